@@ -0,0 +1,18 @@
+; Tight ALU loop: register-only ADD/AND/NOT and a counted branch, no memory traffic in the inner loop.
+; 7 instructions x 5000 x 1000, about 35 million instructions.
+	.ORIG x3000
+	LD R1, OUTER
+OLOOP	LD R2, INNER
+ILOOP	ADD R3, R3, R2
+	AND R4, R3, #15
+	NOT R5, R4
+	ADD R5, R5, R3
+	ADD R0, R0, #1
+	ADD R2, R2, #-1
+	BRp ILOOP
+	ADD R1, R1, #-1
+	BRp OLOOP
+	HALT
+OUTER	.FILL #1000
+INNER	.FILL #5000
+	.END
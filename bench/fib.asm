@@ -0,0 +1,52 @@
+; Deep JSR recursion: naive recursive fib(25) and a 2000-deep linear recursion, 12 times over.
+; Every call pushes R7 and its argument on a stack in memory; about 29 million instructions.
+	.ORIG x3000
+	LD R6, STACK
+MAIN	LD R0, NFIB
+	JSR FIB
+	ST R1, RESULT
+	LD R0, DEPTH
+	JSR DEEP
+	LD R0, ROUNDS
+	ADD R0, R0, #-1
+	ST R0, ROUNDS
+	BRp MAIN
+	HALT
+
+; R1 = fib(R0)
+FIB	ADD R1, R0, #-2
+	BRzp FREC
+	ADD R1, R0, #0
+	RET
+FREC	ADD R6, R6, #-3
+	STR R7, R6, #0
+	STR R0, R6, #1
+	ADD R0, R0, #-1
+	JSR FIB
+	STR R1, R6, #2
+	LDR R0, R6, #1
+	ADD R0, R0, #-2
+	JSR FIB
+	LDR R2, R6, #2
+	ADD R1, R1, R2
+	LDR R7, R6, #0
+	ADD R6, R6, #3
+	RET
+
+; Recurses R0 levels deep
+DEEP	ADD R0, R0, #0
+	BRz DDONE
+	ADD R6, R6, #-1
+	STR R7, R6, #0
+	ADD R0, R0, #-1
+	JSR DEEP
+	LDR R7, R6, #0
+	ADD R6, R6, #1
+DDONE	RET
+
+STACK	.FILL xF000
+NFIB	.FILL #25
+DEPTH	.FILL #2000
+ROUNDS	.FILL #12
+RESULT	.BLKW #1
+	.END
@@ -0,0 +1,19 @@
+; PUTS-heavy output: a 62-character line written with PUTS and OUT 400,000 times.
+; Few instructions (about 2.4 million) but 25 million characters through the console hook.
+	.ORIG x3000
+	LD R2, OUTER
+OLOOP	LD R1, INNER
+LOOP	LEA R0, MSG
+	PUTS
+	LD R0, NEWLINE
+	OUT
+	ADD R1, R1, #-1
+	BRp LOOP
+	ADD R2, R2, #-1
+	BRp OLOOP
+	HALT
+OUTER	.FILL #20
+INNER	.FILL #20000
+NEWLINE	.FILL x000A
+MSG	.STRINGZ "The quick brown fox jumps over the lazy dog, again and again!"
+	.END
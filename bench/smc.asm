@@ -0,0 +1,22 @@
+; Self-modifying code: every iteration rewrites an instruction of its own loop, alternating between two
+; encodings, which makes engines that cache translated code throw it away. About 21 million instructions.
+	.ORIG x3000
+	LD R1, OUTER
+OLOOP	LD R2, INNER
+	LD R4, INSA
+	AND R5, R5, #0
+	ADD R5, R5, #1
+ILOOP	ADD R4, R4, R5
+	NOT R5, R5
+	ADD R5, R5, #1
+	ST R4, PATCH
+PATCH	.FILL x0000
+	ADD R2, R2, #-1
+	BRp ILOOP
+	ADD R1, R1, #-1
+	BRp OLOOP
+	HALT
+OUTER	.FILL #300
+INNER	.FILL #10000
+INSA	ADD R3, R3, #1
+	.END
@@ -0,0 +1,61 @@
+; Memory-heavy sort: fills 1000 words with pseudo-random numbers and insertion sorts them, 15 times over.
+; Mostly LDR/STR in the inner loop, about 23 million instructions.
+	.ORIG x3000
+	LD R1, BASE
+MAIN	JSR FILL
+	JSR SORT
+	LD R0, ROUNDS
+	ADD R0, R0, #-1
+	ST R0, ROUNDS
+	BRp MAIN
+	HALT
+
+; Fill N words at R1 with x = 5x + 13849, masked to 14 bits so differences can't overflow
+FILL	LD R4, SEED
+	LD R6, MASK
+	ADD R3, R1, #0
+	LD R2, N
+FLOOP	ADD R5, R4, R4
+	ADD R5, R5, R5
+	ADD R4, R5, R4
+	LD R5, INC
+	ADD R4, R4, R5
+	AND R5, R4, R6
+	STR R5, R3, #0
+	ADD R3, R3, #1
+	ADD R2, R2, #-1
+	BRp FLOOP
+	ST R4, SEED
+	RET
+
+; Insertion sort of N words at R1; the xFFFF in front of the array stops the inner loop
+SORT	AND R2, R2, #0
+	ADD R2, R2, #1
+SOUTER	LD R6, NNEG
+	ADD R6, R2, R6
+	BRzp SDONE
+	ADD R3, R1, R2
+	LDR R4, R3, #0
+	NOT R0, R4
+	ADD R0, R0, #1
+SINNER	LDR R5, R3, #-1
+	ADD R6, R5, R0
+	BRnz SPLACE
+	STR R5, R3, #0
+	ADD R3, R3, #-1
+	BRnzp SINNER
+SPLACE	STR R4, R3, #0
+	ADD R2, R2, #1
+	BRnzp SOUTER
+SDONE	RET
+
+ROUNDS	.FILL #15
+N	.FILL #1000
+NNEG	.FILL #-1000
+MASK	.FILL x3FFF
+INC	.FILL x3619
+SEED	.FILL #1
+BASE	.FILL ARRAY
+SENTRY	.FILL xFFFF
+ARRAY	.BLKW #1000
+	.END
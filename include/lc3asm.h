@@ -0,0 +1,13 @@
+#ifndef LC3ASM_H
+#define LC3ASM_H
+
+#include <stddef.h>
+#include "lc3sym.h"
+
+#define ASM_OPERANDS 3				// Most operands any instruction or pseudo-op takes
+#define ASM_ERRORS_MAX 20			// Errors printed per source before the rest are only counted
+
+int assemble(const char* source, size_t length, const char* name, unsigned short* mem, lc3_symtab_t* symbols,
+	unsigned short* entry);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef LC3BATCH_H
+#define LC3BATCH_H
+
+#include <time.h>
+#include "lc3sim.h"
+#include "lc3trap.h"
+#include "lc3loop.h"
+
+#define BATCH_SLICE (1 << 20)	// Instructions run between budget/timeout checks
+#define BATCH_BUFFER 65536		// Size of each machine's input and output buffers
+
+// Exit statuses of a batch run
+typedef enum {
+	BATCH_WAITING = -2,		// GETC/IN would block; run another slice once input may have arrived
+	BATCH_RUNNING = -1,		// Slice ended with the program still running
+	BATCH_HALTED = 0,
+	BATCH_NO_INPUT = 2,		// GETC/IN reached the end of the input
+	BATCH_BUDGET = 3,			// Instruction budget used up
+	BATCH_TIMEOUT = 4,		// Wall-clock timeout expired
+	BATCH_STUCK = 5				// Going round a loop that changes nothing, with no event to break in
+} batch_status_t;
+
+typedef struct {
+	unsigned long long max_instructions;	// 0 for no budget
+	double timeout;												// Seconds, 0 for no timeout
+	int dump_state;												// Print the final machine state to stderr
+	const lc3_trap_setting_t* traps;			// Changes to every machine's trap table
+	int ntraps;
+	const char* stats_path;								// Where to write statistics ("-" for stderr), NULL for none
+	int stats_json;
+	const char* coverage_path;						// lcov tracefile to merge coverage into, NULL for none
+	const char* listing_path;							// Where to write the coverage listing, NULL for none
+} batch_options_t;
+
+/*
+ * Console of a headless machine, hung off its io pointer. GETC/IN read in_fd and OUT/PUTS write out_fd, both
+ * through buffers. A non-blocking in_fd makes GETC/IN yield (BATCH_WAITING) instead of blocking the thread; a
+ * blocking one is only waited on until the timeout, if start and timeout are set.
+ */
+typedef struct {
+	int in_fd;				// -1 for no input
+	int out_fd;				// -1 to discard output
+	int eof;
+	int would_block;
+	int timed_out;		// GETC/IN gave up waiting for input at the timeout
+	const struct timespec* start;	// With timeout, how long a blocking in_fd is waited on
+	double timeout;
+	int inpos;
+	int inlen;
+	int outlen;
+	lc3_loop_t loop;	// Where a BATCH_STUCK run is stuck
+	char inbuf[BATCH_BUFFER];
+	char outbuf[BATCH_BUFFER];
+} batch_io_t;
+
+void attach_batch_io(lc3_machine_t* m, batch_io_t* io, int in_fd, int out_fd);
+void flush_batch_io(lc3_machine_t* m);
+void set_batch_limit(lc3_machine_t* m, const batch_options_t* options);
+int batch_status(lc3_machine_t* m, const batch_options_t* options, const struct timespec* start);
+int run_batch_slice(lc3_machine_t* m, const batch_options_t* options, const struct timespec* start);
+double seconds_since(const struct timespec* start);
+int run_batch(lc3_machine_t* m, const batch_options_t* options);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef LC3BENCH_H
+#define LC3BENCH_H
+
+#include "lc3sim.h"
+
+#define BENCH_REPEAT 3	// Runs of each workload per engine by default; the fastest is reported
+
+typedef struct {
+	int repeat;														// Timed runs per workload and engine
+	int engine;														// An engine_t, or -1 for every engine
+	int json;															// One JSON object per line instead of a table
+	unsigned long long max_instructions;	// Per run, 0 for no budget
+} bench_options_t;
+
+// What one workload measured on one engine
+typedef struct {
+	unsigned long long instructions;			// Per run
+	double seconds;												// Fastest run
+	long peak_rss;												// Kilobytes, over the whole measurement
+	int halted;
+} bench_result_t;
+
+int run_bench(char** workloads, int count, const bench_options_t* options);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LC3BLOCK_H
+#define LC3BLOCK_H
+
+#include "lc3pre.h"
+#include "lc3jit.h"
+
+#define BLOCK_MAX 64	// Longest straight-line run translated as one block
+#define BLOCK_FLUSH_LIMIT 4	// Times an address's blocks are retired before it is left to the interpreter
+#define BLOCK_UNCOUNTED 0xFF	// nopcodes of a block whose opcodes haven't been counted yet
+
+/*
+ * A translated basic block: straight-line instructions starting at start,
+ * ending at the first BR/JMP/JSR/JSRR/TRAP/RTI, before a breakpoint, or after BLOCK_MAX words.
+ * A block at an address that keeps being rewritten is a single H_DECODE entry, which execute_instruction() runs.
+ * succ[0] caches the block at the taken/jump target and succ[1] the fall-through block.
+ * ops holds length instructions followed by an H_END entry.
+ */
+typedef struct lc3block_s {
+	unsigned short start;
+	unsigned short length;
+	int valid;
+	unsigned char covered;		// Ways the block has been run whole since the coverage was cleared (see cover_block())
+#ifdef LC3_STATS
+	// The opcodes among its instructions and how many of each, added to the statistics each time it is run whole;
+	// worked out the first time they are needed
+	unsigned char nopcodes;
+	unsigned char opcodes[16];
+	unsigned char opcode_counts[16];
+#endif
+	struct lc3block_s* succ[2];
+	struct lc3block_s* next;	// Link in the retired list
+	lc3pre_t ops[];
+} lc3block_t;
+
+/*
+ * One machine's block cache.
+ * Retired blocks are kept (but never entered again) until the next clear_blocks(), so chain pointers never dangle.
+ */
+typedef struct lc3blocks_s {
+	lc3block_t* map[65536];						// Live block starting at each address
+	unsigned char coverage[65536];		// Number of live blocks covering each address
+	unsigned char flushes[65536];			// Times stores retired the blocks covering each address
+	lc3block_t* retired;
+	int retired_count;
+} lc3blocks_t;
+
+void flush_blocks(lc3_machine_t* m, unsigned short address);
+int update_blocks(lc3_machine_t* m, unsigned short address);
+void clear_blocks(lc3_machine_t* m);
+void free_blocks(lc3_machine_t* m);
+void run_blocks(lc3_machine_t* m);
+void uncover_blocks(lc3_machine_t* m);
+
+/**
+ * @name 	Invalidate Code
+ * @brief Drops every cached decoding of an address after a write to mem[]
+ * @param [lc3_machine_t*] m The machine that was written
+ * @param [unsigned short] address The address that was written
+ */
+static inline void invalidate_code(lc3_machine_t* m, unsigned short address)
+{
+	invalidate_predecoded(m, address);
+	update_blocks(m, address);
+	if (m->jit && m->jit->coverage[address])
+		jit_flush(m, address);
+}
+
+/**
+ * @name 	Invalidate All Code
+ * @brief Drops every cached decoding, e.g. after a new program image is loaded
+ * @param [lc3_machine_t*] m The machine whose image changed
+ */
+static inline void invalidate_all_code(lc3_machine_t* m)
+{
+	invalidate_all_predecoded(m);
+	clear_blocks(m);
+	jit_clear(m);
+}
+
+#endif
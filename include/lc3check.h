@@ -0,0 +1,28 @@
+#ifndef LC3CHECK_H
+#define LC3CHECK_H
+
+#include "lc3sim.h"
+
+#define CHECK_BUDGET 10000000		// Instructions compared per program and engine by default
+#define CHECK_STEP 32						// Most instructions the engine under test runs between comparisons
+#define CHECK_TRAIL 8						// Instructions shown leading up to a divergence
+#define CHECK_SHOWN 8						// Differing words of memory shown
+#define FUZZ_COUNT 1000					// Programs --fuzz generates by default
+#define FUZZ_LENGTH 160					// Words of random code in a generated program
+#define FUZZ_DATA 64						// Words of data it loads and stores through R6, which points at the middle
+#define FUZZ_POINTERS 8					// Pointers into the data for LDI/STI
+#define FUZZ_SAFE 8							// Harmless instructions it copies over its own code
+#define FUZZ_BUDGET 100000			// Instructions compared per generated program by default
+#define FUZZ_INTERVAL 200			// Longest timer interval set by a generated program that takes interrupts
+
+typedef struct {
+	int engine;														// An engine_t to compare with the switch engine, or -1 for every other
+	unsigned long long max_instructions;	// Per program and engine, 0 for the default
+	unsigned long long seed;							// Of the first generated program; the others count up from it
+	int count;														// Programs to generate
+} check_options_t;
+
+int run_check(char** programs, int count, const check_options_t* options);
+int run_fuzz(const check_options_t* options);
+
+#endif
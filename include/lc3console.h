@@ -0,0 +1,41 @@
+#ifndef LC3CONSOLE_H
+#define LC3CONSOLE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "lc3sim.h"
+
+#define CONSOLE_INITIAL 4096					// Bytes the scrollback starts out with
+#define CONSOLE_SCROLLBACK (1 << 22)	// Characters kept by default; older ones are dropped
+#define CONSOLE_TEE_BUFFER 65536			// Output collected before it is written to the tee
+
+/*
+ * What a program has printed. The scrollback is a ring holding the last `length` characters; it grows by
+ * doubling until it reaches `limit`, after which the oldest characters make room for new ones. Everything printed
+ * can also be streamed (teed) to a file, FIFO or command, in buffered writes.
+ */
+typedef struct lc3_console_s {
+	char* text;
+	size_t size;							// Bytes allocated for text
+	size_t limit;							// Most characters kept
+	size_t length;						// Characters held
+	size_t head;							// Where the next character goes
+	unsigned long long total;	// Characters ever printed
+
+	int tee_fd;								// -1 when not teeing
+	FILE* tee_pipe;						// The command's stdin when teeing to "|command"
+	size_t tee_length;
+	char tee_buffer[CONSOLE_TEE_BUFFER];
+} lc3_console_t;
+
+lc3_console_t* create_console(size_t limit);
+void destroy_console(lc3_console_t* console);
+void clear_console(lc3_console_t* console);
+void console_append(lc3_console_t* console, const char* text, size_t length);
+char console_char(const lc3_console_t* console, size_t index);
+int tee_console(lc3_console_t* console, const char* path);
+void flush_console(lc3_console_t* console);
+void console_write_char(lc3_machine_t* m, char c);
+void console_write_string(lc3_machine_t* m, const char* text, int length);
+
+#endif
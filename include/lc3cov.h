@@ -0,0 +1,56 @@
+#ifndef LC3COV_H
+#define LC3COV_H
+
+#include <stdio.h>
+#include "lc3sim.h"
+#include "lc3image.h"
+
+#define COVERAGE_BYTES (65536/8)	// One bit per address
+
+/*
+ * Which instructions of a program ran, and which way its conditional BRs went: a bit per address in each map,
+ * the BR maps only meaningful at a BR. Bits are only ever set, so coverage from any number of runs merges by OR,
+ * whichever thread or process they ran in.
+ */
+typedef struct lc3_coverage_s {
+	unsigned char executed[COVERAGE_BYTES];
+	unsigned char taken[COVERAGE_BYTES];
+	unsigned char not_taken[COVERAGE_BYTES];
+} lc3_coverage_t;
+
+void start_coverage(lc3_machine_t* m);
+void stop_coverage(lc3_machine_t* m);
+void clear_coverage(lc3_machine_t* m);
+void add_coverage(lc3_coverage_t* total, const lc3_coverage_t* coverage);
+void write_coverage(const lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, FILE* out);
+void write_listing(const lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, FILE* out);
+int save_coverage(lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, const char* path);
+int save_listing(const lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, const char* path,
+	int append);
+
+#define COVERAGE_BIT(address) (1 << ((address) & 7))
+
+static inline void cover_address(lc3_coverage_t* coverage, unsigned short address)
+{
+	coverage->executed[address >> 3] |= COVERAGE_BIT(address);
+}
+
+// Records which way a conditional BR went
+static inline void cover_branch(lc3_coverage_t* coverage, unsigned short address, int taken)
+{
+	if (taken)
+		coverage->taken[address >> 3] |= COVERAGE_BIT(address);
+	else
+		coverage->not_taken[address >> 3] |= COVERAGE_BIT(address);
+}
+
+// Called by execute_instruction() after each instruction while measuring coverage
+static inline void cover_instruction(lc3_machine_t* m, unsigned short address, lc3inst_t* instruction)
+{
+	cover_address(m->coverage, address);
+	// BR leaves the CC alone, so the condition can be tested again afterwards
+	if (instruction->opcode == BR && instruction->nzpbits && instruction->nzpbits != 7)
+		cover_branch(m->coverage, address, comparenzp(m, instruction->nzpbits));
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef LC3DEBUG_H
+#define LC3DEBUG_H
+
+#include "lc3sim.h"
+
+int parse_condition(const char* text, const lc3_symtab_t* symbols, lc3_condition_t* condition);
+int condition_holds(lc3_machine_t* m, const lc3_condition_t* condition);
+void set_conditional_breakpoint(lc3_machine_t* m, unsigned short address, const lc3_condition_t* condition,
+	unsigned long long ignore);
+lc3_breakpoint_t* get_breakpoint(lc3_machine_t* m, unsigned short address);
+int pass_breakpoint(lc3_machine_t* m);
+void set_watchpoint(lc3_machine_t* m, unsigned short start, unsigned short end, int access);
+void unset_watchpoint(lc3_machine_t* m, unsigned short start, unsigned short end);
+int watchpoint_at(lc3_machine_t* m, unsigned short address);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef LC3DEVICE_H
+#define LC3DEVICE_H
+
+#include "lc3sim.h"
+
+#define DEVICE_READY 0x8000		// Ready bit of KBSR and DSR, clock enable bit of MCR
+#define DEVICE_IE 0x4000			// Interrupt enable bit of KBSR and TSR
+#define DEVICE_SPIN_GAP 16		// An empty KBSR read this soon after the last one, by the same instruction, is a spin
+#define KEYBOARD_VECTOR 0x80
+#define KEYBOARD_PRIORITY 4
+#define KEYBOARD_POLL (1 << 16)	// Instructions between checks for a key while keyboard interrupts are enabled
+#define TIMER_VECTOR 0x81
+#define TIMER_PRIORITY 6
+
+void write_word(lc3_machine_t* m, unsigned short address, unsigned short value);
+void reset_devices(lc3_machine_t* m);
+int device_interrupt(lc3_machine_t* m, unsigned char* vector);
+void timer_event(lc3_machine_t* m, unsigned long long time);
+void keyboard_event(lc3_machine_t* m, unsigned long long time);
+int device_read(lc3_machine_t* m, unsigned short address, unsigned short* value);
+void device_write(lc3_machine_t* m, unsigned short address, unsigned short value);
+
+#endif
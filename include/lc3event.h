@@ -0,0 +1,21 @@
+#ifndef LC3EVENT_H
+#define LC3EVENT_H
+
+#include "lc3sim.h"
+
+#define IVT_BASE 0x0100				// The service routine for vector v starts at the address in mem[IVT_BASE + v]
+#define PSR_USER 0x8000				// PSR bit 15: running in user mode
+#define PSR_PRIORITY 0x0700		// PSR bits 10-8: priority level
+#define PSR_PRIORITY_SHFT 8
+#define PRIVILEGE_VECTOR 0x00	// Exception taken by RTI in user mode
+#define SUPERVISOR_STACK 0x3000	// Saved_SSP at power-on; the supervisor stack grows down from x2FFF
+
+void clear_events(lc3_machine_t* m);
+void schedule_event(lc3_machine_t* m, event_kind_t kind, unsigned long long time);
+void cancel_event(lc3_machine_t* m, event_kind_t kind);
+unsigned short read_psr(lc3_machine_t* m);
+void run_events(lc3_machine_t* m);
+void check_interrupts(lc3_machine_t* m);
+void return_from_interrupt(lc3_machine_t* m);
+
+#endif
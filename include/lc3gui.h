@@ -2,13 +2,37 @@
 #define LC3GUI_H
 
 #include <ncurses.h>
+#include "lc3sim.h"
+#include "lc3loop.h"
 
 #define NUM_WINDOWS 4
 #define REGWIN_WIDTH 25
 #define REGWIN_HEIGHT 14
 #define DEBUGWIN_HEIGHT 6
-#define CONSOLE_SIZE (LINES-DEBUGWIN_HEIGHT-REGWIN_HEIGHT-3)*(REGWIN_WIDTH-2)
+#define CONSOLE_ROWS (LINES-DEBUGWIN_HEIGHT-REGWIN_HEIGHT-2)
+#define CONSOLE_COLS (REGWIN_WIDTH-2)
 #define WINDOW_PADDING 2
+#define MEMROW_MAX 160		// Formatted text of one memory row, marker excluded
+#define SHOWN_MAX 512			// Widest line the other windows keep a copy of
+#define FRAME_RATE 30			// Redraws per second while a run (F6) is in progress
+#define RUN_SLICE_SECONDS 0.002		// Time a slice of a run aims to take; the keyboard is checked after each
+#define RUN_SLICE_MIN 1024
+#define RUN_SLICE_MAX (1 << 24)
+
+// Formatted text of one address, good for as long as the word there stays the same
+typedef struct {
+	char valid;
+	unsigned short value;
+	char text[MEMROW_MAX];
+} memrow_t;
+
+// What one row of the memory window shows, so rows that haven't changed aren't drawn again
+typedef struct {
+	int addr;					// -1 until drawn
+	unsigned short value;
+	char marker;
+	int highlight;
+} memline_t;
 
 #define MEMWIN windows[0]
 #define REGWIN windows[1]
@@ -22,24 +46,54 @@ static unsigned short mem_cursor;
 static int memwin_state;
 static int dbgwin_state;
 static int cnswin_state;
-static int key_wait;
+static int key_wait;			// GETC/IN found no key during a run
+static int running_live;	// A run started by F6 is in progress
+static int stuck;					// That run stopped in stuck_loop, which changes nothing; shown until the next key
+static lc3_loop_t stuck_loop;
+static unsigned long long run_slice = 65536;	// Instructions per slice, tuned to RUN_SLICE_SECONDS
+static lc3_machine_t* machine;	// The machine being debugged
+static const char* profile_path;	// --profile, written on F9 and at exit
+static const char* folded_path;		// --folded
+static const char* stats_path;		// --stats, written on STATS_SIGNAL and at exit
+static int stats_json;
+static const char* coverage_path;		// --coverage, merged into at exit (or the end of a batch run)
+static const char* listing_path;		// --listing, written at exit
+static const char* program_path;		// The program being debugged, which names its coverage
+static memrow_t* memrows;					// One per address
+static memline_t* memlines;				// One per row of the memory window
+static char regwin_lines[REGWIN_HEIGHT][SHOWN_MAX];		// What each line shows, see draw_line()
+static char dbgwin_lines[DEBUGWIN_HEIGHT][SHOWN_MAX];
+static char* cnswin_lines;					// CONSOLE_ROWS lines of SHOWN_MAX bytes
+static int cns_scroll;						// Lines the console is scrolled back from the end
+static int cns_title_scroll;			// Scroll shown in the console's title, -1 if not drawn yet
+static size_t scrollback;					// --scrollback, 0 for the default
+static const char* tee_path;			// --tee
 
-void build_symbol_table(const char* filename);
+void build_symbol_table(lc3_machine_t* m, const char* filename, int required);
+int save_coverage_files();
 //char* getsym(unsigned short addr);
 
 WINDOW* create_win(int height, int width, int starty, int startx);
 void destroy_win(WINDOW* local_win);
 void initialize();
 void refreshall();
+void invalidate_windows();
+void draw_line(WINDOW* win, int y, int x, int width, const char* text, char* shown);
 
 void update_memwin();
+const char* memrow_text(unsigned short addr, unsigned short value);
+char marker(unsigned short addr);
 void update_regwin();
 void update_dbgwin();
 void update_cnswin();
 
-void wait_for_key(int print);
+int wait_for_key(lc3_machine_t* m, int print);
+int key_typed(lc3_machine_t* m);
+int run_live();
+int run_live_slice();
+void serve_stats_signal();
 
 void hex_to_binstr(short hex, char* buffer);
-void dbggetstrw(int y, int x, const char* prompt, char* buffer);
+void dbggetstrw(int y, int x, const char* prompt, char* buffer, int size);
 
 #endif
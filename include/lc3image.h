@@ -0,0 +1,32 @@
+#ifndef LC3IMAGE_H
+#define LC3IMAGE_H
+
+#include <stdio.h>
+#include "lc3sym.h"
+
+#define IMAGE_BYTES (65536*sizeof(unsigned short))
+
+/*
+ * A loaded program, shared read-only by every machine running it. Machines map the memory copy-on-write (see
+ * map_image()), so each one only pays for the pages it writes to.
+ */
+typedef struct lc3_image_s {
+	int refs;									// Machines using the image, plus whoever loaded it
+	int fd;										// Backing file the machines map
+	const unsigned short* mem;	// Memory as loaded
+	unsigned short entry;			// Where machines start; the first segment of the last program loaded
+	lc3_symtab_t symbols;
+} lc3_image_t;
+
+lc3_image_t* load_images(FILE** programs, int count);
+lc3_image_t* load_image(FILE* program);
+lc3_image_t* open_images(char** paths, int count);
+int is_source(const char* path);
+int load_image_symbols(lc3_image_t* image, const char* path);
+void hold_image(lc3_image_t* image);
+void release_image(lc3_image_t* image);
+unsigned short* map_image(const lc3_image_t* image, unsigned short* at);
+void unmap_image(unsigned short* mem);
+void discard_private_pages(unsigned short* mem, unsigned int address, unsigned int words);
+
+#endif
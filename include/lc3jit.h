@@ -0,0 +1,42 @@
+#ifndef LC3JIT_H
+#define LC3JIT_H
+
+#include <stddef.h>
+#include "lc3sim.h"
+
+#define JIT_MAX 64				// Longest straight-line run compiled as one native block
+#define JIT_THRESHOLD 32		// Executions of an address before it is compiled
+#define JIT_FUEL (1 << 24)	// Instructions a native call may retire before returning
+#define JIT_FLUSH_LIMIT 4		// Flushes of an address after which it is left to the interpreter
+
+/*
+ * State shared with generated code (passed in rdx). Generated code addresses these fields by fixed offset,
+ * see the JITCTX_* offsets in lc3jit.c.
+ */
+typedef struct {
+	short result;						// Last value written to a register; its sign is the condition code
+	unsigned short next;		// Address of the next instruction when native code returns
+	int fuel;								// Instructions left before native code must return
+	unsigned short smc;			// Address of a store that hit translated code
+	unsigned char smc_hit;	// Set when smc is valid
+	unsigned char device;		// Set when native code stopped in front of a device register access at next
+} jitctx_t;
+
+/*
+ * One machine's native code cache. Generated code is position dependent, so each machine has its own arena.
+ */
+typedef struct lc3jit_s {
+	struct jitblock_s* map[65536];		// Native block starting at each address
+	unsigned char heat[65536];				// Times each address was reached before it was compiled
+	unsigned char coverage[65536];		// Number of native blocks covering each address
+	unsigned char flushes[65536];			// Times native code covering each address was thrown away
+	unsigned char* arena;
+	size_t arena_used;
+} lc3jit_t;
+
+void jit_flush(lc3_machine_t* m, unsigned short address);
+void jit_clear(lc3_machine_t* m);
+void jit_free(lc3_machine_t* m);
+void run_jit(lc3_machine_t* m);
+
+#endif
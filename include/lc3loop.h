@@ -0,0 +1,19 @@
+#ifndef LC3LOOP_H
+#define LC3LOOP_H
+
+#include "lc3sim.h"
+
+#define LOOP_PROBE 1024				// Instructions find_loop() follows a run for, so the longest loop it can see
+#define LOOP_SETTLE 1024			// Instructions a batch run gets past an event before looking for the loop again
+
+// A stretch of code going round and round without changing anything
+typedef struct {
+	unsigned short start;			// Lowest and highest address of an instruction in it
+	unsigned short end;
+	unsigned int period;			// Instructions per trip round it
+} lc3_loop_t;
+
+int find_loop(lc3_machine_t* m, unsigned long long limit, lc3_loop_t* loop);
+void skip_loop(lc3_machine_t* m, const lc3_loop_t* loop, unsigned long long target);
+
+#endif
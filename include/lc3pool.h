@@ -0,0 +1,68 @@
+#ifndef LC3POOL_H
+#define LC3POOL_H
+
+#include <pthread.h>
+#include "lc3sim.h"
+#include "lc3batch.h"
+#include "lc3simd.h"
+
+#define POOL_MAX_THREADS 256
+#define POOL_PATH_MAX 1024
+#define POOL_MAX_IMAGES 16	// Object files one job may load
+
+// One (program, input, output) line of a job file and, once it has run, its result
+typedef struct {
+	char program[POOL_PATH_MAX];	// Object files to load, separated by commas
+	char input[POOL_PATH_MAX];		// "-" for no input
+	char output[POOL_PATH_MAX];		// "-" to discard output
+	int program_id;								// Index into the pool's distinct programs
+
+	lc3_machine_t* machine;				// NULL until the job first runs, and again once it has finished
+	batch_io_t* io;
+	struct timespec start;
+	int finished;
+	int status;										// A batch_status_t, or 1 if a file couldn't be opened
+	unsigned long long executions;
+	double seconds;
+	lc3_loop_t loop;							// Where it got stuck, if it did
+#ifdef LC3_STATS
+	unsigned long long counted;		// Instructions its statistics counted
+	double run_seconds;						// Wall time it spent running, without the waits for a worker or input
+#endif
+} pool_job_t;
+
+// A program some jobs run, and its image while any of them hasn't finished
+typedef struct {
+	const char* path;
+	lc3_image_t* image;						// NULL until one of its jobs first starts; kept to the end for coverage
+	int pending;									// Its jobs not finished yet
+	struct lc3_coverage_s* coverage;	// Every finished job's coverage merged, under lock; NULL unless measured
+} pool_program_t;
+
+/*
+ * The unit of work the workers pass around: a single job, or with --lockstep up to SIMD_LANES consecutive jobs
+ * running the same program, which start out in lockstep.
+ */
+typedef struct {
+	int first;										// Index of the first job
+	int count;
+	int started;
+	lc3_lockstep_t* lockstep;			// Non-NULL while some of the jobs are still in lockstep
+	int lane_job[SIMD_LANES];			// Job index of each lockstep lane
+} pool_group_t;
+
+/*
+ * A worker's double-ended queue of group indices. The owner pushes and pops at the bottom; idle workers steal from
+ * the top, and jobs waiting for input are put back at the top so everything runnable goes first.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	int* slots;
+	int capacity;
+	int top;
+	int bottom;
+} pool_deque_t;
+
+int run_pool(const char* jobfile, int threads, engine_t engine, int lockstep, const batch_options_t* options);
+
+#endif
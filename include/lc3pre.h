@@ -0,0 +1,67 @@
+#ifndef LC3PRE_H
+#define LC3PRE_H
+
+#include "lc3sim.h"
+
+/*
+ * Handler indices for the predecoded engine. Each opcode gets its own
+ * handler, with separate variants where the opcode has two encodings
+ * (register/immediate ADD and AND, JSR/JSRR) or a common special case.
+ */
+typedef enum {
+	H_DECODE,	// Entry is stale, decode mem[] and dispatch again
+	H_NOP,		// BR with no condition bits, reserved opcode
+	H_BR,
+	H_BRA,		// BRnzp
+	H_ADDR,
+	H_ADDI,
+	H_LD,
+	H_ST,
+	H_JSR,
+	H_JSRR,
+	H_ANDR,
+	H_ANDI,
+	H_LDR,
+	H_STR,
+	H_NOT,
+	H_LDI,
+	H_STI,
+	H_JMP,
+	H_LEA,
+	H_RTI,
+	H_TRAP,
+	H_END,		// Falls off the end of a translated block (lc3block.c only)
+	H_COUNT
+} handler_t;
+
+/*
+ * One predecoded instruction. Only the fields the handler needs are filled:
+ * a/b/c hold register numbers (or the NZP bits for BR), and imm holds either
+ * a sign-extended immediate/offset6, an absolute PC-relative target, or a trap vector.
+ */
+typedef struct lc3pre_s {
+	unsigned char handler;
+	unsigned char a;
+	unsigned char b;
+	unsigned char c;
+	unsigned short imm;
+} lc3pre_t;
+
+void predecode(lc3pre_t* entry, unsigned short address, unsigned short word);
+void invalidate_all_predecoded(lc3_machine_t* m);
+void free_predecoded(lc3_machine_t* m);
+void run_predecoded(lc3_machine_t* m);
+
+/**
+ * @name 	Invalidate Predecoded
+ * @brief Marks the predecoded entry for an address as stale after a write to mem[]
+ * @param [lc3_machine_t*] m The machine that was written
+ * @param [unsigned short] address The address that was written
+ */
+static inline void invalidate_predecoded(lc3_machine_t* m, unsigned short address)
+{
+	if (m->predecoded)
+		m->predecoded[address].handler = H_DECODE;
+}
+
+#endif
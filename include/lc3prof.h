@@ -0,0 +1,57 @@
+#ifndef LC3PROF_H
+#define LC3PROF_H
+
+#include <stdio.h>
+#include "lc3sim.h"
+
+#define PROFILE_DEFAULT_PATH "simplx.prof"	// Where the debugger writes a profile nobody named
+#define PROFILE_MAX_DEPTH 4096	// Calls tracked on the profiler's stack; deeper ones are counted but not attributed
+
+// A subroutine as reached through one particular chain of calls (a node of the calling-context tree)
+typedef struct {
+	unsigned short entry;				// Address the subroutine was entered at
+	int parent;									// Node of the caller, -1 for the root
+	int child;									// First callee, -1 if none
+	int sibling;								// Next callee of the same caller, -1 if none
+	unsigned long long calls;
+	unsigned long long self;		// Instructions run with this as the innermost call
+} lc3_prof_node_t;
+
+typedef struct {
+	int node;
+	unsigned short return_address;
+} lc3_prof_frame_t;
+
+/*
+ * What the profiler has counted on one machine. Instructions are counted per address as they execute; subroutine
+ * time is only settled when a JSR/JSRR/TRAP enters or a RET leaves a subroutine, by charging the instructions
+ * run since the last call or return to the innermost call.
+ */
+typedef struct lc3_profile_s {
+	unsigned long long counts[65536];
+	lc3_prof_node_t* nodes;			// Node 0 is the root: wherever execution was when profiling began
+	int nnodes;
+	int nodes_size;
+	lc3_prof_frame_t stack[PROFILE_MAX_DEPTH];
+	int depth;									// Frames on stack, the root's included
+	int lost;										// Calls made past PROFILE_MAX_DEPTH and not yet returned from
+	unsigned long long mark;		// executions when the innermost call was last charged
+} lc3_profile_t;
+
+void start_profile(lc3_machine_t* m);
+void stop_profile(lc3_machine_t* m);
+void clear_profile(lc3_machine_t* m);
+void profile_control(lc3_machine_t* m, unsigned short address, lc3inst_t* instruction);
+void write_profile(lc3_machine_t* m, FILE* out);
+void write_folded_stacks(lc3_machine_t* m, FILE* out);
+int save_profile(lc3_machine_t* m, const char* path, const char* folded_path);
+
+// Called by execute_instruction() after each instruction while profiling; only calls and returns leave this inline
+static inline void profile_instruction(lc3_machine_t* m, unsigned short address, lc3inst_t* instruction)
+{
+	m->profile->counts[address]++;
+	if (instruction->opcode == JSR || instruction->opcode == JMP || instruction->opcode == TRAP)
+		profile_control(m, address, instruction);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LC3RECORD_H
+#define LC3RECORD_H
+
+#include "lc3sim.h"
+
+#define RECORD_CAPACITY (1 << 21)		// Instructions the undo log holds by default; a power of two
+#define RECORD_CHECKPOINTS 64				// Full snapshots kept; when full every other one is dropped
+#define RECORD_INTERVAL (1 << 16)		// Instructions between snapshots until the first time they fill up
+
+// What an instruction overwrote, so it can be undone
+#define UNDO_REGISTER 1		// regfile[where] was old
+#define UNDO_MEMORY 2			// mem[where] was old
+#define UNDO_R1 4					// R1 was old_r1 too (UDIV)
+#define UNDO_INPUT 8			// Consumed an entry of the input log
+#define UNDO_DEVICE 16		// KBDR was old_r1, and KBSR had its ready bit if UNDO_KEY_READY is set too
+#define UNDO_KEY_READY 32
+
+#define NO_KEY (-1)				// Logged when a read of KBSR found no key to be had
+
+typedef struct {
+	unsigned short pc;			// PC before the instruction (already past it, as after a fetch)
+	unsigned short where;
+	unsigned short old;
+	unsigned short old_r1;
+	signed char cc;
+	unsigned char what;
+} lc3_undo_t;
+
+typedef struct {
+	unsigned long long executions;
+	unsigned short regfile[8];
+	unsigned short pc;
+	short cc;
+	int halted;
+	int input_pos;
+	lc3_event_t events[EVENT_MAX];
+	int nevents;
+	unsigned short saved_ssp;
+	unsigned short saved_usp;
+	unsigned short* mem;		// All 65536 words
+} lc3_checkpoint_t;
+
+/*
+ * History of one machine. Every instruction leaves an undo record in a ring indexed by instruction number, so the
+ * last `capacity` instructions can be taken back one at a time. Further back, the machine is restored from the
+ * closest snapshot and run forward again; keys read by GETC/IN are logged and fed back on the way, so it ends up
+ * exactly where it was.
+ */
+typedef struct lc3_recorder_s {
+	lc3_undo_t* undo;
+	unsigned int capacity;
+	unsigned long long undo_start;	// Oldest instruction the ring has a record for, if within capacity of undo_end
+	unsigned long long undo_end;		// One past the newest instruction recorded
+
+	lc3_checkpoint_t checkpoints[RECORD_CHECKPOINTS];
+	int ncheckpoints;
+	unsigned long long interval;
+	unsigned long long next_checkpoint;
+
+	int* input;											// Every key GETC/IN and KBSR have read, and NO_KEY for every time
+																	// KBSR had none, in order
+	int input_length;
+	int input_size;
+	int input_pos;									// Next key to hand out; keys past it are replayed before asking for more
+	int (*read_key)(lc3_machine_t* m, int print);	// The frontend's own read_key and key_ready
+	int (*key_ready)(lc3_machine_t* m);
+} lc3_recorder_t;
+
+void start_recording(lc3_machine_t* m, unsigned int capacity);
+void stop_recording(lc3_machine_t* m);
+void clear_recording(lc3_machine_t* m);
+void record_instruction(lc3_machine_t* m, lc3inst_t* instruction);
+void record_barrier(lc3_machine_t* m, unsigned long long executions);
+void record_device(lc3_machine_t* m);
+unsigned long long earliest_recorded(lc3_machine_t* m);
+int rewind_to(lc3_machine_t* m, unsigned long long executions);
+int step_backward(lc3_machine_t* m);
+int run_backward(lc3_machine_t* m);
+
+#endif
@@ -2,6 +2,7 @@
 #define LC3SIM_H
 
 #include <stdio.h>
+#include "lc3image.h"
 
 #define OPCODE_MASK 0xF000
 #define NZP_MASK 0x0E00
@@ -29,11 +30,32 @@
 #define JSRR_SHFT 11
 #define IMMF_SHFT 5
 
-#define KBSR mem[0xFE00]
-#define KBDR mem[0xFE02]
-#define DSR mem[0xFE04]
-#define DDR mem[0xFE06]
-#define MCR mem[0xFFFE]
+#define DEVICE_BASE 0xFE00		// Loads and stores from here up go to the device registers (see lc3device.c)
+#define KBSR_ADDRESS 0xFE00
+#define KBDR_ADDRESS 0xFE02
+#define DSR_ADDRESS 0xFE04
+#define DDR_ADDRESS 0xFE06
+#define TSR_ADDRESS 0xFE08
+#define TIR_ADDRESS 0xFE0A
+#define PSR_ADDRESS 0xFFFC
+#define MCR_ADDRESS 0xFFFE
+
+#define KBSR(m) ((m)->mem[KBSR_ADDRESS])
+#define KBDR(m) ((m)->mem[KBDR_ADDRESS])
+#define DSR(m) ((m)->mem[DSR_ADDRESS])
+#define DDR(m) ((m)->mem[DDR_ADDRESS])
+#define TSR(m) ((m)->mem[TSR_ADDRESS])
+#define TIR(m) ((m)->mem[TIR_ADDRESS])
+#define PSR(m) ((m)->mem[PSR_ADDRESS])		// Privilege and priority; the NZP bits are kept in cc instead
+#define MCR(m) ((m)->mem[MCR_ADDRESS])
+
+#define EVENT_MAX 8			// Events that can be scheduled at once; there is at most one of each kind
+
+#define DISASM_TARGET_MAX 48	// Longest operand label disassemble_to_str() writes, including the terminator
+#define DISASM_MAX 64					// Buffer size disassemble_to_str() needs
+
+#define DIRTY_SHIFT 7									// Words per dirty page: 1 << DIRTY_SHIFT
+#define DIRTY_PAGES (65536 >> DIRTY_SHIFT)
 
 typedef enum {BR, ADD, LD, ST, JSR, AND, LDR, STR, RTI, NOT, LDI, STI, JMP, LOLFENDERCODE, LEA, TRAP} opcode_t;
 
@@ -52,43 +74,219 @@ typedef struct {
 	char imm5_flag;
 } lc3inst_t;
 
-unsigned short regfile[8];
-unsigned short pc;
-unsigned short ir;
-short cc;
-unsigned short mem[65536];
-unsigned char brk[65536];
-unsigned char* syms[65536];
-unsigned char* console;
-unsigned int executions;
-int cns_index;
-int cns_length;
-int cns_max;
-
-int running;
-int halted;
-int first;
-short next;
-lc3inst_t next_inst;
-
-int enable_udiv;
-
-short get_instruction();
+// Things the machine does between instructions once executions reaches their time (see lc3event.c)
+typedef enum {EVENT_INTERRUPT, EVENT_TIMER, EVENT_KEYBOARD} event_kind_t;
+
+typedef struct {
+	unsigned long long time;
+	event_kind_t kind;
+} lc3_event_t;
+
+struct lc3_machine_s;
+
+// What a native service routine changes besides the console, for the recorder to undo (see lc3trap.c)
+#define TRAP_WRITES_R0 1
+#define TRAP_WRITES_R1 2
+#define TRAP_READS_KEY 4
+#define TRAP_WRITES_OTHER 8		// Memory or any other register: more than an undo record holds
+
+#define TRAP_VECTORS 256
+
+// A TRAP vector the simulator serves itself. The routine returns 1 if it has to wait for input, having done
+// nothing, and 0 once done.
+typedef struct {
+	int (*routine)(struct lc3_machine_s* m);
+	int effects;
+} lc3_trap_t;
+
+typedef enum {ENGINE_SWITCH, ENGINE_PREDECODE, ENGINE_BLOCK, ENGINE_JIT} engine_t;
+
+typedef enum {COND_NONE, COND_REGISTER, COND_MEMORY, COND_CC} cond_kind_t;
+typedef enum {COND_EQ, COND_NE, COND_LT, COND_LE, COND_GT, COND_GE} cond_op_t;
+
+// A test such as R2 == x0010, M[x4000] != #0 or CC < 0; see parse_condition()
+typedef struct {
+	cond_kind_t kind;
+	cond_op_t op;
+	unsigned short operand;		// Register number, or memory address
+	short value;							// Compared signed, like the LC-3's own arithmetic
+} lc3_condition_t;
+
+typedef struct {
+	unsigned short address;
+	unsigned char state;	// 1, or 2 once a run has stopped on it (the next run steps past it first)
+	lc3_condition_t condition;
+	unsigned long long hits;		// Times reached with the condition true
+	unsigned long long ignore;	// Hits to run past before stopping
+} lc3_breakpoint_t;
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+
+// Stops a run after any LD/LDR/LDI (WATCH_READ) or ST/STR/STI (WATCH_WRITE) touching start..end
+typedef struct {
+	unsigned short start;
+	unsigned short end;
+	int access;
+	unsigned long long hits;
+} lc3_watchpoint_t;
+
+struct lc3pre_s;
+struct lc3blocks_s;
+struct lc3jit_s;
+struct lc3_profile_s;
+struct lc3_recorder_s;
+struct lc3_stats_s;
+struct lc3_coverage_s;
+
+/*
+ * Everything one simulated LC-3 needs. Nothing in the simulator is global, so any number of machines can run
+ * side by side, one per thread.
+ */
+typedef struct lc3_machine_s {
+	unsigned short regfile[8];
+	unsigned short pc;
+	unsigned short ir;
+	short cc;
+	unsigned short* mem;		// 65536 words, a copy-on-write mapping of image (see lc3image.c)
+	unsigned long long executions;
+	unsigned long long execution_limit;	// Engines stop once executions reaches this (0 for no limit)
+
+	// Program loaded by read_program(), and the pages written since; reset_program() restores just those
+	lc3_image_t* image;
+	unsigned char dirty[DIRTY_PAGES];
+
+	// Breakpoints are few, so they're kept in a short list; brk_filter has bit (address & 63) set for each
+	lc3_breakpoint_t* breakpoints;
+	int nbreakpoints;
+	// Armed watchpoints make runs use the switch engine, whose loads and stores check them
+	lc3_watchpoint_t* watchpoints;
+	int nwatchpoints;
+	int watch_hit;									// Watchpoint (index + 1) that stopped the last run, 0 if none
+	unsigned short watch_address;
+	unsigned long long brk_filter;
+	// Set while profiling (see lc3prof.c), which also hands predecode and JIT runs to the block engine
+	struct lc3_profile_s* profile;
+	// Set while recording history (see lc3record.c); recording is 1 while undo records are being written, which
+	// also makes runs use the switch engine
+	struct lc3_recorder_s* recorder;
+	int recording;
+#ifdef LC3_STATS
+	// Set while keeping statistics (see lc3stats.c); runs that would use the predecode or JIT engine use the block
+	// engine instead, as for coverage
+	struct lc3_stats_s* stats;
+#endif
+	// Set while measuring coverage (see lc3cov.c); runs that would use the predecode or JIT engine use the block
+	// engine instead, which keeps it along with the switch engine
+	struct lc3_coverage_s* coverage;
+
+	int running;
+	int halted;
+	lc3inst_t next_inst;
+
+	engine_t engine;
+	// Native service routines by vector; a vector without one (routine NULL) goes to the guest's at mem[vector]
+	lc3_trap_t traps[TRAP_VECTORS];
+
+	// Console I/O used by the GETC/OUT/PUTS/IN traps and the device registers; the frontend points these at its
+	// own routines. read_key returns 0 if no key can be had without blocking, in which case the trap is retried on
+	// the next run. key_ready says whether read_key has a key for the taking right now, without consuming it.
+	// write_string takes all of a PUTS string at once; by default it hands it to write_char a character at a time.
+	int (*read_key)(struct lc3_machine_s* m, int print);
+	int (*key_ready)(struct lc3_machine_s* m);
+	void (*write_char)(struct lc3_machine_s* m, char c);
+	void (*write_string)(struct lc3_machine_s* m, const char* text, int length);
+	void* io;		// Frontend data for the hooks
+
+	// Where and when a read of KBSR last found no key, to tell a program spinning on it (see lc3device.c)
+	unsigned short poll_pc;
+	unsigned long long poll_executions;
+
+	// Scheduled events, a min-heap on time. The engines treat next_event like a second execution_limit, so they
+	// pay nothing extra for it; run_program() then runs what is due and carries on.
+	lc3_event_t events[EVENT_MAX];
+	int nevents;
+	unsigned long long next_event;	// Time of events[0], or ~0 with none scheduled
+	// Stack pointer of the mode not running; the running one's is R6
+	unsigned short saved_ssp;
+	unsigned short saved_usp;
+
+	struct lc3_console_s* console;	// Scrollback of the debugger's console window, NULL elsewhere
+
+	// Per-engine caches, allocated the first time that engine runs
+	struct lc3pre_s* predecoded;
+	struct lc3blocks_s* blocks;
+	struct lc3jit_s* jit;
+} lc3_machine_t;
+
+lc3_machine_t* create_machine();
+void destroy_machine(lc3_machine_t* m);
+
+short fetch_instruction(lc3_machine_t* m);
 void decode_instruction(lc3inst_t* instruction, short raw_inst);
-void execute_instruction(lc3inst_t* instruction);
-void setcc(short writeval);
-char comparenzp(char nzp);
+int execute_instruction(lc3_machine_t* m, lc3inst_t* instruction);
+int execute_trap(lc3_machine_t* m, short trapvect);
+unsigned short interpret(lc3_machine_t* m, unsigned short address);
+void setcc(lc3_machine_t* m, short writeval);
+char comparenzp(lc3_machine_t* m, char nzp);
 short signext(short value, char bits);
-void show_register_contents();
-void send_to_console(char c);
-void read_program(FILE* program);
+void write_each_char(lc3_machine_t* m, const char* text, int length);
+int read_program(lc3_machine_t* m, FILE* program);
+void use_image(lc3_machine_t* m, lc3_image_t* image);
+
+void run_program(lc3_machine_t* m);
+void step_forward(lc3_machine_t* m);
+void set_breakpoint(lc3_machine_t* m, unsigned short address);
+void unset_breakpoint(lc3_machine_t* m, unsigned short address);
+void reset_program(lc3_machine_t* m);
+
+// Every store into memory goes through here (or, in generated code, does the same), so resets know what to restore
+static inline void mark_dirty(lc3_machine_t* m, unsigned short address)
+{
+	m->dirty[address >> DIRTY_SHIFT] = 1;
+}
+
+// Instruction count the engines stop at: execution_limit, or the next scheduled event if that comes first
+static inline unsigned long long run_limit(lc3_machine_t* m)
+{
+	unsigned long long limit = m->execution_limit ? m->execution_limit : ~0ULL;
+	return m->next_event < limit ? m->next_event : limit;
+}
+
+void watchpoint_access(lc3_machine_t* m, unsigned short address, int access);
+
+// Called on every load and store of execute_instruction(); a single test when no watchpoint is armed
+static inline void watch(lc3_machine_t* m, unsigned short address, int access)
+{
+	if (m->nwatchpoints)
+		watchpoint_access(m, address, access);
+}
+
+// State of the breakpoint at an address, or NULL if there is none
+static inline unsigned char* find_breakpoint(lc3_machine_t* m, unsigned short address)
+{
+	int i;
+	if (!((m->brk_filter >> (address & 63)) & 1))
+		return NULL;
+	for (i=0; i<m->nbreakpoints; i++)
+		if (m->breakpoints[i].address == address)
+			return &m->breakpoints[i].state;
+	return NULL;
+}
+
+static inline unsigned char breakpoint_at(lc3_machine_t* m, unsigned short address)
+{
+	unsigned char* state = find_breakpoint(m, address);
+	return state ? *state : 0;
+}
 
-void run_program();
-void step_forward();
-void set_breakpoint(unsigned short address);
-void unset_breakpoint(unsigned short address);
-void reset_program(FILE* program);
+static inline void set_breakpoint_state(lc3_machine_t* m, unsigned short address, unsigned char value)
+{
+	unsigned char* state = find_breakpoint(m, address);
+	if (state)
+		*state = value;
+}
 
-void disassemble_to_str(short inst, char* buffer);
+void disassemble_to_str(const lc3_symtab_t* symbols, unsigned short address, short instruction, char* buffer);
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef LC3SIMD_H
+#define LC3SIMD_H
+
+#include "lc3sim.h"
+#include "lc3pre.h"
+
+#define SIMD_LANES 16						// Machines run in lockstep; one 256-bit vector of 16-bit registers
+#define SIMD_DIVERGE_LIMIT 1024	// Steps in a row a lane may sit masked off before it leaves lockstep for good
+
+/*
+ * A group of machines loaded with the same program, run one instruction at a time in lockstep.
+ * Lanes leave the group (stepping cleared) when they halt, wait for input, run into code that differs from the
+ * other lanes', or stay diverged for SIMD_DIVERGE_LIMIT steps; their machines are then left ready for run_program().
+ */
+typedef struct {
+	lc3_machine_t* lanes[SIMD_LANES];
+	int count;
+	unsigned char stepping[SIMD_LANES];	// Lane still runs in lockstep
+	lc3pre_t* code;											// Program decoded once for every lane
+	unsigned char* written;							// Addresses some lane has stored to; lanes may disagree about them
+} lc3_lockstep_t;
+
+void init_lockstep(lc3_lockstep_t* group, lc3_machine_t** lanes, int count);
+void free_lockstep(lc3_lockstep_t* group);
+int run_lockstep(lc3_lockstep_t* group);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef LC3STATS_H
+#define LC3STATS_H
+
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include "lc3sim.h"
+
+#define STATS_DEFAULT_PATH "simplx.stats"	// Where the debugger writes statistics asked for without a file
+#define STATS_SIGNAL SIGUSR1			// Writes the statistics so far, e.g. kill -USR1 <pid>
+
+#ifdef LC3_STATS
+
+/*
+ * What one machine has done while statistics were on. execute_instruction() counts each instruction it runs by
+ * opcode, with the outcome of each BR and the vector of each TRAP; loads and stores are worked out from the
+ * opcode counts when the statistics are written. Output is counted where OUT, PUTS, PUTSP and DDR hand it to the
+ * frontend, and time is only counted inside run_program().
+ */
+typedef struct lc3_stats_s {
+	unsigned long long opcodes[16];
+	unsigned long long taken;					// BRs whose condition held, BRnzp included
+	unsigned long long not_taken;			// BRs whose condition didn't (a BR without nzp bits is neither)
+	unsigned long long traps[TRAP_VECTORS];
+	unsigned long long output;				// Characters printed
+	double seconds;										// Wall time spent running
+	struct timespec started;					// When the current run_program() began
+} lc3_stats_t;
+
+// One run that went into a total, such as a job of a pool, for the line on each run
+typedef struct {
+	const char* program;
+	const char* input;
+	unsigned long long instructions;
+	double seconds;										// Wall time spent running it
+} lc3_stats_run_t;
+
+void start_stats(lc3_machine_t* m);
+void stop_stats(lc3_machine_t* m);
+void clear_stats(lc3_machine_t* m);
+void add_stats(lc3_stats_t* total, const lc3_stats_t* stats);
+unsigned long long stats_instructions(const lc3_stats_t* stats);
+void write_stats(const lc3_stats_t* stats, const lc3_stats_run_t* runs, int nruns, FILE* out, int json);
+int save_stats(const lc3_stats_t* stats, const lc3_stats_run_t* runs, int nruns, const char* path, int json);
+void catch_stats_signal();
+int stats_signalled();
+void stats_run_started(lc3_machine_t* m);
+void stats_run_stopped(lc3_machine_t* m);
+
+// Whether a machine is keeping statistics; always 0 when they are compiled out
+#define stats_on(m) ((m)->stats != NULL)
+
+// Called by execute_instruction() after each instruction while statistics are on
+static inline void stats_instruction(lc3_machine_t* m, lc3inst_t* instruction)
+{
+	lc3_stats_t* stats = m->stats;
+
+	stats->opcodes[instruction->opcode]++;
+	if (instruction->opcode == BR && instruction->nzpbits)
+	{
+		// BR leaves the CC alone, so the condition can be tested again afterwards
+		if (comparenzp(m, instruction->nzpbits))
+			stats->taken++;
+		else
+			stats->not_taken++;
+	}
+	else if (instruction->opcode == TRAP)
+		stats->traps[instruction->trapvect & TRAP_MASK]++;
+}
+
+// Called wherever the console is handed characters the program printed
+static inline void stats_output(lc3_machine_t* m, int length)
+{
+	if (m->stats)
+		m->stats->output += length;
+}
+
+#else
+
+#define stats_on(m) 0
+
+static inline void stats_output(lc3_machine_t* m, int length)
+{
+}
+
+#endif
+
+#endif
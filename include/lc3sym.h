@@ -0,0 +1,33 @@
+#ifndef LC3SYM_H
+#define LC3SYM_H
+
+typedef struct {
+	unsigned short address;
+	unsigned int name;				// Offset of the name in the table's arena
+} lc3_symbol_t;
+
+/*
+ * Labels of a loaded program. All names live in one arena; the symbols are sorted by address for address lookups
+ * and hashed by name into an open-addressed index for name lookups.
+ */
+typedef struct {
+	lc3_symbol_t* symbols;
+	int count;
+	int capacity;							// Slots allocated in symbols
+	char* arena;
+	unsigned int arena_used;
+	unsigned int arena_size;
+	int* index;								// Symbol number + 1 per slot, 0 for an empty slot
+	unsigned int index_mask;	// Slots - 1; a power of two at least twice count
+} lc3_symtab_t;
+
+int load_symbols(lc3_symtab_t* table, const char* filename);
+void add_symbol(lc3_symtab_t* table, unsigned short address, const char* name, int length);
+void index_symbols(lc3_symtab_t* table);
+void free_symbols(lc3_symtab_t* table);
+const char* symbol_at(const lc3_symtab_t* table, unsigned short address);
+const char* symbol_before(const lc3_symtab_t* table, unsigned short address, unsigned short* offset);
+int symbol_address(const lc3_symtab_t* table, const char* name, unsigned short* address);
+int format_address(const lc3_symtab_t* table, unsigned short address, char* buffer, int size);
+
+#endif
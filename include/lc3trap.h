@@ -0,0 +1,44 @@
+#ifndef LC3TRAP_H
+#define LC3TRAP_H
+
+#include "lc3sim.h"
+
+#define TRAP_GETC 0x20
+#define TRAP_OUT 0x21
+#define TRAP_PUTS 0x22
+#define TRAP_IN 0x23
+#define TRAP_PUTSP 0x24
+#define TRAP_HALT 0x25
+#define TRAP_UDIV 0x80
+#define TRAP_CHUNK 1024			// Characters PUTS/PUTSP hand to write_string at once
+
+// A native routine that can be put on any vector by name, e.g. --trap=x81:mul
+typedef struct {
+	const char* name;
+	lc3_trap_t trap;
+} lc3_native_trap_t;
+
+// One vector's routine, native or (routine NULL) the guest's
+typedef struct {
+	unsigned char vector;
+	lc3_trap_t trap;
+} lc3_trap_setting_t;
+
+void default_traps(lc3_machine_t* m);
+void register_trap(lc3_machine_t* m, unsigned char vector, int (*routine)(lc3_machine_t* m), int effects);
+void unregister_trap(lc3_machine_t* m, unsigned char vector);
+int parse_trap_setting(const char* text, lc3_trap_setting_t* setting);
+void apply_trap_settings(lc3_machine_t* m, const lc3_trap_setting_t* settings, int count);
+
+int trap_getc(lc3_machine_t* m);
+int trap_out(lc3_machine_t* m);
+int trap_puts(lc3_machine_t* m);
+int trap_in(lc3_machine_t* m);
+int trap_putsp(lc3_machine_t* m);
+int trap_halt(lc3_machine_t* m);
+int trap_udiv(lc3_machine_t* m);
+int trap_mul(lc3_machine_t* m);
+int trap_mod(lc3_machine_t* m);
+int trap_memcpy(lc3_machine_t* m);
+
+#endif
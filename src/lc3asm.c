@@ -0,0 +1,736 @@
+/**
+ * @file		lc3asm.c
+ * @brief		Assembler, writing straight into a program image
+ *
+ * `simplx program.asm` (and every other place that takes a program, see open_images()) assembles the source in
+ * process instead of reading back what an external assembler wrote: the words go straight into the image's memory
+ * and the labels into its symbol table, so nothing touches the disk but the source itself.
+ *
+ * The language is lc3as's: one statement per line, an optional label first, then an instruction or one of the
+ * pseudo-ops .ORIG, .FILL, .BLKW, .STRINGZ and .END, then its operands separated by commas or spaces. ';' starts a
+ * comment. Numbers are #decimal, xhex (0x works too) or plain decimal; a number where a PC-relative operand goes is
+ * the offset itself, as disassemble_to_str() writes it, and a label (or LABEL+n, LABEL-n) is an address. Instruction
+ * names and registers are case-insensitive, labels are not. Everything after .END is ignored up to the next .ORIG,
+ * so one source may hold several segments.
+ *
+ * The source is gone over twice. The first pass splits each line into tokens (pointers into the source, which is
+ * never copied or changed), gives each label its address and keeps the statements; the second encodes them, now
+ * that every label is known. Errors are printed with their line numbers and assembling goes on, so one run finds
+ * them all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <errno.h>
+#include "../include/lc3asm.h"
+
+// What a statement is, which says how its operands are encoded
+typedef enum {
+	K_ALU,			// ADD, AND: DR, SR1, SR2 or imm5
+	K_NOT,			// DR, SR
+	K_BR,				// PCoffset9
+	K_PC9,			// LD, LDI, LEA, ST, STI: register, PCoffset9
+	K_OFF6,			// LDR, STR: register, BaseR, offset6
+	K_JSR,			// PCoffset11
+	K_BASE,			// JMP, JSRR: BaseR
+	K_TRAP,			// trapvect8
+	K_FIXED,		// No operands: RET, RTI, NOP and the trap aliases
+	P_ORIG,
+	P_FILL,
+	P_BLKW,
+	P_STRINGZ,
+	P_END
+} asm_kind_t;
+
+typedef struct {
+	const char* name;
+	asm_kind_t kind;
+	unsigned short bits;		// The instruction with every operand zero
+	int operands;
+} asm_op_t;
+
+static const asm_op_t ops[] = {
+	{ "ADD", K_ALU, 0x1000, 3 }, { "AND", K_ALU, 0x5000, 3 }, { "NOT", K_NOT, 0x903F, 2 },
+	{ "BR", K_BR, 0x0E00, 1 }, { "BRn", K_BR, 0x0800, 1 }, { "BRz", K_BR, 0x0400, 1 }, { "BRp", K_BR, 0x0200, 1 },
+	{ "BRnz", K_BR, 0x0C00, 1 }, { "BRnp", K_BR, 0x0A00, 1 }, { "BRzp", K_BR, 0x0600, 1 },
+	{ "BRnzp", K_BR, 0x0E00, 1 },
+	{ "LD", K_PC9, 0x2000, 2 }, { "LDI", K_PC9, 0xA000, 2 }, { "LEA", K_PC9, 0xE000, 2 },
+	{ "ST", K_PC9, 0x3000, 2 }, { "STI", K_PC9, 0xB000, 2 },
+	{ "LDR", K_OFF6, 0x6000, 3 }, { "STR", K_OFF6, 0x7000, 3 },
+	{ "JSR", K_JSR, 0x4800, 1 }, { "JSRR", K_BASE, 0x4000, 1 }, { "JMP", K_BASE, 0xC000, 1 },
+	{ "TRAP", K_TRAP, 0xF000, 1 },
+	{ "RET", K_FIXED, 0xC1C0, 0 }, { "RTI", K_FIXED, 0x8000, 0 }, { "NOP", K_FIXED, 0x0000, 0 },
+	{ "GETC", K_FIXED, 0xF020, 0 }, { "OUT", K_FIXED, 0xF021, 0 }, { "PUTS", K_FIXED, 0xF022, 0 },
+	{ "IN", K_FIXED, 0xF023, 0 }, { "PUTSP", K_FIXED, 0xF024, 0 }, { "HALT", K_FIXED, 0xF025, 0 },
+	{ ".ORIG", P_ORIG, 0, 1 }, { ".FILL", P_FILL, 0, 1 }, { ".BLKW", P_BLKW, 0, 1 },
+	{ ".STRINGZ", P_STRINGZ, 0, 1 }, { ".END", P_END, 0, 0 }
+};
+
+#define NUM_OPS ((int)(sizeof(ops)/sizeof(ops[0])))
+
+// Part of a line, pointing into the source
+typedef struct {
+	const char* text;
+	int length;
+} asm_token_t;
+
+typedef struct {
+	int line;
+	unsigned short address;
+	unsigned char op;							// Index into ops
+	unsigned char noperands;
+	asm_token_t operands[ASM_OPERANDS];
+} asm_statement_t;
+
+typedef struct {
+	asm_token_t name;							// Empty for an unused slot
+	unsigned short address;
+	int line;
+} asm_label_t;
+
+typedef struct {
+	const char* name;							// Of the source, for errors
+	int errors;
+	asm_statement_t* statements;
+	int nstatements;
+	int capacity;
+	asm_label_t* labels;					// Open-addressed on the name
+	unsigned int label_mask;			// Slots - 1; a power of two at least twice nlabels
+	int nlabels;
+} asm_t;
+
+static void error(asm_t* a, int line, const char* format, ...)
+{
+	va_list args;
+
+	if (a->errors++ == ASM_ERRORS_MAX)
+		fprintf(stderr, "%s: too many errors, not printing any more\n", a->name);
+	if (a->errors > ASM_ERRORS_MAX)
+		return;
+	fprintf(stderr, "%s:%d: ", a->name, line);
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+static int is_label_char(char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static int find_op(asm_token_t token)
+{
+	int i;
+
+	for (i=0; i<NUM_OPS; i++)
+		if ((int)strlen(ops[i].name) == token.length && !strncasecmp(ops[i].name, token.text, token.length))
+			return i;
+	return -1;
+}
+
+/**
+ * @name 	Parse Number
+ * @brief Reads a whole token as #decimal, xhex, 0xhex or decimal, each optionally negative
+ * @param [asm_token_t] token The token
+ * @param [long*] value Set to the number
+ * @retval 1 if the token is a number, 0 if not
+ */
+static int parse_number(asm_token_t token, long* value)
+{
+	const char* p = token.text;
+	const char* end = token.text + token.length;
+	int base = 10;
+	int negative = 0;
+	int digits = 0;
+	int digit;
+
+	*value = 0;
+	if (p < end && *p == '#')
+		p++;
+	else if (p < end && (*p == 'x' || *p == 'X'))
+	{
+		p++;
+		base = 16;
+	}
+	else if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+	{
+		p += 2;
+		base = 16;
+	}
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	for (; p < end; p++, digits++)
+	{
+		if (*p >= '0' && *p <= '9')
+			digit = *p - '0';
+		else if (base == 16 && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+			digit = (*p | 0x20) - 'a' + 10;
+		else
+			return 0;
+		if (*value > 0x7FFFFF)
+			return 0;		// Far out of range of anything; don't let it overflow
+		*value = *value * base + digit;
+	}
+	if (negative)
+		*value = -*value;
+	return digits > 0;
+}
+
+static int parse_register(asm_token_t token, int* reg)
+{
+	if (token.length != 2 || (token.text[0] | 0x20) != 'r' || token.text[1] < '0' || token.text[1] > '7')
+		return 0;
+	*reg = token.text[1] - '0';
+	return 1;
+}
+
+static int is_label(asm_token_t token)
+{
+	long value;
+	int reg;
+	int i;
+
+	if (!token.length || (token.text[0] >= '0' && token.text[0] <= '9') || parse_number(token, &value)
+		|| parse_register(token, &reg))
+		return 0;
+	for (i=0; i<token.length; i++)
+		if (!is_label_char(token.text[i]))
+			return 0;
+	return 1;
+}
+
+static unsigned int hash_token(asm_token_t token)
+{
+	unsigned int hash = 2166136261u;	// FNV-1a
+	int i;
+
+	for (i=0; i<token.length; i++)
+		hash = (hash ^ (unsigned char)token.text[i]) * 16777619u;
+	return hash;
+}
+
+static asm_label_t* find_label(asm_t* a, asm_token_t name)
+{
+	unsigned int slot;
+
+	for (slot = hash_token(name) & a->label_mask; a->labels[slot].name.length; slot = (slot + 1) & a->label_mask)
+		if (a->labels[slot].name.length == name.length && !memcmp(a->labels[slot].name.text, name.text, name.length))
+			break;
+	return &a->labels[slot];
+}
+
+static void grow_labels(asm_t* a)
+{
+	asm_label_t* old = a->labels;
+	unsigned int slots = a->label_mask + 1;
+	unsigned int i;
+
+	a->label_mask = 2*slots - 1;
+	if (!(a->labels = calloc(2*slots, sizeof(asm_label_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	for (i=0; i<slots; i++)
+		if (old[i].name.length)
+			*find_label(a, old[i].name) = old[i];
+	free(old);
+}
+
+static void define_label(asm_t* a, asm_token_t name, unsigned short address, int line)
+{
+	asm_label_t* label;
+
+	if (2*(unsigned int)(a->nlabels + 1) > a->label_mask + 1)
+		grow_labels(a);
+	label = find_label(a, name);
+	if (label->name.length)
+	{
+		error(a, line, "label %.*s is already defined on line %d", name.length, name.text, label->line);
+		return;
+	}
+	label->name = name;
+	label->address = address;
+	label->line = line;
+	a->nlabels++;
+}
+
+/**
+ * @name 	Decode String
+ * @brief Reads a quoted .STRINGZ operand, handling \n, \t, \r, \0, \\ and \"
+ * @param [asm_token_t] token The operand, quotes included
+ * @param [unsigned short*] out Where to write the characters, or NULL just to count them
+ * @retval The number of characters, not counting the terminating zero .STRINGZ adds
+ */
+static int decode_string(asm_token_t token, unsigned short* out)
+{
+	const char* p = token.text + 1;
+	const char* end = token.text + token.length - 1;
+	int n = 0;
+	char c;
+
+	for (; p < end; p++, n++)
+	{
+		c = *p;
+		if (c == '\\' && p+1 < end)
+		{
+			switch (*++p) {
+			case 'n': c = '\n'; break;
+			case 't': c = '\t'; break;
+			case 'r': c = '\r'; break;
+			case '0': c = '\0'; break;
+			case 'e': c = 27; break;
+			default: c = *p; break;
+			}
+		}
+		if (out)
+			out[n] = (unsigned char)c;
+	}
+	return n;
+}
+
+/**
+ * @name 	Split Line
+ * @brief Breaks a line into tokens at spaces and commas, up to a comment
+ * @param [asm_t*] a The assembler
+ * @param [const char*] p Start of the line
+ * @param [const char*] end End of the line
+ * @param [int] line Its number
+ * @param [asm_token_t*] tokens Where to put them; room for ASM_OPERANDS + 2
+ * @retval The number of tokens, or -1 after reporting an error
+ */
+static int split_line(asm_t* a, const char* p, const char* end, int line, asm_token_t* tokens)
+{
+	int n = 0;
+	const char* start;
+
+	for (;;)
+	{
+		while (p < end && is_space(*p))
+			p++;
+		if (p == end || *p == ';')
+			return n;
+		start = p;
+		if (*p == '"')
+		{
+			for (p++; p < end && *p != '"'; p++)
+				if (*p == '\\' && p+1 < end)
+					p++;
+			if (p == end)
+			{
+				error(a, line, "unterminated string");
+				return -1;
+			}
+			p++;
+		}
+		else
+			while (p < end && !is_space(*p) && *p != ';' && *p != '"')
+				p++;
+		if (n == ASM_OPERANDS + 2)
+		{
+			error(a, line, "too many operands");
+			return -1;
+		}
+		tokens[n].text = start;
+		tokens[n].length = p - start;
+		n++;
+	}
+}
+
+static asm_statement_t* add_statement(asm_t* a)
+{
+	if (a->nstatements == a->capacity)
+	{
+		a->capacity = a->capacity ? 2*a->capacity : 256;
+		if (!(a->statements = realloc(a->statements, a->capacity*sizeof(asm_statement_t))))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+	}
+	return &a->statements[a->nstatements++];
+}
+
+/**
+ * @name 	First Pass
+ * @brief Splits the source into statements and gives every label its address
+ * @param [asm_t*] a The assembler
+ * @param [const char*] source The source
+ * @param [size_t] length Its length
+ * @param [unsigned short*] entry Set to the first .ORIG
+ */
+static void first_pass(asm_t* a, const char* source, size_t length, unsigned short* entry)
+{
+	const char* p = source;
+	const char* end = source + length;
+	const char* eol;
+	asm_token_t tokens[ASM_OPERANDS + 2];
+	asm_token_t* label;
+	asm_token_t* operands;
+	asm_statement_t* statement;
+	unsigned int address = 0;
+	int in_segment = 0;
+	int ended = 0;
+	int segments = 0;
+	int line;
+	int n;
+	int op;
+	int words;
+	long value;
+	int reg;
+
+	for (line = 1; p < end; line++, p = eol + 1)
+	{
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		if ((n = split_line(a, p, eol, line, tokens)) <= 0)
+			continue;
+
+		label = NULL;
+		if ((op = find_op(tokens[0])) < 0)
+		{
+			label = &tokens[0];
+			if (label->length > 1 && label->text[label->length-1] == ':')
+				label->length--;
+			if (n > 1 && (op = find_op(tokens[1])) < 0)
+			{
+				if (parse_register(tokens[1], &reg))
+					error(a, line, "unknown instruction %.*s", tokens[0].length, tokens[0].text);
+				else
+					error(a, line, "unknown instruction %.*s", tokens[1].length, tokens[1].text);
+				continue;
+			}
+		}
+		if (!in_segment && (op < 0 || ops[op].kind != P_ORIG))
+		{
+			if (!ended)
+				error(a, line, "code before .ORIG");
+			continue;
+		}
+		operands = tokens + (label ? 2 : 1);
+		n -= operands - tokens;
+		if (op >= 0 && n != ops[op].operands)
+		{
+			error(a, line, "%s takes %d operand%s", ops[op].name, ops[op].operands, ops[op].operands == 1 ? "" : "s");
+			continue;
+		}
+
+		if (op >= 0 && ops[op].kind == P_ORIG)
+		{
+			if (!parse_number(operands[0], &value) || value < 0 || value > 0xFFFF)
+			{
+				error(a, line, ".ORIG needs an address from x0000 to xFFFF");
+				continue;
+			}
+			address = value;
+			in_segment = 1;
+			if (!segments++)
+				*entry = address;
+		}
+		if (label)
+		{
+			if (!is_label(*label))
+				error(a, line, "%.*s is not a valid label", label->length, label->text);
+			else if (address > 0xFFFF)
+				error(a, line, "no room for %.*s: the segment runs past xFFFF", label->length, label->text);
+			else
+				define_label(a, *label, address, line);
+		}
+		if (op < 0)
+			continue;
+
+		words = 1;
+		switch (ops[op].kind) {
+		case P_ORIG:
+			continue;
+		case P_END:
+			in_segment = 0;
+			ended = 1;
+			continue;
+		case P_BLKW:
+			if (!parse_number(operands[0], &value) || value < 1 || value > 0x10000)
+			{
+				error(a, line, ".BLKW needs a number of words");
+				continue;
+			}
+			words = value;
+			break;
+		case P_STRINGZ:
+			if (operands[0].text[0] != '"')
+			{
+				error(a, line, ".STRINGZ needs a quoted string");
+				continue;
+			}
+			words = decode_string(operands[0], NULL) + 1;
+			break;
+		default:
+			break;
+		}
+		if (address + words > 0x10000)
+		{
+			error(a, line, "no room for %s: the segment runs past xFFFF", ops[op].name);
+			continue;
+		}
+
+		statement = add_statement(a);
+		statement->line = line;
+		statement->address = address;
+		statement->op = op;
+		statement->noperands = n;
+		memcpy(statement->operands, operands, n*sizeof(asm_token_t));
+		address += words;
+	}
+	if (!segments && !a->errors)
+		error(a, line - 1, "no .ORIG");
+}
+
+/**
+ * @name 	Resolve
+ * @brief Reads a number, a label, or a label plus or minus a number
+ * @param [asm_t*] a The assembler
+ * @param [asm_token_t] token The operand
+ * @param [int] line Its line, for errors
+ * @param [long*] value Set to the number or address
+ * @param [int*] is_address Set if it was a label
+ * @retval 1 if it could be read, 0 after reporting an error
+ */
+static int resolve(asm_t* a, asm_token_t token, int line, long* value, int* is_address)
+{
+	asm_token_t name = token;
+	asm_token_t offset;
+	asm_label_t* label;
+	long delta = 0;
+	int i;
+
+	*is_address = 0;
+	if (parse_number(token, value))
+		return 1;
+	for (i=1; i<token.length; i++)
+		if (token.text[i] == '+' || token.text[i] == '-')
+		{
+			name.length = i;
+			offset.text = token.text + i + (token.text[i] == '+');
+			offset.length = token.length - i - (token.text[i] == '+');
+			if (!parse_number(offset, &delta))
+			{
+				error(a, line, "%.*s is not a number", token.length - i - 1, token.text + i + 1);
+				return 0;
+			}
+			break;
+		}
+	if (!is_label(name))
+	{
+		error(a, line, "%.*s is not a number or a label", token.length, token.text);
+		return 0;
+	}
+	label = find_label(a, name);
+	if (!label->name.length)
+	{
+		error(a, line, "undefined label %.*s", name.length, name.text);
+		return 0;
+	}
+	*value = label->address + delta;
+	*is_address = 1;
+	return 1;
+}
+
+// Reads an operand that has to be a register
+static int operand_register(asm_t* a, asm_token_t token, int line, int* reg)
+{
+	if (parse_register(token, reg))
+		return 1;
+	error(a, line, "%.*s is not a register", token.length, token.text);
+	return 0;
+}
+
+/**
+ * @name 	Operand Field
+ * @brief Reads a number that has to fit a signed field, or a label whose offset from the next instruction does
+ * @param [asm_t*] a The assembler
+ * @param [const asm_statement_t*] statement The statement
+ * @param [asm_token_t] token The operand
+ * @param [int] bits Width of the field
+ * @param [int] relative Labels are PC-relative rather than not allowed
+ * @param [unsigned short*] field Set to the field's bits
+ * @retval 1 if it fit, 0 after reporting an error
+ */
+static int operand_field(asm_t* a, const asm_statement_t* statement, asm_token_t token, int bits, int relative,
+	unsigned short* field)
+{
+	long low = -(1L << (bits-1));
+	long high = (1L << (bits-1)) - 1;
+	long value;
+	int is_address;
+
+	if (!resolve(a, token, statement->line, &value, &is_address))
+		return 0;
+	if (is_address && !relative)
+	{
+		error(a, statement->line, "%.*s is a label; %s needs a number here", token.length, token.text,
+			ops[statement->op].name);
+		return 0;
+	}
+	if (is_address)
+		value -= statement->address + 1;
+	if (value < low || value > high)
+	{
+		if (is_address)
+			error(a, statement->line, "%.*s is too far away (%ld words; %s reaches %ld to %ld)", token.length,
+				token.text, value, ops[statement->op].name, low, high);
+		else
+			error(a, statement->line, "%.*s is out of range (%ld to %ld)", token.length, token.text, low, high);
+		return 0;
+	}
+	*field = value & ((1 << bits) - 1);
+	return 1;
+}
+
+/**
+ * @name 	Encode
+ * @brief Writes one statement's words into memory
+ * @param [asm_t*] a The assembler
+ * @param [const asm_statement_t*] statement The statement
+ * @param [unsigned short*] mem Memory
+ */
+static void encode(asm_t* a, const asm_statement_t* statement, unsigned short* mem)
+{
+	const asm_op_t* op = &ops[statement->op];
+	const asm_token_t* operand = statement->operands;
+	unsigned short word = op->bits;
+	unsigned short field;
+	int line = statement->line;
+	int dr;
+	int sr;
+	long value;
+	int is_address;
+
+	switch (op->kind) {
+	case K_ALU:
+		if (!operand_register(a, operand[0], line, &dr) || !operand_register(a, operand[1], line, &sr))
+			return;
+		word |= dr << 9 | sr << 6;
+		if (parse_register(operand[2], &sr))
+			word |= sr;
+		else if (operand_field(a, statement, operand[2], 5, 0, &field))
+			word |= 0x20 | field;
+		else
+			return;
+		break;
+	case K_NOT:
+		if (!operand_register(a, operand[0], line, &dr) || !operand_register(a, operand[1], line, &sr))
+			return;
+		word |= dr << 9 | sr << 6;
+		break;
+	case K_BR:
+		if (!operand_field(a, statement, operand[0], 9, 1, &field))
+			return;
+		word |= field;
+		break;
+	case K_PC9:
+		if (!operand_register(a, operand[0], line, &dr) || !operand_field(a, statement, operand[1], 9, 1, &field))
+			return;
+		word |= dr << 9 | field;
+		break;
+	case K_OFF6:
+		if (!operand_register(a, operand[0], line, &dr) || !operand_register(a, operand[1], line, &sr)
+			|| !operand_field(a, statement, operand[2], 6, 0, &field))
+			return;
+		word |= dr << 9 | sr << 6 | field;
+		break;
+	case K_JSR:
+		if (!operand_field(a, statement, operand[0], 11, 1, &field))
+			return;
+		word |= field;
+		break;
+	case K_BASE:
+		if (!operand_register(a, operand[0], line, &sr))
+			return;
+		word |= sr << 6;
+		break;
+	case K_TRAP:
+		if (!parse_number(operand[0], &value) || value < 0 || value > 0xFF)
+		{
+			error(a, line, "TRAP needs a vector from x00 to xFF");
+			return;
+		}
+		word |= value;
+		break;
+	case K_FIXED:
+		break;
+	case P_FILL:
+		if (!resolve(a, operand[0], line, &value, &is_address))
+			return;
+		if (value < -0x8000 || value > 0xFFFF)
+		{
+			error(a, line, "%.*s doesn't fit in a word", operand[0].length, operand[0].text);
+			return;
+		}
+		word = value;
+		break;
+	case P_BLKW:
+		parse_number(operand[0], &value);
+		memset(mem + statement->address, 0, value*sizeof(unsigned short));
+		return;
+	case P_STRINGZ:
+		mem[statement->address + decode_string(operand[0], mem + statement->address)] = 0;
+		return;
+	default:
+		return;
+	}
+	mem[statement->address] = word;
+}
+
+/**
+ * @name 	Assemble
+ * @brief Assembles a source straight into memory and a symbol table
+ * @param [const char*] source The source text, which needn't be terminated
+ * @param [size_t] length Its length
+ * @param [const char*] name What to call it in errors, usually its path
+ * @param [unsigned short*] mem Memory to write the program into
+ * @param [lc3_symtab_t*] symbols Table to add its labels to
+ * @param [unsigned short*] entry Set to the address of its first .ORIG
+ * @retval The number of errors, each printed to stderr as "name:line: message"; 0 if it assembled
+ *
+ * Memory outside the program is left alone. With errors, memory may be partly written and the table is left
+ * alone.
+ */
+int assemble(const char* source, size_t length, const char* name, unsigned short* mem, lc3_symtab_t* symbols,
+	unsigned short* entry)
+{
+	asm_t a;
+	unsigned int i;
+	int s;
+
+	memset(&a, 0, sizeof(asm_t));
+	a.name = name;
+	a.label_mask = 63;
+	if (!(a.labels = calloc(a.label_mask + 1, sizeof(asm_label_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+
+	first_pass(&a, source, length, entry);
+	for (s=0; s<a.nstatements; s++)
+		encode(&a, &a.statements[s], mem);
+
+	if (!a.errors)
+	{
+		for (i=0; i<=a.label_mask; i++)
+			if (a.labels[i].name.length)
+				add_symbol(symbols, a.labels[i].address, a.labels[i].name.text, a.labels[i].name.length);
+		index_symbols(symbols);
+	}
+	free(a.statements);
+	free(a.labels);
+	return a.errors;
+}
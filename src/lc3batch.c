@@ -0,0 +1,337 @@
+/**
+ * @file		lc3batch.c
+ * @brief		Headless batch execution
+ *
+ * Runs a program to completion without ncurses, e.g. `simplx --batch prog.obj < input > output`.
+ * GETC/IN and KBSR/KBDR read from the machine's input and OUT/PUTS/DDR write to its output, both through large
+ * buffers.
+ * The program runs in slices of BATCH_SLICE instructions so the instruction budget, wall-clock timeout and a
+ * request for statistics (STATS_SIGNAL) can be checked without touching the engines' inner loops. After each
+ * slice the program is checked for a loop that changes nothing (see lc3loop.c): with no event to come it is
+ * stuck, and otherwise the trips round the loop before the next event are skipped.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3batch.h"
+#include "../include/lc3stats.h"
+
+/**
+ * @name 	Flush Batch IO
+ * @brief Writes everything buffered by batch_write_char() to the machine's output
+ * @param [lc3_machine_t*] m The machine whose output is flushed
+ */
+void flush_batch_io(lc3_machine_t* m)
+{
+	batch_io_t* io = m->io;
+	int done = 0;
+	int n;
+
+	while (io->out_fd >= 0 && done < io->outlen)
+	{
+		n = write(io->out_fd, io->outbuf + done, io->outlen - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	io->outlen = 0;
+}
+
+/**
+ * @name 	Batch Write Char
+ * @brief OUT/PUTS handler: appends a character to the output buffer
+ * @param [lc3_machine_t*] m The machine printing
+ * @param [char] c The character to print
+ */
+static void batch_write_char(lc3_machine_t* m, char c)
+{
+	batch_io_t* io = m->io;
+	if (io->outlen == BATCH_BUFFER)
+		flush_batch_io(m);
+	io->outbuf[io->outlen++] = c;
+}
+
+/**
+ * @name 	Batch Write String
+ * @brief PUTS handler: appends a whole string to the output buffer
+ * @param [lc3_machine_t*] m The machine printing
+ * @param [const char*] text The characters
+ * @param [int] length How many
+ */
+static void batch_write_string(lc3_machine_t* m, const char* text, int length)
+{
+	batch_io_t* io = m->io;
+	int n;
+
+	while (length)
+	{
+		if (io->outlen == BATCH_BUFFER)
+			flush_batch_io(m);
+		n = BATCH_BUFFER - io->outlen < length ? BATCH_BUFFER - io->outlen : length;
+		memcpy(io->outbuf + io->outlen, text, n);
+		io->outlen += n;
+		text += n;
+		length -= n;
+	}
+}
+
+/**
+ * @name 	Wait For Input
+ * @brief Waits until the input has something to read (or has ended), but no longer than the run's timeout allows
+ * @param [batch_io_t*] io The machine's console
+ * @retval 1	the input can be read, or there is no timeout to wait for
+ * @retval 0	the timeout expired first
+ */
+static int wait_for_input(batch_io_t* io)
+{
+	struct pollfd input;
+	double left;
+	int n;
+
+	if (!io->start || io->timeout <= 0)
+		return 1;
+	input.fd = io->in_fd;
+	input.events = POLLIN;
+	for (;;)
+	{
+		left = io->timeout - seconds_since(io->start);
+		if (left <= 0)
+			return 0;
+		// Round up, so the deadline has passed when poll() gives up
+		n = poll(&input, 1, left < 1e6 ? (int)(left*1000) + 1 : 1000000000);
+		if (n > 0 || (n < 0 && errno != EINTR))
+			return 1;
+	}
+}
+
+/**
+ * @name 	Batch Read Key
+ * @brief GETC/IN handler: takes the next character of input into R0
+ * @param [lc3_machine_t*] m The machine reading
+ * @param [int] print Echo the character, as IN does
+ * @retval 1	a character was read
+ * @retval 0	no character yet (would_block set), before the timeout (timed_out set) or ever (eof set)
+ */
+static int batch_read_key(lc3_machine_t* m, int print)
+{
+	batch_io_t* io = m->io;
+	int n;
+
+	if (io->inpos == io->inlen)
+	{
+		if (io->in_fd < 0)
+			n = 0;
+		else if (!wait_for_input(io))
+		{
+			io->timed_out = 1;
+			return 0;
+		}
+		else
+			while ((n = read(io->in_fd, io->inbuf, BATCH_BUFFER)) < 0 && errno == EINTR);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			io->would_block = 1;
+			return 0;
+		}
+		if (n <= 0)
+		{
+			io->eof = 1;
+			return 0;
+		}
+		io->inpos = 0;
+		io->inlen = n;
+	}
+	m->regfile[0] = (unsigned char)io->inbuf[io->inpos++];
+	if (print)
+		batch_write_char(m, m->regfile[0]);
+	return 1;
+}
+
+/**
+ * @name 	Batch Key Ready
+ * @brief Checks whether batch_read_key() can return without waiting on the input
+ * @param [lc3_machine_t*] m The machine reading
+ * @retval 1 if a character is buffered or the input has one (or its end) ready to read, 0 otherwise
+ */
+static int batch_key_ready(lc3_machine_t* m)
+{
+	batch_io_t* io = m->io;
+	struct pollfd input;
+
+	if (io->inpos < io->inlen)
+		return 1;
+	if (io->in_fd < 0)
+		return 0;
+	input.fd = io->in_fd;
+	input.events = POLLIN;
+	return poll(&input, 1, 0) > 0;
+}
+
+/**
+ * @name 	Attach Batch IO
+ * @brief Points a machine's console at a pair of file descriptors
+ * @param [lc3_machine_t*] m The machine
+ * @param [batch_io_t*] io Buffers for the machine; must live as long as it does
+ * @param [int] in_fd Descriptor GETC/IN read from, -1 for none
+ * @param [int] out_fd Descriptor OUT/PUTS write to, -1 to discard output
+ */
+void attach_batch_io(lc3_machine_t* m, batch_io_t* io, int in_fd, int out_fd)
+{
+	memset(io, 0, offsetof(batch_io_t, inbuf));
+	io->in_fd = in_fd;
+	io->out_fd = out_fd;
+	m->io = io;
+	m->read_key = batch_read_key;
+	m->key_ready = batch_key_ready;
+	m->write_char = batch_write_char;
+	m->write_string = batch_write_string;
+}
+
+/**
+ * @name 	Seconds Since
+ * @brief Wall-clock time elapsed since a CLOCK_MONOTONIC timestamp
+ * @param [const struct timespec*] start The timestamp
+ */
+double seconds_since(const struct timespec* start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @name 	Dump State
+ * @brief Prints the registers, PC, IR, CC, instruction count and run status to stderr
+ * @param [lc3_machine_t*] m The machine to print
+ * @param [batch_status_t] status How the run ended
+ */
+static void dump_state(lc3_machine_t* m, batch_status_t status)
+{
+	static const char* names[] = { "halted", "", "input exhausted", "instruction budget exceeded", "timed out",
+		"stuck in a loop" };
+	int i;
+
+	for (i=0; i<8; i++)
+		fprintf(stderr, "R%d=x%.4hx%c", i, m->regfile[i], i == 7 ? '\n' : ' ');
+	// The PC shown by the debugger is one past the next instruction; report the next instruction itself
+	fprintf(stderr, "PC=x%.4hx IR=x%.4hx CC=%c EX=%llu\n", (unsigned short)(m->pc-1), m->ir,
+		m->cc < 0 ? 'N' : (m->cc == 0 ? 'Z' : 'P'), m->executions);
+	fprintf(stderr, "status=%s\n", names[status]);
+}
+
+/**
+ * @name 	Set Batch Limit
+ * @brief Sets a machine's execution_limit to the end of its next slice, or its budget if that comes first
+ * @param [lc3_machine_t*] m The machine
+ * @param [const batch_options_t*] options Budget
+ */
+void set_batch_limit(lc3_machine_t* m, const batch_options_t* options)
+{
+	unsigned long long slice_end = m->executions + BATCH_SLICE;
+
+	if (options->max_instructions && options->max_instructions < slice_end)
+		m->execution_limit = options->max_instructions;
+	else
+		m->execution_limit = slice_end;
+}
+
+/**
+ * @name 	Run Batch Slice
+ * @brief Runs a machine with batch IO attached for BATCH_SLICE instructions, then checks it isn't stuck
+ * @param [lc3_machine_t*] m The machine to run
+ * @param [const batch_options_t*] options Budget and timeout
+ * @param [const struct timespec*] start When the run started (CLOCK_MONOTONIC), for the timeout
+ * @retval The batch_status_t describing how the slice ended; BATCH_RUNNING or BATCH_WAITING if the run isn't over
+ *
+ * A loop that changes nothing, but that an event will break into, is skipped up to the event, so a slice can count
+ * for many more instructions than it ran.
+ */
+int run_batch_slice(lc3_machine_t* m, const batch_options_t* options, const struct timespec* start)
+{
+	batch_io_t* io = m->io;
+	unsigned long long budget = options->max_instructions ? options->max_instructions : ~0ULL;
+	int status;
+
+	set_batch_limit(m, options);
+	io->would_block = 0;
+	run_program(m);
+	while ((status = batch_status(m, options, start)) == BATCH_RUNNING && find_loop(m, budget, &io->loop))
+	{
+		if (!m->nevents)
+			return BATCH_STUCK;
+		// Only the next event can break in, so go straight to it and run it
+		skip_loop(m, &io->loop, m->next_event < budget ? m->next_event : budget);
+		m->execution_limit = m->executions + LOOP_SETTLE < budget ? m->executions + LOOP_SETTLE : budget;
+		run_program(m);
+	}
+	return status;
+}
+
+/**
+ * @name 	Batch Status
+ * @brief Works out whether a machine with batch IO attached is done, after it has been run for a while
+ * @param [lc3_machine_t*] m The machine
+ * @param [const batch_options_t*] options Budget and timeout
+ * @param [const struct timespec*] start When the run started (CLOCK_MONOTONIC), for the timeout
+ * @retval The batch_status_t describing how the run ended; BATCH_RUNNING or BATCH_WAITING if it isn't over
+ */
+int batch_status(lc3_machine_t* m, const batch_options_t* options, const struct timespec* start)
+{
+	batch_io_t* io = m->io;
+
+	if (m->halted)
+		return BATCH_HALTED;
+	if (io->eof)
+		return BATCH_NO_INPUT;
+	if (options->max_instructions && m->executions >= options->max_instructions)
+		return BATCH_BUDGET;
+	if (io->timed_out || (options->timeout > 0 && seconds_since(start) >= options->timeout))
+		return BATCH_TIMEOUT;
+	return io->would_block ? BATCH_WAITING : BATCH_RUNNING;
+}
+
+/**
+ * @name 	Run Batch
+ * @brief Runs the program loaded by read_program() headlessly on stdin/stdout until HALT, end of input, the
+ * instruction budget or the timeout
+ * @param [lc3_machine_t*] m The machine to run
+ * @param [const batch_options_t*] options Budget, timeout and reporting options
+ * @retval The batch_status_t describing how the run ended
+ */
+int run_batch(lc3_machine_t* m, const batch_options_t* options)
+{
+	static batch_io_t io;
+	struct timespec start;
+	int status;
+
+	attach_batch_io(m, &io, 0, 1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	// stdin blocks, so GETC/IN have to watch the clock themselves
+	io.start = &start;
+	io.timeout = options->timeout;
+
+	do {
+		status = run_batch_slice(m, options, &start);
+#ifdef LC3_STATS
+		if (m->stats && stats_signalled()
+			&& save_stats(m->stats, NULL, 0, options->stats_path, options->stats_json))
+			fprintf(stderr, "Couldn't write the statistics!\n");
+#endif
+	} while (status < 0);
+
+	flush_batch_io(m);
+	if (status == BATCH_STUCK)
+		fprintf(stderr, "Stuck at x%.4hx-x%.4hx, in a loop of %u instruction%s that changes nothing\n",
+			io.loop.start, io.loop.end, io.loop.period, io.loop.period == 1 ? "" : "s");
+	if (options->dump_state)
+		dump_state(m, status);
+	return status;
+}
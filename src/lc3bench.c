@@ -0,0 +1,175 @@
+/**
+ * @file		lc3bench.c
+ * @brief		Headless benchmark harness
+ *
+ * Times whole runs of each workload on each engine, e.g. `simplx --bench` over the bench/ workloads (or
+ * `make bench`), and reports instructions, MIPS, nanoseconds per instruction and peak resident memory. Every
+ * workload and engine pair is measured in a child process of its own, so peak RSS and engine caches belong to
+ * that pair alone.
+ * Each one is run BENCH_REPEAT times from the same machine, reset_program() in between, and the fastest run
+ * counts, so the cost of translating code the first time doesn't hide the steady state. Output goes to the
+ * batch console and is thrown away; a workload that reads input sees end of input. Where there is no JIT, the
+ * "jit" rows measure the block engine it falls back to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3image.h"
+#include "../include/lc3batch.h"
+#include "../include/lc3bench.h"
+
+static const char* engine_names[] = { "switch", "predecode", "block", "jit" };
+
+/**
+ * @name 	Measure
+ * @brief Loads a workload and times repeated runs of it on one engine
+ * @param [char*] path The workload's object file or source
+ * @param [engine_t] engine Engine to run it on
+ * @param [const bench_options_t*] options Repeat count and budget
+ * @param [bench_result_t*] result Filled in with what was measured
+ * @retval 0 on success, -EINVAL if the workload couldn't be loaded
+ */
+static int measure(char* path, engine_t engine, const bench_options_t* options, bench_result_t* result)
+{
+	static batch_io_t io;
+	struct timespec start;
+	struct rusage usage;
+	lc3_machine_t* m;
+	lc3_image_t* image;
+	double seconds;
+	int r;
+
+	if (!(image = open_images(&path, 1)))
+		return -EINVAL;
+
+	m = create_machine();
+	m->engine = engine;
+	use_image(m, image);
+	release_image(image);
+	attach_batch_io(m, &io, -1, -1);
+
+	result->seconds = -1;
+	for (r=0; r<options->repeat; r++)
+	{
+		if (r)
+			reset_program(m);
+		m->execution_limit = options->max_instructions;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		run_program(m);
+		seconds = seconds_since(&start);
+		if (result->seconds < 0 || seconds < result->seconds)
+			result->seconds = seconds;
+	}
+
+	result->instructions = m->executions;
+	result->halted = m->halted;
+	getrusage(RUSAGE_SELF, &usage);
+	result->peak_rss = usage.ru_maxrss;
+	destroy_machine(m);
+	return 0;
+}
+
+/**
+ * @name 	Print Result
+ * @brief Prints one workload's measurement on one engine, as a table row or a line of JSON
+ * @param [const char*] path The workload's object file
+ * @param [engine_t] engine Engine it ran on
+ * @param [const bench_result_t*] result What was measured
+ * @param [int] json Print JSON instead of a table row
+ */
+static void print_result(const char* path, engine_t engine, const bench_result_t* result, int json)
+{
+	char name[64];
+	const char* base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	char* dot;
+	double seconds = result->seconds > 0 ? result->seconds : 1e-9;
+	double mips = result->instructions / seconds / 1e6;
+	double ns = result->instructions ? seconds * 1e9 / result->instructions : 0;
+
+	snprintf(name, sizeof(name), "%s", base);
+	if ((dot = strrchr(name, '.')))
+		*dot = '\0';
+
+	if (json)
+		printf("{\"workload\":\"%s\",\"engine\":\"%s\",\"instructions\":%llu,\"seconds\":%.6f,\"mips\":%.2f,"
+			"\"ns_per_instruction\":%.3f,\"peak_rss_kb\":%ld,\"halted\":%s}\n", name, engine_names[engine],
+			result->instructions, result->seconds, mips, ns, result->peak_rss, result->halted ? "true" : "false");
+	else
+		printf("%-12s %-10s %12llu %10.4f %10.2f %8.3f %10ld%s\n", name, engine_names[engine],
+			result->instructions, result->seconds, mips, ns, result->peak_rss, result->halted ? "" : "  (didn't halt)");
+}
+
+/**
+ * @name 	Run Bench
+ * @brief Measures every workload on every engine (or the one asked for), each pair in a child process, and
+ * prints the results as they come in
+ * @param [char**] workloads Object files to run, each on its own
+ * @param [int] count Number of workloads
+ * @param [const bench_options_t*] options Engines, repeat count, budget and output format
+ * @retval 0 if every workload halted on every engine, 1 if any didn't, -EINVAL on bad arguments
+ */
+int run_bench(char** workloads, int count, const bench_options_t* options)
+{
+	bench_result_t result;
+	int worst = 0;
+	int status;
+	pid_t pid;
+	int first = options->engine < 0 ? ENGINE_SWITCH : options->engine;
+	int last = options->engine < 0 ? ENGINE_JIT : options->engine;
+	int w;
+	int e;
+
+	if (options->repeat < 1)
+	{
+		printf("Bad argument! Repeat count must be at least 1\n");
+		return -EINVAL;
+	}
+
+	if (!options->json)
+		printf("%-12s %-10s %12s %10s %10s %8s %10s\n", "workload", "engine", "instructions", "seconds", "MIPS",
+			"ns/inst", "rss_kb");
+	for (w=0; w<count; w++)
+		for (e=first; e<=last; e++)
+		{
+			// Whatever the parent has buffered would otherwise be printed by the child too
+			fflush(stdout);
+			if ((pid = fork()) < 0)
+			{
+				perror("fork");
+				return -errno;
+			}
+			if (!pid)
+			{
+				if (measure(workloads[w], e, options, &result))
+				{
+					printf("Bad argument! Couldn't load %s\n", workloads[w]);
+					fflush(stdout);
+					_exit(2);
+				}
+				print_result(workloads[w], e, &result, options->json);
+				fflush(stdout);
+				_exit(result.halted ? 0 : 1);
+			}
+			if (waitpid(pid, &status, 0) < 0)
+				status = 1;
+			else if (WIFSIGNALED(status))
+			{
+				printf("%s crashed on the %s engine (signal %d)\n", workloads[w], engine_names[e], WTERMSIG(status));
+				status = 1;
+			}
+			else
+				status = WEXITSTATUS(status);
+			if (status == 2)
+				return -EINVAL;
+			if (status > worst)
+				worst = status;
+		}
+	return worst;
+}
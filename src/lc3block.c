@@ -0,0 +1,735 @@
+/**
+ * @file		lc3block.c
+ * @brief		Basic-block translation cache with block chaining
+ *
+ * Splits the program into straight-line basic blocks of predecoded instructions and runs each block as a unit:
+ * the instruction count is bumped once per block, and breakpoints are only checked when entering a block.
+ * Translation never extends a block over an address with a breakpoint, and set_breakpoint() flushes any block
+ * that already covers one, so a breakpoint is always the first instruction of its block.
+ * Each block remembers its successors, so hot loops chain from block to block without a lookup.
+ *
+ * A store to an address covered by a block predecodes the new instruction into every block covering it, as long
+ * as it ends a block exactly when the old one did, so the blocks keep their shape. Otherwise the blocks are
+ * retired. Retired blocks are kept (but never entered again) until the next clear_blocks(), so chain pointers to
+ * them never dangle. Once an address has had its blocks retired BLOCK_FLUSH_LIMIT times, blocks end in front of it
+ * and execute_instruction() runs it, so code that keeps rewriting itself stops being translated again and again.
+ * A load or store that reaches the device registers leaves the block, and execute_instruction() runs it.
+ * Each machine has its own cache, allocated the first time it runs blocks.
+ *
+ * While coverage is measured, each block records the addresses it ran when it is left. A block run whole only
+ * records once for each way out of it, so a hot loop pays for coverage the first time round and then no more.
+ * While profiling, each block adds the instructions it ran to the per-address counts when it is left, and a call
+ * or return, which always ends a block, is handed to the profiler there. While statistics are kept, a block run
+ * whole adds its instructions by opcode, counted when it was translated, and the way the BR ending it went.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3block.h"
+#include "../include/lc3cov.h"
+#include "../include/lc3prof.h"
+#include "../include/lc3stats.h"
+
+#define RETIRED_MAX 4096	// Retired blocks kept before the whole cache is thrown away
+
+#ifdef LC3_STATS
+// Opcode each handler stands for; H_DECODE is never counted, as execute_instruction() runs it
+static const unsigned char handler_opcodes[H_COUNT] = {
+	[H_NOP] = BR, [H_BR] = BR, [H_BRA] = BR, [H_ADDR] = ADD, [H_ADDI] = ADD, [H_LD] = LD, [H_ST] = ST, [H_JSR] = JSR,
+	[H_JSRR] = JSR, [H_ANDR] = AND, [H_ANDI] = AND, [H_LDR] = LDR, [H_STR] = STR, [H_NOT] = NOT, [H_LDI] = LDI,
+	[H_STI] = STI, [H_JMP] = JMP, [H_LEA] = LEA, [H_RTI] = RTI, [H_TRAP] = TRAP
+};
+
+// Opcode of a predecoded instruction; an H_NOP with a set is the reserved opcode (see predecode())
+static int op_opcode(const lc3pre_t* op)
+{
+	return op->handler == H_NOP && op->a ? LOLFENDERCODE : handler_opcodes[op->handler];
+}
+
+// Works out which opcodes a block's instructions have, and how many of each
+static void count_opcodes(lc3block_t* block)
+{
+	unsigned char counts[16] = {0};
+	int i;
+
+	for (i=0; i<block->length; i++)
+		counts[op_opcode(&block->ops[i])]++;
+	block->nopcodes = 0;
+	for (i=0; i<16; i++)
+		if (counts[i])
+		{
+			block->opcodes[block->nopcodes] = i;
+			block->opcode_counts[block->nopcodes++] = counts[i];
+		}
+}
+
+// Moves one of a block's instructions from one opcode to another in its counts, if they have been worked out
+static void recount_opcode(lc3block_t* block, int from, int to)
+{
+	int i;
+
+	if (block->nopcodes == BLOCK_UNCOUNTED || from == to)
+		return;
+	for (i=0; block->opcodes[i] != from; i++);
+	block->opcode_counts[i]--;
+	for (i=0; i<block->nopcodes && block->opcodes[i] != to; i++);
+	if (i == block->nopcodes)
+	{
+		block->opcodes[block->nopcodes++] = to;
+		block->opcode_counts[i] = 0;
+	}
+	block->opcode_counts[i]++;
+}
+#endif
+
+/**
+ * @name 	Ends Block
+ * @brief Checks whether a predecoded instruction ends a basic block
+ * @param [unsigned char] handler The predecoded handler of the instruction
+ * @retval 1	the instruction can change the PC (BR, JMP, JSR, JSRR, TRAP, RTI)
+ * @retval 0	the instruction always falls through
+ */
+static int ends_block(unsigned char handler)
+{
+	switch (handler) {
+	case H_BR:
+	case H_BRA:
+	case H_JSR:
+	case H_JSRR:
+	case H_JMP:
+	case H_RTI:
+	case H_TRAP:
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @name 	Translate
+ * @brief Builds the basic block starting at an address and enters it in the cache
+ * @param [lc3_machine_t*] m The machine whose memory holds the block
+ * @param [unsigned short] start The address of the first instruction
+ * @retval The new block
+ */
+static lc3block_t* translate(lc3_machine_t* m, unsigned short start)
+{
+	lc3pre_t ops[BLOCK_MAX];
+	unsigned short address = start;
+	int length = 0;
+	int i;
+
+	if (m->blocks->flushes[start] >= BLOCK_FLUSH_LIMIT)
+		ops[length++].handler = H_DECODE;
+	else do {
+		if (length && (breakpoint_at(m, address) || m->blocks->flushes[address] >= BLOCK_FLUSH_LIMIT))
+			break;
+		predecode(&ops[length], address, m->mem[address]);
+		if (ends_block(ops[length++].handler))
+			break;
+		address++;
+	} while (length < BLOCK_MAX);
+
+	lc3block_t* block = malloc(sizeof(lc3block_t) + (length+1)*sizeof(lc3pre_t));
+	if (!block)
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+
+	block->start = start;
+	block->length = length;
+	block->valid = 1;
+	block->covered = 0;
+	block->succ[0] = NULL;
+	block->succ[1] = NULL;
+	block->next = NULL;
+	memcpy(block->ops, ops, length*sizeof(lc3pre_t));
+	block->ops[length].handler = H_END;
+#ifdef LC3_STATS
+	block->nopcodes = BLOCK_UNCOUNTED;
+#endif
+
+	m->blocks->map[start] = block;
+	for (i=0; i<length; i++)
+		m->blocks->coverage[(unsigned short)(start+i)]++;
+
+	return block;
+}
+
+/**
+ * @name 	Lookup Block
+ * @brief Finds the block starting at an address, translating it if needed
+ * @param [lc3_machine_t*] m The machine to look in
+ * @param [unsigned short] start The address of the first instruction
+ */
+static lc3block_t* lookup_block(lc3_machine_t* m, unsigned short start)
+{
+	return m->blocks->map[start] ? m->blocks->map[start] : translate(m, start);
+}
+
+/**
+ * @name 	Flush Blocks
+ * @brief Retires every block that covers an address
+ * @param [lc3_machine_t*] m The machine that was written
+ * @param [unsigned short] address The address whose translations are stale
+ */
+void flush_blocks(lc3_machine_t* m, unsigned short address)
+{
+	lc3blocks_t* blocks = m->blocks;
+	int i, j;
+
+	if (!blocks)
+		return;
+	for (i=0; i<BLOCK_MAX && blocks->coverage[address]; i++)
+	{
+		unsigned short start = address-i;
+		lc3block_t* block = blocks->map[start];
+		if (!block || block->length <= i)
+			continue;
+
+		blocks->map[start] = NULL;
+		block->valid = 0;
+		for (j=0; j<block->length; j++)
+			blocks->coverage[(unsigned short)(start+j)]--;
+
+		block->next = blocks->retired;
+		blocks->retired = block;
+		blocks->retired_count++;
+	}
+}
+
+/**
+ * @name 	Patch Blocks
+ * @brief Predecodes a rewritten instruction again in every block covering it, unless that would change their shape
+ * @param [lc3_machine_t*] m The machine that was written
+ * @param [unsigned short] address The address that was written
+ * @retval 1	every block covering the address is up to date
+ * @retval 0	the instruction now ends a block where it didn't or the other way round; nothing was changed
+ */
+static int patch_blocks(lc3_machine_t* m, unsigned short address)
+{
+	lc3blocks_t* blocks = m->blocks;
+	lc3block_t* found[BLOCK_MAX];
+	int offset[BLOCK_MAX];
+	lc3block_t* block;
+	lc3pre_t op;
+	int nfound = 0;
+	int i;
+
+	predecode(&op, address, m->mem[address]);
+	// Check every block first, then patch them
+	for (i=0; i<BLOCK_MAX && nfound < blocks->coverage[address]; i++)
+	{
+		block = blocks->map[(unsigned short)(address-i)];
+		if (!block || block->length <= i)
+			continue;
+		if (block->ops[i].handler != H_DECODE && ends_block(block->ops[i].handler) != ends_block(op.handler))
+			return 0;
+		found[nfound] = block;
+		offset[nfound++] = i;
+	}
+	for (i=0; i<nfound; i++)
+	{
+		block = found[i];
+		// Reads mem[] whenever it runs anyway
+		if (block->ops[offset[i]].handler == H_DECODE)
+			continue;
+#ifdef LC3_STATS
+		recount_opcode(block, op_opcode(&block->ops[offset[i]]), op_opcode(&op));
+#endif
+		block->ops[offset[i]] = op;
+		if (ends_block(op.handler))
+		{
+			// The block may now go somewhere else, and a BR ending it has yet to be covered
+			block->succ[0] = NULL;
+			block->succ[1] = NULL;
+			block->covered = 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @name 	Update Blocks
+ * @brief Brings the blocks covering an address up to date after a write to it
+ * @param [lc3_machine_t*] m The machine that was written
+ * @param [unsigned short] address The address that was written
+ * @retval 1	blocks covering the address were retired
+ * @retval 0	they were patched in place, or there were none
+ */
+int update_blocks(lc3_machine_t* m, unsigned short address)
+{
+	lc3blocks_t* blocks = m->blocks;
+
+	if (!blocks || !blocks->coverage[address] || patch_blocks(m, address))
+		return 0;
+	if (blocks->flushes[address] < BLOCK_FLUSH_LIMIT)
+		blocks->flushes[address]++;
+	flush_blocks(m, address);
+	return 1;
+}
+
+/**
+ * @name 	Clear Blocks
+ * @brief Frees every block, live or retired
+ * @param [lc3_machine_t*] m The machine whose cache is emptied
+ */
+void clear_blocks(lc3_machine_t* m)
+{
+	lc3blocks_t* blocks = m->blocks;
+	lc3block_t* block;
+	int i;
+
+	if (!blocks)
+		return;
+	for (i=0; i<65536; i++)
+	{
+		free(blocks->map[i]);
+		blocks->map[i] = NULL;
+	}
+	while (blocks->retired)
+	{
+		block = blocks->retired->next;
+		free(blocks->retired);
+		blocks->retired = block;
+	}
+	blocks->retired_count = 0;
+	memset(blocks->coverage, 0, sizeof(blocks->coverage));
+	memset(blocks->flushes, 0, sizeof(blocks->flushes));
+}
+
+/**
+ * @name 	Free Blocks
+ * @brief Frees a machine's block cache
+ * @param [lc3_machine_t*] m The machine that owns the cache
+ */
+void free_blocks(lc3_machine_t* m)
+{
+	clear_blocks(m);
+	free(m->blocks);
+	m->blocks = NULL;
+}
+
+/**
+ * @name 	Uncover Blocks
+ * @brief Has every live block record its coverage again, once the coverage has been cleared
+ * @param [lc3_machine_t*] m The machine that owns the cache
+ */
+void uncover_blocks(lc3_machine_t* m)
+{
+	int i;
+
+	if (!m->blocks)
+		return;
+	for (i=0; i<65536; i++)
+		if (m->blocks->map[i])
+			m->blocks->map[i]->covered = 0;
+}
+
+/**
+ * @name 	Cover Block
+ * @brief Records the instructions of a block a run got through, and which way a BR ending it went
+ * @param [lc3_coverage_t*] coverage The machine's coverage
+ * @param [lc3block_t*] block The block just left
+ * @param [unsigned long long] ran How many of its instructions ran
+ * @param [int] slot How it was left, as in block->succ: 0 taken, 1 fallen through, -1 any other way
+ */
+static void cover_block(lc3_coverage_t* coverage, lc3block_t* block, unsigned long long ran, int slot)
+{
+	unsigned int i;
+
+	for (i=0; i<ran; i++)
+		cover_address(coverage, block->start+i);
+	if (ran < block->length)
+		return;
+	block->covered |= 1 << (slot+1);
+	if (slot >= 0 && block->ops[block->length-1].handler == H_BR)
+		cover_branch(coverage, block->start+block->length-1, !slot);
+}
+
+/**
+ * @name 	Profile Block
+ * @brief Counts the instructions of a block a run got through, and follows a call or return ending it
+ * @param [lc3_machine_t*] m The profiled machine
+ * @param [lc3block_t*] block The block just left
+ * @param [unsigned long long] ran How many of its instructions ran
+ * @param [unsigned short] next The address the run went on from
+ * @param [unsigned long long] count Instructions run so far
+ */
+static void profile_block(lc3_machine_t* m, lc3block_t* block, unsigned long long ran, unsigned short next,
+	unsigned long long count)
+{
+	lc3pre_t* last = &block->ops[block->length-1];
+	lc3inst_t instruction;
+	unsigned int i;
+
+	for (i=0; i<ran; i++)
+		m->profile->counts[(unsigned short)(block->start+i)]++;
+	if (ran < block->length || (last->handler != H_JSR && last->handler != H_JSRR && last->handler != H_JMP
+		&& last->handler != H_TRAP))
+		return;
+	// profile_control() expects the machine as execute_instruction() leaves it; a TRAP already did that
+	if (last->handler != H_TRAP)
+		m->pc = next;
+	m->executions = count;
+	// It only looks at the opcode and the base register
+	instruction.opcode = last->handler == H_TRAP ? TRAP : (last->handler == H_JMP ? JMP : JSR);
+	instruction.src1reg = last->b;
+	profile_control(m, block->start + block->length-1, &instruction);
+}
+
+#ifdef LC3_STATS
+/**
+ * @name 	Count Block
+ * @brief Adds the instructions of a block a run got through to the statistics, and the BR or TRAP ending it
+ * @param [lc3_stats_t*] stats The machine's statistics
+ * @param [lc3block_t*] block The block just left
+ * @param [unsigned long long] ran How many of its instructions ran
+ * @param [int] slot How it was left, as in block->succ: 0 taken, 1 fallen through, -1 any other way
+ */
+static void count_block(lc3_stats_t* stats, lc3block_t* block, unsigned long long ran, int slot)
+{
+	lc3pre_t* last = &block->ops[block->length-1];
+	unsigned int i;
+
+	if (ran < block->length)
+	{
+		for (i=0; i<ran; i++)
+			stats->opcodes[op_opcode(&block->ops[i])]++;
+		return;
+	}
+	if (block->nopcodes == BLOCK_UNCOUNTED)
+		count_opcodes(block);
+	for (i=0; i<block->nopcodes; i++)
+		stats->opcodes[block->opcodes[i]] += block->opcode_counts[i];
+	if (last->handler == H_BR)
+	{
+		if (slot == 0)
+			stats->taken++;
+		else
+			stats->not_taken++;
+	}
+	else if (last->handler == H_BRA)
+		stats->taken++;
+	else if (last->handler == H_TRAP)
+		stats->traps[last->imm & TRAP_MASK]++;
+}
+
+#define COUNT_BLOCK()	if (stats) count_block(stats, block, count - begin, slot)
+// Whether the store at entry, while statistics are kept, is over an instruction of the block that already ran
+#define OVER_RAN()	(stats && (unsigned short)(target - block->start) <= entry - block->ops)
+#else
+#define COUNT_BLOCK()
+#define OVER_RAN()	0
+#endif
+
+// Records what ran of the block just left for the coverage, the profile and the statistics; begin moves up, so it's
+// only done once
+#define RECORD()	do { \
+		if (count != begin) { \
+			if (coverage && (count - begin < block->length || !(block->covered & (1 << (slot+1))))) \
+				cover_block(coverage, block, count - begin, slot); \
+			if (profile) \
+				profile_block(m, block, count - begin, address, count); \
+			COUNT_BLOCK(); \
+			begin = count; \
+		} \
+	} while (0)
+
+// Condition codes are kept as the last value written to a register, as in lc3pre.c
+#define CCBIT(v) ((short)(v) < 0 ? 4 : ((v) == 0 ? 2 : 1))
+#define CCVAL(v) ((short)(v) < 0 ? -1 : ((v) != 0))
+
+#ifdef __GNUC__
+#define HANDLER(h)	h:
+#define DISPATCH()	goto *labels[entry->handler]
+#else
+#define HANDLER(h)	case h:
+#define DISPATCH()	continue
+#endif
+
+// Move on to the next instruction of the block
+#define NEXT()	do { entry++; DISPATCH(); } while (0)
+
+// Address of the instruction after the current one
+#define FOLLOWING()	(unsigned short)(block->start + (entry - block->ops) + 1)
+
+/**
+ * @name 	Run Blocks
+ * @brief Runs the program from the current PC one basic block at a time until HALT or a breakpoint
+ * @param [lc3_machine_t*] m The machine to run
+ *
+ * Registers live in a local copy while blocks run, so stores to mem[] can't force them to be reloaded.
+ * Leaves the machine's pc, ir, cc, executions and next_inst exactly as the same number of step_forward() calls would.
+ */
+void run_blocks(lc3_machine_t* m)
+{
+#ifdef __GNUC__
+	static void* labels[H_COUNT] = {
+		&&H_DECODE, &&H_NOP, &&H_BR, &&H_BRA, &&H_ADDR, &&H_ADDI, &&H_LD, &&H_ST, &&H_JSR, &&H_JSRR,
+		&&H_ANDR, &&H_ANDI, &&H_LDR, &&H_STR, &&H_NOT, &&H_LDI, &&H_STI, &&H_JMP, &&H_LEA, &&H_RTI, &&H_TRAP,
+		&&H_END
+	};
+#endif
+	unsigned short r[8];
+	unsigned short* mem = m->mem;
+	unsigned short address = m->pc-1;
+	unsigned short target;
+	unsigned long long count = m->executions;
+	unsigned long long begin;						// count when the block was entered
+	unsigned long long limit = run_limit(m);
+	short result = m->cc;
+	lc3blocks_t* blocks;
+	lc3block_t* block;
+	lc3block_t* successor;
+	lc3pre_t* entry;
+	lc3_coverage_t* coverage = m->coverage;
+	lc3_profile_t* profile = m->profile;
+#ifdef LC3_STATS
+	lc3_stats_t* stats = m->stats;
+#endif
+	int slot;
+
+	if (m->halted)
+		return;
+
+	if (!m->blocks && !(m->blocks = calloc(1, sizeof(lc3blocks_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	blocks = m->blocks;
+
+	// Stop on a fresh breakpoint, or step past the one we stopped on last time
+	if (breakpoint_at(m, address) == 1)
+	{
+		set_breakpoint_state(m, address, 2);
+		m->running = 0;
+		return;
+	}
+	if (breakpoint_at(m, address) == 2)
+		set_breakpoint_state(m, address, 1);
+
+	memcpy(r, m->regfile, sizeof(r));
+	block = lookup_block(m, address);
+
+run:
+	entry = block->ops;
+	begin = count;
+	slot = -1;
+	// A block that could run past the limit (the next event, say) is stepped through instead, so runs stop on it exactly
+	if (count + block->length > limit)
+		goto interpreted;
+#ifndef __GNUC__
+	for (;;)
+	switch (entry->handler) {
+#endif
+	DISPATCH();
+
+	HANDLER(H_ADDR)
+		r[entry->a] = r[entry->b] + r[entry->c];
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_ADDI)
+		r[entry->a] = r[entry->b] + entry->imm;
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_ANDR)
+		r[entry->a] = r[entry->b] & r[entry->c];
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_ANDI)
+		r[entry->a] = r[entry->b] & entry->imm;
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_NOT)
+		r[entry->a] = ~r[entry->b];
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_LD)
+		if (entry->imm >= DEVICE_BASE)
+			goto interpreted;
+		r[entry->a] = mem[entry->imm];
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_LDR)
+		target = r[entry->b] + entry->imm;
+		if (target >= DEVICE_BASE)
+			goto interpreted;
+		r[entry->a] = mem[target];
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_LDI)
+		target = mem[entry->imm];
+		if (entry->imm >= DEVICE_BASE || target >= DEVICE_BASE)
+			goto interpreted;
+		r[entry->a] = mem[target];
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_LEA)
+		r[entry->a] = entry->imm;
+		result = r[entry->a];
+		NEXT();
+	HANDLER(H_ST)
+		target = entry->imm;
+		goto store;
+	HANDLER(H_STR)
+		target = r[entry->b] + entry->imm;
+		goto store;
+	HANDLER(H_STI)
+		if (entry->imm >= DEVICE_BASE)
+			goto interpreted;
+		target = mem[entry->imm];
+store:
+		if (target >= DEVICE_BASE)
+			goto interpreted;
+		mem[target] = r[entry->a];
+		mark_dirty(m, target);
+		invalidate_predecoded(m, target);
+		if (m->jit && m->jit->coverage[target])
+			jit_flush(m, target);
+		if (blocks->coverage[target] && (OVER_RAN() || update_blocks(m, target)))
+		{
+			// The rest of this block (or its successors) may be stale; leave it after this store. A store over what
+			// already ran of it is counted for the statistics first, while the block still holds what ran
+			count += entry - block->ops + 1;
+			address = FOLLOWING();
+			slot = -1;
+			if (OVER_RAN())
+			{
+				RECORD();
+				update_blocks(m, target);
+			}
+			goto chain;
+		}
+		NEXT();
+	HANDLER(H_NOP)
+		NEXT();
+	HANDLER(H_END)
+		count += block->length;
+		address = block->start + block->length;
+		slot = 1;
+		goto chain;
+	HANDLER(H_RTI)
+	HANDLER(H_DECODE)
+		goto interpreted;
+	HANDLER(H_BR)
+		count += block->length;
+		if (entry->a & CCBIT(result))
+		{
+			address = entry->imm;
+			slot = 0;
+		}
+		else
+		{
+			address = FOLLOWING();
+			slot = 1;
+		}
+		goto chain;
+	HANDLER(H_BRA)
+		count += block->length;
+		address = entry->imm;
+		slot = 0;
+		goto chain;
+	HANDLER(H_JSR)
+		count += block->length;
+		r[7] = FOLLOWING();
+		address = entry->imm;
+		slot = 0;
+		goto chain;
+	HANDLER(H_JSRR)
+	HANDLER(H_JMP)
+		count += block->length;
+		target = r[entry->b];
+		r[7] = FOLLOWING();
+		address = target;
+		slot = -1;
+		goto chain;
+	HANDLER(H_TRAP)
+		// Service routines work on the machine, so bring it up to date first
+		count += block->length - 1;
+		m->pc = FOLLOWING();
+		m->ir = mem[(unsigned short)(m->pc-1)];
+		m->cc = CCVAL(result);
+		m->executions = count;
+		memcpy(m->regfile, r, sizeof(r));
+		if (execute_trap(m, entry->imm))
+		{
+			// Waiting for input; stop in front of the trap so it runs again next time
+			address = m->pc-1;
+			m->running = 0;
+			goto stop;
+		}
+		memcpy(r, m->regfile, sizeof(r));
+		result = m->cc;
+		count++;
+		// A HALT stays in front of itself, as in step_forward()
+		address = m->halted ? m->pc-1 : m->pc;
+		slot = -1;
+		if (m->halted || !m->running)
+			goto stop;
+		goto chain;
+#ifndef __GNUC__
+	}
+#endif
+
+interpreted:
+	// Device registers and RTI have effects only execute_instruction() knows about, which may schedule events;
+	// H_DECODE stands for an instruction that keeps being rewritten, and the first instruction of a block that could
+	// run past the limit comes here too
+	count += entry - block->ops;
+	address = FOLLOWING() - 1;
+	RECORD();
+	m->cc = CCVAL(result);
+	m->executions = count;
+	memcpy(m->regfile, r, sizeof(r));
+	target = interpret(m, address);
+	memcpy(r, m->regfile, sizeof(r));
+	result = m->cc;
+	count = m->executions;
+	// execute_instruction() recorded the instruction itself
+	begin = count;
+	limit = run_limit(m);
+	if (m->halted || !m->running)
+		goto fetch;
+	address = target;
+	slot = -1;
+
+chain:
+	RECORD();
+	if (breakpoint_at(m, address) || count >= limit)
+		goto stop;
+	if (blocks->retired_count > RETIRED_MAX)
+	{
+		// Too much self-modifying churn; start over rather than keep dead blocks around
+		clear_blocks(m);
+		block = lookup_block(m, address);
+		goto run;
+	}
+	successor = slot >= 0 ? block->succ[slot] : NULL;
+	if (!successor || !successor->valid)
+	{
+		successor = lookup_block(m, address);
+		if (slot >= 0)
+			block->succ[slot] = successor;
+	}
+	block = successor;
+	goto run;
+
+stop:
+	// Stopped in front of the instruction at address; fetch it like step_forward() does
+	if (breakpoint_at(m, address) == 1 && m->running)
+		set_breakpoint_state(m, address, 2);
+	m->running = 0;
+fetch:
+	RECORD();
+	memcpy(m->regfile, r, sizeof(r));
+	m->pc = address+1;
+	m->ir = mem[address];
+	decode_instruction(&m->next_inst, m->ir);
+	m->cc = CCVAL(result);
+	m->executions = count;
+}
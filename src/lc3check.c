@@ -0,0 +1,567 @@
+/**
+ * @file		lc3check.c
+ * @brief		Differential checker for the execution engines, and a fuzzer to feed it
+ *
+ * `simplx --check program.obj` runs the program on the switch engine, the reference, and on each faster engine
+ * side by side. The engine under test is run a step at a time (execution_limit up to CHECK_STEP past where it is,
+ * so that blocks run whole as well as being cut short), the reference is stepped to the same instruction count,
+ * and registers, PC, IR, CC, the interrupt state, the output so far and every page either machine wrote are
+ * compared. The first difference is reported with the instructions the reference ran leading up to it. Every
+ * engine takes events (an interrupt, say) on the instruction they come due, so an engine that takes one late or
+ * early diverges too.
+ *
+ * `simplx --fuzz=N` does the same for N generated programs: random mixes of every instruction but RTI, with
+ * branch and jump targets inside the program, loads and stores confined to a data area (R6 points at it and is
+ * never written), and some stores of harmless instructions over the program's own code. Every other program also
+ * takes interrupts: it installs timer and keyboard service routines that end in RTI, starts the timer with
+ * interrupts enabled, and loads from and stores to the device registers through pointers. A program that diverges
+ * is saved as fuzz-SEED.obj, to be run again with --check.
+ *
+ * Both sides read the same endless stream of keys. The checker owns its machines and clears their dirty pages as
+ * it goes, so they can't be reset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3image.h"
+#include "../include/lc3device.h"
+#include "../include/lc3event.h"
+#include "../include/lc3check.h"
+
+#define FUZZ_SETUP 34		// Words between the first two instructions and the code, in a program that takes interrupts
+
+static const char* engine_names[] = { "switch", "predecode", "block", "jit" };
+
+// Device registers a generated program that takes interrupts reaches through pointers; TIR comes last, as only the
+// setup stores to it
+static const unsigned short fuzz_devices[] = { KBSR_ADDRESS, KBDR_ADDRESS, DSR_ADDRESS, DDR_ADDRESS, TSR_ADDRESS,
+	TIR_ADDRESS };
+#define FUZZ_DEVICES ((int)(sizeof(fuzz_devices)/sizeof(fuzz_devices[0])))
+
+// Input and output of one checked machine
+typedef struct {
+	unsigned long long keys;					// Keys read so far; the next is 'a' + keys % 26
+	unsigned long long output;				// Characters written
+	unsigned long long output_hash;
+} check_io_t;
+
+static int check_read_key(lc3_machine_t* m, int print)
+{
+	check_io_t* io = m->io;
+
+	m->regfile[0] = 'a' + io->keys++ % 26;
+	if (print)
+		m->write_char(m, (char)m->regfile[0]);
+	return 1;
+}
+
+static int check_key_ready(lc3_machine_t* m)
+{
+	return 1;
+}
+
+static void check_write_char(lc3_machine_t* m, char c)
+{
+	check_io_t* io = m->io;
+
+	io->output++;
+	io->output_hash = (io->output_hash ^ (unsigned char)c) * 1099511628211ULL;
+}
+
+static lc3_machine_t* create_checked(lc3_image_t* image, engine_t engine, check_io_t* io)
+{
+	lc3_machine_t* m = create_machine();
+
+	m->engine = engine;
+	use_image(m, image);
+	memset(io, 0, sizeof(check_io_t));
+	m->io = io;
+	m->read_key = check_read_key;
+	m->key_ready = check_key_ready;
+	m->write_char = check_write_char;
+	return m;
+}
+
+static unsigned long long next_random(unsigned long long* state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+// A random number below n
+static unsigned int pick(unsigned long long* state, unsigned int n)
+{
+	return (unsigned int)(next_random(state) >> 32) % n;
+}
+
+// Counts (and prints, if asked) a field that differs
+static int differ(const char* name, unsigned long long expected, unsigned long long actual, engine_t engine, int print)
+{
+	if (expected == actual)
+		return 0;
+	if (print)
+		printf("  %-12s x%.4llx (switch)  x%.4llx (%s)\n", name, expected, actual, engine_names[engine]);
+	return 1;
+}
+
+/**
+ * @name 	Differences
+ * @brief Compares the machine under test with the reference
+ * @param [lc3_machine_t*] ref The reference, on the switch engine
+ * @param [lc3_machine_t*] test The machine under test
+ * @param [int] print Print each difference
+ * @retval The number of differences, counting at most CHECK_SHOWN words of memory
+ *
+ * Memory is compared on the pages either machine has written since the last time they agreed.
+ */
+static int differences(lc3_machine_t* ref, lc3_machine_t* test, int print)
+{
+	check_io_t* ref_io = ref->io;
+	check_io_t* test_io = test->io;
+	engine_t engine = test->engine;
+	char name[16];
+	unsigned long long ref_pages;
+	unsigned long long test_pages;
+	unsigned int page;
+	unsigned int address;
+	int n = 0;
+	int words = 0;
+	int i;
+
+	for (i=0; i<8; i++)
+	{
+		if (ref->regfile[i] == test->regfile[i])
+			continue;
+		snprintf(name, sizeof(name), "R%d", i);
+		n += differ(name, ref->regfile[i], test->regfile[i], engine, print);
+	}
+	n += differ("PC", ref->pc, test->pc, engine, print);
+	n += differ("IR", ref->ir, test->ir, engine, print);
+	n += differ("CC", (unsigned short)ref->cc, (unsigned short)test->cc, engine, print);
+	n += differ("halted", ref->halted, test->halted, engine, print);
+	n += differ("executions", ref->executions, test->executions, engine, print);
+	n += differ("Saved_SSP", ref->saved_ssp, test->saved_ssp, engine, print);
+	n += differ("Saved_USP", ref->saved_usp, test->saved_usp, engine, print);
+	n += differ("next event", ref->next_event, test->next_event, engine, print);
+	n += differ("keys read", ref_io->keys, test_io->keys, engine, print);
+	n += differ("output", ref_io->output, test_io->output, engine, print);
+	n += differ("output hash", ref_io->output_hash, test_io->output_hash, engine, print);
+
+	for (page=0; page<DIRTY_PAGES && words<CHECK_SHOWN; page++)
+	{
+		// Usually no page or one is dirty, so skip eight clean ones at a time
+		if (!(page & 7))
+		{
+			memcpy(&ref_pages, &ref->dirty[page], 8);
+			memcpy(&test_pages, &test->dirty[page], 8);
+			if (!(ref_pages | test_pages))
+			{
+				page += 7;
+				continue;
+			}
+		}
+		if (!ref->dirty[page] && !test->dirty[page])
+			continue;
+		for (address = page << DIRTY_SHIFT; address < (page+1) << DIRTY_SHIFT && words < CHECK_SHOWN; address++)
+		{
+			if (ref->mem[address] == test->mem[address])
+				continue;
+			snprintf(name, sizeof(name), "mem[x%.4x]", address);
+			words += differ(name, ref->mem[address], test->mem[address], engine, print);
+		}
+	}
+	return n + words;
+}
+
+/**
+ * @name 	Check Image
+ * @brief Runs a program on the switch engine and another side by side, stopping at the first difference
+ * @param [lc3_image_t*] image The program
+ * @param [const char*] name What to call it in the report
+ * @param [engine_t] engine The engine under test
+ * @param [unsigned long long] budget Instructions to compare before calling it a match
+ * @param [unsigned long long*] compared Where to add the number of instructions compared
+ * @retval 0 if the engines agreed throughout, 1 if they diverged
+ */
+static int check_image(lc3_image_t* image, const char* name, engine_t engine, unsigned long long budget,
+	unsigned long long* compared)
+{
+	check_io_t ref_io;
+	check_io_t test_io;
+	lc3_machine_t* ref = create_checked(image, ENGINE_SWITCH, &ref_io);
+	lc3_machine_t* test = create_checked(image, engine, &test_io);
+	unsigned short trail[CHECK_TRAIL];
+	unsigned long long ntrail = 0;
+	unsigned long long state = 0x9E3779B97F4A7C15ULL;
+	unsigned long long before;
+	unsigned long long i;
+	char text[DISASM_MAX];
+	int diverged = 0;
+	unsigned short address;
+
+	while (!test->halted && test->executions < budget)
+	{
+		before = test->executions;
+		// Steps of varying length, so the block-based engines run whole blocks and also stop inside them
+		test->execution_limit = test->executions + 1 + pick(&state, CHECK_STEP);
+		run_program(test);
+		while (ref->executions < test->executions && !ref->halted)
+		{
+			trail[ntrail++ % CHECK_TRAIL] = ref->pc-1;
+			step_forward(ref);
+		}
+		if (differences(ref, test, 0) || (test->executions == before && !test->halted))
+		{
+			diverged = 1;
+			break;
+		}
+		memset(ref->dirty, 0, sizeof(ref->dirty));
+		memset(test->dirty, 0, sizeof(test->dirty));
+	}
+
+	if (diverged)
+	{
+		printf("%s: %s diverges from switch between instructions %llu and %llu\n", name, engine_names[engine], before,
+			test->executions);
+		if (!differences(ref, test, 1))
+			printf("  %s stopped making progress\n", engine_names[engine]);
+		printf("  last instructions the switch engine ran:\n");
+		for (i = ntrail > CHECK_TRAIL ? ntrail - CHECK_TRAIL : 0; i < ntrail; i++)
+		{
+			address = trail[i % CHECK_TRAIL];
+			disassemble_to_str(&image->symbols, address, ref->mem[address], text);
+			printf("    x%.4hx  x%.4hx  %s\n", address, ref->mem[address], text);
+		}
+	}
+	*compared += test->executions;
+	destroy_machine(ref);
+	destroy_machine(test);
+	return diverged;
+}
+
+/**
+ * @name 	Run Check
+ * @brief Compares every engine (or the one asked for) with the switch engine on each program
+ * @param [char**] programs Object files or sources, each checked on its own
+ * @param [int] count Number of programs
+ * @param [const check_options_t*] options Engine and budget
+ * @retval 0 if every engine agreed on every program, 1 if any diverged, -EINVAL on bad arguments
+ */
+int run_check(char** programs, int count, const check_options_t* options)
+{
+	unsigned long long budget = options->max_instructions ? options->max_instructions : CHECK_BUDGET;
+	unsigned long long compared;
+	int first = options->engine < 0 ? ENGINE_PREDECODE : options->engine;
+	int last = options->engine < 0 ? ENGINE_JIT : options->engine;
+	lc3_image_t* image;
+	int worst = 0;
+	int p;
+	int e;
+
+	for (p=0; p<count; p++)
+	{
+		if (!(image = open_images(&programs[p], 1)))
+		{
+			if (errno != ENOEXEC)
+				printf("Bad argument! Couldn't load %s\n", programs[p]);
+			return -EINVAL;
+		}
+		for (e=first; e<=last; e++)
+		{
+			compared = 0;
+			if (check_image(image, programs[p], e, budget, &compared))
+				worst = 1;
+			else
+				printf("%s: %s agrees with switch over %llu instructions\n", programs[p], engine_names[e], compared);
+		}
+		release_image(image);
+	}
+	return worst;
+}
+
+// PC-relative offset field from the instruction at address to target
+static unsigned short offset(unsigned short address, unsigned short target, unsigned short mask)
+{
+	return (unsigned short)(target - (address+1)) & mask;
+}
+
+/**
+ * @name 	Generate
+ * @brief Writes a random program as an object file
+ * @param [unsigned long long] seed Which program; the same seed always gives the same one
+ * @param [FILE*] file Where to write it
+ *
+ * Laid out at x3000 as: LEA R6 to the middle of the data, LEA R7 to the HALT, FUZZ_LENGTH words of random code,
+ * HALT, the data, pointers into it, and the harmless instructions. Everything is within PC-relative reach of
+ * everything else.
+ *
+ * Odd seeds give programs that take interrupts, with FUZZ_SETUP more words ahead of the code: the setup, which
+ * installs the service routines in the vector table, sets TIR and enables timer interrupts in TSR, then branches
+ * to the code; pointers to the device registers and the vector table entries; the constants and the words the
+ * service routines save R5 in; and the two service routines. The timer's does a couple of random ALU instructions
+ * and acknowledges the interrupt; the keyboard's reads KBDR and turns keyboard interrupts off. Their code also
+ * loads and stores the device registers, directly and through R5, and sometimes enables keyboard interrupts.
+ */
+static void generate(unsigned long long seed, FILE* file)
+{
+	unsigned short words[2 + FUZZ_SETUP + FUZZ_LENGTH + 1 + FUZZ_DATA + FUZZ_POINTERS + FUZZ_SAFE];
+	unsigned short origin = 0x3000;
+	unsigned short setup = origin + 2;
+	unsigned short devices = setup + 9;
+	unsigned short vectors = devices + FUZZ_DEVICES;
+	unsigned short constants = vectors + 2;
+	unsigned short timer = constants + 4;
+	unsigned short keyboard = timer + 7;
+	int interrupts = seed & 1;
+	unsigned short body = interrupts ? setup + FUZZ_SETUP : setup;
+	unsigned short end = body + FUZZ_LENGTH;
+	unsigned short data = end + 1;
+	unsigned short pointers = data + FUZZ_DATA;
+	unsigned short safe = pointers + FUZZ_POINTERS;
+	unsigned short count = safe + FUZZ_SAFE - origin;
+	unsigned long long state = (seed + 1) * 0x9E3779B97F4A7C15ULL;
+	unsigned short address;
+	unsigned short target;
+	unsigned short* w;
+	int dr;
+	int i;
+
+	// Results only ever go to R0-R4: R5 is for the two-word sequences, R6 the data pointer, R7 the return address
+	words[0] = 0xE000 | 6 << 9 | offset(origin, data + FUZZ_DATA/2, 0x1FF);		// LEA R6, middle of data
+	words[1] = 0xE000 | 7 << 9 | offset(origin+1, end, 0x1FF);								// LEA R7, HALT
+	if (interrupts)
+	{
+		w = &words[setup - origin];
+		w[0] = 0xE000 | 5 << 9 | offset(setup, timer, 0x1FF);												// LEA R5, timer's routine
+		w[1] = 0xB000 | 5 << 9 | offset(setup+1, vectors+1, 0x1FF);									// STI R5, its vector
+		w[2] = 0xE000 | 5 << 9 | offset(setup+2, keyboard, 0x1FF);										// LEA R5, keyboard's routine
+		w[3] = 0xB000 | 5 << 9 | offset(setup+3, vectors, 0x1FF);										// STI R5, its vector
+		w[4] = 0x2000 | 5 << 9 | offset(setup+4, constants+1, 0x1FF);								// LD R5, interval
+		w[5] = 0xB000 | 5 << 9 | offset(setup+5, devices + FUZZ_DEVICES-1, 0x1FF);	// STI R5, TIR
+		w[6] = 0x2000 | 5 << 9 | offset(setup+6, constants, 0x1FF);									// LD R5, DEVICE_IE
+		w[7] = 0xB000 | 5 << 9 | offset(setup+7, devices+4, 0x1FF);									// STI R5, TSR
+		w[8] = 0x0E00 | offset(setup+8, body, 0x1FF);																// BRnzp to the code
+		for (i=0; i<FUZZ_DEVICES; i++)
+			words[devices - origin + i] = fuzz_devices[i];
+		words[vectors - origin] = IVT_BASE + KEYBOARD_VECTOR;
+		words[vectors - origin + 1] = IVT_BASE + TIMER_VECTOR;
+		words[constants - origin] = DEVICE_IE;
+		words[constants - origin + 1] = 20 + pick(&state, FUZZ_INTERVAL - 20);
+		words[constants - origin + 2] = 0;
+		words[constants - origin + 3] = 0;
+		w = &words[timer - origin];
+		w[0] = 0x3000 | 5 << 9 | offset(timer, constants+2, 0x1FF);									// ST R5
+		for (i=1; i<3; i++)
+			w[i] = (pick(&state, 2) ? 0x1000 : 0x5000) | pick(&state, 5) << 9
+				| pick(&state, 8) << 6 | 0x20 | pick(&state, 32);														// ADD/AND
+		w[3] = 0x2000 | 5 << 9 | offset(timer+3, constants, 0x1FF);									// LD R5, DEVICE_IE
+		w[4] = 0xB000 | 5 << 9 | offset(timer+4, devices+4, 0x1FF);									// STI R5, TSR
+		w[5] = 0x2000 | 5 << 9 | offset(timer+5, constants+2, 0x1FF);								// LD R5
+		w[6] = 0x8000;																																// RTI
+		w = &words[keyboard - origin];
+		w[0] = 0x3000 | 5 << 9 | offset(keyboard, constants+3, 0x1FF);							// ST R5
+		w[1] = 0xA000 | 5 << 9 | offset(keyboard+1, devices+1, 0x1FF);							// LDI R5, KBDR
+		w[2] = 0x5000 | 5 << 9 | 5 << 6 | 0x20;																				// AND R5, R5, #0
+		w[3] = 0xB000 | 5 << 9 | offset(keyboard+3, devices, 0x1FF);									// STI R5, KBSR
+		w[4] = 0x2000 | 5 << 9 | offset(keyboard+4, constants+3, 0x1FF);						// LD R5
+		w[5] = 0x8000;																																// RTI
+	}
+	for (address = body; address < end; address++)
+	{
+		w = &words[address - origin];
+		dr = pick(&state, 5);
+		switch (pick(&state, interrupts ? 36 : 32)) {
+		case 0: case 1: case 2: case 3: case 4: case 5:
+			*w = 0x1000 | dr << 9 | pick(&state, 8) << 6
+				| (pick(&state, 2) ? 0x20 | pick(&state, 32) : pick(&state, 8));							// ADD
+			break;
+		case 6: case 7: case 8:
+			*w = 0x5000 | dr << 9 | pick(&state, 8) << 6
+				| (pick(&state, 2) ? 0x20 | pick(&state, 32) : pick(&state, 8));							// AND
+			break;
+		case 9:
+			*w = 0x903F | dr << 9 | pick(&state, 8) << 6;																// NOT
+			break;
+		case 10:
+			*w = 0xE000 | dr << 9 | offset(address, origin + pick(&state, count), 0x1FF);		// LEA
+			break;
+		case 11: case 12:
+			*w = 0x2000 | dr << 9 | offset(address, origin + pick(&state, count), 0x1FF);		// LD
+			break;
+		case 13: case 14:
+			*w = 0x6000 | dr << 9 | 6 << 6 | pick(&state, 64);													// LDR
+			break;
+		case 15:
+			*w = 0xA000 | dr << 9 | offset(address, pointers + pick(&state, FUZZ_POINTERS), 0x1FF);	// LDI
+			break;
+		case 16: case 17:
+			*w = 0x3000 | pick(&state, 8) << 9 | offset(address, data + pick(&state, FUZZ_DATA), 0x1FF);	// ST
+			break;
+		case 18: case 19:
+			*w = 0x7000 | pick(&state, 8) << 9 | 6 << 6 | pick(&state, 64);							// STR
+			break;
+		case 20:
+			*w = 0xB000 | pick(&state, 8) << 9 | offset(address, pointers + pick(&state, FUZZ_POINTERS), 0x1FF);	// STI
+			break;
+		case 21: case 22: case 23: case 24:
+			// Mostly forward, so most programs get to the HALT
+			if (pick(&state, 10) < 7)
+				target = address + 1 + pick(&state, end - address);
+			else
+				target = body + pick(&state, address - body + 1);
+			*w = pick(&state, 8) << 9 | offset(address, target, 0x1FF);									// BR
+			break;
+		case 25:
+			*w = 0x4800 | offset(address, body + pick(&state, FUZZ_LENGTH + 1), 0x7FF);		// JSR
+			break;
+		case 26:
+			if (address + 1 == end)
+				goto nop;
+			*w = 0xE000 | 5 << 9 | offset(address, body + pick(&state, FUZZ_LENGTH + 1), 0x1FF);	// LEA R5
+			w[1] = (pick(&state, 2) ? 0xC000 : 0x4000) | 5 << 6;											// JMP/JSRR R5
+			address++;
+			break;
+		case 27:
+			*w = 0xC1C0;																																// RET
+			break;
+		case 28:
+			switch (pick(&state, 5)) {
+			case 0: *w = 0xF020; break;		// GETC
+			case 1: *w = 0xF021; break;		// OUT
+			case 2: *w = 0xF023; break;		// IN
+			case 3: *w = 0xF080; break;		// UDIV
+			default:
+				if (address + 1 == end)
+					goto nop;
+				*w = 0xE000 | offset(address, data + pick(&state, FUZZ_DATA), 0x1FF);				// LEA R0
+				w[1] = pick(&state, 2) ? 0xF022 : 0xF024;																		// PUTS/PUTSP
+				address++;
+				break;
+			}
+			break;
+		case 29:
+			if (address + 1 == end)
+				goto nop;
+			*w = 0x2000 | 5 << 9 | offset(address, safe + pick(&state, FUZZ_SAFE), 0x1FF);		// LD R5
+			w[1] = 0x3000 | 5 << 9 | offset(address+1, body + pick(&state, FUZZ_LENGTH), 0x1FF);	// ST R5
+			address++;
+			break;
+		case 30:
+			*w = 0xD000 | pick(&state, 0x1000);																					// Reserved
+			break;
+		case 32:
+			*w = 0xA000 | dr << 9 | offset(address, devices + pick(&state, FUZZ_DEVICES), 0x1FF);		// LDI device
+			break;
+		case 33:
+			*w = 0xB000 | pick(&state, 8) << 9 | offset(address, devices + pick(&state, FUZZ_DEVICES-1), 0x1FF);	// STI
+			break;
+		case 34: case 35:
+			if (address + 1 == end)
+				goto nop;
+			if (pick(&state, 2))
+			{
+				*w = 0x2000 | 5 << 9 | offset(address, devices + pick(&state, FUZZ_DEVICES), 0x1FF);	// LD R5, device
+				w[1] = 0x6000 | dr << 9 | 5 << 6;																					// LDR through R5
+			}
+			else
+			{
+				*w = 0x2000 | 5 << 9 | offset(address, devices + pick(&state, FUZZ_DEVICES-1), 0x1FF);	// LD R5, device
+				w[1] = 0x7000 | pick(&state, 8) << 9 | 5 << 6;																// STR through R5
+			}
+			address++;
+			break;
+		default:
+		nop:
+			*w = pick(&state, 0x200);																										// BR never taken
+			if (*w >> 9)
+				*w = 0;
+			break;
+		}
+	}
+	words[end - origin] = 0xF025;																										// HALT
+	for (i=0; i<FUZZ_DATA; i++)
+		words[data - origin + i] = (unsigned short)next_random(&state);
+	for (i=0; i<FUZZ_POINTERS; i++)
+		words[pointers - origin + i] = data + pick(&state, FUZZ_DATA);
+	for (i=0; i<FUZZ_SAFE; i++)
+		words[safe - origin + i] = (pick(&state, 2) ? 0x1000 : 0x5000) | pick(&state, 5) << 9
+			| pick(&state, 8) << 6 | 0x20 | pick(&state, 32);
+
+	fputc(origin >> 8, file);
+	fputc(origin & 0xFF, file);
+	fputc(count >> 8, file);
+	fputc(count & 0xFF, file);
+	for (i=0; i<count; i++)
+	{
+		fputc(words[i] >> 8, file);
+		fputc(words[i] & 0xFF, file);
+	}
+}
+
+/**
+ * @name 	Run Fuzz
+ * @brief Generates random programs and checks every engine (or the one asked for) against the switch engine on
+ * each, until one diverges
+ * @param [const check_options_t*] options Engine, budget, first seed and number of programs
+ * @retval 0 if every engine agreed on every program, 1 if one diverged, -EINVAL on bad arguments
+ */
+int run_fuzz(const check_options_t* options)
+{
+	unsigned long long budget = options->max_instructions ? options->max_instructions : FUZZ_BUDGET;
+	unsigned long long compared = 0;
+	unsigned long long seed;
+	int first = options->engine < 0 ? ENGINE_PREDECODE : options->engine;
+	int last = options->engine < 0 ? ENGINE_JIT : options->engine;
+	char name[64];
+	lc3_image_t* image;
+	FILE* file;
+	int p;
+	int e;
+
+	if (options->count < 1)
+	{
+		printf("Bad argument! Fuzz at least one program\n");
+		return -EINVAL;
+	}
+
+	for (p=0; p<options->count; p++)
+	{
+		seed = options->seed + p;
+		if (!(file = tmpfile()))
+		{
+			printf("Couldn't create a temporary file!\n");
+			return -EIO;
+		}
+		generate(seed, file);
+		rewind(file);
+		image = load_image(file);
+		fclose(file);
+		if (!image)
+		{
+			printf("Couldn't load a generated program!\n");
+			return -EIO;
+		}
+		snprintf(name, sizeof(name), "fuzz-%llu.obj", seed);
+		for (e=first; e<=last; e++)
+			if (check_image(image, name, e, budget, &compared))
+			{
+				release_image(image);
+				if ((file = fopen(name, "w")))
+				{
+					generate(seed, file);
+					fclose(file);
+					printf("Saved the program as %s\n", name);
+				}
+				return 1;
+			}
+		release_image(image);
+	}
+	printf("%d programs from seed %llu: no divergence over %llu instructions\n", options->count, options->seed,
+		compared);
+	return 0;
+}
@@ -0,0 +1,242 @@
+/**
+ * @file		lc3console.c
+ * @brief		Console output of the debugger
+ *
+ * Keeps what a program prints for the console window to show and scroll through, and optionally streams it to a
+ * file or another program, e.g. `simplx --tee=out.txt prog.obj` or `--tee='|grep ERROR'`. PUTS hands over its
+ * whole string at once (see write_string), so printing costs a memcpy into the scrollback and another into the
+ * tee buffer rather than a call per character.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3console.h"
+
+/**
+ * @name 	Create Console
+ * @brief Allocates an empty console
+ * @param [size_t] limit Most characters of scrollback kept, 0 for CONSOLE_SCROLLBACK
+ * @retval The console
+ */
+lc3_console_t* create_console(size_t limit)
+{
+	lc3_console_t* console;
+
+	if (!(console = calloc(1, sizeof(lc3_console_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	console->limit = limit ? limit : CONSOLE_SCROLLBACK;
+	console->size = console->limit < CONSOLE_INITIAL ? console->limit : CONSOLE_INITIAL;
+	if (!(console->text = malloc(console->size)))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	console->tee_fd = -1;
+	return console;
+}
+
+/**
+ * @name 	Destroy Console
+ * @brief Writes out what is left for the tee, closes it and frees the console
+ * @param [lc3_console_t*] console The console, or NULL
+ */
+void destroy_console(lc3_console_t* console)
+{
+	if (!console)
+		return;
+	flush_console(console);
+	if (console->tee_pipe)
+		pclose(console->tee_pipe);
+	else if (console->tee_fd >= 0)
+		close(console->tee_fd);
+	free(console->text);
+	free(console);
+}
+
+/**
+ * @name 	Clear Console
+ * @brief Empties the scrollback; the tee carries on
+ * @param [lc3_console_t*] console The console
+ */
+void clear_console(lc3_console_t* console)
+{
+	console->length = 0;
+	console->head = 0;
+}
+
+/**
+ * @name 	Grow
+ * @brief Doubles the scrollback, up to its limit, unrolling the ring so it starts at the beginning
+ * @param [lc3_console_t*] console The console
+ */
+static void grow(lc3_console_t* console)
+{
+	size_t size = console->size*2 < console->limit ? console->size*2 : console->limit;
+	size_t start = (console->head + console->size - console->length) % console->size;
+	size_t first = console->size - start < console->length ? console->size - start : console->length;
+	char* text;
+
+	if (!(text = malloc(size)))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	memcpy(text, console->text + start, first);
+	memcpy(text + first, console->text, console->length - first);
+	free(console->text);
+	console->text = text;
+	console->head = console->length;
+	console->size = size;
+}
+
+/**
+ * @name 	Tee Write
+ * @brief Writes straight to the tee, giving up on it if the write fails
+ * @param [lc3_console_t*] console The console
+ * @param [const char*] text The characters
+ * @param [size_t] length How many
+ */
+static void tee_write(lc3_console_t* console, const char* text, size_t length)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (console->tee_fd >= 0 && done < length)
+	{
+		n = write(console->tee_fd, text + done, length - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			// The reader is gone; stop teeing rather than fail every write from here on
+			if (!console->tee_pipe)
+				close(console->tee_fd);
+			console->tee_fd = -1;
+			break;
+		}
+		done += n;
+	}
+}
+
+/**
+ * @name 	Console Append
+ * @brief Adds printed text to the scrollback and the tee
+ * @param [lc3_console_t*] console The console
+ * @param [const char*] text The characters
+ * @param [size_t] length How many
+ */
+void console_append(lc3_console_t* console, const char* text, size_t length)
+{
+	size_t n;
+
+	console->total += length;
+	if (console->tee_fd >= 0)
+	{
+		if (console->tee_length + length > CONSOLE_TEE_BUFFER)
+			flush_console(console);
+		if (length > CONSOLE_TEE_BUFFER)
+			tee_write(console, text, length);
+		else
+		{
+			memcpy(console->tee_buffer + console->tee_length, text, length);
+			console->tee_length += length;
+		}
+	}
+
+	while (console->length + length > console->size && console->size < console->limit)
+		grow(console);
+	// Of more than the scrollback holds, only the end is kept
+	if (length > console->size)
+	{
+		text += length - console->size;
+		length = console->size;
+	}
+	while (length)
+	{
+		n = console->size - console->head < length ? console->size - console->head : length;
+		memcpy(console->text + console->head, text, n);
+		console->head = (console->head + n) % console->size;
+		console->length = console->length + n < console->size ? console->length + n : console->size;
+		text += n;
+		length -= n;
+	}
+}
+
+/**
+ * @name 	Console Char
+ * @brief Reads a character of the scrollback
+ * @param [const lc3_console_t*] console The console
+ * @param [size_t] index Which character, 0 being the oldest one held; must be less than length
+ * @retval The character
+ */
+char console_char(const lc3_console_t* console, size_t index)
+{
+	return console->text[(console->head + console->size - console->length + index) % console->size];
+}
+
+/**
+ * @name 	Tee Console
+ * @brief Streams everything printed from now on to a file (created or truncated), a FIFO, or with "|command"
+ * to the standard input of a shell command
+ * @param [lc3_console_t*] console The console
+ * @param [const char*] path Where to
+ * @retval 0 on success, -errno if it couldn't be opened
+ */
+int tee_console(lc3_console_t* console, const char* path)
+{
+	if (path[0] == '|')
+	{
+		if (!(console->tee_pipe = popen(path+1, "w")))
+			return -errno;
+		// A command that exits early shouldn't take the simulator with it; the tee just stops
+		signal(SIGPIPE, SIG_IGN);
+		console->tee_fd = fileno(console->tee_pipe);
+		return 0;
+	}
+	if ((console->tee_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -errno;
+	return 0;
+}
+
+/**
+ * @name 	Flush Console
+ * @brief Writes what has been collected for the tee
+ * @param [lc3_console_t*] console The console
+ */
+void flush_console(lc3_console_t* console)
+{
+	tee_write(console, console->tee_buffer, console->tee_length);
+	console->tee_length = 0;
+}
+
+/**
+ * @name 	Console Write Char
+ * @brief OUT handler (write_char) for a machine with a console
+ * @param [lc3_machine_t*] m The machine printing
+ * @param [char] c The character
+ */
+void console_write_char(lc3_machine_t* m, char c)
+{
+	console_append(m->console, &c, 1);
+}
+
+/**
+ * @name 	Console Write String
+ * @brief PUTS handler (write_string) for a machine with a console
+ * @param [lc3_machine_t*] m The machine printing
+ * @param [const char*] text The characters
+ * @param [int] length How many
+ */
+void console_write_string(lc3_machine_t* m, const char* text, int length)
+{
+	console_append(m->console, text, length);
+}
@@ -0,0 +1,467 @@
+/**
+ * @file		lc3cov.c
+ * @brief		Instruction and branch coverage
+ *
+ * Records which addresses executed and which way each conditional BR went, a bit apiece, and reports them as an
+ * lcov tracefile and as an annotated listing labelled from the program's symbols. The switch engine records each
+ * instruction from execute_instruction(); the block engine records a block when it leaves it, and only the first
+ * time it leaves it each way, which is what makes coverage cheap enough to leave on (see lc3block.c).
+ *
+ * What counts as the program's code is worked out from the image as loaded: everything reachable from the entry
+ * point or from any address that executed, following fall-through, BR and JSR targets, but not running past a HALT,
+ * an unconditional BR, a JMP or RET, a zero word or a reserved opcode. Data in between is left out of the totals.
+ *
+ * A tracefile accumulates, as gcov's data files do: saving coverage ORs in what the file already holds for the
+ * same program, under a lock, so runs in any number of processes can share one file. Delete it to start over.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3block.h"
+#include "../include/lc3trap.h"
+#include "../include/lc3cov.h"
+
+#define END_OF_RECORD "end_of_record"
+
+// Totals over a program's code, for the tracefile's summary lines and the listing's heading
+typedef struct {
+	unsigned int instructions;
+	unsigned int executed;
+	unsigned int branches;				// Directions of the conditional BRs, two each
+	unsigned int branches_taken;	// Directions that were ever gone
+} coverage_totals_t;
+
+/**
+ * @name 	Start Coverage
+ * @brief Starts recording coverage; runs that would use the predecode or JIT engine use the block engine from now on
+ * @param [lc3_machine_t*] m The machine
+ */
+void start_coverage(lc3_machine_t* m)
+{
+	if (m->coverage)
+		return;
+	if (!(m->coverage = malloc(sizeof(lc3_coverage_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	clear_coverage(m);
+}
+
+void stop_coverage(lc3_machine_t* m)
+{
+	free(m->coverage);
+	m->coverage = NULL;
+}
+
+void clear_coverage(lc3_machine_t* m)
+{
+	if (!m->coverage)
+		return;
+	memset(m->coverage, 0, sizeof(lc3_coverage_t));
+	uncover_blocks(m);
+}
+
+/**
+ * @name 	Add Coverage
+ * @brief Merges one run's coverage of a program into another's, e.g. over the jobs of a pool
+ * @param [lc3_coverage_t*] total The coverage merged into
+ * @param [const lc3_coverage_t*] coverage What to add
+ */
+void add_coverage(lc3_coverage_t* total, const lc3_coverage_t* coverage)
+{
+	int i;
+
+	for (i=0; i<COVERAGE_BYTES; i++)
+	{
+		total->executed[i] |= coverage->executed[i];
+		total->taken[i] |= coverage->taken[i];
+		total->not_taken[i] |= coverage->not_taken[i];
+	}
+}
+
+static int is_set(const unsigned char* map, unsigned short address)
+{
+	return (map[address >> 3] & COVERAGE_BIT(address)) != 0;
+}
+
+static int is_branch(unsigned short word)
+{
+	return (word >> 12) == BR && (word & 0x0E00) && (word & 0x0E00) != 0x0E00;
+}
+
+// Adds an address to the code found so far and the addresses still to follow, if it could be an instruction
+static void reach(const lc3_coverage_t* coverage, const unsigned short* mem, unsigned char* code,
+	unsigned short* pending, int* npending, unsigned short address)
+{
+	if (code[address])
+		return;
+	if (!is_set(coverage->executed, address)
+		&& (address >= DEVICE_BASE || !mem[address] || (mem[address] >> 12) == LOLFENDERCODE))
+		return;
+	code[address] = 1;
+	pending[(*npending)++] = address;
+}
+
+/**
+ * @name 	Find Code
+ * @brief Marks the addresses that make up a program's code, as described at the top of this file
+ * @param [const lc3_coverage_t*] coverage Coverage of the program, whose executed addresses are all code
+ * @param [const lc3_image_t*] image The program
+ * @param [unsigned char*] code 65536 flags, set to 1 for code and 0 for anything else
+ */
+static void find_code(const lc3_coverage_t* coverage, const lc3_image_t* image, unsigned char* code)
+{
+	const unsigned short* mem = image->mem;
+	unsigned short* pending;
+	unsigned short address;
+	lc3inst_t instruction;
+	int npending = 0;
+	int i;
+
+	// Each address is only added once, so 65536 is as many as can be pending
+	if (!(pending = malloc(65536*sizeof(unsigned short))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	memset(code, 0, 65536);
+	reach(coverage, mem, code, pending, &npending, image->entry);
+	for (i=0; i<65536; i++)
+		if (is_set(coverage->executed, i))
+			reach(coverage, mem, code, pending, &npending, i);
+
+	while (npending)
+	{
+		address = pending[--npending];
+		decode_instruction(&instruction, mem[address]);
+		switch (instruction.opcode) {
+		case BR:
+			if (instruction.nzpbits)
+				reach(coverage, mem, code, pending, &npending, address + 1 + instruction.pcoffset9);
+			if (instruction.nzpbits != 7)
+				reach(coverage, mem, code, pending, &npending, address + 1);
+			break;
+		case JSR:
+			if (!instruction.jsrr_flag)
+				reach(coverage, mem, code, pending, &npending, address + 1 + instruction.pcoffset11);
+			reach(coverage, mem, code, pending, &npending, address + 1);
+			break;
+		case TRAP:
+			if ((instruction.trapvect & TRAP_MASK) != TRAP_HALT)
+				reach(coverage, mem, code, pending, &npending, address + 1);
+			break;
+		// Where these go is only known at run time
+		case JMP:
+		case RTI:
+			break;
+		default:
+			reach(coverage, mem, code, pending, &npending, address + 1);
+			break;
+		}
+	}
+	free(pending);
+}
+
+static void count_totals(const lc3_coverage_t* coverage, const lc3_image_t* image, const unsigned char* code,
+	coverage_totals_t* totals)
+{
+	int i;
+
+	memset(totals, 0, sizeof(coverage_totals_t));
+	for (i=0; i<65536; i++)
+	{
+		if (!code[i])
+			continue;
+		totals->instructions++;
+		totals->executed += is_set(coverage->executed, i);
+		if (is_branch(image->mem[i]))
+		{
+			totals->branches += 2;
+			totals->branches_taken += is_set(coverage->taken, i) + is_set(coverage->not_taken, i);
+		}
+	}
+}
+
+static unsigned char* code_of(const lc3_coverage_t* coverage, const lc3_image_t* image)
+{
+	unsigned char* code;
+
+	if (!(code = malloc(65536)))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	find_code(coverage, image, code);
+	return code;
+}
+
+static double percent(unsigned int part, unsigned int total)
+{
+	return total ? 100.0 * part / total : 0;
+}
+
+/**
+ * @name 	Write Coverage
+ * @brief Writes a program's coverage as one record of an lcov tracefile
+ * @param [const lc3_coverage_t*] coverage The coverage
+ * @param [const lc3_image_t*] image The program
+ * @param [const char*] name What to call it in the SF line, e.g. the path it was loaded from
+ * @param [FILE*] out Where to write it
+ *
+ * Line numbers are addresses, in decimal as lcov has them, and counts are 1 for ran and 0 for didn't. Each label
+ * on code is a function, hit if the instruction it labels ran. Each conditional BR is a branch block with two
+ * branches, 0 taken and 1 fallen through.
+ */
+void write_coverage(const lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, FILE* out)
+{
+	const lc3_symtab_t* symbols = &image->symbols;
+	const char* arena = symbols->arena;
+	unsigned char* code = code_of(coverage, image);
+	coverage_totals_t totals;
+	unsigned short address;
+	int functions = 0;
+	int functions_hit = 0;
+	int i;
+
+	count_totals(coverage, image, code, &totals);
+	fprintf(out, "TN:\nSF:%s\n", name);
+	for (i=0; i<symbols->count; i++)
+		if (code[symbols->symbols[i].address])
+			fprintf(out, "FN:%u,%s\n", symbols->symbols[i].address, arena + symbols->symbols[i].name);
+	for (i=0; i<symbols->count; i++)
+	{
+		address = symbols->symbols[i].address;
+		if (!code[address])
+			continue;
+		functions++;
+		functions_hit += is_set(coverage->executed, address);
+		fprintf(out, "FNDA:%d,%s\n", is_set(coverage->executed, address), arena + symbols->symbols[i].name);
+	}
+	fprintf(out, "FNF:%d\nFNH:%d\n", functions, functions_hit);
+
+	for (i=0; i<65536; i++)
+		if (code[i] && is_branch(image->mem[i]))
+		{
+			if (is_set(coverage->executed, i))
+				fprintf(out, "BRDA:%d,0,0,%d\nBRDA:%d,0,1,%d\n", i, is_set(coverage->taken, i), i,
+					is_set(coverage->not_taken, i));
+			else
+				fprintf(out, "BRDA:%d,0,0,-\nBRDA:%d,0,1,-\n", i, i);
+		}
+	fprintf(out, "BRF:%u\nBRH:%u\n", totals.branches, totals.branches_taken);
+
+	for (i=0; i<65536; i++)
+		if (code[i])
+			fprintf(out, "DA:%d,%d\n", i, is_set(coverage->executed, i));
+	fprintf(out, "LF:%u\nLH:%u\n%s\n", totals.instructions, totals.executed, END_OF_RECORD);
+	free(code);
+}
+
+/**
+ * @name 	Write Listing
+ * @brief Writes a program's code with its labels, marking what never ran and how each BR went
+ * @param [const lc3_coverage_t*] coverage The coverage
+ * @param [const lc3_image_t*] image The program
+ * @param [const char*] name What to call it in the heading
+ * @param [FILE*] out Where to write it
+ *
+ * Instructions that never ran are marked ##### as gcov marks lines; a blank line separates stretches of code.
+ */
+void write_listing(const lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, FILE* out)
+{
+	unsigned char* code = code_of(coverage, image);
+	coverage_totals_t totals;
+	const char* label;
+	const char* ways;
+	char disasm[DISASM_MAX];
+	int last = -2;
+	int i;
+
+	count_totals(coverage, image, code, &totals);
+	fprintf(out, "%s: %u of %u instructions ran (%.2f%%), %u of %u branch directions taken (%.2f%%)\n", name,
+		totals.executed, totals.instructions, percent(totals.executed, totals.instructions), totals.branches_taken,
+		totals.branches, percent(totals.branches_taken, totals.branches));
+
+	for (i=0; i<65536; i++)
+	{
+		if (!code[i])
+			continue;
+		if (i != last+1)
+			fprintf(out, "\n");
+		last = i;
+		label = symbol_at(&image->symbols, i);
+		disassemble_to_str(&image->symbols, i, image->mem[i], disasm);
+		ways = "";
+		if (is_branch(image->mem[i]) && is_set(coverage->executed, i))
+			ways = !is_set(coverage->taken, i) ? "never taken" : !is_set(coverage->not_taken, i) ? "always taken"
+				: "both ways";
+		fprintf(out, "%5s  x%.4X  %-20s %-*s%s\n", is_set(coverage->executed, i) ? "" : "#####", i,
+			label ? label : "", *ways ? 33 : 0, disasm, ways);
+	}
+	free(code);
+}
+
+/**
+ * @name 	Read Record
+ * @brief Adds what a tracefile record says ran into a program's coverage
+ * @param [lc3_coverage_t*] coverage The coverage
+ * @param [const char*] record The record's text
+ * @param [const char*] end Where it ends
+ */
+static void read_record(lc3_coverage_t* coverage, const char* record, const char* end)
+{
+	const char* line;
+	unsigned int address;
+	unsigned int branch;
+	unsigned long long count;
+
+	for (line = record; line && line < end; line = strchr(line, '\n'), line = line ? line+1 : NULL)
+	{
+		if (sscanf(line, "DA:%u,%llu", &address, &count) == 2 && address < 65536 && count)
+			cover_address(coverage, address);
+		else if (sscanf(line, "BRDA:%u,%*u,%u,%llu", &address, &branch, &count) == 3 && address < 65536 && count
+			&& branch < 2)
+			cover_branch(coverage, address, !branch);
+	}
+}
+
+/**
+ * @name 	Record Named
+ * @brief Checks whether a tracefile record is a program's
+ * @param [const char*] record The record's text
+ * @param [const char*] end Where it ends
+ * @param [const char*] name The program's name, as in the SF line
+ */
+static int record_named(const char* record, const char* end, const char* name)
+{
+	const char* line;
+	size_t length = strlen(name);
+
+	for (line = record; line && line < end; line = strchr(line, '\n'), line = line ? line+1 : NULL)
+		if (!strncmp(line, "SF:", 3))
+			return !strncmp(line+3, name, length) && (line[3+length] == '\n' || !line[3+length]);
+	return 0;
+}
+
+/**
+ * @name 	Read File
+ * @brief Reads the whole of an open file
+ * @param [int] fd The file
+ * @retval Its contents, terminated, or NULL if it couldn't be read
+ */
+static char* read_file(int fd)
+{
+	struct stat info;
+	char* text;
+	ssize_t got;
+	off_t size = 0;
+
+	if (fstat(fd, &info))
+		return NULL;
+	if (!(text = malloc(info.st_size + 1)))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	while (size < info.st_size && (got = read(fd, text + size, info.st_size - size)) > 0)
+		size += got;
+	text[size] = '\0';
+	return text;
+}
+
+/**
+ * @name 	Save Coverage
+ * @brief Merges a program's coverage into a tracefile
+ * @param [lc3_coverage_t*] coverage The coverage, which gains whatever the tracefile held for the program
+ * @param [const lc3_image_t*] image The program
+ * @param [const char*] name What to call it, which is what identifies its record in the tracefile
+ * @param [const char*] path The tracefile
+ * @retval 0 on success, -errno if it couldn't be read or written
+ *
+ * The tracefile is locked while it is rewritten, so processes sharing it each add to it in turn. Records of other
+ * programs are kept as they were.
+ */
+int save_coverage(lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, const char* path)
+{
+	FILE* out;
+	char* text;
+	char* record;
+	char* end;
+	int written = 0;
+	int error;
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+		return -errno;
+	if (flock(fd, LOCK_EX) || !(text = read_file(fd)))
+	{
+		error = -errno;
+		close(fd);
+		return error;
+	}
+
+	for (record = text; *record; record = end)
+	{
+		end = (end = strstr(record, END_OF_RECORD)) ? end + strlen(END_OF_RECORD) : record + strlen(record);
+		end += strspn(end, "\r\n");
+		if (record_named(record, end, name))
+			read_record(coverage, record, end);
+	}
+
+	if (ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET) || !(out = fdopen(fd, "w")))
+	{
+		error = -errno;
+		free(text);
+		close(fd);
+		return error;
+	}
+	for (record = text; *record; record = end)
+	{
+		end = (end = strstr(record, END_OF_RECORD)) ? end + strlen(END_OF_RECORD) : record + strlen(record);
+		end += strspn(end, "\r\n");
+		if (!record_named(record, end, name))
+		{
+			fwrite(record, 1, end - record, out);
+			if (end[-1] != '\n')
+				fputc('\n', out);
+		}
+		else if (!written++)
+			write_coverage(coverage, image, name, out);
+	}
+	if (!written)
+		write_coverage(coverage, image, name, out);
+	free(text);
+	// Closing the file lets go of the lock
+	return fclose(out) ? -errno : 0;
+}
+
+/**
+ * @name 	Save Listing
+ * @brief Writes a program's listing to a file
+ * @param [const lc3_coverage_t*] coverage The coverage
+ * @param [const lc3_image_t*] image The program
+ * @param [const char*] name What to call it
+ * @param [const char*] path The file
+ * @param [int] append 1 to add to what the file holds, e.g. for each program of a pool after the first
+ * @retval 0 on success, -errno if the file couldn't be written
+ */
+int save_listing(const lc3_coverage_t* coverage, const lc3_image_t* image, const char* name, const char* path,
+	int append)
+{
+	FILE* out;
+
+	if (!(out = fopen(path, append ? "a" : "w")))
+		return -errno;
+	if (append)
+		fprintf(out, "\n");
+	write_listing(coverage, image, name, out);
+	return fclose(out) ? -errno : 0;
+}
@@ -0,0 +1,323 @@
+/**
+ * @file		lc3debug.c
+ * @brief		Conditional breakpoints, hit counts and watchpoints
+ *
+ * The engines only know that a breakpoint sits at an address: they stop in front of it exactly as before. Whether
+ * the stop counts is decided here afterwards, in pass_breakpoint(): a breakpoint whose condition is false, or
+ * whose hit count hasn't come up yet, sends run_program() straight back into the engine, which steps past it.
+ * So breakpoints cost nothing until one is reached, and plain ones behave as they always have.
+ *
+ * Watchpoints are checked on the loads and stores of execute_instruction(). While any is armed run_program() uses
+ * the switch engine, so the other engines never need to know about them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3debug.h"
+
+static const char* skip_spaces(const char* text)
+{
+	while (isspace((unsigned char)*text))
+		text++;
+	return text;
+}
+
+/**
+ * @name 	Parse Value
+ * @brief Parses a number in LC-3 assembler syntax (x1F, #-3 or 12), 0x1F, or a label
+ * @param [const char**] text Where to start; moved past the value
+ * @param [const lc3_symtab_t*] symbols Labels to accept (may be NULL)
+ * @param [int*] value Set to the value
+ * @retval 0 on success, -EINVAL if there's no value there
+ */
+static int parse_value(const char** text, const lc3_symtab_t* symbols, int* value)
+{
+	char token[64];
+	unsigned short address;
+	char* end;
+	int n = 0;
+
+	*text = skip_spaces(*text);
+	while (n < (int)sizeof(token)-1 && (*text)[n] && (isalnum((unsigned char)(*text)[n]) || strchr("#-_x", (*text)[n])))
+	{
+		token[n] = (*text)[n];
+		n++;
+	}
+	token[n] = '\0';
+	if (!n)
+		return -EINVAL;
+
+	if ((token[0] == 'x' || token[0] == 'X') && token[1])
+		*value = strtol(token+1, &end, 16);
+	else if (token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+		*value = strtol(token+2, &end, 16);
+	else if (token[0] == '#')
+		*value = strtol(token+1, &end, 10);
+	else
+		*value = strtol(token, &end, 10);
+	if (*end)
+	{
+		// Not a number; perhaps a label
+		if (symbol_address(symbols, token, &address))
+			return -EINVAL;
+		*value = address;
+	}
+	*text += n;
+	return 0;
+}
+
+/**
+ * @name 	Parse Condition
+ * @brief Parses a breakpoint condition: operand, comparison, value
+ * @param [const char*] text The condition, e.g. "R2 == x0010", "M[COUNT] != #0" or "CC < 0"; empty for none
+ * @param [const lc3_symtab_t*] symbols Labels usable as addresses and values (may be NULL)
+ * @param [lc3_condition_t*] condition Set to the parsed condition
+ * @retval 0 on success, -EINVAL if the condition can't be parsed
+ *
+ * The operand is a register R0-R7, CC (compared as -1, 0 or 1) or a memory word M[address]. The comparison is
+ * one of == != < <= > >=, done on signed 16-bit values.
+ */
+int parse_condition(const char* text, const lc3_symtab_t* symbols, lc3_condition_t* condition)
+{
+	static const char* ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+	static const cond_op_t codes[] = { COND_EQ, COND_NE, COND_LE, COND_GE, COND_LT, COND_GT };
+	int value;
+	int i;
+
+	memset(condition, 0, sizeof(lc3_condition_t));
+	text = skip_spaces(text);
+	if (!*text)
+		return 0;
+
+	if ((text[0] == 'R' || text[0] == 'r') && text[1] >= '0' && text[1] <= '7')
+	{
+		condition->kind = COND_REGISTER;
+		condition->operand = text[1] - '0';
+		text += 2;
+	}
+	else if (!strncasecmp(text, "CC", 2))
+	{
+		condition->kind = COND_CC;
+		text += 2;
+	}
+	else
+	{
+		if (*text == 'M' || *text == 'm')
+			text++;
+		if (*text++ != '[' || parse_value(&text, symbols, &value))
+			return -EINVAL;
+		text = skip_spaces(text);
+		if (*text++ != ']')
+			return -EINVAL;
+		condition->kind = COND_MEMORY;
+		condition->operand = value;
+	}
+
+	text = skip_spaces(text);
+	for (i=0; i<6 && strncmp(text, ops[i], strlen(ops[i])); i++);
+	if (i == 6)
+		return -EINVAL;
+	condition->op = codes[i];
+	text += strlen(ops[i]);
+
+	text = skip_spaces(text);
+	if (condition->kind == COND_CC && *text && strchr("nNzZpP", *text) && !isalnum((unsigned char)text[1]))
+	{
+		value = (*text | 0x20) == 'n' ? -1 : (*text | 0x20) == 'z' ? 0 : 1;
+		text++;
+	}
+	else if (parse_value(&text, symbols, &value))
+		return -EINVAL;
+	if (*skip_spaces(text))
+		return -EINVAL;
+	condition->value = value;
+	return 0;
+}
+
+/**
+ * @name 	Condition Holds
+ * @brief Tests a condition against a stopped machine
+ * @param [lc3_machine_t*] m The machine
+ * @param [const lc3_condition_t*] condition The condition
+ * @retval 1 if it holds (always, for COND_NONE), 0 if not
+ */
+int condition_holds(lc3_machine_t* m, const lc3_condition_t* condition)
+{
+	short operand;
+
+	switch (condition->kind) {
+	case COND_REGISTER:
+		operand = m->regfile[condition->operand];
+		break;
+	case COND_MEMORY:
+		operand = m->mem[condition->operand];
+		break;
+	case COND_CC:
+		operand = m->cc;
+		break;
+	default:
+		return 1;
+	}
+
+	switch (condition->op) {
+	case COND_EQ:
+		return operand == condition->value;
+	case COND_NE:
+		return operand != condition->value;
+	case COND_LT:
+		return operand < condition->value;
+	case COND_LE:
+		return operand <= condition->value;
+	case COND_GT:
+		return operand > condition->value;
+	case COND_GE:
+		return operand >= condition->value;
+	}
+	return 1;
+}
+
+lc3_breakpoint_t* get_breakpoint(lc3_machine_t* m, unsigned short address)
+{
+	int i;
+	for (i=0; i<m->nbreakpoints; i++)
+		if (m->breakpoints[i].address == address)
+			return &m->breakpoints[i];
+	return NULL;
+}
+
+/**
+ * @name 	Set Conditional Breakpoint
+ * @brief Sets a breakpoint that only stops a run when its condition holds, and not until its hit count comes up
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] address Where to break
+ * @param [const lc3_condition_t*] condition When to break (NULL or COND_NONE for always)
+ * @param [unsigned long long] ignore How many times the condition may hold before a run stops
+ */
+void set_conditional_breakpoint(lc3_machine_t* m, unsigned short address, const lc3_condition_t* condition,
+	unsigned long long ignore)
+{
+	lc3_breakpoint_t* breakpoint;
+
+	set_breakpoint(m, address);
+	breakpoint = get_breakpoint(m, address);
+	if (condition)
+		breakpoint->condition = *condition;
+	else
+		memset(&breakpoint->condition, 0, sizeof(lc3_condition_t));
+	breakpoint->ignore = ignore;
+	breakpoint->hits = 0;
+}
+
+/**
+ * @name 	Pass Breakpoint
+ * @brief Decides whether the breakpoint a run just stopped on should stop it
+ * @param [lc3_machine_t*] m The machine
+ * @retval 1 if the run should carry on past it, 0 if the machine should stay stopped
+ *
+ * Only looks at runs that stopped on a breakpoint (marked 2 by the engine), not on HALT, the instruction limit,
+ * a watchpoint or a wait for input.
+ */
+int pass_breakpoint(lc3_machine_t* m)
+{
+	lc3_breakpoint_t* breakpoint;
+
+	if (m->running || m->halted || m->watch_hit)
+		return 0;
+	if (m->execution_limit && m->executions >= m->execution_limit)
+		return 0;
+	if (!(breakpoint = get_breakpoint(m, m->pc-1)) || breakpoint->state != 2)
+		return 0;
+	if (!condition_holds(m, &breakpoint->condition))
+		return 1;
+	return ++breakpoint->hits <= breakpoint->ignore;
+}
+
+/**
+ * @name 	Set Watchpoint
+ * @brief Stops runs right after a load or store touching a range of memory
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] start First address watched
+ * @param [unsigned short] end Last address watched
+ * @param [int] access WATCH_READ, WATCH_WRITE or both; a range already watched has these added
+ */
+void set_watchpoint(lc3_machine_t* m, unsigned short start, unsigned short end, int access)
+{
+	int i;
+
+	for (i=0; i<m->nwatchpoints; i++)
+		if (m->watchpoints[i].start == start && m->watchpoints[i].end == end)
+		{
+			m->watchpoints[i].access |= access;
+			return;
+		}
+	if (!(m->watchpoints = realloc(m->watchpoints, (m->nwatchpoints+1)*sizeof(lc3_watchpoint_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	m->watchpoints[m->nwatchpoints].start = start;
+	m->watchpoints[m->nwatchpoints].end = end;
+	m->watchpoints[m->nwatchpoints].access = access;
+	m->watchpoints[m->nwatchpoints].hits = 0;
+	m->nwatchpoints++;
+}
+
+void unset_watchpoint(lc3_machine_t* m, unsigned short start, unsigned short end)
+{
+	int i;
+
+	for (i=0; i<m->nwatchpoints; i++)
+		if (m->watchpoints[i].start == start && m->watchpoints[i].end == end)
+		{
+			m->watchpoints[i] = m->watchpoints[--m->nwatchpoints];
+			return;
+		}
+}
+
+/**
+ * @name 	Watchpoint At
+ * @brief Tells which accesses to an address are watched
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] address The address
+ * @retval WATCH_READ and/or WATCH_WRITE, or 0
+ */
+int watchpoint_at(lc3_machine_t* m, unsigned short address)
+{
+	int access = 0;
+	int i;
+
+	for (i=0; i<m->nwatchpoints; i++)
+		if (address >= m->watchpoints[i].start && address <= m->watchpoints[i].end)
+			access |= m->watchpoints[i].access;
+	return access;
+}
+
+/**
+ * @name 	Watchpoint Access
+ * @brief Called through watch() when a watchpoint is armed; stops the run if the access is watched
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] address The address loaded or stored
+ * @param [int] access WATCH_READ or WATCH_WRITE
+ *
+ * The instruction still completes; the run stops in front of the next one.
+ */
+void watchpoint_access(lc3_machine_t* m, unsigned short address, int access)
+{
+	int i;
+
+	for (i=0; i<m->nwatchpoints; i++)
+		if (address >= m->watchpoints[i].start && address <= m->watchpoints[i].end
+			&& (m->watchpoints[i].access & access))
+		{
+			m->watchpoints[i].hits++;
+			m->watch_hit = i+1;
+			m->watch_address = address;
+			m->running = 0;
+			return;
+		}
+}
@@ -0,0 +1,258 @@
+/**
+ * @file		lc3device.c
+ * @brief		Memory-mapped device registers
+ *
+ * Loads and stores at DEVICE_BASE and up leave the engines' fast paths and come here (see execute_instruction()),
+ * so ordinary memory only pays for one compare. The registers keep their values in mem[] like any other word, so
+ * resets, snapshots and the memory window see them; what happens here is the side effects:
+ *
+ * 	KBSR	Bit 15 is set while a key waits in KBDR. Reading it with no key waiting takes one from the frontend's
+ * 				read_key, whose input is already buffered (batch mode reads it in BATCH_BUFFER chunks), if key_ready
+ * 				says one can be had without blocking. Setting bit 14 enables keyboard interrupts (vector x80, priority
+ * 				4); the keyboard is then checked for a key every KEYBOARD_POLL instructions.
+ * 	KBDR	Reading it takes the key, clearing KBSR's bit 15.
+ * 	DSR		Bit 15 is always set: the display is never busy.
+ * 	DDR		Writing it prints the low byte through write_char.
+ * 	TSR		Bit 15 is set each time the timer expires. Writing it clears bit 15 and sets bit 14 as given, which
+ * 				enables timer interrupts (vector x81, priority 6); a service routine acknowledges the interrupt this way.
+ * 	TIR		Writing it starts the timer, expiring every that many instructions, or stops it if 0.
+ * 	PSR		Bit 15 is set in user mode, and bits 10-8 hold the priority level. The NZP bits read as the condition
+ * 				codes, and writing them sets those.
+ * 	MCR		Writing it with bit 15 clear stops the machine, as HALT does.
+ *
+ * A program spinning on KBSR would burn millions of instructions waiting for a person to type. When the same
+ * instruction finds KBSR empty again within DEVICE_SPIN_GAP instructions, the read asks read_key for a key
+ * outright instead, which waits for one, or makes the instruction wait and the run stop as GETC does, so the
+ * spin takes no time at all.
+ */
+
+#include <stdio.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3block.h"
+#include "../include/lc3record.h"
+#include "../include/lc3device.h"
+#include "../include/lc3event.h"
+#include "../include/lc3stats.h"
+
+/**
+ * @name 	Write Word
+ * @brief Writes a word of memory the way a store does, but without device side effects
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] address The address
+ * @param [unsigned short] value The word
+ *
+ * Registers are written like memory, so resets restore them and cached decodings of the word are dropped.
+ */
+void write_word(lc3_machine_t* m, unsigned short address, unsigned short value)
+{
+	m->mem[address] = value;
+	invalidate_code(m, address);
+	mark_dirty(m, address);
+}
+
+/**
+ * @name 	Reset Devices
+ * @brief Puts the device registers in their power-on state: no key, display ready, timer stopped, no interrupts
+ * scheduled, supervisor mode at priority 0, clock running
+ * @param [lc3_machine_t*] m The machine
+ */
+void reset_devices(lc3_machine_t* m)
+{
+	write_word(m, KBSR_ADDRESS, 0);
+	write_word(m, KBDR_ADDRESS, 0);
+	write_word(m, DSR_ADDRESS, DEVICE_READY);
+	write_word(m, DDR_ADDRESS, 0);
+	write_word(m, TSR_ADDRESS, 0);
+	write_word(m, TIR_ADDRESS, 0);
+	write_word(m, PSR_ADDRESS, 0);
+	write_word(m, MCR_ADDRESS, DEVICE_READY);
+	m->poll_executions = ~0ULL;
+	m->saved_ssp = SUPERVISOR_STACK;
+	m->saved_usp = 0;
+	clear_events(m);
+}
+
+/**
+ * @name 	Device Interrupt
+ * @brief Finds the highest priority interrupt a device is asking for
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned char*] vector Where to put its vector
+ * @retval Its priority, or -1 if no device is asking
+ */
+int device_interrupt(lc3_machine_t* m, unsigned char* vector)
+{
+	if ((TSR(m) & (DEVICE_READY | DEVICE_IE)) == (DEVICE_READY | DEVICE_IE))
+	{
+		*vector = TIMER_VECTOR;
+		return TIMER_PRIORITY;
+	}
+	if ((KBSR(m) & (DEVICE_READY | DEVICE_IE)) == (DEVICE_READY | DEVICE_IE))
+	{
+		*vector = KEYBOARD_VECTOR;
+		return KEYBOARD_PRIORITY;
+	}
+	return -1;
+}
+
+// Latches a key from read_key into KBDR, if there is one
+static int take_key(lc3_machine_t* m)
+{
+	unsigned short r0 = m->regfile[0];
+
+	if (!m->read_key(m, 0))
+		return 0;
+	// read_key leaves the key in R0, as GETC wants it
+	if (m->recording)
+		record_device(m);
+	write_word(m, KBDR_ADDRESS, m->regfile[0]);
+	write_word(m, KBSR_ADDRESS, KBSR(m) | DEVICE_READY);
+	m->regfile[0] = r0;
+	check_interrupts(m);
+	return 1;
+}
+
+/**
+ * @name 	Poll Keyboard
+ * @brief Tries to get a key into KBDR for a read of KBSR that found none waiting
+ * @param [lc3_machine_t*] m The machine
+ * @retval 0	KBSR is up to date, with or without a key
+ * @retval 1	the program is spinning and no key can be had without blocking; the read should wait
+ */
+static int poll_keyboard(lc3_machine_t* m)
+{
+	int spinning = m->pc == m->poll_pc && m->executions >= m->poll_executions
+		&& m->executions - m->poll_executions <= DEVICE_SPIN_GAP;
+
+	if ((!spinning && !m->key_ready(m)) || !take_key(m))
+	{
+		if (spinning)
+			return 1;
+		m->poll_pc = m->pc;
+		m->poll_executions = m->executions;
+	}
+	return 0;
+}
+
+/**
+ * @name 	Keyboard Event
+ * @brief Checks for a key while keyboard interrupts are enabled, so one can arrive without the program asking
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned long long] time When the check was due
+ */
+void keyboard_event(lc3_machine_t* m, unsigned long long time)
+{
+	if (!(KBSR(m) & DEVICE_IE))
+		return;
+	if (!(KBSR(m) & DEVICE_READY) && m->key_ready(m))
+		take_key(m);
+	schedule_event(m, EVENT_KEYBOARD, time + KEYBOARD_POLL);
+}
+
+/**
+ * @name 	Timer Event
+ * @brief Expires the timer and starts its next interval
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned long long] time When it was due, so the intervals don't drift when runs overshoot it
+ */
+void timer_event(lc3_machine_t* m, unsigned long long time)
+{
+	write_word(m, TSR_ADDRESS, TSR(m) | DEVICE_READY);
+	if (TIR(m))
+		schedule_event(m, EVENT_TIMER, time + TIR(m));
+	check_interrupts(m);
+}
+
+/**
+ * @name 	Device Read
+ * @brief Reads a word at DEVICE_BASE or above for a load
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] address The address
+ * @param [unsigned short*] value Where to put the word
+ * @retval 0	the word was read
+ * @retval 1	the load is waiting for input and did nothing; it should be retried later
+ */
+int device_read(lc3_machine_t* m, unsigned short address, unsigned short* value)
+{
+	switch (address) {
+	case KBSR_ADDRESS:
+		if (!(KBSR(m) & DEVICE_READY) && poll_keyboard(m))
+			return 1;
+		break;
+	case KBDR_ADDRESS:
+		if (KBSR(m) & DEVICE_READY)
+		{
+			if (m->recording)
+				record_device(m);
+			write_word(m, KBSR_ADDRESS, KBSR(m) & ~DEVICE_READY);
+		}
+		break;
+	case PSR_ADDRESS:
+		*value = read_psr(m);
+		return 0;
+	default:
+		break;
+	}
+	*value = m->mem[address];
+	return 0;
+}
+
+/**
+ * @name 	Device Write
+ * @brief Writes a word at DEVICE_BASE or above for a store
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] address The address
+ * @param [unsigned short] value The word
+ */
+void device_write(lc3_machine_t* m, unsigned short address, unsigned short value)
+{
+	unsigned short old = m->mem[address];
+
+	switch (address) {
+	case KBSR_ADDRESS:
+		value = (old & DEVICE_READY) | (value & ~DEVICE_READY);
+		write_word(m, address, value);
+		if (!(value & DEVICE_IE))
+			cancel_event(m, EVENT_KEYBOARD);
+		else if (!(old & DEVICE_IE))
+		{
+			schedule_event(m, EVENT_KEYBOARD, m->executions + 1);
+			check_interrupts(m);
+		}
+		return;
+	case DSR_ADDRESS:
+		// The ready bit belongs to the device
+		value = (old & DEVICE_READY) | (value & ~DEVICE_READY);
+		break;
+	case KBDR_ADDRESS:
+		return;
+	case DDR_ADDRESS:
+		m->write_char(m, (char)value);
+		stats_output(m, 1);
+		break;
+	case TSR_ADDRESS:
+		value &= DEVICE_IE;
+		break;
+	case TIR_ADDRESS:
+		write_word(m, address, value);
+		if (value)
+			schedule_event(m, EVENT_TIMER, m->executions + value);
+		else
+			cancel_event(m, EVENT_TIMER);
+		return;
+	case PSR_ADDRESS:
+		write_word(m, address, value & ~7);
+		m->cc = value & 4 ? -1 : value & 2 ? 0 : 1;
+		check_interrupts(m);
+		return;
+	case MCR_ADDRESS:
+		if (!(value & DEVICE_READY))
+		{
+			m->halted = 1;
+			m->running = 0;
+		}
+		break;
+	default:
+		break;
+	}
+	write_word(m, address, value);
+}
@@ -0,0 +1,262 @@
+/**
+ * @file		lc3event.c
+ * @brief		Event scheduler, interrupts and RTI
+ *
+ * Anything the machine has to do at some instruction count rather than in response to an instruction (the timer
+ * expiring, polling the keyboard for an interrupt, delivering an interrupt) is an event. Events sit in a small
+ * min-heap on their time, and the machine keeps the earliest time in next_event. The engines already stop at
+ * execution_limit; run_limit() folds next_event into that, so nothing scheduled costs nothing, and something
+ * scheduled costs one stop of the run when it comes due. step_forward() and run_program() then call run_events(),
+ * always between two instructions.
+ *
+ * Interrupts follow the LC-3's: a device asks for one when its ready and interrupt enable bits are both set (see
+ * device_interrupt()), and gets it once its priority is above the PSR's. The PSR and PC are pushed on the
+ * supervisor stack (switching to it from user mode), the PSR takes the device's priority, and the PC the address in
+ * the interrupt vector table. RTI undoes that. Whatever could let a pending interrupt through (a device becoming
+ * ready, interrupts being enabled, the priority dropping) calls check_interrupts(), which schedules an
+ * EVENT_INTERRUPT for right after the current instruction.
+ *
+ * The recorder's undo records can't hold all an interrupt or RTI changes, so these put up a barrier it won't undo
+ * across; going back past one restores a snapshot, which includes the events, and runs forward again.
+ */
+
+#include "../include/lc3sim.h"
+#include "../include/lc3record.h"
+#include "../include/lc3device.h"
+#include "../include/lc3event.h"
+
+// The heap changed while recording: history from before now can only be reached through a snapshot
+static void changed(lc3_machine_t* m)
+{
+	if (m->recording)
+		record_barrier(m, m->executions + 1);
+}
+
+static void sift_up(lc3_machine_t* m, int i)
+{
+	lc3_event_t event = m->events[i];
+
+	while (i && m->events[(i-1)/2].time > event.time)
+	{
+		m->events[i] = m->events[(i-1)/2];
+		i = (i-1)/2;
+	}
+	m->events[i] = event;
+}
+
+static void sift_down(lc3_machine_t* m, int i)
+{
+	lc3_event_t event = m->events[i];
+	int child;
+
+	while ((child = 2*i+1) < m->nevents)
+	{
+		if (child+1 < m->nevents && m->events[child+1].time < m->events[child].time)
+			child++;
+		if (m->events[child].time >= event.time)
+			break;
+		m->events[i] = m->events[child];
+		i = child;
+	}
+	m->events[i] = event;
+}
+
+// Takes events[i] out of the heap
+static void remove_event(lc3_machine_t* m, int i)
+{
+	m->nevents--;
+	if (i < m->nevents)
+	{
+		m->events[i] = m->events[m->nevents];
+		sift_up(m, i);
+		sift_down(m, i);
+	}
+	m->next_event = m->nevents ? m->events[0].time : ~0ULL;
+}
+
+/**
+ * @name 	Clear Events
+ * @brief Drops everything scheduled, as at power-on
+ * @param [lc3_machine_t*] m The machine
+ */
+void clear_events(lc3_machine_t* m)
+{
+	m->nevents = 0;
+	m->next_event = ~0ULL;
+}
+
+/**
+ * @name 	Schedule Event
+ * @brief Arranges for an event to happen once executions reaches a time, replacing any of the same kind
+ * @param [lc3_machine_t*] m The machine
+ * @param [event_kind_t] kind What to do
+ * @param [unsigned long long] time Instruction count to do it at; a time already reached means before the next
+ * instruction
+ */
+void schedule_event(lc3_machine_t* m, event_kind_t kind, unsigned long long time)
+{
+	int i;
+
+	for (i=0; i<m->nevents; i++)
+		if (m->events[i].kind == kind)
+			break;
+	if (i == m->nevents)
+		m->nevents++;
+	m->events[i].kind = kind;
+	m->events[i].time = time;
+	sift_up(m, i);
+	sift_down(m, i);
+	m->next_event = m->events[0].time;
+	changed(m);
+}
+
+/**
+ * @name 	Cancel Event
+ * @brief Unschedules the event of a kind, if there is one
+ * @param [lc3_machine_t*] m The machine
+ * @param [event_kind_t] kind The kind
+ */
+void cancel_event(lc3_machine_t* m, event_kind_t kind)
+{
+	int i;
+
+	for (i=0; i<m->nevents; i++)
+		if (m->events[i].kind == kind)
+		{
+			remove_event(m, i);
+			changed(m);
+			return;
+		}
+}
+
+/**
+ * @name 	Read PSR
+ * @brief The PSR as a program sees it, with the NZP bits filled in from cc
+ * @param [lc3_machine_t*] m The machine
+ * @retval The PSR
+ */
+unsigned short read_psr(lc3_machine_t* m)
+{
+	return (PSR(m) & ~7) | (m->cc < 0 ? 4 : m->cc == 0 ? 2 : 1);
+}
+
+static void push(lc3_machine_t* m, unsigned short value)
+{
+	m->regfile[6]--;
+	write_word(m, m->regfile[6], value);
+}
+
+/**
+ * @name 	Enter Service Routine
+ * @brief Takes an interrupt or exception: saves PSR and PC on the supervisor stack and jumps through the vector
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned char] vector Entry of the interrupt vector table
+ * @param [int] priority Priority level to run the service routine at
+ * @param [unsigned short] pc Where RTI is to return to
+ *
+ * Leaves the PC at the service routine, not past it, like a jump in execute_instruction().
+ */
+static void enter_service_routine(lc3_machine_t* m, unsigned char vector, int priority, unsigned short pc)
+{
+	unsigned short psr = read_psr(m);
+
+	if (psr & PSR_USER)
+	{
+		m->saved_usp = m->regfile[6];
+		m->regfile[6] = m->saved_ssp;
+	}
+	push(m, psr);
+	push(m, pc);
+	write_word(m, PSR_ADDRESS, (priority << PSR_PRIORITY_SHFT) & PSR_PRIORITY);
+	m->pc = m->mem[IVT_BASE + vector];
+}
+
+static int priority_of(lc3_machine_t* m)
+{
+	return (PSR(m) & PSR_PRIORITY) >> PSR_PRIORITY_SHFT;
+}
+
+// Takes the highest priority interrupt asked for, if it is above the machine's, between two instructions
+static void interrupt(lc3_machine_t* m)
+{
+	unsigned char vector;
+	int priority = device_interrupt(m, &vector);
+
+	if (priority <= priority_of(m))
+		return;
+	enter_service_routine(m, vector, priority, m->pc-1);
+	fetch_instruction(m);
+	decode_instruction(&m->next_inst, m->ir);
+}
+
+/**
+ * @name 	Run Events
+ * @brief Does everything scheduled for now or earlier; called between instructions once executions reaches
+ * next_event
+ * @param [lc3_machine_t*] m The machine
+ *
+ * An interrupt taken here leaves the machine about to run the first instruction of its service routine.
+ */
+void run_events(lc3_machine_t* m)
+{
+	lc3_event_t event;
+
+	while (m->nevents && m->events[0].time <= m->executions && !m->halted)
+	{
+		event = m->events[0];
+		remove_event(m, 0);
+		changed(m);
+		switch (event.kind) {
+		case EVENT_INTERRUPT:
+			interrupt(m);
+			break;
+		case EVENT_TIMER:
+			timer_event(m, event.time);
+			break;
+		case EVENT_KEYBOARD:
+			keyboard_event(m, event.time);
+			break;
+		}
+	}
+}
+
+/**
+ * @name 	Check Interrupts
+ * @brief Schedules an interrupt for before the next instruction if a device asks for one the priority lets through
+ * @param [lc3_machine_t*] m The machine
+ */
+void check_interrupts(lc3_machine_t* m)
+{
+	unsigned char vector;
+
+	if (device_interrupt(m, &vector) > priority_of(m))
+		schedule_event(m, EVENT_INTERRUPT, m->executions);
+}
+
+/**
+ * @name 	Return from Interrupt
+ * @brief Executes RTI: pops PC and PSR off the supervisor stack, going back to the user stack if the PSR says so
+ * @param [lc3_machine_t*] m The machine
+ *
+ * In user mode, RTI takes the privilege mode exception instead, at the same priority.
+ */
+void return_from_interrupt(lc3_machine_t* m)
+{
+	unsigned short psr;
+
+	if (PSR(m) & PSR_USER)
+	{
+		enter_service_routine(m, PRIVILEGE_VECTOR, priority_of(m), m->pc);
+		return;
+	}
+	m->pc = m->mem[m->regfile[6]++];
+	psr = m->mem[m->regfile[6]++];
+	write_word(m, PSR_ADDRESS, psr & ~7);
+	m->cc = psr & 4 ? -1 : psr & 2 ? 0 : 1;
+	if (psr & PSR_USER)
+	{
+		m->saved_ssp = m->regfile[6];
+		m->regfile[6] = m->saved_usp;
+	}
+	check_interrupts(m);
+}
@@ -2,52 +2,331 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
 #include "../include/lc3sim.h"
+#include "../include/lc3debug.h"
+#include "../include/lc3prof.h"
+#include "../include/lc3record.h"
+#include "../include/lc3block.h"
+#include "../include/lc3batch.h"
+#include "../include/lc3pool.h"
+#include "../include/lc3bench.h"
+#include "../include/lc3check.h"
+#include "../include/lc3trap.h"
+#include "../include/lc3stats.h"
+#include "../include/lc3cov.h"
+#include "../include/lc3console.h"
+#include "../include/lc3event.h"
 #include "../include/lc3gui.h"
 
+static struct option long_options[] = {
+	{"engine", required_argument, 0, 'e'},
+	{"jit", no_argument, 0, 'j'},
+	{"batch", no_argument, 0, 'b'},
+	{"max-instructions", required_argument, 0, 'm'},
+	{"timeout", required_argument, 0, 't'},
+	{"dump-state", no_argument, 0, 'd'},
+	{"pool", required_argument, 0, 'p'},
+	{"threads", required_argument, 0, 'n'},
+	{"lockstep", no_argument, 0, 'l'},
+	{"entry", required_argument, 0, 'a'},
+	{"profile", required_argument, 0, 'r'},
+	{"folded", required_argument, 0, 'f'},
+	{"record", no_argument, 0, 'R'},
+	{"bench", no_argument, 0, 'B'},
+	{"repeat", required_argument, 0, 'k'},
+	{"json", no_argument, 0, 'J'},
+	{"scrollback", required_argument, 0, 's'},
+	{"tee", required_argument, 0, 'T'},
+	{"check", no_argument, 0, 'C'},
+	{"fuzz", optional_argument, 0, 'F'},
+	{"seed", required_argument, 0, 'S'},
+	{"trap", required_argument, 0, 'V'},
+	{"stats", optional_argument, 0, 'X'},
+	{"coverage", required_argument, 0, 'c'},
+	{"listing", required_argument, 0, 'L'},
+	{0, 0, 0, 0}
+};
+
 int main(int argc, char* argv[])
 {
-	if (argc != 2)
+	int opt;
+	int batch = 0;
+	const char* jobfile = NULL;
+	int lockstep = 0;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long entry = -1;
+	int nprograms;
+	lc3_image_t* image;
+	int i;
+	int status;
+	int record = 0;
+	int bench = 0;
+	int engine_given = 0;
+	bench_options_t bench_options = { BENCH_REPEAT, -1, 0, 0 };
+	int check = 0;
+	int fuzz = 0;
+	check_options_t check_options = { -1, 0, 1, FUZZ_COUNT };
+	engine_t engine = ENGINE_BLOCK;
+	batch_options_t batch_options = { 0, 0, 0 };
+	lc3_trap_setting_t traps[TRAP_VECTORS];
+	int ntraps = 0;
+	while ((opt = getopt_long(argc, argv, "e:jbm:t:dp:n:la:r:f:RBk:Js:T:CF::S:V:X::c:L:", long_options, NULL)) != -1)
 	{
-		printf("Bad argument! Just give me a filename of a compiled assembly program.\n");
-		return -EINVAL;
+		switch (opt) {
+		case 'e':
+			if (!strcmp(optarg, "switch"))
+				engine = ENGINE_SWITCH;
+			else if (!strcmp(optarg, "predecode"))
+				engine = ENGINE_PREDECODE;
+			else if (!strcmp(optarg, "block"))
+				engine = ENGINE_BLOCK;
+			else if (!strcmp(optarg, "jit"))
+				engine = ENGINE_JIT;
+			else
+			{
+				printf("Bad argument! Engine must be one of: switch, predecode, block, jit\n");
+				return -EINVAL;
+			}
+			engine_given = 1;
+			break;
+		case 'j':
+			engine = ENGINE_JIT;
+			engine_given = 1;
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		case 'm':
+			batch_options.max_instructions = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			batch_options.timeout = strtod(optarg, NULL);
+			break;
+		case 'd':
+			batch_options.dump_state = 1;
+			break;
+		case 'p':
+			jobfile = optarg;
+			break;
+		case 'n':
+			threads = atoi(optarg);
+			break;
+		case 'l':
+			lockstep = 1;
+			break;
+		case 'a':
+			// Accepts LC-3 style x3000 as well as 0x3000 or 3000
+			entry = strtol(optarg + (optarg[0] == 'x' || optarg[0] == 'X'), NULL, 16);
+			if (entry < 0 || entry > 0xFFFF)
+			{
+				printf("Bad argument! The entry point must be an address between x0000 and xFFFF\n");
+				return -EINVAL;
+			}
+			break;
+		case 'r':
+			profile_path = optarg;
+			break;
+		case 'f':
+			folded_path = optarg;
+			break;
+		case 'R':
+			record = 1;
+			break;
+		case 'B':
+			bench = 1;
+			break;
+		case 'k':
+			bench_options.repeat = atoi(optarg);
+			break;
+		case 'J':
+			bench_options.json = 1;
+			batch_options.stats_json = 1;
+			break;
+		case 's':
+			scrollback = strtoull(optarg, NULL, 0);
+			break;
+		case 'T':
+			tee_path = optarg;
+			break;
+		case 'C':
+			check = 1;
+			break;
+		case 'F':
+			fuzz = 1;
+			if (optarg)
+				check_options.count = atoi(optarg);
+			break;
+		case 'S':
+			check_options.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'V':
+			if (ntraps == TRAP_VECTORS || parse_trap_setting(optarg, &traps[ntraps]))
+			{
+				printf("Bad argument! A trap is VECTOR:ROUTINE, e.g. x81:mul; the routines are getc, out, puts, in, putsp, halt, udiv, mul, mod, memcpy and os (the guest's own)\n");
+				return -EINVAL;
+			}
+			ntraps++;
+			break;
+		case 'X':
+#ifndef LC3_STATS
+			printf("Bad argument! This simplx was built without statistics; rebuild it with make STATS=1\n");
+			return -EINVAL;
+#endif
+			batch_options.stats_path = optarg ? optarg : "-";
+			break;
+		case 'c':
+			batch_options.coverage_path = optarg;
+			break;
+		case 'L':
+			batch_options.listing_path = optarg;
+			break;
+		default:
+			return -EINVAL;
+		}
 	}
 
-	enable_udiv = 1;
+	batch_options.traps = traps;
+	batch_options.ntraps = ntraps;
 
-	FILE* program;
-	if (!(program = fopen(argv[1], "r")))
+	if (jobfile)
+		return run_pool(jobfile, threads, engine, lockstep, &batch_options);
+
+	if (bench && argc - optind >= 1)
 	{
-		printf("Bad argument! File not found.\n");
+		// Every engine unless one was asked for
+		bench_options.engine = engine_given ? (int)engine : -1;
+		bench_options.max_instructions = batch_options.max_instructions;
+		return run_bench(argv + optind, argc - optind, &bench_options);
+	}
+
+	if (check || fuzz)
+	{
+		// Every engine against the switch engine unless one was asked for
+		check_options.engine = engine_given ? (int)engine : -1;
+		check_options.max_instructions = batch_options.max_instructions;
+		if (fuzz)
+			return run_fuzz(&check_options);
+		if (argc - optind >= 1)
+			return run_check(argv + optind, argc - optind, &check_options);
+	}
+
+	if (argc - optind < 1)
+	{
+		printf("Bad argument! Just give me a filename of an assembly program, compiled or not.\n");
+		printf("Usage: %s [--engine=switch|predecode|block|jit] [--jit] [--entry=ADDR] [--profile=FILE] [--folded=FILE] [--record] [--scrollback=CHARS] [--tee=FILE|'|COMMAND'] [--trap=VECTOR:ROUTINE ...] [--stats[=FILE]] [--json] [--coverage=FILE] [--listing=FILE] [os.obj ...] program.obj|program.asm\n", argv[0]);
+		printf("       %s --batch [--max-instructions=N] [--timeout=SECONDS] [--dump-state] [--trap=VECTOR:ROUTINE ...] [--stats[=FILE]] [--json] [--coverage=FILE] [--listing=FILE] [--entry=ADDR] [--profile=FILE] [--folded=FILE] [os.obj ...] program.obj|program.asm\n", argv[0]);
+		printf("       %s --pool=jobs.txt [--threads=N] [--lockstep] [--max-instructions=N] [--timeout=SECONDS] [--trap=VECTOR:ROUTINE ...] [--stats[=FILE]] [--json] [--coverage=FILE] [--listing=FILE]\n", argv[0]);
+		printf("       %s --bench [--engine=switch|predecode|block|jit] [--repeat=N] [--json] [--max-instructions=N] workload.obj ...\n", argv[0]);
+		printf("       %s --check [--engine=predecode|block|jit] [--max-instructions=N] program.obj ...\n", argv[0]);
+		printf("       %s --fuzz[=PROGRAMS] [--seed=N] [--engine=predecode|block|jit] [--max-instructions=N]\n", argv[0]);
 		return -EINVAL;
 	}
 
-	build_symbol_table(argv[1]);
+	machine = create_machine();
+	machine->engine = engine;
+	apply_trap_settings(machine, traps, ntraps);
+
+	// Every file given is loaded into one image, in order; the last is the program being run. Sources are
+	// assembled on the way.
+	nprograms = argc - optind;
+	if (!(image = open_images(argv + optind, nprograms)))
+	{
+		if (errno == ENOEXEC)
+			return -EINVAL;		// The assembler has said what's wrong
+		printf("Bad argument! %s\n", errno == ENOENT ? "File not found." : errno == EINVAL ? "Not a valid object file."
+			: "Couldn't read the program.");
+		return -EINVAL;
+	}
+	if (entry >= 0)
+		image->entry = entry;
+	use_image(machine, image);
+	release_image(image);
+
+	if (profile_path || folded_path)
+		start_profile(machine);
+#ifdef LC3_STATS
+	if (batch_options.stats_path)
+	{
+		start_stats(machine);
+		catch_stats_signal();
+	}
+#endif
+	coverage_path = batch_options.coverage_path;
+	listing_path = batch_options.listing_path;
+	program_path = argv[argc-1];
+	if (coverage_path || listing_path)
+		start_coverage(machine);
+
+	// Batch runs only need symbols to label a profile or coverage, and do without them
+	if (!batch || machine->profile || machine->coverage)
+		for (i=0; i<nprograms; i++)
+			build_symbol_table(machine, argv[optind+i], !batch && i == nprograms-1);
+
+	if (batch)
+	{
+		status = run_batch(machine, &batch_options);
+		if (machine->profile && save_profile(machine, profile_path ? profile_path : PROFILE_DEFAULT_PATH, folded_path))
+			fprintf(stderr, "Couldn't write the profile!\n");
+#ifdef LC3_STATS
+		if (machine->stats
+			&& save_stats(machine->stats, NULL, 0, batch_options.stats_path, batch_options.stats_json))
+			fprintf(stderr, "Couldn't write the statistics!\n");
+#endif
+		if (machine->coverage && save_coverage_files())
+			fprintf(stderr, "Couldn't write the coverage!\n");
+		return status;
+	}
 
-	pc = 0x3000;
-	running = 1;
-	read_program(program);
+	machine->console = create_console(scrollback);
+	if (tee_path && tee_console(machine->console, tee_path))
+	{
+		printf("Bad argument! Couldn't open %s for the console.\n", tee_path);
+		return -EINVAL;
+	}
+	machine->read_key = wait_for_key;
+	machine->key_ready = key_typed;
+	machine->write_char = console_write_char;
+	machine->write_string = console_write_string;
+	if (record)
+		start_recording(machine, 0);
+	// stderr is the screen here
+	if (batch_options.stats_path)
+		stats_path = strcmp(batch_options.stats_path, "-") ? batch_options.stats_path : STATS_DEFAULT_PATH;
+	stats_json = batch_options.stats_json;
 
 	int ch;
 	initialize();
 
 	while(ch != KEY_F(1))
 	{
+		serve_stats_signal();
+		if (running_live)
+		{
+			// Any key pauses the run; F1 still quits
+			ch = run_live();
+			refreshall();
+			continue;
+		}
 		ch = getch();
+		stuck = 0;
 		switch (ch) {
 		case KEY_F(2):
-			reset_program(program);
+			reset_program(machine);
 			break;
 		case KEY_F(3):
 			dbgwin_state = 1;
 			break;
 		case KEY_F(4):
+			if (memwin_state == 2)
+				dbgwin_state = 3;
 			break;
 		case KEY_F(5):
-			step_forward();
+			step_forward(machine);
 			break;
 		case KEY_F(6):
-			run_program();
+			running_live = !machine->halted;
 			break;
 		case KEY_F(7):
 			memwin_state = (memwin_state == 2 ? 0 : 2);
@@ -56,6 +335,19 @@ int main(int argc, char* argv[])
 		case KEY_F(8):
 			dbgwin_state = 2;
 			break;
+		case KEY_F(9):
+			// Starts profiling the first time, writes what has been counted after that
+			if (!machine->profile)
+				start_profile(machine);
+			else
+				save_profile(machine, profile_path ? profile_path : PROFILE_DEFAULT_PATH, folded_path);
+			break;
+		case KEY_F(11):
+			step_backward(machine);
+			break;
+		case KEY_F(12):
+			run_backward(machine);
+			break;
 		case KEY_UP:
 			if (memwin_state == 2)
 				mem_cursor--;
@@ -64,17 +356,40 @@ int main(int argc, char* argv[])
 			if (memwin_state == 2)
 				mem_cursor++;
 			break;
+		// Page keys scroll the console outside the memory explorer
 		case KEY_NPAGE:
 			if (memwin_state == 2)
 				mem_cursor += (LINES-DEBUGWIN_HEIGHT);
+			else
+				cns_scroll = cns_scroll > CONSOLE_ROWS-1 ? cns_scroll - (CONSOLE_ROWS-1) : 0;
 			break;
 		case KEY_PPAGE:
 			if (memwin_state == 2)
 				mem_cursor -= (LINES-DEBUGWIN_HEIGHT);
+			else
+				cns_scroll += CONSOLE_ROWS-1;
+			break;
+		case KEY_END:
+			cns_scroll = 0;
 			break;
 		case 0xA:
 			if (memwin_state ==2)
-				brk[(unsigned short)mem_cursor] ^= 1;
+			{
+				if (breakpoint_at(machine, mem_cursor))
+					unset_breakpoint(machine, mem_cursor);
+				else
+					set_breakpoint(machine, mem_cursor);
+			}
+			break;
+		case 'r':
+		case 'w':
+			if (memwin_state == 2)
+			{
+				if (watchpoint_at(machine, mem_cursor) & (ch == 'r' ? WATCH_READ : WATCH_WRITE))
+					unset_watchpoint(machine, mem_cursor, mem_cursor);
+				else
+					set_watchpoint(machine, mem_cursor, mem_cursor, ch == 'r' ? WATCH_READ : WATCH_WRITE);
+			}
 			break;
 		}
 		refreshall();
@@ -82,45 +397,46 @@ int main(int argc, char* argv[])
 quit:
 	curs_set(1);
 	endwin();
+	if (machine->profile && save_profile(machine, profile_path ? profile_path : PROFILE_DEFAULT_PATH, folded_path))
+		printf("Couldn't write the profile!\n");
+#ifdef LC3_STATS
+	if (machine->stats && save_stats(machine->stats, NULL, 0, stats_path, stats_json))
+		printf("Couldn't write the statistics!\n");
+#endif
+	if (machine->coverage && save_coverage_files())
+		printf("Couldn't write the coverage!\n");
+	// Flushes the tee, and waits for a command it feeds to finish
+	destroy_console(machine->console);
+	machine->console = NULL;
 	return 0;
 }
 
-void build_symbol_table(const char* filename)
+void build_symbol_table(lc3_machine_t* m, const char* filename, int required)
 {
-	int namelength = strlen(filename);
-	char* symbolfile;
-
-	if (!(symbolfile = malloc(namelength)))
-	{
-		printf("Malloc returned NULL! That's no good!\n");
-		exit(-ENOMEM);
-	}
-
-	strncpy(symbolfile, filename, namelength-4);
-	symbolfile[namelength-4] = '.';
-	symbolfile[namelength-3] = 's';
-	symbolfile[namelength-2] = 'y';
-	symbolfile[namelength-1] = 'm';
-
-	FILE* symbols;
-	if (!(symbols = fopen(symbolfile, "r")))
+	// The symbols belong to the loaded image, so this has to come after the program is loaded
+	if (load_image_symbols(m->image, filename) && required)
 	{
 		printf("Couldn't find the symbol file!\n");
 		exit(-ENOENT);
 	}
+}
 
-	unsigned short address;
-	char* symbol;
-	while (!feof(symbols))
-	{
-		symbol = (char*)malloc(16);
-		fscanf(symbols, "%4hx", &address);
-		fscanf(symbols, "%s", symbol);
-		if (*symbol) syms[address] = symbol;
-	}
+/**
+ * @name 	Save Coverage Files
+ * @brief Merges the machine's coverage into the --coverage tracefile and writes the --listing, whichever were given
+ * @retval 0 on success, -errno if a file couldn't be written
+ *
+ * The listing is written after the merge, so it shows every run the tracefile has seen.
+ */
+int save_coverage_files()
+{
+	int error;
 
-	free(symbolfile);
-	fclose(symbols);
+	if (coverage_path && (error = save_coverage(machine->coverage, machine->image, program_path, coverage_path)))
+		return error;
+	if (listing_path)
+		return save_listing(machine->coverage, machine->image, program_path, listing_path, 0);
+	return 0;
 }
 
 void initialize()
@@ -151,9 +467,17 @@ void initialize()
 	memwin_state = 0;
 	cnswin_state = 0;
 
-	console = (char*)malloc(CONSOLE_SIZE);
-	cns_index = 0;
-	cns_max = CONSOLE_SIZE;
+	// Untouched entries of memrows cost no memory until a row at that address is shown
+	memrows = calloc(65536, sizeof(memrow_t));
+	memlines = malloc((LINES-DEBUGWIN_HEIGHT)*sizeof(memline_t));
+	cnswin_lines = malloc(CONSOLE_ROWS*SHOWN_MAX);
+	if (!memrows || !memlines || !cnswin_lines)
+	{
+		endwin();
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	invalidate_windows();
 
 	refreshall();
 }
@@ -173,6 +497,10 @@ WINDOW* create_win(int height, int width, int y, int x)
 	return win;
 }
 
+/**
+ * @name 	Refresh All
+ * @brief Brings every window up to date and sends what changed to the terminal in a single update
+ */
 void refreshall()
 {
 	int i;
@@ -181,35 +509,87 @@ void refreshall()
 	update_cnswin();
 	update_memwin();
 	for (i=0; i<windex; i++)
-		wrefresh(windows[i]);
-	refresh();
+		wnoutrefresh(windows[i]);
+	doupdate();
+	flush_console(machine->console);
 }
 
+/**
+ * @name 	Invalidate Windows
+ * @brief Forgets what the windows show, so the next refreshall() draws every line of them again; needed after
+ * anything draws over them behind their back, like the echo of a prompt
+ */
+void invalidate_windows()
+{
+	int i;
 
+	for (i=0; i<LINES-DEBUGWIN_HEIGHT; i++)
+		memlines[i].addr = -1;
+	// No line of text starts with 0xFF, so these never match
+	for (i=0; i<REGWIN_HEIGHT; i++)
+		regwin_lines[i][0] = (char)0xFF;
+	for (i=0; i<DEBUGWIN_HEIGHT; i++)
+		dbgwin_lines[i][0] = (char)0xFF;
+	for (i=0; i<CONSOLE_ROWS; i++)
+		cnswin_lines[i*SHOWN_MAX] = (char)0xFF;
+	cns_title_scroll = -1;
+	for (i=0; i<windex; i++)
+		touchwin(windows[i]);
+}
+
+/**
+ * @name 	Draw Line
+ * @brief Writes a line of a window, padded with blanks to the given width, unless that is what it shows already
+ * @param [WINDOW*] win The window
+ * @param [int] y Row within the window
+ * @param [int] x Column the line starts at
+ * @param [int] width Columns the line covers
+ * @param [const char*] text What the line should show
+ * @param [char*] shown What the line shows now, SHOWN_MAX bytes; updated
+ */
+void draw_line(WINDOW* win, int y, int x, int width, const char* text, char* shown)
+{
+	if (width > SHOWN_MAX-1)
+		width = SHOWN_MAX-1;
+	if (!strncmp(text, shown, width) && (strlen(text) >= width || !shown[strlen(text)]))
+		return;
+	mvwprintw(win, y, x, "%-*.*s", width, width, text);
+	snprintf(shown, width+1, "%s", text);
+}
+
+
+/**
+ * @name 	Update Memory Window
+ * @brief Redraws the rows of the memory window whose address, word, marker or highlight changed
+ */
 void update_memwin()
 {
 	int i;
+	int width = COLS-REGWIN_WIDTH-WINDOW_PADDING*2;
+	memline_t now;
 	if (!memwin_state)
-		mem_index = pc-1;
+		mem_index = machine->pc-1;
 	else if (memwin_state == 2)
 		mem_index = mem_cursor;
-	for (i; i<LINES-DEBUGWIN_HEIGHT-WINDOW_PADDING*2; i++)
+	for (i=0; i<LINES-DEBUGWIN_HEIGHT-WINDOW_PADDING*2; i++)
 	{
 		unsigned short addr = mem_index-(LINES-DEBUGWIN_HEIGHT-WINDOW_PADDING)/2+i;
-		short curr = mem[(unsigned short)addr];
-		char binstring[20];
-		char disasmstr[35];
-		hex_to_binstr(curr, binstring);
-		disassemble_to_str(curr, disasmstr);
-		if (mem_cursor == addr && memwin_state == 2)
+		now.addr = addr;
+		now.value = machine->mem[addr];
+		now.marker = marker(addr);
+		now.highlight = mem_cursor == addr && memwin_state == 2 ? 2 : (unsigned short)(machine->pc-1) == addr;
+		// Compared field by field: the padding in memline_t is never written
+		if (now.addr == memlines[i].addr && now.value == memlines[i].value && now.marker == memlines[i].marker &&
+			now.highlight == memlines[i].highlight)
+			continue;
+		memlines[i] = now;
+
+		if (now.highlight == 2)
 			wattron(MEMWIN, COLOR_PAIR(1));
-		else if (pc-1 == addr)
+		else if (now.highlight)
 			wattron(MEMWIN, A_STANDOUT);
-		int c;
-		for (c=0; c<COLS-REGWIN_WIDTH-WINDOW_PADDING*2; c++)
-			mvwprintw(MEMWIN, i+WINDOW_PADDING, c+WINDOW_PADDING, " ");
-		mvwprintw(MEMWIN, i+WINDOW_PADDING, WINDOW_PADDING, "%c x%.4hx\t x%.4hx\t %.5d\t %s\t %s", brk[addr] ? '@' : ' ', addr, curr, curr, binstring, disasmstr);
-		mvwprintw(MEMWIN, i+WINDOW_PADDING, WINDOW_PADDING+73, "%s", syms[addr] ? (const char*)syms[addr] : "");
+		mvwprintw(MEMWIN, i+WINDOW_PADDING, WINDOW_PADDING, "%c %-*.*s", now.marker, width-2, width-2,
+			memrow_text(addr, now.value));
 		wattroff(MEMWIN, A_STANDOUT);
 		wattroff(MEMWIN, COLOR_PAIR(1));
 	}
@@ -217,34 +597,146 @@ void update_memwin()
 		memwin_state = 0;
 }
 
+/**
+ * @name 	Memory Row Text
+ * @brief Returns the text of an address's row in the memory window, formatting it only if the word there changed
+ * since it was last formatted
+ * @param [unsigned short] addr The address
+ * @param [unsigned short] value The word at it
+ * @retval The row's text, without the marker; tabs are already expanded
+ */
+const char* memrow_text(unsigned short addr, unsigned short value)
+{
+	memrow_t* row = &memrows[addr];
+	char line[MEMROW_MAX];
+	char binstring[20];
+	char disasmstr[DISASM_MAX];
+	char label[DISASM_TARGET_MAX];
+	int i, n;
+
+	if (row->valid && row->value == value)
+		return row->text;
+
+	hex_to_binstr(value, binstring);
+	disassemble_to_str(&machine->image->symbols, addr, value, disasmstr);
+	format_address(&machine->image->symbols, addr, label, sizeof(label));
+	snprintf(line, sizeof(line), "x%.4hx\t x%.4hx\t %.5d\t %s\t %s", addr, value, (short)value, binstring, disasmstr);
+
+	// Tab stops are every 8 columns of the window, and the text starts after the marker and a blank
+	for (i=0, n=0; line[i] && n < MEMROW_MAX-1; i++)
+	{
+		if (line[i] != '\t')
+			row->text[n++] = line[i];
+		else do {
+			row->text[n++] = ' ';
+		} while ((WINDOW_PADDING+2+n) % 8 && n < MEMROW_MAX-1);
+	}
+	// The label has a column of its own, 73 columns in, and covers whatever reaches that far
+	while (n < 71)
+		row->text[n++] = ' ';
+	snprintf(row->text+71, MEMROW_MAX-71, "%s", label);
+	row->value = value;
+	row->valid = 1;
+	return row->text;
+}
+
+/**
+ * @name 	Marker
+ * @brief Picks the character shown next to an address in the memory window
+ * @param [unsigned short] addr The address
+ * @retval '@' for a breakpoint, '?' for a conditional one, 'r'/'w'/'b' for a read/write/both watchpoint, else ' '
+ */
+char marker(unsigned short addr)
+{
+	lc3_breakpoint_t* breakpoint;
+	int access;
+
+	if ((breakpoint = get_breakpoint(machine, addr)))
+		return breakpoint->condition.kind != COND_NONE || breakpoint->ignore ? '?' : '@';
+	if ((access = watchpoint_at(machine, addr)))
+		return access == WATCH_READ ? 'r' : access == WATCH_WRITE ? 'w' : 'b';
+	return ' ';
+}
+
+/**
+ * @name 	Update Register Window
+ * @brief Redraws the lines of the register window whose registers changed
+ */
 void update_regwin()
 {
 	int i;
+	int width = REGWIN_WIDTH-WINDOW_PADDING*2;
+	char line[SHOWN_MAX];
 	for (i=0; i<4; i++)
-		mvwprintw(REGWIN, i+WINDOW_PADDING, WINDOW_PADDING, "R%d: x%.4hx | R%d: x%.4hx", 2*i, regfile[2*i], 2*i+1, regfile[2*i+1]);
-	mvwprintw(REGWIN, WINDOW_PADDING+6, WINDOW_PADDING, "PC: x%.4hx", pc);
-	mvwprintw(REGWIN, WINDOW_PADDING+7, WINDOW_PADDING, "IR: x%.4hx", ir);
-	mvwprintw(REGWIN, WINDOW_PADDING+8, WINDOW_PADDING, "CC: x%.4hx", cc);
-	mvwprintw(REGWIN, WINDOW_PADDING+9, WINDOW_PADDING, "EX: %d", executions);
+	{
+		snprintf(line, sizeof(line), "R%d: x%.4hx | R%d: x%.4hx", 2*i, machine->regfile[2*i], 2*i+1, machine->regfile[2*i+1]);
+		draw_line(REGWIN, i+WINDOW_PADDING, WINDOW_PADDING, width, line, regwin_lines[i]);
+	}
+	snprintf(line, sizeof(line), "PC: x%.4hx", machine->pc);
+	draw_line(REGWIN, WINDOW_PADDING+6, WINDOW_PADDING, width, line, regwin_lines[6]);
+	snprintf(line, sizeof(line), "IR: x%.4hx", machine->ir);
+	draw_line(REGWIN, WINDOW_PADDING+7, WINDOW_PADDING, width, line, regwin_lines[7]);
+	snprintf(line, sizeof(line), "CC: x%.4hx PSR: x%.4hx", machine->cc, read_psr(machine));
+	draw_line(REGWIN, WINDOW_PADDING+8, WINDOW_PADDING, width, line, regwin_lines[8]);
+	snprintf(line, sizeof(line), "EX: %llu", machine->executions);
+	draw_line(REGWIN, WINDOW_PADDING+9, WINDOW_PADDING, width, line, regwin_lines[9]);
 }
 
+/**
+ * @name 	Update Debug Window
+ * @brief Redraws the debug window's help and status lines if they changed, or runs the prompt it was switched to
+ */
 void update_dbgwin()
 {
-	int i, j;
-	char goaddr[6];
-	char realaddr[7];
-	for (i=0; i<DEBUGWIN_HEIGHT-WINDOW_PADDING*2; i++)
-		for (j=0; j<COLS-WINDOW_PADDING*2; j++)
-			mvwprintw(DBGWIN, i+WINDOW_PADDING, j+WINDOW_PADDING, " ");
+	int i;
+	int width = COLS-WINDOW_PADDING*2;
+	char lines[DEBUGWIN_HEIGHT-WINDOW_PADDING*2][SHOWN_MAX];
+	char goaddr[DISASM_TARGET_MAX];
+	char realaddr[DISASM_TARGET_MAX+1];
+	char condstr[64];
+	lc3_condition_t condition;
+	unsigned long long ignore;
+	unsigned short address;
+	memset(lines, 0, sizeof(lines));
 	switch (dbgwin_state) {
 	case 0:
-		mvwprintw(DBGWIN, WINDOW_PADDING, WINDOW_PADDING, "F5 - Step | F6 - Run | F7 - Memory Explorer | F1 - Exit");
-		break;
+		if (machine->recorder)
+			snprintf(lines[0], SHOWN_MAX,
+				"F5 - Step | F6 - Run | F11 - Step Back | F12 - Run Back | F7 - Memory Explorer | F1 - Exit");
+		else
+			snprintf(lines[0], SHOWN_MAX, "F5 - Step | F6 - Run | F7 - Memory Explorer | F1 - Exit");
+		if (memwin_state == 2)
+			snprintf(lines[1], SHOWN_MAX,
+				"Enter - Breakpoint | F4 - Conditional Breakpoint | r/w - Watch Reads/Writes | F8 - Edit");
+		else if (machine->watch_hit)
+			snprintf(lines[1], SHOWN_MAX, "Watchpoint hit at x%.4hx", machine->watch_address);
+		else if (stuck)
+			snprintf(lines[1], SHOWN_MAX, "Stuck at x%.4hx-x%.4hx, in a loop of %u instruction%s that changes nothing",
+				stuck_loop.start, stuck_loop.end, stuck_loop.period, stuck_loop.period == 1 ? "" : "s");
+		else if (machine->profile)
+			snprintf(lines[1], SHOWN_MAX, "Profiling | F9 - Write profile to %s",
+				profile_path ? profile_path : PROFILE_DEFAULT_PATH);
+		else
+			snprintf(lines[1], SHOWN_MAX, "F9 - Start profiling");
+		for (i=0; i<DEBUGWIN_HEIGHT-WINDOW_PADDING*2; i++)
+			draw_line(DBGWIN, i+WINDOW_PADDING, WINDOW_PADDING, width, lines[i], dbgwin_lines[i]);
+		return;
+	}
+
+	// A prompt, on blank lines
+	for (i=0; i<DEBUGWIN_HEIGHT-WINDOW_PADDING*2; i++)
+		draw_line(DBGWIN, i+WINDOW_PADDING, WINDOW_PADDING, width, lines[i], dbgwin_lines[i]);
+	switch (dbgwin_state) {
 	case 1:
-		dbggetstrw(WINDOW_PADDING, WINDOW_PADDING, "Goto address: ", goaddr);
-		realaddr[0] = '0';
-		strcpy(&realaddr[1], goaddr);
-		sscanf(realaddr, "%x", &mem_index);
+		dbggetstrw(WINDOW_PADDING, WINDOW_PADDING, "Goto address or label: ", goaddr, sizeof(goaddr));
+		if (!symbol_address(&machine->image->symbols, goaddr, &address))
+			mem_index = address;
+		else
+		{
+			realaddr[0] = '0';
+			strcpy(&realaddr[1], goaddr);
+			sscanf(realaddr, "%hx", &mem_index);
+		}
 		dbgwin_state = 0;
 		if (!memwin_state)
 			memwin_state = 1;
@@ -253,35 +745,251 @@ void update_dbgwin()
 		refreshall();
 		break;
 	case 2:
-		dbggetstrw(WINDOW_PADDING, WINDOW_PADDING, "New value: ", goaddr);
+		dbggetstrw(WINDOW_PADDING, WINDOW_PADDING, "New value: ", goaddr, sizeof(goaddr));
 		realaddr[0] = '0';
 		strcpy(&realaddr[1], goaddr);
 		short a;
 		sscanf(realaddr, "%x", &a);
-		mem[mem_cursor] = a;
+		machine->mem[mem_cursor] = a;
+		invalidate_code(machine, mem_cursor);
+		mark_dirty(machine, mem_cursor);
+		// The history no longer leads here
+		clear_recording(machine);
 		dbgwin_state = 0;
 		refreshall();
 		break;
+	case 3:
+		dbggetstrw(WINDOW_PADDING, WINDOW_PADDING, "Break when (e.g. R2 == x10, M[COUNT] < #0): ", condstr, sizeof(condstr));
+		dbgwin_state = 0;
+		if (parse_condition(condstr, &machine->image->symbols, &condition))
+			break;
+		dbggetstrw(WINDOW_PADDING+1, WINDOW_PADDING, "Skip first hits: ", goaddr, sizeof(goaddr));
+		ignore = strtoull(goaddr, NULL, 10);
+		set_conditional_breakpoint(machine, mem_cursor, &condition, ignore);
+		refreshall();
+		break;
 	}
 }
 
+/**
+ * @name 	Update Console Window
+ * @brief Lays out the end of the scrollback (or further back, when scrolled) in lines of the window's width and
+ * redraws the lines that changed; control characters other than newline show as blanks
+ */
 void update_cnswin()
 {
-	int i, j;
-	for (i = cns_index; i != (cns_index ? cns_index-1 : cns_length); i++)
+	lc3_console_t* console = machine->console;
+	int rows = CONSOLE_ROWS;
+	int want = rows + cns_scroll;
+	size_t length = console->length;
+	size_t start = length;
+	int newlines = 0;
+	int count, first, line, col;
+	char text[CONSOLE_COLS+1];
+	char c;
+	size_t i;
+
+	// Back far enough for `want` lines: as many newlines, or as many full lines if they run that long
+	while (start > 0 && length - start < (size_t)want*(CONSOLE_COLS+1))
+	{
+		if (console_char(console, start-1) == '\n' && ++newlines > want)
+			break;
+		start--;
+	}
+
+	// Count the lines from there, and keep the scroll within them
+	for (i=start, count=1, col=0; i<length; i++)
+	{
+		if (console_char(console, i) == '\n' || col == CONSOLE_COLS)
+		{
+			count++;
+			col = 0;
+		}
+		if (console_char(console, i) != '\n')
+			col++;
+	}
+	if (want > count)
 	{
-		j = i - cns_index;
-		mvwaddch(CNSWIN, j/(REGWIN_WIDTH-2)+1, j%(REGWIN_WIDTH-2)+1, console[i]);
+		cns_scroll = count > rows ? count - rows : 0;
+		want = rows + cns_scroll;
+	}
+	// Short output starts at the top, like a terminal
+	first = count > want ? count - want : 0;
+
+	for (i=start, line=0, col=0; line < first+rows; i++)
+	{
+		c = i < length ? console_char(console, i) : '\n';
+		if (c == '\n' || col == CONSOLE_COLS)
+		{
+			if (line >= first)
+			{
+				text[col] = '\0';
+				draw_line(CNSWIN, line-first+1, 1, CONSOLE_COLS, text, &cnswin_lines[(line-first)*SHOWN_MAX]);
+			}
+			line++;
+			col = 0;
+		}
+		if (c != '\n')
+			text[col++] = (unsigned char)c < ' ' ? ' ' : c;
+	}
+
+	if (cns_title_scroll != cns_scroll)
+	{
+		box(CNSWIN, 0, 0);
+		if (cns_scroll)
+			mvwprintw(CNSWIN, 0, 0, "Console (%d up, End)", cns_scroll);
+		else
+			mvwprintw(CNSWIN, 0, 0, "Console");
+		cns_title_scroll = cns_scroll;
 	}
 }
 
-void wait_for_key(int print)
+int wait_for_key(lc3_machine_t* m, int print)
 {
-	refreshall();
+	int key;
 	char ch;
-	while(!(ch=getch()));
-	regfile[0] = (short)ch;
-	if (print) send_to_console(ch);
+	if (running_live)
+	{
+		// Never block a run: without a key the instruction waits, and run_live() waits for one instead.
+		// Function keys are left for run_live() to pause on.
+		if ((key = getch()) == ERR || key >= KEY_MIN)
+		{
+			if (key != ERR)
+				ungetch(key);
+			key_wait = 1;
+			return 0;
+		}
+		ch = key;
+	}
+	else
+	{
+		refreshall();
+		while(!(ch=getch()));
+	}
+	m->regfile[0] = (short)ch;
+	if (print) console_write_char(m, ch);
+	return 1;
+}
+
+/**
+ * @name 	Key Typed
+ * @brief key_ready for the console: whether a key has been typed that wait_for_key() would take without waiting
+ * @param [lc3_machine_t*] m The machine polling the keyboard
+ */
+int key_typed(lc3_machine_t* m)
+{
+	int key;
+
+	nodelay(stdscr, TRUE);
+	key = getch();
+	if (!running_live)
+		nodelay(stdscr, FALSE);
+	if (key == ERR)
+		return 0;
+	ungetch(key);
+	return key < KEY_MIN;
+}
+
+/**
+ * @name 	Run Live
+ * @brief Runs the machine (F6) in slices, redrawing the windows FRAME_RATE times a second, until it halts, stops
+ * on a breakpoint or watchpoint, or a key is pressed. While GETC/IN waits for input, ordinary keys are the input.
+ * @retval The key that paused the run, or ERR if the program stopped by itself
+ */
+int run_live()
+{
+	struct timespec frame;
+	int ch = ERR;
+
+	nodelay(stdscr, TRUE);
+	while (running_live)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &frame);
+		do {
+			if (!run_live_slice())
+				running_live = 0;
+			else if (!key_wait && (ch = getch()) != ERR)
+				running_live = 0;
+		} while (running_live && !key_wait && seconds_since(&frame) < 1.0/FRAME_RATE);
+		serve_stats_signal();
+		refreshall();
+
+		if (running_live && key_wait)
+		{
+			// Nothing to run until a key comes; wait for one without missing a frame
+			timeout(1000/FRAME_RATE);
+			if ((ch = getch()) != ERR)
+			{
+				if (ch >= KEY_MIN)
+					running_live = 0;
+				else
+				{
+					ungetch(ch);
+					ch = ERR;
+				}
+			}
+			nodelay(stdscr, TRUE);
+		}
+	}
+	nodelay(stdscr, FALSE);
+	return ch;
+}
+
+/**
+ * @name 	Run Live Slice
+ * @brief Runs up to run_slice instructions, then retunes run_slice to take about RUN_SLICE_SECONDS
+ * @retval 1 if the run can go on (the slice ran out, or GETC/IN is waiting for a key), 0 if the program halted,
+ * stopped on a breakpoint or watchpoint, or is stuck in a loop that changes nothing (see lc3loop.c)
+ */
+int run_live_slice()
+{
+	lc3_breakpoint_t* breakpoint;
+	struct timespec start;
+	unsigned long long limit = machine->executions + run_slice;
+	double seconds;
+
+	key_wait = 0;
+	machine->execution_limit = limit;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_program(machine);
+	seconds = seconds_since(&start);
+	machine->execution_limit = 0;
+
+	if (machine->halted || machine->watch_hit)
+		return 0;
+	if ((breakpoint = get_breakpoint(machine, machine->pc-1)) && breakpoint->state == 2)
+	{
+		if (machine->executions < limit)
+			return 0;
+		// Reached along with the end of the slice, so run_program() hasn't judged it yet
+		return pass_breakpoint(machine);
+	}
+	if (key_wait)
+		return 1;
+	// Nothing could ever get it out
+	if (!machine->nevents && find_loop(machine, 0, &stuck_loop))
+	{
+		stuck = 1;
+		return 0;
+	}
+
+	if (seconds < RUN_SLICE_SECONDS/2 && run_slice < RUN_SLICE_MAX)
+		run_slice *= 2;
+	else if (seconds > RUN_SLICE_SECONDS*2 && run_slice > RUN_SLICE_MIN)
+		run_slice /= 2;
+	return 1;
+}
+
+/**
+ * @name 	Serve Stats Signal
+ * @brief Writes the statistics so far if STATS_SIGNAL has come; checked once per key, and once per frame of a run
+ */
+void serve_stats_signal()
+{
+#ifdef LC3_STATS
+	if (machine->stats && stats_signalled())
+		save_stats(machine->stats, NULL, 0, stats_path, stats_json);
+#endif
 }
 
 void hex_to_binstr(short hex, char* buffer)
@@ -296,13 +1004,15 @@ void hex_to_binstr(short hex, char* buffer)
 	sprintf(buffer, "%s %s %s %s", strings[a], strings[b], strings[c], strings[d]);
 }
 
-void dbggetstrw(int y, int x, const char* prompt, char* buffer)
+void dbggetstrw(int y, int x, const char* prompt, char* buffer, int size)
 {
 	mvwprintw(DBGWIN, y, x, prompt);
 	wrefresh(DBGWIN);
 	move(LINES-DEBUGWIN_HEIGHT+y, x+strlen(prompt));
 
 	curs_set(1);
-	getstr(buffer);
+	getnstr(buffer, size-1);
 	curs_set(0);
+	// The echo went through stdscr, over whatever the windows had there
+	invalidate_windows();
 }
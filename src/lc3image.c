@@ -0,0 +1,396 @@
+/**
+ * @file		lc3image.c
+ * @brief		Shared, copy-on-write program images
+ *
+ * A program is read from its .obj file (or assembled from its source, see lc3asm.c) once into an image: its memory
+ * lives in an unlinked in-memory file, next to its symbol table (see lc3sym.c). Every machine running the program maps
+ * that file MAP_PRIVATE as its mem[], so all of them read the same physical pages and the kernel copies a page only
+ * when a machine first writes to it. Images are reference counted and go away with the last machine using them.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/lc3image.h"
+#include "../include/lc3asm.h"
+
+/**
+ * @name 	Create Backing File
+ * @brief Opens an anonymous file to hold an image's memory
+ * @retval A file descriptor, or -1 on failure
+ */
+static int create_backing_file()
+{
+#ifdef __linux__
+	return memfd_create("lc3-image", MFD_CLOEXEC);
+#else
+	char path[] = "/tmp/lc3-imageXXXXXX";
+	int fd = mkstemp(path);
+	if (fd >= 0)
+		unlink(path);
+	return fd;
+#endif
+}
+
+/**
+ * @name 	Read Object File
+ * @brief Gets the whole contents of an object file (or a source), mapping it if it's a regular file
+ * @param [FILE*] program The opened file
+ * @param [size_t*] size Set to the file's length in bytes
+ * @param [int*] mapped Set if the contents were mapped rather than read into a buffer
+ * @retval The contents, or NULL if the file couldn't be read
+ */
+static unsigned char* read_object_file(FILE* program, size_t* size, int* mapped)
+{
+	struct stat st;
+	unsigned char* data = NULL;
+	size_t capacity = 0;
+	size_t n;
+	void* map;
+
+	*size = 0;
+	*mapped = 0;
+	if (!fstat(fileno(program), &st) && S_ISREG(st.st_mode) && st.st_size > 0
+		&& (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(program), 0)) != MAP_FAILED)
+	{
+		*size = st.st_size;
+		*mapped = 1;
+		return map;
+	}
+
+	// Pipes and the like get read the slow way
+	rewind(program); // Be kind, rewind!
+	do {
+		if (*size == capacity)
+		{
+			capacity = capacity ? 2*capacity : 65536;
+			if (!(data = realloc(data, capacity)))
+			{
+				printf("Malloc returned NULL! That's no good!\n");
+				exit(-ENOMEM);
+			}
+		}
+		n = fread(data + *size, 1, capacity - *size, program);
+		*size += n;
+	} while (n > 0);
+	if (ferror(program))
+	{
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+/**
+ * @name 	Load Segments
+ * @brief Checks every segment of an object file, then copies them all into memory
+ * @param [unsigned short*] mem Memory to load into
+ * @param [const unsigned char*] data The file's contents
+ * @param [size_t] size Length of the contents in bytes
+ * @param [unsigned short*] entry Set to the address of the first segment
+ * @retval 0 on success, -EINVAL if the file isn't a well-formed object file
+ *
+ * An object file is a run of segments, each a big-endian start address and word count followed by that many
+ * big-endian words. A lone xFFFF word may end the file. Nothing is loaded from a file that fails the checks.
+ */
+static int load_segments(unsigned short* mem, const unsigned char* data, size_t size, unsigned short* entry)
+{
+	unsigned int address;
+	unsigned int words;
+	size_t pos;
+	size_t i;
+	int segments = 0;
+
+	for (pos = 0; pos < size; pos += 4 + 2*words)
+	{
+		if (size - pos == 2 && data[pos] == 0xFF && data[pos+1] == 0xFF)
+			break;
+		if (size - pos < 4)
+			return -EINVAL;		// Truncated header
+		address = (data[pos] << 8) | data[pos+1];
+		words = (data[pos+2] << 8) | data[pos+3];
+		if (size - pos - 4 < 2*(size_t)words || address + words > 65536)
+			return -EINVAL;		// Truncated segment, or one running off the end of memory
+		if (!segments++)
+			*entry = address;
+	}
+	if (!segments)
+		return -EINVAL;
+
+	for (pos = 0; pos + 4 <= size; pos += 4 + 2*words)
+	{
+		const unsigned char* src = data + pos + 4;
+		unsigned short* dst;
+		address = (data[pos] << 8) | data[pos+1];
+		words = (data[pos+2] << 8) | data[pos+3];
+		dst = mem + address;
+		for (i=0; i<words; i++)
+			dst[i] = (src[2*i] << 8) | src[2*i+1];
+	}
+	return 0;
+}
+
+/**
+ * @name 	Create Image
+ * @brief Makes an empty image to load programs into
+ * @param [unsigned short**] mem Set to the image's memory, writable until finish_image()
+ * @retval The image
+ */
+static lc3_image_t* create_image(unsigned short** mem)
+{
+	lc3_image_t* image;
+
+	if (!(image = calloc(1, sizeof(lc3_image_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	// The file starts out all zero, and the programs are written straight into it
+	if ((image->fd = create_backing_file()) < 0 || ftruncate(image->fd, IMAGE_BYTES)
+		|| (*mem = mmap(NULL, IMAGE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, 0)) == MAP_FAILED)
+	{
+		printf("Couldn't create the program image!\n");
+		exit(-ENOMEM);
+	}
+	image->mem = *mem;
+	image->refs = 1;
+	return image;
+}
+
+/**
+ * @name 	Finish Image
+ * @brief Makes a loaded image read-only, or throws it away if a program didn't load
+ * @param [lc3_image_t*] image The image
+ * @param [int] error 0 if everything loaded, or the errno to fail with
+ * @retval The image, or NULL with errno set
+ */
+static lc3_image_t* finish_image(lc3_image_t* image, int error)
+{
+	if (error)
+	{
+		release_image(image);
+		errno = error;
+		return NULL;
+	}
+	mprotect((void*)image->mem, IMAGE_BYTES, PROT_READ);
+	return image;
+}
+
+/**
+ * @name 	Load Object
+ * @brief Loads one object file into an image being built
+ * @param [lc3_image_t*] image The image
+ * @param [unsigned short*] mem Its writable memory
+ * @param [FILE*] program The opened object file
+ * @retval 0 on success, EIO if the file couldn't be read, EINVAL if it isn't a well-formed object file
+ */
+static int load_object(lc3_image_t* image, unsigned short* mem, FILE* program)
+{
+	unsigned char* data;
+	size_t size;
+	int mapped;
+	int error = 0;
+
+	if (!(data = read_object_file(program, &size, &mapped)))
+		return EIO;
+	if (load_segments(mem, data, size, &image->entry))
+		error = EINVAL;
+	if (mapped)
+		munmap(data, size);
+	else
+		free(data);
+	return error;
+}
+
+/**
+ * @name 	Load Images
+ * @brief Reads one or more assembled LC-3 programs into a new image, e.g. an OS followed by a user program
+ * @param [FILE**] programs The assembled programs as opened FILEs, loaded in order
+ * @param [int] count How many there are
+ * @retval The image, holding one reference for the caller, or NULL (with errno set) if a file couldn't be read
+ * 	or isn't a well-formed object file
+ *
+ * Later programs overwrite earlier ones where they overlap, and memory outside every segment is zero. The entry
+ * point is the first segment of the last program; callers may change it before any machine uses the image.
+ */
+lc3_image_t* load_images(FILE** programs, int count)
+{
+	unsigned short* mem;
+	lc3_image_t* image = create_image(&mem);
+	int error = 0;
+	int i;
+
+	for (i=0; i<count && !error; i++)
+		error = load_object(image, mem, programs[i]);
+	return finish_image(image, error);
+}
+
+lc3_image_t* load_image(FILE* program)
+{
+	return load_images(&program, 1);
+}
+
+/**
+ * @name 	Is Source
+ * @brief Tells assembly source from object files by name
+ * @param [const char*] path The file's name
+ * @retval 1 if it ends in .asm (in any case)
+ */
+int is_source(const char* path)
+{
+	size_t length = strlen(path);
+	return length >= 4 && !strcasecmp(path + length - 4, ".asm");
+}
+
+/**
+ * @name 	Load Image Symbols
+ * @brief Adds the labels of one of the programs loaded into an image, from the .sym file next to it
+ * @param [lc3_image_t*] image The image
+ * @param [const char*] path The program's object file, e.g. prog.obj for prog.sym
+ * @retval 0 on success, -ENOENT if there is no symbol file
+ *
+ * An assembled source brought its labels along already, so there's nothing to do for one.
+ */
+int load_image_symbols(lc3_image_t* image, const char* path)
+{
+	size_t length = strlen(path);
+	char* symbolfile;
+	int error;
+
+	if (is_source(path))
+		return 0;
+	if (!(symbolfile = malloc(length+1)))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	strcpy(symbolfile, path);
+	if (length >= 4)
+		strcpy(symbolfile + length - 4, ".sym");
+	error = load_symbols(&image->symbols, symbolfile);
+	free(symbolfile);
+	return error;
+}
+
+/**
+ * @name 	Open Images
+ * @brief Like load_images(), but from file names, assembling any .asm source on the way
+ * @param [char**] paths The programs, loaded in order
+ * @param [int] count How many there are
+ * @retval The image, holding one reference for the caller, or NULL with errno set: ENOENT if a file couldn't be
+ * 	opened, EIO if it couldn't be read, EINVAL if it isn't a well-formed object file, ENOEXEC if it didn't assemble
+ *
+ * Sources are assembled straight into the image, labels and all (see lc3asm.c); assembly errors are printed to
+ * stderr. The symbols of object files are left to the caller, as with load_images().
+ */
+lc3_image_t* open_images(char** paths, int count)
+{
+	unsigned short* mem;
+	lc3_image_t* image = create_image(&mem);
+	unsigned char* data;
+	size_t size;
+	int mapped;
+	FILE* file;
+	int error = 0;
+	int i;
+
+	for (i=0; i<count && !error; i++)
+	{
+		if (!(file = fopen(paths[i], "r")))
+		{
+			error = ENOENT;
+			break;
+		}
+		if (!is_source(paths[i]))
+			error = load_object(image, mem, file);
+		else if (!(data = read_object_file(file, &size, &mapped)))
+			error = EIO;
+		else
+		{
+			if (assemble((const char*)data, size, paths[i], mem, &image->symbols, &image->entry))
+				error = ENOEXEC;
+			if (mapped)
+				munmap(data, size);
+			else
+				free(data);
+		}
+		fclose(file);
+	}
+	return finish_image(image, error);
+}
+
+void hold_image(lc3_image_t* image)
+{
+	__atomic_add_fetch(&image->refs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @name 	Release Image
+ * @brief Drops a reference to an image, freeing it with the last one
+ * @param [lc3_image_t*] image The image (may be NULL)
+ */
+void release_image(lc3_image_t* image)
+{
+	if (!image || __atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+	munmap((void*)image->mem, IMAGE_BYTES);
+	close(image->fd);
+	free_symbols(&image->symbols);
+	free(image);
+}
+
+/**
+ * @name 	Map Image
+ * @brief Maps an image's memory copy-on-write for one machine
+ * @param [const lc3_image_t*] image The image, or NULL for all-zero memory
+ * @param [unsigned short*] at A previous mapping to replace in place, or NULL for a new one
+ * @retval The machine's memory
+ */
+unsigned short* map_image(const lc3_image_t* image, unsigned short* at)
+{
+	void* mem;
+
+	if (image)
+		mem = mmap(at, IMAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | (at ? MAP_FIXED : 0), image->fd, 0);
+	else
+		mem = mmap(at, IMAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | (at ? MAP_FIXED : 0), -1, 0);
+	if (mem == MAP_FAILED)
+	{
+		printf("Couldn't map the program image!\n");
+		exit(-ENOMEM);
+	}
+	return mem;
+}
+
+void unmap_image(unsigned short* mem)
+{
+	munmap(mem, IMAGE_BYTES);
+}
+
+/**
+ * @name 	Discard Private Pages
+ * @brief Hands a machine's copies of the image pages covering some memory back to the kernel
+ * @param [unsigned short*] mem The machine's memory, from map_image()
+ * @param [unsigned int] address First word of the range
+ * @param [unsigned int] words Length of the range
+ *
+ * The range is widened to whole pages, which then read from the image again; every word of them must already
+ * match the image. Only frees memory where the kernel guarantees that (Linux); elsewhere this does nothing.
+ */
+void discard_private_pages(unsigned short* mem, unsigned int address, unsigned int words)
+{
+#ifdef __linux__
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)(mem + address) & ~(page-1);
+	uintptr_t end = ((uintptr_t)(mem + address + words) + page-1) & ~(page-1);
+
+	madvise((void*)start, end - start, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,639 @@
+/**
+ * @file		lc3jit.c
+ * @brief		Native x86-64 JIT backend for hot LC-3 code
+ *
+ * Counts how often each address is reached, and once an address has been run JIT_THRESHOLD times compiles the
+ * basic block starting there into x86-64 code in an mmap'd arena. Everything else, including every TRAP, runs
+ * through execute_instruction() one instruction at a time, so service routines always see an up-to-date machine.
+ * Each machine has its own arena and block map, allocated the first time it runs the JIT.
+ *
+ * Generated code is called as code(regfile, mem, ctx, coverage, dirty) and works on regfile[] and mem[] in place:
+ * 	rdi = regfile, rsi = mem, rdx = ctx, r8 = coverage, r9 = dirty page map, eax/ecx scratch.
+ * It never calls out, and returns to run_jit() at the end of every block, so breakpoints (block entry only, as in
+ * lc3block.c) and the instruction count are exact. A block that branches back to its own start loops natively
+ * while its fuel lasts for another whole trip. A block is only called with fuel for all of it, so runs stop exactly
+ * on the execution limit and the next event; otherwise its instructions are interpreted one at a time.
+ *
+ * A store whose address is covered by a native block leaves the block straight after the store with ctx->smc
+ * set, and run_jit() throws away every block covering that address before continuing. Native stores only look for
+ * native code, so the predecode and block engines' caches are thrown away when the JIT takes over the machine.
+ * Once native code covering an address has been thrown away JIT_FLUSH_LIMIT times, blocks end in front of it and
+ * the interpreter runs it instead, so code that keeps rewriting itself isn't compiled over and over.
+ *
+ * Device registers are left to the interpreter too. A block ends in front of an LD/ST/LDI/STI whose operand
+ * address is one of them; other addresses are compared against DEVICE_BASE as the block runs, and one at or above
+ * it leaves the block in front of the instruction with ctx->device set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3block.h"
+#include "../include/lc3jit.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+#define JIT_ARENA (4 << 20)			// Bytes of executable memory
+#define JIT_BLOCK_BYTES 8192		// Upper bound on the code for one block
+#define JIT_PAGE 4096						// Granularity of the arena's protection changes
+
+#define JITCTX_RESULT		0
+#define JITCTX_NEXT			2
+#define JITCTX_FUEL			4
+#define JITCTX_SMC			8
+#define JITCTX_SMC_HIT	10
+#define JITCTX_DEVICE		11
+
+_Static_assert(offsetof(jitctx_t, result) == JITCTX_RESULT, "jitctx_t layout");
+_Static_assert(offsetof(jitctx_t, next) == JITCTX_NEXT, "jitctx_t layout");
+_Static_assert(offsetof(jitctx_t, fuel) == JITCTX_FUEL, "jitctx_t layout");
+_Static_assert(offsetof(jitctx_t, smc) == JITCTX_SMC, "jitctx_t layout");
+_Static_assert(offsetof(jitctx_t, smc_hit) == JITCTX_SMC_HIT, "jitctx_t layout");
+_Static_assert(offsetof(jitctx_t, device) == JITCTX_DEVICE, "jitctx_t layout");
+
+typedef void (*jitcode_t)(unsigned short* regs, unsigned short* memory, jitctx_t* ctx, unsigned char* coverage,
+	unsigned char* dirty);
+
+typedef struct jitblock_s {
+	jitcode_t code;				// NULL if the block can't be translated
+	unsigned short start;
+	unsigned short length;
+} jitblock_t;
+
+static _Thread_local unsigned char* out;		// Emit pointer; machines on other threads compile concurrently
+
+static void emit8(unsigned char b)
+{
+	*out++ = b;
+}
+
+static void emit16(unsigned short w)
+{
+	emit8(w & 0xFF);
+	emit8(w >> 8);
+}
+
+static void emit32(unsigned int d)
+{
+	emit16(d & 0xFFFF);
+	emit16(d >> 16);
+}
+
+static void emit_bytes(const char* bytes, int n)
+{
+	memcpy(out, bytes, n);
+	out += n;
+}
+
+// Patch a rel32 field at site to jump to target
+static void patch_rel32(unsigned char* site, unsigned char* target)
+{
+	int rel = (int)(target - (site + 4));
+	memcpy(site, &rel, 4);
+}
+
+/*
+ * Instruction templates. "reg" is 0 for eax and 1 for ecx.
+ */
+
+// movzx reg, word [rdi + 2*r]
+static void emit_load_reg(int reg, int r)
+{
+	emit_bytes("\x0F\xB7", 2);
+	emit8(0x47 | (reg << 3));
+	emit8(2*r);
+}
+
+// mov word [rdi + 2*r], ax ; mov word [rdx], ax
+static void emit_writeback(int r)
+{
+	emit_bytes("\x66\x89\x47", 3);
+	emit8(2*r);
+	emit_bytes("\x66\x89\x02", 3);
+}
+
+// movzx reg, word [rsi + 2*address]
+static void emit_load_abs(int reg, unsigned short address)
+{
+	emit_bytes("\x0F\xB7", 2);
+	emit8(0x86 | (reg << 3));
+	emit32(2*address);
+}
+
+// movzx reg, word [rsi + rcx*2]
+static void emit_load_indexed(int reg)
+{
+	emit_bytes("\x0F\xB7", 2);
+	emit8(0x04 | (reg << 3));
+	emit8(0x4E);
+}
+
+// ecx = (regfile[base] + offset) & 0xFFFF
+static void emit_base_offset(int base, short offset)
+{
+	emit_load_reg(1, base);
+	emit_bytes("\x81\xC1", 2);
+	emit32((unsigned int)(int)offset);
+	emit_bytes("\x0F\xB7\xC9", 3);
+}
+
+// cmp ecx, DEVICE_BASE ; jae (to be patched)
+static unsigned char* emit_device_check()
+{
+	emit_bytes("\x81\xF9", 2);
+	emit32(DEVICE_BASE);
+	emit_bytes("\x0F\x83", 2);
+	emit32(0);
+	return out-4;
+}
+
+// sub dword [rdx + fuel], count
+static void emit_burn(int count)
+{
+	emit_bytes("\x81\x6A", 2);
+	emit8(JITCTX_FUEL);
+	emit32(count);
+}
+
+// mov word [rdx + next], address ; ret
+static void emit_return_to(unsigned short address)
+{
+	emit_bytes("\x66\xC7\x42", 3);
+	emit8(JITCTX_NEXT);
+	emit16(address);
+	emit8(0xC3);
+}
+
+// Leave the block after count instructions, continuing at address
+static void emit_exit(int count, unsigned short address)
+{
+	emit_burn(count);
+	emit_return_to(address);
+}
+
+// Leave the block after count instructions, continuing at target; loop natively if target is the block start and
+// there is fuel left for another whole trip round it (count is then the block's length)
+static void emit_jump(int count, unsigned short target, unsigned short start, unsigned char* top)
+{
+	emit_burn(count);
+	if (target == start)
+	{
+		// cmp dword [rdx + fuel], count ; jge top
+		emit_bytes("\x81\x7A", 2);
+		emit8(JITCTX_FUEL);
+		emit32(count);
+		emit_bytes("\x0F\x8D", 2);
+		emit32(0);
+		patch_rel32(out-4, top);
+	}
+	emit_return_to(target);
+}
+
+/**
+ * @name 	JIT Compile
+ * @brief Translates the basic block starting at an address into native code
+ * @param [lc3_machine_t*] m The machine whose memory holds the block
+ * @param [unsigned short] start The address of the first instruction
+ * @retval The new block; its code is NULL if the first instruction can't be translated
+ */
+static jitblock_t* jit_compile(lc3_machine_t* m, unsigned short start)
+{
+	lc3jit_t* jit = m->jit;
+	lc3pre_t op;
+	unsigned char* smc_sites[JIT_MAX];
+	unsigned short smc_next[JIT_MAX];
+	int smc_count[JIT_MAX];
+	int nstores = 0;
+	unsigned char* device_sites[JIT_MAX];
+	unsigned short device_address[JIT_MAX];
+	int device_count[JIT_MAX];
+	int ndevices = 0;
+	unsigned short address = start;
+	int length = 0;
+	int done = 0;
+	int i;
+
+	jitblock_t* block = malloc(sizeof(jitblock_t));
+	if (!block)
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+
+	if (jit->arena_used + JIT_BLOCK_BYTES > JIT_ARENA)
+		jit_clear(m);
+	// Only the pages the block can land in are made writable: self-modifying code recompiles constantly, and
+	// changing the protection of the whole arena each time costs far more than running it
+	unsigned char* window = jit->arena + (jit->arena_used & ~(size_t)(JIT_PAGE-1));
+	size_t window_size = ((jit->arena_used + JIT_BLOCK_BYTES + JIT_PAGE-1) & ~(size_t)(JIT_PAGE-1))
+		- (window - jit->arena);
+	mprotect(window, window_size, PROT_READ | PROT_WRITE);
+
+	unsigned char* entry = jit->arena + jit->arena_used;
+	out = entry;
+	emit_bytes("\x4D\x89\xC1", 3);		// mov r9, r8
+	emit_bytes("\x49\x89\xC8", 3);		// mov r8, rcx
+	unsigned char* top = out;
+
+	while (!done)
+	{
+		if (length && breakpoint_at(m, address))
+		{
+			emit_exit(length, address);
+			break;
+		}
+		if (jit->flushes[address] >= JIT_FLUSH_LIMIT)
+		{
+			if (length)
+				emit_exit(length, address);
+			break;
+		}
+		predecode(&op, address, m->mem[address]);
+		lc3pre_t* e = &op;
+		unsigned short following = address+1;
+
+		// Stop in front of a device register access the way the block stops in front of a TRAP
+		if ((e->handler == H_LD || e->handler == H_ST || e->handler == H_LDI || e->handler == H_STI)
+			&& e->imm >= DEVICE_BASE)
+			e->handler = H_TRAP;
+		// Addresses only known at run time are checked there; these exits say where they leave the block
+		device_address[ndevices] = address;
+		device_count[ndevices] = length;
+
+		switch (e->handler) {
+		case H_ADDR:
+		case H_ANDR:
+			emit_load_reg(0, e->b);
+			emit_bytes(e->handler == H_ADDR ? "\x66\x03\x47" : "\x66\x23\x47", 3);
+			emit8(2*e->c);
+			emit_writeback(e->a);
+			break;
+		case H_ADDI:
+		case H_ANDI:
+			emit_load_reg(0, e->b);
+			emit_bytes(e->handler == H_ADDI ? "\x66\x05" : "\x66\x25", 2);
+			emit16(e->imm);
+			emit_writeback(e->a);
+			break;
+		case H_NOT:
+			emit_load_reg(0, e->b);
+			emit_bytes("\x66\xF7\xD0", 3);
+			emit_writeback(e->a);
+			break;
+		case H_LD:
+			emit_load_abs(0, e->imm);
+			emit_writeback(e->a);
+			break;
+		case H_LDR:
+			emit_base_offset(e->b, e->imm);
+			device_sites[ndevices++] = emit_device_check();
+			emit_load_indexed(0);
+			emit_writeback(e->a);
+			break;
+		case H_LDI:
+			emit_load_abs(1, e->imm);
+			device_sites[ndevices++] = emit_device_check();
+			emit_load_indexed(0);
+			emit_writeback(e->a);
+			break;
+		case H_LEA:
+			emit8(0xB8);
+			emit32(e->imm);
+			emit_writeback(e->a);
+			break;
+		case H_ST:
+		case H_STR:
+		case H_STI:
+			if (e->handler == H_ST)
+			{
+				emit8(0xB9);
+				emit32(e->imm);
+			}
+			else if (e->handler == H_STR)
+				emit_base_offset(e->b, e->imm);
+			else
+				emit_load_abs(1, e->imm);
+			if (e->handler != H_ST)
+				device_sites[ndevices++] = emit_device_check();
+			emit_load_reg(0, e->a);
+			emit_bytes("\x66\x89\x04\x4E", 4);					// mov word [rsi + rcx*2], ax
+			emit_bytes("\x89\xC8", 2);									// mov eax, ecx
+			emit_bytes("\xC1\xE8", 2);									// shr eax, DIRTY_SHIFT
+			emit8(DIRTY_SHIFT);
+			emit_bytes("\x41\xC6\x04\x01\x01", 5);			// mov byte [r9 + rax], 1
+			emit_bytes("\x41\x80\x3C\x08\x00", 5);			// cmp byte [r8 + rcx], 0
+			emit_bytes("\x0F\x85", 2);									// jne smc stub
+			emit32(0);
+			smc_sites[nstores] = out-4;
+			smc_next[nstores] = following;
+			smc_count[nstores] = length+1;
+			nstores++;
+			break;
+		case H_NOP:
+			break;
+		case H_BR:
+			emit_bytes("\x66\x83\x3A\x00", 4);					// cmp word [rdx], 0
+			// Jump to the taken path on the NZP condition
+			switch (e->a) {
+			case 4: emit_bytes("\x0F\x8C", 2); break;		// n: jl
+			case 2: emit_bytes("\x0F\x84", 2); break;		// z: je
+			case 1: emit_bytes("\x0F\x8F", 2); break;		// p: jg
+			case 6: emit_bytes("\x0F\x8E", 2); break;		// nz: jle
+			case 3: emit_bytes("\x0F\x8D", 2); break;		// zp: jge
+			case 5: emit_bytes("\x0F\x85", 2); break;		// np: jne
+			}
+			emit32(0);
+			unsigned char* taken = out-4;
+			emit_exit(length+1, following);
+			patch_rel32(taken, out);
+			emit_jump(length+1, e->imm, start, top);
+			done = 1;
+			break;
+		case H_BRA:
+			emit_jump(length+1, e->imm, start, top);
+			done = 1;
+			break;
+		case H_JSR:
+			emit_bytes("\x66\xC7\x47\x0E", 4);					// mov word [rdi + 14], following
+			emit16(following);
+			emit_jump(length+1, e->imm, start, top);
+			done = 1;
+			break;
+		case H_JSRR:
+		case H_JMP:
+			emit_load_reg(0, e->b);
+			emit_bytes("\x66\xC7\x47\x0E", 4);					// mov word [rdi + 14], following
+			emit16(following);
+			emit_burn(length+1);
+			emit_bytes("\x66\x89\x42", 3);							// mov word [rdx + next], ax
+			emit8(JITCTX_NEXT);
+			emit8(0xC3);
+			done = 1;
+			break;
+		default:
+			// TRAP, HALT and RTI run in the interpreter, so the block stops in front of them
+			if (length)
+				emit_exit(length, address);
+			done = 1;
+			length--;
+			break;
+		}
+		length++;
+		address++;
+		if (!done && length == JIT_MAX)
+		{
+			emit_exit(length, address);
+			done = 1;
+		}
+	}
+
+	// Out-of-line exits for stores that hit translated code
+	for (i=0; i<nstores; i++)
+	{
+		patch_rel32(smc_sites[i], out);
+		emit_bytes("\x66\x89\x4A", 3);							// mov word [rdx + smc], cx
+		emit8(JITCTX_SMC);
+		emit_bytes("\xC6\x42", 2);									// mov byte [rdx + smc_hit], 1
+		emit8(JITCTX_SMC_HIT);
+		emit8(1);
+		emit_exit(smc_count[i], smc_next[i]);
+	}
+
+	// Out-of-line exits for device register accesses
+	for (i=0; i<ndevices; i++)
+	{
+		patch_rel32(device_sites[i], out);
+		emit_bytes("\xC6\x42", 2);									// mov byte [rdx + device], 1
+		emit8(JITCTX_DEVICE);
+		emit8(1);
+		emit_exit(device_count[i], device_address[i]);
+	}
+
+	mprotect(window, window_size, PROT_READ | PROT_EXEC);
+
+	block->start = start;
+	block->length = length;
+	if (!length)
+	{
+		block->code = NULL;
+	}
+	else
+	{
+		block->code = (jitcode_t)entry;
+		jit->arena_used += out - entry;
+		for (i=0; i<length; i++)
+			jit->coverage[(unsigned short)(start+i)]++;
+	}
+	jit->map[start] = block;
+	return block;
+}
+
+/**
+ * @name 	JIT Flush
+ * @brief Throws away every native block that covers an address
+ * @param [lc3_machine_t*] m The machine that was written
+ * @param [unsigned short] address The address whose translations are stale
+ */
+void jit_flush(lc3_machine_t* m, unsigned short address)
+{
+	lc3jit_t* jit = m->jit;
+	int i, j;
+
+	if (!jit)
+		return;
+	if (jit->flushes[address] < JIT_FLUSH_LIMIT)
+		jit->flushes[address]++;
+	for (i=0; i<JIT_MAX && jit->coverage[address]; i++)
+	{
+		unsigned short start = address-i;
+		jitblock_t* block = jit->map[start];
+		if (!block || !block->code || block->length <= i)
+			continue;
+
+		for (j=0; j<block->length; j++)
+			jit->coverage[(unsigned short)(start+j)]--;
+		jit->map[start] = NULL;
+		jit->heat[start] = 0;
+		free(block);
+	}
+	// An untranslatable entry may become translatable once its first word changes
+	if (jit->map[address] && !jit->map[address]->code)
+	{
+		free(jit->map[address]);
+		jit->map[address] = NULL;
+	}
+}
+
+/**
+ * @name 	JIT Clear
+ * @brief Throws away all native code, e.g. after a new program image is loaded
+ * @param [lc3_machine_t*] m The machine whose code is thrown away
+ */
+void jit_clear(lc3_machine_t* m)
+{
+	lc3jit_t* jit = m->jit;
+	int i;
+
+	if (!jit)
+		return;
+	for (i=0; i<65536; i++)
+	{
+		free(jit->map[i]);
+		jit->map[i] = NULL;
+	}
+	memset(jit->heat, 0, sizeof(jit->heat));
+	memset(jit->flushes, 0, sizeof(jit->flushes));
+	memset(jit->coverage, 0, sizeof(jit->coverage));
+	jit->arena_used = 0;
+}
+
+/**
+ * @name 	JIT Free
+ * @brief Frees a machine's native code cache and its arena
+ * @param [lc3_machine_t*] m The machine that owns the cache
+ */
+void jit_free(lc3_machine_t* m)
+{
+	if (!m->jit)
+		return;
+	jit_clear(m);
+	if (m->jit->arena)
+		munmap(m->jit->arena, JIT_ARENA);
+	free(m->jit);
+	m->jit = NULL;
+}
+
+/**
+ * @name 	Run JIT
+ * @brief Runs the program from the current PC, compiling hot blocks to native code, until HALT or a breakpoint
+ * @param [lc3_machine_t*] m The machine to run
+ *
+ * Leaves the machine's pc, ir, cc, executions and next_inst exactly as the same number of step_forward() calls would.
+ */
+void run_jit(lc3_machine_t* m)
+{
+	unsigned short address = m->pc-1;
+	unsigned long long limit = run_limit(m);
+	lc3jit_t* jit;
+	jitblock_t* block;
+	jitctx_t ctx;
+	int fuel;
+	int device = 0;
+
+	if (m->halted)
+		return;
+
+	if (!m->jit && !(m->jit = calloc(1, sizeof(lc3jit_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	jit = m->jit;
+	if (!jit->arena)
+	{
+		jit->arena = mmap(NULL, JIT_ARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (jit->arena == MAP_FAILED)
+		{
+			jit->arena = NULL;
+			run_blocks(m);
+			return;
+		}
+	}
+	// They would go stale under native stores; the engines rebuild them if they run this machine again
+	free_predecoded(m);
+	free_blocks(m);
+
+	// Stop on a fresh breakpoint, or step past the one we stopped on last time
+	if (breakpoint_at(m, address) == 1)
+	{
+		set_breakpoint_state(m, address, 2);
+		m->running = 0;
+		return;
+	}
+	if (breakpoint_at(m, address) == 2)
+	{
+		set_breakpoint_state(m, address, 1);
+		address = interpret(m, address);
+		limit = run_limit(m);
+		if (m->halted || !m->running)
+			goto fetch;
+	}
+
+	for (;;)
+	{
+		if (m->executions >= limit)
+		{
+			m->running = 0;
+			break;
+		}
+		if (breakpoint_at(m, address))
+		{
+			if (breakpoint_at(m, address) == 1)
+				set_breakpoint_state(m, address, 2);
+			m->running = 0;
+			break;
+		}
+
+		// A block that stopped in front of a device register access leaves it to the interpreter
+		block = device ? NULL : jit->map[address];
+		if (!block && !device && ++jit->heat[address] >= JIT_THRESHOLD)
+			block = jit_compile(m, address);
+		device = 0;
+
+		// Native code only returns at the end of a block, so a block that could run past the limit is interpreted
+		if (block && block->code && m->executions + block->length <= limit)
+		{
+			ctx.result = m->cc;
+			ctx.fuel = limit - m->executions < JIT_FUEL ? (int)(limit - m->executions) : JIT_FUEL;
+			fuel = ctx.fuel;
+			ctx.smc_hit = 0;
+			ctx.device = 0;
+			block->code(m->regfile, m->mem, &ctx, jit->coverage, m->dirty);
+			m->executions += fuel - ctx.fuel;
+			m->cc = ctx.result < 0 ? -1 : ctx.result != 0;
+			address = ctx.next;
+			if (ctx.smc_hit)
+				invalidate_code(m, ctx.smc);
+			device = ctx.device;
+			continue;
+		}
+
+		// Instructions left to the interpreter may schedule events
+		address = interpret(m, address);
+		limit = run_limit(m);
+		if (m->halted || !m->running)
+			break;
+	}
+
+fetch:
+	m->pc = address+1;
+	m->ir = m->mem[address];
+	decode_instruction(&m->next_inst, m->ir);
+}
+
+#else
+
+void jit_flush(lc3_machine_t* m, unsigned short address)
+{
+}
+
+void jit_clear(lc3_machine_t* m)
+{
+}
+
+void jit_free(lc3_machine_t* m)
+{
+}
+
+// No native backend on this platform; the block engine is the next best thing
+void run_jit(lc3_machine_t* m)
+{
+	run_blocks(m);
+}
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * @file		lc3loop.c
+ * @brief		Finding loops that change nothing
+ *
+ * A program stuck in BRnzp #-1, or polling a word nothing will ever write, would run until its budget is spent.
+ * find_loop() looks for that by stepping the machine a little way and watching for the PC, registers and CC to come
+ * back to where they started, with no instruction in between having changed memory, touched the keyboard,
+ * stored to a device register, trapped or returned from an interrupt. The machine is deterministic apart from those, so
+ * coming back means it will go round the same way forever; only an event (the timer, a keyboard interrupt) can
+ * break in. With none scheduled the program is stuck, and with one the trips up to it can be skipped with
+ * skip_loop(), since each leaves the machine exactly as it was.
+ *
+ * Loops waiting on KBSR are already cut short by the device (see lc3device.c), which waits for the next key
+ * instead of running them.
+ */
+
+#include "../include/lc3sim.h"
+#include "../include/lc3loop.h"
+
+/**
+ * @name 	Changes Nothing
+ * @brief Whether an instruction is one a loop that changes nothing could be made of
+ * @param [lc3_machine_t*] m The machine, about to run it
+ * @param [lc3inst_t*] instruction The instruction
+ * @retval 1 if it only changes registers and the CC, or reads memory other than the keyboard's registers, or stores
+ * a word that's already there
+ */
+static int changes_nothing(lc3_machine_t* m, lc3inst_t* instruction)
+{
+	unsigned short address;
+
+	switch (instruction->opcode) {
+	case LD:
+	case LDI:
+	case ST:
+	case STI:
+		address = m->pc + instruction->pcoffset9;
+		break;
+	case LDR:
+	case STR:
+		address = m->regfile[instruction->src1reg] + instruction->offset6;
+		break;
+	case TRAP:
+	case RTI:
+		return 0;
+	default:
+		return 1;
+	}
+	if (address == KBSR_ADDRESS || address == KBDR_ADDRESS)
+		return 0;
+	// The pointer read by LDI and STI is an ordinary load
+	if (instruction->opcode == LDI || instruction->opcode == STI)
+	{
+		if (address >= DEVICE_BASE)
+			return 0;
+		address = m->mem[address];
+		if (instruction->opcode == LDI)
+			return address != KBSR_ADDRESS && address != KBDR_ADDRESS;
+	}
+	if (instruction->opcode == LD || instruction->opcode == LDR)
+		return 1;
+	return address < DEVICE_BASE && m->mem[address] == m->regfile[instruction->destreg];
+}
+
+/**
+ * @name 	Find Loop
+ * @brief Steps a machine up to LOOP_PROBE instructions to see whether it is going round a loop that changes nothing
+ * @param [lc3_machine_t*] m The machine, stopped between instructions
+ * @param [unsigned long long] limit Instruction count not to step past, e.g. a budget (0 for none); the probe
+ * stops short of the next event as well
+ * @param [lc3_loop_t*] loop Filled in if there is one
+ * @retval 1 if the machine is in such a loop, and back where it was; 0 if not, having run some of the program
+ *
+ * The instructions stepped are run for real, so the machine carries on from wherever the probe stopped.
+ * Breakpoints and watchpoints stop the probe, so it never steps over one.
+ */
+int find_loop(lc3_machine_t* m, unsigned long long limit, lc3_loop_t* loop)
+{
+	unsigned short regfile[8];
+	unsigned short pc = m->pc;
+	short cc = m->cc;
+	unsigned short address;
+	unsigned int n;
+	int i;
+
+	// step_forward() runs events once executions reaches the next, so stop one short of it
+	if (!limit || limit >= m->next_event)
+		limit = m->next_event - 1;
+	if (m->halted || m->nwatchpoints)
+		return 0;
+	for (i=0; i<8; i++)
+		regfile[i] = m->regfile[i];
+	loop->start = loop->end = pc-1;
+
+	for (n=1; n<=LOOP_PROBE && m->executions < limit; n++)
+	{
+		address = m->pc-1;
+		if (breakpoint_at(m, address) || !changes_nothing(m, &m->next_inst))
+			return 0;
+		step_forward(m);
+		if (address < loop->start)
+			loop->start = address;
+		if (address > loop->end)
+			loop->end = address;
+		if (m->pc != pc || m->cc != cc)
+			continue;
+		for (i=0; i<8 && m->regfile[i] == regfile[i]; i++);
+		if (i == 8)
+		{
+			loop->period = n;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @name 	Skip Loop
+ * @brief Counts as run every whole trip round a loop that fits before an instruction count
+ * @param [lc3_machine_t*] m The machine, just found in the loop by find_loop()
+ * @param [const lc3_loop_t*] loop The loop
+ * @param [unsigned long long] target Instruction count to skip up to, e.g. the next event
+ *
+ * Nothing but executions changes, so the machine is just as if it had run them. The profiler and statistics, which
+ * count instructions as they run, don't see the trips skipped.
+ */
+void skip_loop(lc3_machine_t* m, const lc3_loop_t* loop, unsigned long long target)
+{
+	if (target > m->executions)
+		m->executions += (target - m->executions) / loop->period * loop->period;
+}
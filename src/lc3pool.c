@@ -0,0 +1,674 @@
+/**
+ * @file		lc3pool.c
+ * @brief		Multi-threaded batch runner
+ *
+ * Runs every (program, input, output) line of a job file headlessly, spread over a pool of worker threads, e.g.
+ * `simplx --pool=jobs.txt --threads=8`. Each job gets its own machine when it first runs, so any number of jobs
+ * can be queued. Each program is read once, and the machines of all its jobs share that image copy-on-write.
+ * A finished job's machine is kept by its worker, and if the next job that worker starts runs the
+ * same program it gets the machine back through reset_program() instead of a fresh load, engine caches and all.
+ * Every worker owns a deque of jobs and steals from the others once its own runs dry. A job whose GETC/IN finds
+ * no input ready (its input is a pipe or FIFO that hasn't been written yet) yields its worker and goes back on
+ * the queue, so it can't hold up the jobs behind it.
+ * With --lockstep, runs of up to SIMD_LANES consecutive jobs with the same program are started together in
+ * lockstep (see lc3simd.c) and finished one by one once they leave it.
+ * Coverage is merged per program over all of its jobs, and written once they have all run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3batch.h"
+#include "../include/lc3pool.h"
+#include "../include/lc3stats.h"
+#include "../include/lc3cov.h"
+
+#define POOL_ERROR 1	// Job status when its files couldn't be opened
+
+typedef struct {
+	pool_job_t* jobs;
+	int njobs;
+	pool_group_t* groups;
+	int ngroups;
+	pool_deque_t* deques;
+	int nthreads;
+	engine_t engine;
+	const batch_options_t* options;
+	pool_program_t* programs;
+	int nprograms;
+	pthread_mutex_t lock;
+	int remaining;				// Jobs not finished yet, under lock
+#ifdef LC3_STATS
+	lc3_stats_t stats;		// Every finished job's statistics added up, under lock
+#endif
+} pool_t;
+
+typedef struct {
+	pool_t* pool;
+	int id;
+	lc3_machine_t* spare;					// Machine of the last job this worker finished, ready for reset_program()
+	int spare_program;
+} worker_t;
+
+static int slot(pool_deque_t* deque, int index)
+{
+	return ((index % deque->capacity) + deque->capacity) % deque->capacity;
+}
+
+static void push_bottom(pool_deque_t* deque, int job)
+{
+	pthread_mutex_lock(&deque->lock);
+	deque->slots[slot(deque, deque->bottom++)] = job;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static void push_top(pool_deque_t* deque, int job)
+{
+	pthread_mutex_lock(&deque->lock);
+	deque->slots[slot(deque, --deque->top)] = job;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static int pop_bottom(pool_deque_t* deque)
+{
+	int job = -1;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top)
+		job = deque->slots[slot(deque, --deque->bottom)];
+	pthread_mutex_unlock(&deque->lock);
+	return job;
+}
+
+static int steal_top(pool_deque_t* deque)
+{
+	int job = -1;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom > deque->top)
+		job = deque->slots[slot(deque, deque->top++)];
+	pthread_mutex_unlock(&deque->lock);
+	return job;
+}
+
+/**
+ * @name 	Open Image
+ * @brief Reads a comma-separated list of programs, e.g. "os.obj,prog.asm", into one image
+ * @param [const char*] paths The files, loaded in order
+ * @param [int] symbols 1 to load the labels of each as well, where it has a symbol file
+ * @retval The image, or NULL if a file couldn't be opened, isn't a valid object file or didn't assemble
+ */
+static lc3_image_t* open_image(const char* paths, int symbols)
+{
+	lc3_image_t* image;
+	char list[POOL_PATH_MAX];
+	char* files[POOL_MAX_IMAGES];
+	char* path;
+	char* rest;
+	int n = 0;
+
+	strcpy(list, paths);
+	for (path = strtok_r(list, ",", &rest); path; path = strtok_r(NULL, ",", &rest))
+	{
+		if (n == POOL_MAX_IMAGES)
+			return NULL;
+		files[n++] = path;
+	}
+	if (!n || !(image = open_images(files, n)))
+		return NULL;
+	while (symbols && n--)
+		load_image_symbols(image, files[n]);
+	return image;
+}
+
+/**
+ * @name 	Get Image
+ * @brief Returns the shared image of a job's program, reading the program the first time one of its jobs starts
+ * @param [pool_t*] pool The pool the job belongs to
+ * @param [pool_job_t*] job The job
+ * @retval The image, with a reference for the caller, or NULL if the program couldn't be loaded
+ */
+static lc3_image_t* get_image(pool_t* pool, pool_job_t* job)
+{
+	pool_program_t* program = &pool->programs[job->program_id];
+	lc3_image_t* image;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!program->image)
+		program->image = open_image(job->program, program->coverage != NULL);
+	if ((image = program->image))
+		hold_image(image);
+	pthread_mutex_unlock(&pool->lock);
+	return image;
+}
+
+/**
+ * @name 	Start Job
+ * @brief Sets up a job's machine, from the worker's spare if it ran the same program, and opens its input and output
+ * @param [worker_t*] self The worker starting the job
+ * @param [pool_job_t*] job The job
+ * @retval 0	the job is ready to run
+ * @retval POOL_ERROR	a file couldn't be opened
+ */
+static int start_job(worker_t* self, pool_job_t* job)
+{
+	lc3_image_t* image = NULL;
+	int reuse = self->spare && self->spare_program == job->program_id;
+	int in_fd = -1;
+	int out_fd = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	if (!reuse && !(image = get_image(self->pool, job)))
+		return POOL_ERROR;
+	// Non-blocking, so a GETC on an empty pipe yields instead of stalling the worker
+	if (strcmp(job->input, "-") && (in_fd = open(job->input, O_RDONLY | O_NONBLOCK)) < 0)
+	{
+		release_image(image);
+		return POOL_ERROR;
+	}
+	if (strcmp(job->output, "-") && (out_fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		release_image(image);
+		if (in_fd >= 0)
+			close(in_fd);
+		return POOL_ERROR;
+	}
+
+	if (!(job->io = malloc(sizeof(batch_io_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	if (reuse)
+	{
+		job->machine = self->spare;
+		self->spare = NULL;
+		reset_program(job->machine);
+	}
+	else
+	{
+		job->machine = create_machine();
+		job->machine->engine = self->pool->engine;
+		apply_trap_settings(job->machine, self->pool->options->traps, self->pool->options->ntraps);
+#ifdef LC3_STATS
+		if (self->pool->options->stats_path)
+			start_stats(job->machine);
+#endif
+		if (self->pool->programs[job->program_id].coverage)
+			start_coverage(job->machine);
+		use_image(job->machine, image);
+		release_image(image);
+	}
+	attach_batch_io(job->machine, job->io, in_fd, out_fd);
+	return 0;
+}
+
+/**
+ * @name 	Finish Job
+ * @brief Records how a job ended and hands its machine to the worker as its spare
+ * @param [worker_t*] self The worker finishing the job
+ * @param [pool_job_t*] job The job
+ * @param [int] status How the job ended
+ */
+static void finish_job(worker_t* self, pool_job_t* job, int status)
+{
+	pool_t* pool = self->pool;
+
+	job->finished = 1;
+	job->status = status;
+	job->seconds = seconds_since(&job->start);
+	if (job->machine)
+	{
+		flush_batch_io(job->machine);
+		if (job->io->in_fd >= 0)
+			close(job->io->in_fd);
+		if (job->io->out_fd >= 0)
+			close(job->io->out_fd);
+		job->executions = job->machine->executions;
+		job->loop = job->io->loop;
+#ifdef LC3_STATS
+		if (job->machine->stats)
+		{
+			job->counted = stats_instructions(job->machine->stats);
+			job->run_seconds = job->machine->stats->seconds;
+			pthread_mutex_lock(&pool->lock);
+			add_stats(&pool->stats, job->machine->stats);
+			pthread_mutex_unlock(&pool->lock);
+		}
+#endif
+		if (job->machine->coverage)
+		{
+			pthread_mutex_lock(&pool->lock);
+			add_coverage(pool->programs[job->program_id].coverage, job->machine->coverage);
+			pthread_mutex_unlock(&pool->lock);
+		}
+		if (self->spare)
+			destroy_machine(self->spare);
+		self->spare = job->machine;
+		self->spare_program = job->program_id;
+		free(job->io);
+		job->machine = NULL;
+		job->io = NULL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->remaining--;
+	if (!--pool->programs[job->program_id].pending && !pool->programs[job->program_id].coverage)
+	{
+		// Machines still using the image hold their own references
+		release_image(pool->programs[job->program_id].image);
+		pool->programs[job->program_id].image = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @name 	Start Lockstep
+ * @brief Puts the started jobs of a group into lockstep, if there are at least two of them
+ * @param [pool_group_t*] group The group
+ * @param [pool_t*] pool The pool it belongs to
+ */
+static void start_lockstep(pool_t* pool, pool_group_t* group)
+{
+	lc3_machine_t* lanes[SIMD_LANES];
+	int n = 0;
+	int i;
+
+	for (i=0; i<group->count; i++)
+		if (pool->jobs[group->first+i].machine)
+		{
+			group->lane_job[n] = group->first+i;
+			lanes[n++] = pool->jobs[group->first+i].machine;
+		}
+	if (n < 2)
+		return;
+
+	if (!(group->lockstep = malloc(sizeof(lc3_lockstep_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	init_lockstep(group->lockstep, lanes, n);
+}
+
+/**
+ * @name 	Run Lockstep Group
+ * @brief Runs a group's lockstep lanes until none is left in lockstep, finishing the jobs that end on the way
+ * @param [worker_t*] self The worker running the group
+ * @param [pool_group_t*] group The group
+ */
+static void run_lockstep_group(worker_t* self, pool_group_t* group)
+{
+	pool_t* pool = self->pool;
+	lc3_lockstep_t* lockstep = group->lockstep;
+	unsigned char stepping[SIMD_LANES];
+	pool_job_t* job;
+	int status;
+	int l;
+
+	do {
+		memcpy(stepping, lockstep->stepping, sizeof(stepping));
+		for (l=0; l<lockstep->count; l++)
+			if (stepping[l])
+			{
+				set_batch_limit(lockstep->lanes[l], pool->options);
+				((batch_io_t*)lockstep->lanes[l]->io)->would_block = 0;
+			}
+
+		run_lockstep(lockstep);
+
+		for (l=0; l<lockstep->count; l++)
+		{
+			if (!stepping[l])
+				continue;
+			job = &pool->jobs[group->lane_job[l]];
+			status = batch_status(job->machine, pool->options, &job->start);
+			if (status >= 0)
+			{
+				lockstep->stepping[l] = 0;
+				finish_job(self, job, status);
+			}
+		}
+	} while (memchr(lockstep->stepping, 1, lockstep->count));
+
+	free_lockstep(lockstep);
+	free(lockstep);
+	group->lockstep = NULL;
+}
+
+/**
+ * @name 	Run Group
+ * @brief Runs a group's jobs until each has ended or has to wait for input
+ * @param [worker_t*] self The worker running the group
+ * @param [int] index The group's index
+ * @retval 1	a job is waiting for input and the group should be requeued
+ * @retval 0	every job in the group is finished
+ */
+static int run_group(worker_t* self, int index)
+{
+	pool_t* pool = self->pool;
+	pool_group_t* group = &pool->groups[index];
+	pool_job_t* job;
+	int waiting = 0;
+	int status;
+	int i;
+
+	for (i=0; i<group->count; i++)
+	{
+		job = &pool->jobs[group->first+i];
+		if (!job->finished && !job->machine && start_job(self, job))
+			finish_job(self, job, POOL_ERROR);
+	}
+
+	if (!group->started)
+	{
+		group->started = 1;
+		if (group->count > 1)
+			start_lockstep(pool, group);
+	}
+	if (group->lockstep)
+		run_lockstep_group(self, group);
+
+	for (i=0; i<group->count; i++)
+	{
+		job = &pool->jobs[group->first+i];
+		if (job->finished)
+			continue;
+		while ((status = run_batch_slice(job->machine, pool->options, &job->start)) == BATCH_RUNNING);
+		if (status == BATCH_WAITING)
+			waiting = 1;
+		else
+			finish_job(self, job, status);
+	}
+	return waiting;
+}
+
+/**
+ * @name 	Worker
+ * @brief Thread body: runs groups from its own deque, then steals from the others, until every job is finished
+ * @param [void*] arg The worker_t for this thread
+ */
+static void* worker(void* arg)
+{
+	worker_t* self = arg;
+	pool_t* pool = self->pool;
+	int id = self->id;
+	pool_deque_t* own = &pool->deques[id];
+	struct timespec nap = { 0, 1000000 };
+	int remaining;
+	int group;
+	int i;
+
+	for (;;)
+	{
+		group = pop_bottom(own);
+		for (i=1; group < 0 && i<pool->nthreads; i++)
+			group = steal_top(&pool->deques[(id+i) % pool->nthreads]);
+
+		if (group < 0)
+		{
+			pthread_mutex_lock(&pool->lock);
+			remaining = pool->remaining;
+			pthread_mutex_unlock(&pool->lock);
+			if (!remaining)
+				break;
+			// Everything left is running on other workers or waiting for input
+			nanosleep(&nap, NULL);
+			continue;
+		}
+
+		if (run_group(self, group))
+		{
+			push_top(own, group);
+			sched_yield();
+		}
+	}
+
+	if (self->spare)
+		destroy_machine(self->spare);
+	return NULL;
+}
+
+/**
+ * @name 	Read Jobs
+ * @brief Parses a job file: one "program.obj input output" line per job; blank lines and lines starting with # are skipped
+ * @param [const char*] jobfile The job file
+ * @param [int*] njobs Set to the number of jobs read
+ * @retval The jobs, or NULL if the file couldn't be read
+ */
+static pool_job_t* read_jobs(const char* jobfile, int* njobs)
+{
+	FILE* file;
+	char line[3*POOL_PATH_MAX + 16];
+	pool_job_t* jobs = NULL;
+	int capacity = 0;
+	int n = 0;
+
+	if (!(file = fopen(jobfile, "r")))
+		return NULL;
+
+	capacity = 64;
+	if (!(jobs = malloc(capacity*sizeof(pool_job_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	while (fgets(line, sizeof(line), file))
+	{
+		if (n == capacity)
+		{
+			capacity *= 2;
+			if (!(jobs = realloc(jobs, capacity*sizeof(pool_job_t))))
+			{
+				printf("Malloc returned NULL! That's no good!\n");
+				exit(-ENOMEM);
+			}
+		}
+		memset(&jobs[n], 0, sizeof(pool_job_t));
+		if (sscanf(line, "%1023s %1023s %1023s", jobs[n].program, jobs[n].input, jobs[n].output) < 1
+			|| jobs[n].program[0] == '#')
+			continue;
+		if (!jobs[n].input[0])
+			strcpy(jobs[n].input, "-");
+		if (!jobs[n].output[0])
+			strcpy(jobs[n].output, "-");
+		n++;
+	}
+
+	fclose(file);
+	*njobs = n;
+	return jobs;
+}
+
+/**
+ * @name 	Run Pool
+ * @brief Runs every job in a job file on a pool of threads, then prints a result line per job and the throughput
+ * @param [const char*] jobfile The job file; see read_jobs()
+ * @param [int] threads Number of worker threads
+ * @param [engine_t] engine Execution engine for every job
+ * @param [int] lockstep Start runs of jobs with the same program in lockstep
+ * @param [const batch_options_t*] options Budget, timeout and trap table for each job
+ * @retval 0 if every job halted, otherwise the highest job status
+ */
+int run_pool(const char* jobfile, int threads, engine_t engine, int lockstep, const batch_options_t* options)
+{
+	static const char* names[] = { "halted", "error", "input exhausted", "instruction budget exceeded", "timed out",
+		"stuck in a loop" };
+	pthread_t tids[POOL_MAX_THREADS];
+	worker_t workers[POOL_MAX_THREADS];
+	struct timespec start;
+	unsigned long long total = 0;
+	double seconds;
+	int worst = 0;
+	int listings = 0;
+	pool_t pool;
+#ifdef LC3_STATS
+	lc3_stats_run_t* runs;
+#endif
+	int i;
+	int p;
+
+	if (threads < 1 || threads > POOL_MAX_THREADS)
+	{
+		printf("Bad argument! Thread count must be between 1 and %d\n", POOL_MAX_THREADS);
+		return -EINVAL;
+	}
+	if (!(pool.jobs = read_jobs(jobfile, &pool.njobs)))
+	{
+		printf("Bad argument! Couldn't read the job file.\n");
+		return -EINVAL;
+	}
+
+	// Jobs running the same program share one image of it
+	if (!(pool.programs = calloc(pool.njobs + 1, sizeof(pool_program_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	pool.nprograms = 0;
+	for (i=0; i<pool.njobs; i++)
+	{
+		for (p=0; p<pool.nprograms && strcmp(pool.programs[p].path, pool.jobs[i].program); p++);
+		if (p == pool.nprograms)
+			pool.programs[pool.nprograms++].path = pool.jobs[i].program;
+		pool.programs[p].pending++;
+		pool.jobs[i].program_id = p;
+	}
+	if (options->coverage_path || options->listing_path)
+		for (p=0; p<pool.nprograms; p++)
+			if (!(pool.programs[p].coverage = calloc(1, sizeof(lc3_coverage_t))))
+			{
+				printf("Malloc returned NULL! That's no good!\n");
+				exit(-ENOMEM);
+			}
+
+	pool.nthreads = threads;
+	pool.engine = engine;
+	pool.options = options;
+	pool.remaining = pool.njobs;
+	pthread_mutex_init(&pool.lock, NULL);
+#ifdef LC3_STATS
+	memset(&pool.stats, 0, sizeof(pool.stats));
+	// Lockstep runs outside execute_instruction() and the block engine, where statistics are kept
+	if (options->stats_path)
+		lockstep = 0;
+#endif
+	// Nor is coverage
+	if (options->coverage_path || options->listing_path)
+		lockstep = 0;
+	// Group the jobs: singly, or runs of the same program for lockstep
+	if (!(pool.groups = calloc(pool.njobs + 1, sizeof(pool_group_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	pool.ngroups = 0;
+	for (i=0; i<pool.njobs; i++)
+	{
+		pool_group_t* last = pool.ngroups ? &pool.groups[pool.ngroups-1] : NULL;
+		if (lockstep && last && last->count < SIMD_LANES
+			&& !strcmp(pool.jobs[last->first].program, pool.jobs[i].program))
+		{
+			last->count++;
+			continue;
+		}
+		pool.groups[pool.ngroups].first = i;
+		pool.groups[pool.ngroups].count = 1;
+		pool.ngroups++;
+	}
+
+	if (!(pool.deques = calloc(threads, sizeof(pool_deque_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	for (i=0; i<threads; i++)
+	{
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+		pool.deques[i].capacity = pool.ngroups + 1;
+		if (!(pool.deques[i].slots = malloc(pool.deques[i].capacity*sizeof(int))))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+	}
+	// Deal the groups out round-robin, last first so each owner pops them in file order; stealing evens out the rest
+	for (i=pool.ngroups-1; i>=0; i--)
+		push_bottom(&pool.deques[i % threads], i);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i=0; i<threads; i++)
+	{
+		workers[i].pool = &pool;
+		workers[i].id = i;
+		workers[i].spare = NULL;
+		pthread_create(&tids[i], NULL, worker, &workers[i]);
+	}
+	for (i=0; i<threads; i++)
+		pthread_join(tids[i], NULL);
+	seconds = seconds_since(&start);
+
+	for (i=0; i<pool.njobs; i++)
+	{
+		pool_job_t* job = &pool.jobs[i];
+		printf("%s %s %s: %s", job->program, job->input, job->output, names[job->status]);
+		if (job->status == BATCH_STUCK)
+			printf(" at x%.4hx-x%.4hx", job->loop.start, job->loop.end);
+		printf(", %llu instructions, %.3fs\n", job->executions, job->seconds);
+		total += job->executions;
+		if (job->status > worst)
+			worst = job->status;
+	}
+	printf("%d jobs on %d threads in %.3fs: %llu instructions, %.1f MIPS, %.1f jobs/s\n", pool.njobs, threads,
+		seconds, total, seconds > 0 ? total / seconds / 1e6 : 0, seconds > 0 ? pool.njobs / seconds : 0);
+#ifdef LC3_STATS
+	if (options->stats_path)
+	{
+		// The total, then each job on its own
+		if (!(runs = malloc(pool.njobs * sizeof(lc3_stats_run_t))))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+		for (i=0; i<pool.njobs; i++)
+		{
+			runs[i].program = pool.jobs[i].program;
+			runs[i].input = pool.jobs[i].input;
+			runs[i].instructions = pool.jobs[i].counted;
+			runs[i].seconds = pool.jobs[i].run_seconds;
+		}
+		if (save_stats(&pool.stats, runs, pool.njobs, options->stats_path, options->stats_json))
+			fprintf(stderr, "Couldn't write the statistics!\n");
+		free(runs);
+	}
+#endif
+	for (p=0; p<pool.nprograms; p++)
+	{
+		pool_program_t* program = &pool.programs[p];
+		if (program->image && options->coverage_path
+			&& save_coverage(program->coverage, program->image, program->path, options->coverage_path))
+			fprintf(stderr, "Couldn't write the coverage!\n");
+		// One listing after another, in job file order
+		if (program->image && options->listing_path
+			&& save_listing(program->coverage, program->image, program->path, options->listing_path, listings++))
+			fprintf(stderr, "Couldn't write the coverage listing!\n");
+		release_image(program->image);
+		free(program->coverage);
+	}
+
+	for (i=0; i<threads; i++)
+	{
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].slots);
+	}
+	free(pool.deques);
+	free(pool.groups);
+	free(pool.programs);
+	free(pool.jobs);
+	pthread_mutex_destroy(&pool.lock);
+	return worst;
+}
@@ -0,0 +1,351 @@
+/**
+ * @file		lc3pre.c
+ * @brief		Predecoded, threaded-dispatch execution engine
+ *
+ * Keeps a table parallel to mem[] holding each word already decoded into a handler index and the few fields
+ * that handler needs. Entries are decoded lazily the first time they are executed and reset to H_DECODE
+ * whenever the word under them is written (see invalidate_code()), so self-modifying code is picked up on its next
+ * execution.
+ * Loads and stores that reach the device registers are handed to execute_instruction(), which knows their side
+ * effects.
+ * With GCC/Clang the handlers are threaded with computed gotos; other compilers get a switch in a loop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3block.h"
+
+/**
+ * @name 	Predecode
+ * @brief Decodes an instruction word into a predecoded entry
+ * @param [lc3pre_t*] entry The entry to fill
+ * @param [unsigned short] address The address the word lives at, for PC-relative targets
+ * @param [unsigned short] word The instruction
+ */
+void predecode(lc3pre_t* entry, unsigned short address, unsigned short word)
+{
+	lc3inst_t inst;
+	unsigned short npc = address+1;
+
+	decode_instruction(&inst, word);
+	entry->a = inst.destreg;
+	entry->b = inst.src1reg;
+	entry->c = inst.src2reg;
+	entry->imm = 0;
+
+	switch (inst.opcode) {
+	case BR:
+		entry->a = inst.nzpbits;
+		entry->imm = npc + inst.pcoffset9;
+		if (!inst.nzpbits)
+			entry->handler = H_NOP;
+		else if (inst.nzpbits == 7)
+			entry->handler = H_BRA;
+		else
+			entry->handler = H_BR;
+		break;
+	case ADD:
+		entry->handler = inst.imm5_flag ? H_ADDI : H_ADDR;
+		entry->imm = inst.imm5;
+		break;
+	case AND:
+		entry->handler = inst.imm5_flag ? H_ANDI : H_ANDR;
+		entry->imm = inst.imm5;
+		break;
+	case LD:
+		entry->handler = H_LD;
+		entry->imm = npc + inst.pcoffset9;
+		break;
+	case ST:
+		entry->handler = H_ST;
+		entry->imm = npc + inst.pcoffset9;
+		break;
+	case LDI:
+		entry->handler = H_LDI;
+		entry->imm = npc + inst.pcoffset9;
+		break;
+	case STI:
+		entry->handler = H_STI;
+		entry->imm = npc + inst.pcoffset9;
+		break;
+	case LEA:
+		entry->handler = H_LEA;
+		entry->imm = npc + inst.pcoffset9;
+		break;
+	case JSR:
+		entry->handler = inst.jsrr_flag ? H_JSRR : H_JSR;
+		entry->imm = npc + inst.pcoffset11;
+		break;
+	case LDR:
+		entry->handler = H_LDR;
+		entry->imm = inst.offset6;
+		break;
+	case STR:
+		entry->handler = H_STR;
+		entry->imm = inst.offset6;
+		break;
+	case NOT:
+		entry->handler = H_NOT;
+		break;
+	case JMP:
+		entry->handler = H_JMP;
+		break;
+	case TRAP:
+		entry->handler = H_TRAP;
+		entry->imm = inst.trapvect;
+		break;
+	case RTI:
+		entry->handler = H_RTI;
+		break;
+	default:	// The reserved opcode does nothing; a tells it from a BR without nzp bits, for the statistics
+		entry->handler = H_NOP;
+		entry->a = 1;
+		break;
+	}
+}
+
+/**
+ * @name 	Invalidate All Predecoded
+ * @brief Marks every predecoded entry as stale, e.g. after a new program image is loaded
+ * @param [lc3_machine_t*] m The machine whose table is stale
+ */
+void invalidate_all_predecoded(lc3_machine_t* m)
+{
+	int i;
+	if (!m->predecoded)
+		return;
+	for (i=0; i<65536; i++)
+		m->predecoded[i].handler = H_DECODE;
+}
+
+/**
+ * @name 	Free Predecoded
+ * @brief Frees a machine's predecoded table
+ * @param [lc3_machine_t*] m The machine that owns the table
+ */
+void free_predecoded(lc3_machine_t* m)
+{
+	free(m->predecoded);
+	m->predecoded = NULL;
+}
+
+// Condition codes are kept as the last value written to a register and only turned into NZP bits by BR
+#define CCBIT(v) ((short)(v) < 0 ? 4 : ((v) == 0 ? 2 : 1))
+#define CCVAL(v) ((short)(v) < 0 ? -1 : ((v) != 0))
+
+#ifdef __GNUC__
+#define HANDLER(h)	h:
+#define DISPATCH()	goto *labels[entry->handler]
+#else
+#define HANDLER(h)	case h:
+#define DISPATCH()	continue
+#endif
+
+// Retire the current instruction and move to the instruction at (target)
+#define NEXT(target) \
+	do { \
+		address = (target); \
+		count++; \
+		if (breakpoint_at(m, address) || count >= limit) \
+			goto stop; \
+		entry = &predecoded[address]; \
+		DISPATCH(); \
+	} while (0)
+
+/**
+ * @name 	Run Predecoded
+ * @brief Runs the program from the current PC through the predecoded table until HALT or a breakpoint
+ * @param [lc3_machine_t*] m The machine to run
+ *
+ * Leaves the machine's pc, ir, cc, executions and next_inst exactly as the same number of step_forward() calls would.
+ */
+void run_predecoded(lc3_machine_t* m)
+{
+#ifdef __GNUC__
+	static void* labels[H_COUNT] = {
+		&&H_DECODE, &&H_NOP, &&H_BR, &&H_BRA, &&H_ADDR, &&H_ADDI, &&H_LD, &&H_ST, &&H_JSR, &&H_JSRR,
+		&&H_ANDR, &&H_ANDI, &&H_LDR, &&H_STR, &&H_NOT, &&H_LDI, &&H_STI, &&H_JMP, &&H_LEA, &&H_RTI, &&H_TRAP
+	};
+#endif
+	unsigned short* regfile = m->regfile;
+	unsigned short* mem = m->mem;
+	unsigned short address = m->pc-1;
+	unsigned short target;
+	unsigned long long count = m->executions;
+	unsigned long long limit = run_limit(m);
+	short result = m->cc;
+	lc3pre_t* predecoded;
+	lc3pre_t* entry;
+
+	if (m->halted)
+		return;
+
+	if (!m->predecoded && !(m->predecoded = calloc(65536, sizeof(lc3pre_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	predecoded = m->predecoded;
+
+	// Stop on a fresh breakpoint, or step past the one we stopped on last time
+	if (breakpoint_at(m, address) == 1)
+	{
+		set_breakpoint_state(m, address, 2);
+		m->running = 0;
+		return;
+	}
+	if (breakpoint_at(m, address) == 2)
+		set_breakpoint_state(m, address, 1);
+
+run:
+	entry = &predecoded[address];
+#ifndef __GNUC__
+	for (;;)
+	switch (entry->handler) {
+#endif
+	DISPATCH();
+
+	HANDLER(H_DECODE)
+		predecode(entry, address, mem[address]);
+		DISPATCH();
+	HANDLER(H_NOP)
+		NEXT(address+1);
+	HANDLER(H_RTI)
+		goto interpreted;
+	HANDLER(H_BR)
+		NEXT(entry->a & CCBIT(result) ? entry->imm : address+1);
+	HANDLER(H_BRA)
+		NEXT(entry->imm);
+	HANDLER(H_ADDR)
+		regfile[entry->a] = regfile[entry->b] + regfile[entry->c];
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_ADDI)
+		regfile[entry->a] = regfile[entry->b] + entry->imm;
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_ANDR)
+		regfile[entry->a] = regfile[entry->b] & regfile[entry->c];
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_ANDI)
+		regfile[entry->a] = regfile[entry->b] & entry->imm;
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_NOT)
+		regfile[entry->a] = ~regfile[entry->b];
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_LD)
+		if (entry->imm >= DEVICE_BASE)
+			goto interpreted;
+		regfile[entry->a] = mem[entry->imm];
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_LDR)
+		target = regfile[entry->b] + entry->imm;
+		if (target >= DEVICE_BASE)
+			goto interpreted;
+		regfile[entry->a] = mem[target];
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_LDI)
+		target = mem[entry->imm];
+		if (entry->imm >= DEVICE_BASE || target >= DEVICE_BASE)
+			goto interpreted;
+		regfile[entry->a] = mem[target];
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_LEA)
+		regfile[entry->a] = entry->imm;
+		result = regfile[entry->a];
+		NEXT(address+1);
+	HANDLER(H_ST)
+		target = entry->imm;
+		if (target >= DEVICE_BASE)
+			goto interpreted;
+		mem[target] = regfile[entry->a];
+		invalidate_code(m, target);
+		mark_dirty(m, target);
+		NEXT(address+1);
+	HANDLER(H_STR)
+		target = regfile[entry->b] + entry->imm;
+		if (target >= DEVICE_BASE)
+			goto interpreted;
+		mem[target] = regfile[entry->a];
+		invalidate_code(m, target);
+		mark_dirty(m, target);
+		NEXT(address+1);
+	HANDLER(H_STI)
+		target = mem[entry->imm];
+		if (entry->imm >= DEVICE_BASE || target >= DEVICE_BASE)
+			goto interpreted;
+		mem[target] = regfile[entry->a];
+		invalidate_code(m, target);
+		mark_dirty(m, target);
+		NEXT(address+1);
+	HANDLER(H_JSR)
+		regfile[7] = address+1;
+		NEXT(entry->imm);
+	HANDLER(H_JSRR)
+		target = regfile[entry->b];
+		regfile[7] = address+1;
+		NEXT(target);
+	HANDLER(H_JMP)
+		target = regfile[entry->b];
+		regfile[7] = address+1;
+		NEXT(target);
+	HANDLER(H_TRAP)
+		// Service routines work on the machine, so bring it up to date first
+		m->pc = address+1;
+		m->ir = mem[address];
+		m->cc = CCVAL(result);
+		m->executions = count;
+		if (execute_trap(m, entry->imm))
+		{
+			// Waiting for input; stop in front of the trap so it runs again next time
+			m->running = 0;
+			goto stop;
+		}
+		result = m->cc;
+		if (m->halted || !m->running)
+		{
+			// A HALT stays in front of itself, as in step_forward()
+			address = m->halted ? address : m->pc;
+			count++;
+			goto stop;
+		}
+		NEXT(m->pc);
+#ifndef __GNUC__
+	}
+#endif
+
+interpreted:
+	// Device registers and RTI have effects only execute_instruction() knows about, which may schedule events
+	m->cc = CCVAL(result);
+	m->executions = count;
+	target = interpret(m, address);
+	result = m->cc;
+	count = m->executions;
+	limit = run_limit(m);
+	if (m->halted || !m->running)
+		goto fetch;
+	address = target;
+	if (breakpoint_at(m, address) || count >= limit)
+		goto stop;
+	goto run;
+
+stop:
+	// Stopped in front of the instruction at address; fetch it like step_forward() does
+	if (breakpoint_at(m, address) == 1 && m->running)
+		set_breakpoint_state(m, address, 2);
+	m->running = 0;
+fetch:
+	m->pc = address+1;
+	m->ir = mem[address];
+	decode_instruction(&m->next_inst, m->ir);
+	m->cc = CCVAL(result);
+	m->executions = count;
+}
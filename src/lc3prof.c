@@ -0,0 +1,471 @@
+/**
+ * @file		lc3prof.c
+ * @brief		Execution profiler
+ *
+ * Counts how often each address executes and works out where subroutines spend their time. Calls are followed
+ * on a shadow stack: JSR, JSRR and TRAPs into service routines push a frame, and a RET (JMP R7) to the return
+ * address of a frame pops it and everything above it, so routines that skip their own RET are still unwound.
+ * Each frame is a node of a calling-context tree, one per distinct chain of calls, which is enough to produce
+ * exclusive and inclusive counts per subroutine, the call graph and folded stacks for flame graphs.
+ *
+ * The switch engine calls profile_instruction() from execute_instruction() after each instruction. The block
+ * engine, which the predecode and JIT engines hand over to while profiling, counts a whole block when it leaves
+ * it, and calls and returns end blocks, so profile_control() sees them all the same (see lc3block.c). Either way
+ * it costs one counter increment per instruction plus a little work per call and return.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3prof.h"
+
+typedef struct {
+	unsigned short entry;
+	unsigned long long calls;
+	unsigned long long self;
+	unsigned long long inclusive;
+} prof_function_t;
+
+typedef struct {
+	unsigned short caller;
+	unsigned short callee;
+	unsigned long long calls;
+	unsigned long long recursive_calls;	// Calls made while the callee was already running further up
+	unsigned long long inclusive;				// Of the other calls only
+} prof_edge_t;
+
+typedef struct {
+	unsigned short address;
+	unsigned long long count;
+} prof_address_t;
+
+/**
+ * @name 	Start Profile
+ * @brief Starts counting; runs on the predecode and JIT engines use the block engine from now on
+ * @param [lc3_machine_t*] m The machine to profile
+ */
+void start_profile(lc3_machine_t* m)
+{
+	if (m->profile)
+		return;
+	if (!(m->profile = malloc(sizeof(lc3_profile_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	m->profile->nodes = NULL;
+	m->profile->nodes_size = 0;
+	clear_profile(m);
+}
+
+void stop_profile(lc3_machine_t* m)
+{
+	if (!m->profile)
+		return;
+	free(m->profile->nodes);
+	free(m->profile);
+	m->profile = NULL;
+}
+
+/**
+ * @name 	Add Node
+ * @brief Appends a node to the calling-context tree
+ * @param [lc3_profile_t*] p The profile
+ * @param [int] parent The caller's node, or -1 for the root
+ * @param [unsigned short] entry Where the subroutine starts
+ * @retval The new node
+ */
+static int add_node(lc3_profile_t* p, int parent, unsigned short entry)
+{
+	lc3_prof_node_t* node;
+
+	if (p->nnodes == p->nodes_size)
+	{
+		p->nodes_size = p->nodes_size ? 2*p->nodes_size : 256;
+		if (!(p->nodes = realloc(p->nodes, p->nodes_size*sizeof(lc3_prof_node_t))))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+	}
+	node = &p->nodes[p->nnodes];
+	node->entry = entry;
+	node->parent = parent;
+	node->child = -1;
+	node->sibling = -1;
+	node->calls = 0;
+	node->self = 0;
+	if (parent >= 0)
+	{
+		node->sibling = p->nodes[parent].child;
+		p->nodes[parent].child = p->nnodes;
+	}
+	return p->nnodes++;
+}
+
+/**
+ * @name 	Clear Profile
+ * @brief Throws away everything counted so far and starts again from the current PC
+ * @param [lc3_machine_t*] m The profiled machine
+ */
+void clear_profile(lc3_machine_t* m)
+{
+	lc3_profile_t* p = m->profile;
+
+	if (!p)
+		return;
+	memset(p->counts, 0, sizeof(p->counts));
+	p->nnodes = 0;
+	p->stack[0].node = add_node(p, -1, m->pc-1);
+	p->stack[0].return_address = 0;
+	p->depth = 1;
+	p->lost = 0;
+	p->mark = m->executions;
+}
+
+// Charges the instructions run since the last call or return to the innermost call
+static void charge(lc3_machine_t* m)
+{
+	lc3_profile_t* p = m->profile;
+	p->nodes[p->stack[p->depth-1].node].self += m->executions - p->mark;
+	p->mark = m->executions;
+}
+
+static void enter(lc3_machine_t* m, unsigned short entry, unsigned short return_address)
+{
+	lc3_profile_t* p = m->profile;
+	int parent;
+	int node;
+
+	charge(m);
+	if (p->depth == PROFILE_MAX_DEPTH)
+	{
+		p->lost++;
+		return;
+	}
+	parent = p->stack[p->depth-1].node;
+	for (node = p->nodes[parent].child; node >= 0 && p->nodes[node].entry != entry; node = p->nodes[node].sibling);
+	if (node < 0)
+		node = add_node(p, parent, entry);
+	p->nodes[node].calls++;
+	p->stack[p->depth].node = node;
+	p->stack[p->depth].return_address = return_address;
+	p->depth++;
+}
+
+static void leave(lc3_machine_t* m, unsigned short target)
+{
+	lc3_profile_t* p = m->profile;
+	int i;
+
+	if (p->lost)
+	{
+		p->lost--;
+		return;
+	}
+	for (i=p->depth-1; i>0 && p->stack[i].return_address != target; i--);
+	// A RET that doesn't go back to any call seen is just a jump
+	if (!i)
+		return;
+	charge(m);
+	p->depth = i;
+}
+
+/**
+ * @name 	Profile Control
+ * @brief Follows a JSR, JSRR, TRAP or JMP that has just executed
+ * @param [lc3_machine_t*] m The profiled machine
+ * @param [unsigned short] address Address of the instruction
+ * @param [lc3inst_t*] instruction The instruction
+ */
+void profile_control(lc3_machine_t* m, unsigned short address, lc3inst_t* instruction)
+{
+	switch (instruction->opcode) {
+	case JSR:
+		enter(m, m->pc, address+1);
+		break;
+	case TRAP:
+		// Traps the simulator handles itself don't go anywhere
+		if (m->pc != (unsigned short)(address+1))
+			enter(m, m->pc, address+1);
+		break;
+	case JMP:
+		if (instruction->src1reg == 7)
+			leave(m, m->pc);
+		break;
+	default:
+		break;
+	}
+}
+
+// Writes a subroutine's label, or its address if it has none
+static void name_of(lc3_machine_t* m, unsigned short address, char* buffer, int size)
+{
+	if (!format_address(m->image ? &m->image->symbols : NULL, address, buffer, size))
+		snprintf(buffer, size, "x%.4hX", address);
+}
+
+// Whether a node's subroutine is already running further up its chain of calls
+static int recursive(lc3_profile_t* p, int node)
+{
+	int n;
+	for (n = p->nodes[node].parent; n >= 0; n = p->nodes[n].parent)
+		if (p->nodes[n].entry == p->nodes[node].entry)
+			return 1;
+	return 0;
+}
+
+static int compare_self(const void* a, const void* b)
+{
+	const prof_function_t* x = a;
+	const prof_function_t* y = b;
+	return x->self < y->self ? 1 : x->self > y->self ? -1 : x->entry - y->entry;
+}
+
+static int compare_inclusive(const void* a, const void* b)
+{
+	const prof_function_t* x = a;
+	const prof_function_t* y = b;
+	return x->inclusive < y->inclusive ? 1 : x->inclusive > y->inclusive ? -1 : x->entry - y->entry;
+}
+
+static int compare_edges(const void* a, const void* b)
+{
+	const prof_edge_t* x = a;
+	const prof_edge_t* y = b;
+	return x->caller != y->caller ? x->caller - y->caller : x->callee - y->callee;
+}
+
+static int compare_counts(const void* a, const void* b)
+{
+	const prof_address_t* x = a;
+	const prof_address_t* y = b;
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : x->address - y->address;
+}
+
+static double percent(unsigned long long part, unsigned long long total)
+{
+	return total ? 100.0 * part / total : 0;
+}
+
+/**
+ * @name 	Write Profile
+ * @brief Writes a flat profile by subroutine, the call graph and the instruction counts per address
+ * @param [lc3_machine_t*] m The profiled machine
+ * @param [FILE*] out Where to write it
+ *
+ * Inclusive counts of recursive subroutines count each instruction once, at the outermost call. So in the call
+ * graph, calls into a subroutine that is already running further up are labelled recursive instead of being
+ * given an inclusive count of their own, much like gprof collapses cycles.
+ */
+void write_profile(lc3_machine_t* m, FILE* out)
+{
+	lc3_profile_t* p = m->profile;
+	unsigned long long* inclusive;
+	unsigned long long total = 0;
+	int* function_of;
+	prof_function_t* functions;
+	prof_edge_t* edges;
+	prof_address_t* addresses;
+	int nfunctions = 0;
+	int nedges = 0;
+	int naddresses = 0;
+	int f, e, n, i;
+	char name[DISASM_TARGET_MAX];
+	char other[DISASM_TARGET_MAX];
+	char disasm[DISASM_MAX];
+
+	if (!p)
+		return;
+	charge(m);
+
+	inclusive = malloc(p->nnodes*sizeof(unsigned long long));
+	function_of = malloc(65536*sizeof(int));
+	functions = malloc(p->nnodes*sizeof(prof_function_t));
+	edges = malloc(p->nnodes*sizeof(prof_edge_t));
+	addresses = malloc(65536*sizeof(prof_address_t));
+	if (!inclusive || !function_of || !functions || !edges || !addresses)
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+
+	// Callees are always added after their callers, so one pass from the end sums every subtree
+	for (n=0; n<p->nnodes; n++)
+		inclusive[n] = p->nodes[n].self;
+	for (n=p->nnodes-1; n>0; n--)
+		inclusive[p->nodes[n].parent] += inclusive[n];
+
+	for (i=0; i<65536; i++)
+		function_of[i] = -1;
+	for (n=0; n<p->nnodes; n++)
+	{
+		if ((f = function_of[p->nodes[n].entry]) < 0)
+		{
+			f = function_of[p->nodes[n].entry] = nfunctions++;
+			functions[f].entry = p->nodes[n].entry;
+			functions[f].calls = functions[f].self = functions[f].inclusive = 0;
+		}
+		functions[f].calls += p->nodes[n].calls;
+		functions[f].self += p->nodes[n].self;
+		if (!recursive(p, n))
+			functions[f].inclusive += inclusive[n];
+		total += p->nodes[n].self;
+
+		if (n)
+		{
+			edges[nedges].caller = p->nodes[p->nodes[n].parent].entry;
+			edges[nedges].callee = p->nodes[n].entry;
+			edges[nedges].calls = p->nodes[n].calls;
+			edges[nedges].recursive_calls = recursive(p, n) ? p->nodes[n].calls : 0;
+			edges[nedges].inclusive = recursive(p, n) ? 0 : inclusive[n];
+			nedges++;
+		}
+	}
+
+	// Merge the edges reached through different chains of calls
+	qsort(edges, nedges, sizeof(prof_edge_t), compare_edges);
+	for (i=0, e=0; i<nedges; i++)
+	{
+		if (e && edges[e-1].caller == edges[i].caller && edges[e-1].callee == edges[i].callee)
+		{
+			edges[e-1].calls += edges[i].calls;
+			edges[e-1].recursive_calls += edges[i].recursive_calls;
+			edges[e-1].inclusive += edges[i].inclusive;
+		}
+		else
+			edges[e++] = edges[i];
+	}
+	nedges = e;
+
+	fprintf(out, "Flat profile: %llu instructions\n\n", total);
+	fprintf(out, "%14s %7s %14s %7s %10s  %s\n", "self", "%", "inclusive", "%", "calls", "subroutine");
+	qsort(functions, nfunctions, sizeof(prof_function_t), compare_self);
+	for (f=0; f<nfunctions; f++)
+	{
+		name_of(m, functions[f].entry, name, sizeof(name));
+		fprintf(out, "%14llu %6.2f%% %14llu %6.2f%% %10llu  %s\n", functions[f].self,
+			percent(functions[f].self, total), functions[f].inclusive, percent(functions[f].inclusive, total),
+			functions[f].calls, name);
+	}
+
+	fprintf(out, "\nCall graph: callers (<-) and callees (->) of each subroutine, with calls and inclusive instructions\n\n");
+	qsort(functions, nfunctions, sizeof(prof_function_t), compare_inclusive);
+	for (f=0; f<nfunctions; f++)
+	{
+		name_of(m, functions[f].entry, name, sizeof(name));
+		fprintf(out, "%s: %llu calls, %llu self, %llu inclusive\n", name, functions[f].calls, functions[f].self,
+			functions[f].inclusive);
+		for (e=0; e<nedges; e++)
+			if (edges[e].callee == functions[f].entry)
+			{
+				name_of(m, edges[e].caller, other, sizeof(other));
+				fprintf(out, "    <- %-24s %10llu calls\n", other, edges[e].calls);
+			}
+		for (e=0; e<nedges; e++)
+			if (edges[e].caller == functions[f].entry)
+			{
+				name_of(m, edges[e].callee, other, sizeof(other));
+				if (edges[e].recursive_calls == edges[e].calls)
+					fprintf(out, "    -> %-24s %10llu calls %14s recursive\n", other, edges[e].calls, "");
+				else if (edges[e].recursive_calls)
+					fprintf(out, "    -> %-24s %10llu calls %14llu inclusive, %llu of the calls recursive\n", other,
+						edges[e].calls, edges[e].inclusive, edges[e].recursive_calls);
+				else
+					fprintf(out, "    -> %-24s %10llu calls %14llu inclusive\n", other, edges[e].calls,
+						edges[e].inclusive);
+			}
+	}
+
+	fprintf(out, "\nInstructions by address, hottest first\n\n");
+	for (i=0; i<65536; i++)
+		if (p->counts[i])
+		{
+			addresses[naddresses].address = i;
+			addresses[naddresses].count = p->counts[i];
+			naddresses++;
+		}
+	qsort(addresses, naddresses, sizeof(prof_address_t), compare_counts);
+	for (i=0; i<naddresses; i++)
+	{
+		format_address(m->image ? &m->image->symbols : NULL, addresses[i].address, name, sizeof(name));
+		disassemble_to_str(m->image ? &m->image->symbols : NULL, addresses[i].address,
+			m->mem[addresses[i].address], disasm);
+		fprintf(out, "%14llu %6.2f%%  x%.4hX  %-20s %s\n", addresses[i].count, percent(addresses[i].count, total),
+			addresses[i].address, name, disasm);
+	}
+
+	free(inclusive);
+	free(function_of);
+	free(functions);
+	free(edges);
+	free(addresses);
+}
+
+/**
+ * @name 	Write Folded Stacks
+ * @brief Writes one "OUTER;INNER count" line per chain of calls, the input flamegraph.pl and similar tools take
+ * @param [lc3_machine_t*] m The profiled machine
+ * @param [FILE*] out Where to write them
+ */
+void write_folded_stacks(lc3_machine_t* m, FILE* out)
+{
+	lc3_profile_t* p = m->profile;
+	int* chain;
+	int length;
+	int n, i;
+	char name[DISASM_TARGET_MAX];
+
+	if (!p)
+		return;
+	charge(m);
+	if (!(chain = malloc(p->nnodes*sizeof(int))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+
+	for (n=0; n<p->nnodes; n++)
+	{
+		if (!p->nodes[n].self)
+			continue;
+		length = 0;
+		for (i=n; i>=0; i=p->nodes[i].parent)
+			chain[length++] = i;
+		while (length--)
+		{
+			name_of(m, p->nodes[chain[length]].entry, name, sizeof(name));
+			fprintf(out, "%s%c", name, length ? ';' : ' ');
+		}
+		fprintf(out, "%llu\n", p->nodes[n].self);
+	}
+	free(chain);
+}
+
+/**
+ * @name 	Save Profile
+ * @brief Writes the profile and, if asked for, the folded stacks to files
+ * @param [lc3_machine_t*] m The profiled machine
+ * @param [const char*] path File for write_profile()
+ * @param [const char*] folded_path File for write_folded_stacks(), or NULL for none
+ * @retval 0 on success, -errno if a file couldn't be written
+ */
+int save_profile(lc3_machine_t* m, const char* path, const char* folded_path)
+{
+	FILE* out;
+
+	if (!(out = fopen(path, "w")))
+		return -errno;
+	write_profile(m, out);
+	fclose(out);
+	if (folded_path)
+	{
+		if (!(out = fopen(folded_path, "w")))
+			return -errno;
+		write_folded_stacks(m, out);
+		fclose(out);
+	}
+	return 0;
+}
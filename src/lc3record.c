@@ -0,0 +1,568 @@
+/**
+ * @file		lc3record.c
+ * @brief		Execution recording, for stepping and running backwards
+ *
+ * While recording, execute_instruction() calls record_instruction() before each instruction, which notes what the
+ * instruction is about to overwrite (one register or word, or R0 and R1 for a native trap such as UDIV) along with the
+ * PC and CC. Those undo records go in a ring, so going back over the last RECORD_CAPACITY instructions just means
+ * applying them in reverse. Every so often a full snapshot is taken as well; to go back further the machine is restored
+ * from the closest snapshot before the target and run forward to it. Snapshots are thinned out as the run grows, so
+ * there are never more than RECORD_CHECKPOINTS of them. Snapshots include the event schedule, and since interrupts and
+ * RTI change more than one record holds, the ring is never used to go back past them (see record_barrier()); the same
+ * goes for native traps that write memory, such as memcpy.
+ *
+ * Going forward again must retrace the same path, so the recorder stands in for the frontend's read_key and logs every
+ * key GETC and IN read. It stands in for key_ready as well, since whether a read of KBSR found a key is just as much a
+ * part of the path. After a rewind the log is played back, in order, before any new keys are asked for. Console output
+ * already shown is not taken back, and isn't repeated when instructions are rerun.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3debug.h"
+#include "../include/lc3block.h"
+#include "../include/lc3record.h"
+#include "../include/lc3device.h"
+
+#define NOT_FOUND (~0ULL)
+
+static void no_output(lc3_machine_t* m, char c)
+{
+}
+
+static void no_string_output(lc3_machine_t* m, const char* text, int length)
+{
+}
+
+// Moves past an entry of the input log, which the instruction being recorded gives back if it is undone
+static void consume_input(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+
+	rec->input_pos++;
+	if (m->recording)
+		rec->undo[m->executions & (rec->capacity - 1)].what |= UNDO_INPUT;
+}
+
+static void log_input(lc3_machine_t* m, int key)
+{
+	lc3_recorder_t* rec = m->recorder;
+
+	if (rec->input_length == rec->input_size)
+	{
+		rec->input_size = rec->input_size ? 2*rec->input_size : 256;
+		if (!(rec->input = realloc(rec->input, rec->input_size*sizeof(int))))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+	}
+	rec->input[rec->input_length++] = key;
+	consume_input(m);
+}
+
+// read_key while recording: replays logged keys, then logs each new one the frontend reads
+static int recorded_read_key(lc3_machine_t* m, int print)
+{
+	lc3_recorder_t* rec = m->recorder;
+
+	if (rec->input_pos < rec->input_length)
+	{
+		m->regfile[0] = rec->input[rec->input_pos];
+		consume_input(m);
+		if (print)
+			m->write_char(m, (char)m->regfile[0]);
+		return 1;
+	}
+	if (!rec->read_key(m, print))
+		return 0;
+	log_input(m, (unsigned short)m->regfile[0]);
+	return 1;
+}
+
+// key_ready while recording: answers as the log says, then logs NO_KEY each time the frontend has none
+static int recorded_key_ready(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+
+	if (rec->input_pos < rec->input_length)
+	{
+		if (rec->input[rec->input_pos] != NO_KEY)
+			return 1;
+		consume_input(m);
+		return 0;
+	}
+	if (rec->key_ready(m))
+		return 1;
+	log_input(m, NO_KEY);
+	return 0;
+}
+
+/**
+ * @name 	Start Recording
+ * @brief Starts keeping a history of the machine; runs use the switch engine from now on
+ * @param [lc3_machine_t*] m The machine to record
+ * @param [unsigned int] capacity Instructions the undo log holds, a power of two (0 for RECORD_CAPACITY)
+ *
+ * Must come after the frontend has set read_key and key_ready, which the recorder wraps.
+ */
+void start_recording(lc3_machine_t* m, unsigned int capacity)
+{
+	lc3_recorder_t* rec;
+
+	if (m->recorder)
+		return;
+	if (!capacity || (capacity & (capacity - 1)))
+		capacity = RECORD_CAPACITY;
+	if (!(rec = calloc(1, sizeof(lc3_recorder_t))) || !(rec->undo = malloc(capacity*sizeof(lc3_undo_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	rec->capacity = capacity;
+	rec->read_key = m->read_key;
+	rec->key_ready = m->key_ready;
+	m->read_key = recorded_read_key;
+	m->key_ready = recorded_key_ready;
+	m->recorder = rec;
+	m->recording = 1;
+	clear_recording(m);
+}
+
+void stop_recording(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+	int i;
+
+	if (!rec)
+		return;
+	m->read_key = rec->read_key;
+	m->key_ready = rec->key_ready;
+	m->recorder = NULL;
+	m->recording = 0;
+	for (i=0; i<RECORD_CHECKPOINTS; i++)
+		free(rec->checkpoints[i].mem);
+	free(rec->input);
+	free(rec->undo);
+	free(rec);
+}
+
+/**
+ * @name 	Clear Recording
+ * @brief Forgets the history, so it starts again from where the machine is now
+ * @param [lc3_machine_t*] m The recorded machine
+ *
+ * Needed whenever the machine's state is changed other than by running it, since history from before the change
+ * could no longer be replayed.
+ */
+void clear_recording(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+
+	if (!rec)
+		return;
+	rec->undo_start = m->executions;
+	rec->undo_end = m->executions;
+	rec->ncheckpoints = 0;
+	rec->interval = RECORD_INTERVAL;
+	rec->next_checkpoint = m->executions;
+	rec->input_length = 0;
+	rec->input_pos = 0;
+}
+
+static void take_checkpoint(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+	lc3_checkpoint_t spare;
+	lc3_checkpoint_t* checkpoint;
+	int i;
+
+	if (rec->ncheckpoints == RECORD_CHECKPOINTS)
+	{
+		// Keep every other snapshot, moving the dropped ones' memory to the free slots for reuse
+		for (i=1; i<RECORD_CHECKPOINTS/2; i++)
+		{
+			spare = rec->checkpoints[i];
+			rec->checkpoints[i] = rec->checkpoints[2*i];
+			rec->checkpoints[2*i] = spare;
+		}
+		rec->ncheckpoints = RECORD_CHECKPOINTS/2;
+		rec->interval *= 2;
+	}
+
+	checkpoint = &rec->checkpoints[rec->ncheckpoints];
+	if (!checkpoint->mem && !(checkpoint->mem = malloc(IMAGE_BYTES)))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	checkpoint->executions = m->executions;
+	memcpy(checkpoint->regfile, m->regfile, sizeof(m->regfile));
+	checkpoint->pc = m->pc;
+	checkpoint->cc = m->cc;
+	checkpoint->halted = m->halted;
+	checkpoint->input_pos = rec->input_pos;
+	memcpy(checkpoint->events, m->events, sizeof(m->events));
+	checkpoint->nevents = m->nevents;
+	checkpoint->saved_ssp = m->saved_ssp;
+	checkpoint->saved_usp = m->saved_usp;
+	memcpy(checkpoint->mem, m->mem, IMAGE_BYTES);
+	rec->ncheckpoints++;
+	rec->next_checkpoint = m->executions + rec->interval;
+}
+
+/**
+ * @name 	Record Instruction
+ * @brief Notes what an instruction is about to overwrite; called by execute_instruction() while recording
+ * @param [lc3_machine_t*] m The recorded machine
+ * @param [lc3inst_t*] instruction The instruction at pc-1
+ *
+ * The record goes in the slot for instruction number executions, so if the instruction doesn't complete (GETC
+ * waiting for a key) it is simply written again when it is retried.
+ */
+void record_instruction(lc3_machine_t* m, lc3inst_t* instruction)
+{
+	lc3_recorder_t* rec = m->recorder;
+	lc3_undo_t* undo = &rec->undo[m->executions & (rec->capacity - 1)];
+	const lc3_trap_t* trap;
+
+	if (m->executions >= rec->next_checkpoint)
+		take_checkpoint(m);
+	if (m->executions >= rec->undo_end)
+		rec->undo_end = m->executions + 1;
+
+	undo->pc = m->pc;
+	undo->cc = m->cc;
+	undo->what = 0;
+	switch (instruction->opcode) {
+	case ADD:
+	case AND:
+	case NOT:
+	case LD:
+	case LDR:
+	case LDI:
+	case LEA:
+		undo->what = UNDO_REGISTER;
+		undo->where = instruction->destreg;
+		break;
+	case JSR:
+	case JMP:
+		undo->what = UNDO_REGISTER;
+		undo->where = 7;
+		break;
+	case ST:
+		undo->what = UNDO_MEMORY;
+		undo->where = m->pc + instruction->pcoffset9;
+		break;
+	case STR:
+		undo->what = UNDO_MEMORY;
+		undo->where = m->regfile[instruction->src1reg] + instruction->offset6;
+		break;
+	case STI:
+		undo->what = UNDO_MEMORY;
+		undo->where = m->mem[(unsigned short)(m->pc + instruction->pcoffset9)];
+		break;
+	case TRAP:
+		trap = &m->traps[instruction->trapvect & TRAP_MASK];
+		if (!trap->routine)
+		{
+			// Jumps to the guest's service routine
+			undo->what = UNDO_REGISTER;
+			undo->where = 7;
+			break;
+		}
+		if (trap->effects & TRAP_WRITES_R0)
+		{
+			undo->what |= UNDO_REGISTER;
+			undo->where = 0;
+		}
+		if (trap->effects & TRAP_WRITES_R1)
+		{
+			undo->what |= UNDO_R1;
+			undo->old_r1 = m->regfile[1];
+		}
+		if (trap->effects & TRAP_READS_KEY)
+			undo->what |= UNDO_INPUT;
+		if (trap->effects & TRAP_WRITES_OTHER)
+			record_barrier(m, m->executions + 1);
+		break;
+	case RTI:
+		// Changes the PSR and both stack pointers, more than a record holds
+		record_barrier(m, m->executions + 1);
+		break;
+	default:
+		break;
+	}
+	if (undo->what & UNDO_REGISTER)
+		undo->old = m->regfile[undo->where];
+	else if (undo->what & UNDO_MEMORY)
+		undo->old = m->mem[undo->where];
+}
+
+/**
+ * @name 	Record Barrier
+ * @brief Keeps the ring from undoing past a point; called when the machine changes more than undo records hold
+ * (interrupts, RTI, the event schedule)
+ * @param [lc3_machine_t*] m The recorded machine
+ * @param [unsigned long long] executions Oldest instruction count the ring may take the machine back to
+ *
+ * Going back further restores a snapshot and runs forward again instead, which gets everything right.
+ */
+void record_barrier(lc3_machine_t* m, unsigned long long executions)
+{
+	lc3_recorder_t* rec = m->recorder;
+
+	if (rec->undo_start < executions)
+		rec->undo_start = executions;
+}
+
+/**
+ * @name 	Record Device
+ * @brief Notes the keyboard registers before a read of them changes them; called by lc3device.c while recording
+ * @param [lc3_machine_t*] m The recorded machine
+ */
+void record_device(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+	lc3_undo_t* undo = &rec->undo[m->executions & (rec->capacity - 1)];
+
+	if (undo->what & UNDO_DEVICE)
+		return;
+	undo->what |= UNDO_DEVICE;
+	if (KBSR(m) & DEVICE_READY)
+		undo->what |= UNDO_KEY_READY;
+	undo->old_r1 = KBDR(m);
+}
+
+// Takes back the last instruction executed, which must still be in the ring
+static void undo_instruction(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+	lc3_undo_t* undo = &rec->undo[(m->executions - 1) & (rec->capacity - 1)];
+
+	if (undo->what & UNDO_MEMORY)
+	{
+		m->mem[undo->where] = undo->old;
+		invalidate_code(m, undo->where);
+		mark_dirty(m, undo->where);
+	}
+	if (undo->what & UNDO_REGISTER)
+		m->regfile[undo->where] = undo->old;
+	if (undo->what & UNDO_R1)
+		m->regfile[1] = undo->old_r1;
+	if (undo->what & UNDO_INPUT)
+		rec->input_pos--;
+	if (undo->what & UNDO_DEVICE)
+	{
+		KBSR(m) = (KBSR(m) & ~DEVICE_READY) | (undo->what & UNDO_KEY_READY ? DEVICE_READY : 0);
+		KBDR(m) = undo->old_r1;
+		mark_dirty(m, KBSR_ADDRESS);
+		mark_dirty(m, KBDR_ADDRESS);
+	}
+	m->pc = undo->pc;
+	m->cc = undo->cc;
+	m->halted = 0;
+	m->executions--;
+}
+
+// Oldest instruction the ring can still take the machine back to
+static unsigned long long ring_start(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+	// Going forward again after a rewind rewrites the same slots, so only records past undo_end evict old ones
+	unsigned long long reach = rec->undo_end > rec->capacity ? rec->undo_end - rec->capacity : 0;
+	return rec->undo_start > reach ? rec->undo_start : reach;
+}
+
+static void restore_checkpoint(lc3_machine_t* m, int c)
+{
+	lc3_recorder_t* rec = m->recorder;
+	lc3_checkpoint_t* checkpoint = &rec->checkpoints[c];
+	unsigned int address;
+
+	for (address=0; address<65536; address++)
+		if (m->mem[address] != checkpoint->mem[address])
+		{
+			m->mem[address] = checkpoint->mem[address];
+			invalidate_code(m, address);
+			mark_dirty(m, address);
+		}
+	memcpy(m->regfile, checkpoint->regfile, sizeof(m->regfile));
+	m->pc = checkpoint->pc;
+	m->cc = checkpoint->cc;
+	m->halted = checkpoint->halted;
+	m->executions = checkpoint->executions;
+	rec->input_pos = checkpoint->input_pos;
+	memcpy(m->events, checkpoint->events, sizeof(m->events));
+	m->nevents = checkpoint->nevents;
+	m->next_event = m->nevents ? m->events[0].time : ~0ULL;
+	m->saved_ssp = checkpoint->saved_ssp;
+	m->saved_usp = checkpoint->saved_usp;
+	m->poll_executions = ~0ULL;
+	rec->undo_start = m->executions;
+	rec->undo_end = m->executions;
+}
+
+/**
+ * @name 	Replay
+ * @brief Runs the machine forward to an instruction count it has reached before
+ * @param [lc3_machine_t*] m The recorded machine
+ * @param [unsigned long long] target Where to stop
+ * @param [int] recording Whether to fill the undo ring on the way; without it the faster predecode engine is used
+ * @retval executions at the last breakpoint the run stopped on before target, or NOT_FOUND
+ *
+ * Output is discarded and input comes from the log. Breakpoints only break the run into pieces.
+ */
+static unsigned long long replay(lc3_machine_t* m, unsigned long long target, int recording)
+{
+	engine_t engine = m->engine;
+	unsigned long long limit = m->execution_limit;
+	void (*write_char)(lc3_machine_t* m, char c) = m->write_char;
+	void (*write_string)(lc3_machine_t* m, const char* text, int length) = m->write_string;
+	struct lc3_profile_s* profile = m->profile;
+	unsigned long long found = NOT_FOUND;
+	unsigned long long before;
+	int stalls = 0;
+
+	m->recording = recording;
+	// The predecode engine is the fastest one that stops exactly at the limit
+	m->engine = ENGINE_PREDECODE;
+	m->execution_limit = target;
+	m->write_char = no_output;
+	m->write_string = no_string_output;
+	m->profile = NULL;
+	m->ir = m->mem[(unsigned short)(m->pc-1)];
+	decode_instruction(&m->next_inst, m->ir);
+
+	while (m->executions < target && !m->halted && stalls < 2)
+	{
+		before = m->executions;
+		run_program(m);
+		if (!m->halted && m->executions < target && breakpoint_at(m, m->pc-1) == 2)
+			found = m->executions;
+		// A run makes no progress only when it stops on a breakpoint it starts at, and then the next one steps past
+		stalls = m->executions == before ? stalls + 1 : 0;
+	}
+	if (!recording)
+		m->recorder->undo_start = m->recorder->undo_end = m->executions;
+
+	m->recording = 1;
+	m->engine = engine;
+	m->execution_limit = limit;
+	m->write_char = write_char;
+	m->write_string = write_string;
+	m->profile = profile;
+	return found;
+}
+
+// Leaves the machine stopped in front of the instruction at pc-1, as if a run had just stopped there
+static void stop_here(lc3_machine_t* m)
+{
+	m->running = 0;
+	m->ir = m->mem[(unsigned short)(m->pc-1)];
+	decode_instruction(&m->next_inst, m->ir);
+	if (breakpoint_at(m, m->pc-1))
+		set_breakpoint_state(m, m->pc-1, 2);
+}
+
+unsigned long long earliest_recorded(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+	if (!rec)
+		return m->executions;
+	return rec->ncheckpoints ? rec->checkpoints[0].executions : ring_start(m);
+}
+
+/**
+ * @name 	Rewind To
+ * @brief Puts the machine back the way it was when executions was some earlier count
+ * @param [lc3_machine_t*] m The recorded machine
+ * @param [unsigned long long] executions The count to go back to
+ * @retval 0 on success, -EINVAL if the machine isn't recorded or the history doesn't reach that far
+ */
+int rewind_to(lc3_machine_t* m, unsigned long long executions)
+{
+	lc3_recorder_t* rec = m->recorder;
+	int c;
+
+	if (!rec || executions > m->executions || executions < earliest_recorded(m))
+		return -EINVAL;
+
+	if (executions < ring_start(m))
+	{
+		for (c = rec->ncheckpoints-1; rec->checkpoints[c].executions > executions; c--);
+		restore_checkpoint(m, c);
+		// Snapshots past this one are taken again as the machine goes forward
+		rec->ncheckpoints = c+1;
+		rec->next_checkpoint = m->executions + rec->interval;
+		if (executions - m->executions > rec->capacity)
+			replay(m, executions - rec->capacity, 0);
+		replay(m, executions, 1);
+	}
+	while (m->executions > executions)
+		undo_instruction(m);
+	stop_here(m);
+	return 0;
+}
+
+/**
+ * @name 	Step Backward
+ * @brief Takes back the last instruction executed
+ * @param [lc3_machine_t*] m The recorded machine
+ * @retval 0 on success, -EINVAL if there is no history to go back over
+ */
+int step_backward(lc3_machine_t* m)
+{
+	if (!m->recorder || !m->executions)
+		return -EINVAL;
+	return rewind_to(m, m->executions-1);
+}
+
+/**
+ * @name 	Run Backward
+ * @brief Goes back to the last time the machine stopped in front of a breakpoint, or to the start of the history
+ * @param [lc3_machine_t*] m The recorded machine
+ * @retval 0 on success, -EINVAL if there is no history to go back over
+ *
+ * Conditional breakpoints count only where their condition held.
+ */
+int run_backward(lc3_machine_t* m)
+{
+	lc3_recorder_t* rec = m->recorder;
+	lc3_breakpoint_t* breakpoint;
+	unsigned long long start;
+	unsigned long long end;
+	unsigned long long found;
+	int c;
+
+	if (!rec || m->executions <= earliest_recorded(m))
+		return -EINVAL;
+
+	// The ring can be walked back one instruction at a time
+	start = ring_start(m);
+	while (m->executions > start)
+	{
+		undo_instruction(m);
+		if ((breakpoint = get_breakpoint(m, m->pc-1)) && condition_holds(m, &breakpoint->condition))
+		{
+			stop_here(m);
+			return 0;
+		}
+	}
+
+	// Before that, each stretch between snapshots is run again to find the last breakpoint in it
+	end = m->executions;
+	for (c = rec->ncheckpoints-1; c >= 0; c--)
+	{
+		if (rec->checkpoints[c].executions >= end)
+			continue;
+		restore_checkpoint(m, c);
+		if ((found = replay(m, end, 0)) != NOT_FOUND)
+			return rewind_to(m, found);
+		end = rec->checkpoints[c].executions;
+	}
+	return rewind_to(m, earliest_recorded(m));
+}
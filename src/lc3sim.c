@@ -12,44 +12,124 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../include/lc3sim.h"
+#include <errno.h>
+#include "../include/lc3block.h"
+#include "../include/lc3debug.h"
+#include "../include/lc3prof.h"
+#include "../include/lc3record.h"
+#include "../include/lc3console.h"
+#include "../include/lc3device.h"
+#include "../include/lc3event.h"
+#include "../include/lc3trap.h"
+#include "../include/lc3stats.h"
+#include "../include/lc3cov.h"
 
-static FILE* file;
+
+// Default console hooks for a machine nobody has attached a frontend to
+static int no_key(lc3_machine_t* m, int print)
+{
+	return 0;
+}
+
+static int no_key_ready(lc3_machine_t* m)
+{
+	return 0;
+}
+
+static void no_console(lc3_machine_t* m, char c)
+{
+}
+
+/**
+ * @name 	Create Machine
+ * @brief Allocates a machine with zeroed memory and registers and the PC at x3000
+ * @retval The new machine
+ *
+ * The console hooks start out discarding output and never having a key ready; frontends replace them.
+ */
+lc3_machine_t* create_machine()
+{
+	lc3_machine_t* m = calloc(1, sizeof(lc3_machine_t));
+	if (!m)
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	m->mem = map_image(NULL, NULL);
+	m->pc = 0x3000;
+	m->running = 1;
+	default_traps(m);
+	m->engine = ENGINE_BLOCK;
+	m->read_key = no_key;
+	m->key_ready = no_key_ready;
+	m->write_char = no_console;
+	m->write_string = write_each_char;
+	reset_devices(m);
+	return m;
+}
+
+/**
+ * @name 	Destroy Machine
+ * @brief Frees a machine along with its memory, breakpoints, profile, history, statistics, coverage, console and
+ * engine caches, and lets go of its image
+ * @param [lc3_machine_t*] m The machine to free
+ */
+void destroy_machine(lc3_machine_t* m)
+{
+	free_predecoded(m);
+	free_blocks(m);
+	jit_free(m);
+	stop_profile(m);
+	stop_recording(m);
+#ifdef LC3_STATS
+	stop_stats(m);
+#endif
+	stop_coverage(m);
+	unmap_image(m->mem);
+	release_image(m->image);
+	free(m->breakpoints);
+	free(m->watchpoints);
+	destroy_console(m->console);
+	free(m);
+}
 
 /**
  * @name 	Set Condition Code
+ * @param [lc3_machine_t*] m The machine whose CC is set
  * @param [short] writeval Value to write to the CC (negative, zero, or positive)
  */
-void setcc(short writeval)
+void setcc(lc3_machine_t* m, short writeval)
 {
 	if (writeval < 0)
-		cc = -1;
+		m->cc = -1;
 	else if (writeval == 0)
-		cc = 0;
+		m->cc = 0;
 	else
-		cc = 1;
+		m->cc = 1;
 }
 
 /**
  * @name 	Compare NZP
+ * @param [lc3_machine_t*] m The machine whose CC is checked
  * @param [char] nzp An NZP condition from a branch instruction
  * @retval 1	condition code met specified NZP condition
  * @retval 0	condition code did not meet specified NZP condition
  */
-char comparenzp(char nzp)
+char comparenzp(lc3_machine_t* m, char nzp)
 {
 	if (nzp == 7)									// nzp (always true)
 		return 1;
-	else if (nzp == 6 && cc <= 0) // nz
+	else if (nzp == 6 && m->cc <= 0) // nz
 		return 1;
-	else if (nzp == 5 && cc != 0)	// np
+	else if (nzp == 5 && m->cc != 0)	// np
 		return 1;
-	else if (nzp == 4 && cc < 0)	// n
+	else if (nzp == 4 && m->cc < 0)	// n
 		return 1;
-	else if (nzp == 3 && cc >= 0)	// zp
+	else if (nzp == 3 && m->cc >= 0)	// zp
 		return 1;
-	else if (nzp == 2 && cc == 0)	// z
+	else if (nzp == 2 && m->cc == 0)	// z
 		return 1;
-	else if (nzp == 1 && cc > 0)	// p
+	else if (nzp == 1 && m->cc > 0)	// p
 		return 1;
 	return 0;
 }
@@ -76,13 +156,14 @@ short signext(short value, char bits)
 /**
  * @name 	Fetch Instruction
  * @brief Fetches the next instruction to be executed
+ * @param [lc3_machine_t*] m The machine to fetch from
  * @retval The next instruction
  */
-short fetch_instruction()
+short fetch_instruction(lc3_machine_t* m)
 {
-	ir = mem[pc];
-	pc++;
-	return ir;
+	m->ir = m->mem[m->pc];
+	m->pc++;
+	return m->ir;
 }
 
 /**
@@ -107,255 +188,558 @@ void decode_instruction(lc3inst_t* instruction, short raw_inst)
 	instruction->imm5_flag = (raw_inst & IMMF_MASK) >> IMMF_SHFT;
 }
 
+// Loads and stores of execute_instruction(); below DEVICE_BASE they only cost a compare on top of the access
+static inline int load(lc3_machine_t* m, unsigned short address, unsigned short* value)
+{
+	if (address >= DEVICE_BASE)
+		return device_read(m, address, value);
+	*value = m->mem[address];
+	return 0;
+}
+
+static inline void store(lc3_machine_t* m, unsigned short address, unsigned short value)
+{
+	if (address >= DEVICE_BASE)
+	{
+		device_write(m, address, value);
+		return;
+	}
+	m->mem[address] = value;
+	invalidate_code(m, address);
+	mark_dirty(m, address);
+}
+
 /** name	Execute Instruction
  * @brief Executes an Lc-3 instruction
+ * @param [lc3_machine_t*] m	The machine to run it on
  * @param [lc3inst_t*] instruction	A pointer to the instruction to be executed
+ * @retval 0	the instruction was executed
+ * @retval 1	the instruction is a GETC/IN, or a read of KBSR, waiting for input and did nothing; it should be retried
+ * later
  */
-void execute_instruction(lc3inst_t* instruction)
+int execute_instruction(lc3_machine_t* m, lc3inst_t* instruction)
 {
 	short old_pc;
-	short old_reg0;
+	unsigned short address;
+	unsigned short value;
+	unsigned short inst_address = m->pc-1;
+	if (m->recording)
+		record_instruction(m, instruction);
 	switch (instruction->opcode) {
 	// Branch
 	case BR:
-		if (comparenzp(instruction->nzpbits))
-			pc += instruction->pcoffset9;
+		if (comparenzp(m, instruction->nzpbits))
+			m->pc += instruction->pcoffset9;
 		break;
 	// Add
 	case ADD:
 		if (instruction->imm5_flag)
-			regfile[instruction->destreg] = regfile[instruction->src1reg] + instruction->imm5;
+			m->regfile[instruction->destreg] = m->regfile[instruction->src1reg] + instruction->imm5;
 		else
-			regfile[instruction->destreg] = regfile[instruction->src1reg] + regfile[instruction->src2reg];
-		setcc(regfile[instruction->destreg]);
+			m->regfile[instruction->destreg] = m->regfile[instruction->src1reg] + m->regfile[instruction->src2reg];
+		setcc(m, m->regfile[instruction->destreg]);
 		break;
 	// Load
 	case LD:
-		regfile[instruction->destreg] = mem[pc+instruction->pcoffset9];
-		setcc(regfile[instruction->destreg]);
+		address = m->pc+instruction->pcoffset9;
+		watch(m, address, WATCH_READ);
+		if (load(m, address, &value))
+			return 1;
+		m->regfile[instruction->destreg] = value;
+		setcc(m, m->regfile[instruction->destreg]);
 		break;
 	// Store
 	case ST:
-		mem[pc+instruction->pcoffset9] = regfile[instruction->destreg];
+		address = m->pc+instruction->pcoffset9;
+		watch(m, address, WATCH_WRITE);
+		store(m, address, m->regfile[instruction->destreg]);
 		break;
 	// Jump to Subroutine
 	case JSR:
-		old_pc = pc;
+		old_pc = m->pc;
 		if (instruction->jsrr_flag)
-			pc = regfile[instruction->src1reg];
+			m->pc = m->regfile[instruction->src1reg];
 		else
-			pc = pc+instruction->pcoffset11;
-		regfile[7] = old_pc;
+			m->pc = m->pc+instruction->pcoffset11;
+		m->regfile[7] = old_pc;
 		break;
 	// And
 	case AND:
 		if (instruction->imm5_flag)
-			regfile[instruction->destreg] = regfile[instruction->src1reg] & instruction->imm5;
+			m->regfile[instruction->destreg] = m->regfile[instruction->src1reg] & instruction->imm5;
 		else
-			regfile[instruction->destreg] = regfile[instruction->src1reg] & regfile[instruction->src2reg];
-		setcc(regfile[instruction->destreg]);
+			m->regfile[instruction->destreg] = m->regfile[instruction->src1reg] & m->regfile[instruction->src2reg];
+		setcc(m, m->regfile[instruction->destreg]);
 		break;
 	// Load Register
 	case LDR:
-		regfile[instruction->destreg] = mem[regfile[instruction->src1reg] + instruction->offset6];
-		setcc(regfile[instruction->destreg]);
+		address = m->regfile[instruction->src1reg] + instruction->offset6;
+		watch(m, address, WATCH_READ);
+		if (load(m, address, &value))
+			return 1;
+		m->regfile[instruction->destreg] = value;
+		setcc(m, m->regfile[instruction->destreg]);
 		break;
 	// Store Register
 	case STR:
-		mem[regfile[instruction->src1reg] + instruction->offset6] = regfile[instruction->destreg];
+		address = m->regfile[instruction->src1reg] + instruction->offset6;
+		watch(m, address, WATCH_WRITE);
+		store(m, address, m->regfile[instruction->destreg]);
 		break;
 	// Return from Interrupt
 	case RTI:
+		return_from_interrupt(m);
 		break;
 	// Not
 	case NOT:
-		regfile[instruction->destreg] = ~regfile[instruction->src1reg];
-		setcc(regfile[instruction->destreg]);
+		m->regfile[instruction->destreg] = ~m->regfile[instruction->src1reg];
+		setcc(m, m->regfile[instruction->destreg]);
 		break;
 	// Load Indirect
 	case LDI:
-		regfile[instruction->destreg] = mem[mem[pc+instruction->pcoffset9]];
-		setcc(regfile[instruction->destreg]);
+		address = m->pc+instruction->pcoffset9;
+		watch(m, address, WATCH_READ);
+		if (load(m, address, &address))
+			return 1;
+		watch(m, address, WATCH_READ);
+		if (load(m, address, &value))
+			return 1;
+		m->regfile[instruction->destreg] = value;
+		setcc(m, m->regfile[instruction->destreg]);
 		break;
 	// Store Indirect
 	case STI:
-		mem[mem[pc+instruction->pcoffset9]] = regfile[instruction->destreg];
+		address = m->pc+instruction->pcoffset9;
+		watch(m, address, WATCH_READ);
+		if (load(m, address, &address))
+			return 1;
+		watch(m, address, WATCH_WRITE);
+		store(m, address, m->regfile[instruction->destreg]);
 		break;
 	// Jump
 	case JMP:
-		old_pc = pc;
-		pc = regfile[instruction->src1reg];
-		regfile[7] = old_pc;
+		old_pc = m->pc;
+		m->pc = m->regfile[instruction->src1reg];
+		m->regfile[7] = old_pc;
 		break;
 	// Load Effective Address
 	case LEA:
-		regfile[instruction->destreg] = pc + instruction->pcoffset9;
-		setcc(regfile[instruction->destreg]);
+		m->regfile[instruction->destreg] = m->pc + instruction->pcoffset9;
+		setcc(m, m->regfile[instruction->destreg]);
 		break;
 	// Trap
 	case TRAP:
-		switch (instruction->trapvect) {
-		// GETC
-		case 0x20:
-			wait_for_key(0);
-			break;
-		// OUT
-		case 0x21:
-			send_to_console((char)regfile[0]);
-			break;
-		// PUTS
-		case 0x22:
-			old_reg0 = regfile[0];
-			while (mem[regfile[0]])
-			{
-				send_to_console((char)mem[regfile[0]]);
-				regfile[0]++;
-			}
-			regfile[0] = old_reg0;
-			break;
-		// IN
-		case 0x23:
-			wait_for_key(1);
-			break;
-		// HALT
-		case 0x25:
-			halted = 1;
-			running = 0;
-			break;
-		// UDIV
-		case 0x80:
-			if (enable_udiv)
-			{
-				if (!regfile[1])
-					break;
-				unsigned short temp = regfile[0]/regfile[1];
-				regfile[1] = regfile[0]%regfile[1];
-				regfile[0] = temp;
-			}
-			break;
-		// Generic trap
-		default:
-			old_pc = pc;
-			pc = mem[instruction->trapvect];
-			regfile[7] = old_pc;
-			break;
-		}
+		if (execute_trap(m, instruction->trapvect))
+			return 1;
 		break;
 	}
-	executions++;
+	m->executions++;
+	if (m->profile)
+		profile_instruction(m, inst_address, instruction);
+#ifdef LC3_STATS
+	if (m->stats)
+		stats_instruction(m, instruction);
+#endif
+	if (m->coverage)
+		cover_instruction(m, inst_address, instruction);
+	return 0;
+}
+
+/**
+ * @name 	Interpret
+ * @brief Runs the instruction at an address through execute_instruction(), for the faster engines to hand over
+ * instructions they leave to it
+ * @param [lc3_machine_t*] m The machine to step; its registers, CC and executions must be up to date
+ * @param [unsigned short] address The address of the instruction
+ * @retval The address of the next instruction; the same address if it halted or is waiting for input
+ */
+unsigned short interpret(lc3_machine_t* m, unsigned short address)
+{
+	lc3inst_t inst;
+	m->pc = address+1;
+	m->ir = m->mem[address];
+	decode_instruction(&inst, m->ir);
+	if (execute_instruction(m, &inst))
+	{
+		m->running = 0;
+		return address;
+	}
+	return m->halted ? address : m->pc;
+}
+
+/**
+ * @name 	Execute Trap
+ * @brief Runs the service routine for a TRAP instruction: the native one if the vector has one (see lc3trap.c),
+ * otherwise a jump to the guest's at mem[trapvect]
+ * @param [lc3_machine_t*] m	The machine to run it on
+ * @param [short] trapvect The trap vector from the instruction
+ * @retval 0	the trap was executed
+ * @retval 1	the trap is waiting for input and did nothing
+ *
+ * Shared by the reference switch in execute_instruction() and the faster engines.
+ */
+int execute_trap(lc3_machine_t* m, short trapvect)
+{
+	const lc3_trap_t* trap = &m->traps[trapvect & TRAP_MASK];
+	unsigned short old_pc;
+
+	if (trap->routine)
+		return trap->routine(m);
+	old_pc = m->pc;
+	m->pc = m->mem[trapvect & TRAP_MASK];
+	m->regfile[7] = old_pc;
+	return 0;
 }
 
 /**
- * @name 	Send to Console
- * @brief Sends a character to the console to be printed
- * @param [const char] c The character to be sent to the console
+ * @name 	Write Each Char
+ * @brief Default write_string: prints a string through write_char, a character at a time
+ * @param [lc3_machine_t*] m The machine printing
+ * @param [const char*] text The characters
+ * @param [int] length How many
  */
-void send_to_console(const char c)
+void write_each_char(lc3_machine_t* m, const char* text, int length)
 {
-	static int cindex = 0;
-	console[cindex] = c;
-	cindex++;
-	if (cns_length < cns_max)		// Update the length of the text in the console, if it isn't at max capacity
-		cns_length++;
-	if (cindex-1 >= cns_length)	// Make sure the console index isn't greater than the console size
-		cindex %= cns_length;
+	int i;
+	for (i=0; i<length; i++)
+		m->write_char(m, text[i]);
 }
 
 /**
  * @name 	Read Program
  * @brief Reads an assembled LC-3 program from a file
+ * @param [lc3_machine_t*] m The machine to load it into
  * @param [FILE*] program Pointer to the assembled LC-3 program as an opened FILE
+ * @retval 0 on success, -EINVAL if the file isn't a well-formed object file (the machine is left alone)
  */
-void read_program(FILE* program)
+int read_program(lc3_machine_t* m, FILE* program)
 {
-	unsigned short a = 1;	// beautiful variable names
-	unsigned short address;
-	unsigned char num = 0;
-	unsigned short b;	// exquisite
+	lc3_image_t* image;
 
-	rewind(program); // Be kind, rewind!
+	if (!(image = load_image(program)))
+		return -EINVAL;
+	use_image(m, image);
+	release_image(image);
+	return 0;
+}
 
-	// This loop reads the format of the object file into two 
-	while(a != 0xffff)
-	{
-		a = ((fgetc(program) << 8) | fgetc(program));
-		if (!num) // The first number is actually an address, not an instruction.
-		{
-			address = a;	// Set the address
-			a = ((fgetc(program) << 8) | fgetc(program));	// The second number is how many instructions are next
-			num = a;	// Set the number of following instructions
-			b = address + num;	// How to derive the addresses of the other things in the else block
-		} else {
-			mem[b-num] = a;	// Derives the address of the instruction
-			num--;	// One fewer instruction to process before the next block (or the end)
-		}
-	}
+/**
+ * @name 	Use Image
+ * @brief Loads a program that has already been read into an image, sharing its memory with other machines
+ * @param [lc3_machine_t*] m The machine to load it into
+ * @param [lc3_image_t*] image The image; the machine takes its own reference
+ *
+ * Replaces all of the machine's memory, so anything the previous program left behind is gone, and puts the PC
+ * at the image's entry point.
+ */
+void use_image(lc3_machine_t* m, lc3_image_t* image)
+{
+	hold_image(image);
+	release_image(m->image);
+	m->image = image;
+	map_image(image, m->mem);
 
-	// Set up some console stuff
-	cns_index = 0;
-	cns_length = 0;
+	// Anything decoded from the previous image is stale now
+	invalidate_all_code(m);
+	memset(m->dirty, 0, sizeof(m->dirty));
+	reset_devices(m);
+	m->pc = image->entry;
+
+	if (m->console)
+		clear_console(m->console);
 
 	// Prefetch and decode the first instruction so the PC and IR values accurately reflect the current state of the machine
-	next = fetch_instruction();
-	decode_instruction(&next_inst, next);
+	fetch_instruction(m);
+	decode_instruction(&m->next_inst, m->ir);
+	clear_profile(m);
+	clear_recording(m);
+#ifdef LC3_STATS
+	clear_stats(m);
+#endif
+	clear_coverage(m);
 }
 
-void reset_program(FILE* program)
+/**
+ * @name 	Reset Program
+ * @brief Puts a machine back the way read_program() left it, without rereading the program
+ * @param [lc3_machine_t*] m The machine to reset
+ *
+ * Only pages marked dirty since the program was read are compared against the saved image, and only words that
+ * actually changed are restored and dropped from the engine caches, so code that was never overwritten stays
+ * compiled. Memory written outside the program's segments is cleared along with everything else, and the device
+ * registers are back in their power-on state.
+ * Breakpoint hit counts, the profile, the recorded history, the statistics and the coverage, if any, start over.
+ */
+void reset_program(lc3_machine_t* m)
 {
-	pc = 0x3000;
-	running = 1;
-	halted = 0;
-	executions = 0;
-	read_program(program);
-	
+	const unsigned short* image;
+	unsigned int page;
+	unsigned int address;
+	unsigned int low = 65536;
+	unsigned int high = 0;
 	int i;
+
+	if (!m->image)
+		return;
+
+	image = m->image->mem;
+	for (page=0; page<DIRTY_PAGES; page++)
+	{
+		if (!m->dirty[page])
+			continue;
+		m->dirty[page] = 0;
+		for (address = page << DIRTY_SHIFT; address < (page+1) << DIRTY_SHIFT; address++)
+			if (m->mem[address] != image[address])
+			{
+				m->mem[address] = image[address];
+				invalidate_code(m, address);
+			}
+		if (low > page << DIRTY_SHIFT)
+			low = page << DIRTY_SHIFT;
+		high = (page+1) << DIRTY_SHIFT;
+	}
+	// Memory matches the image again, so the copies of the pages written can go back to sharing it
+	if (high)
+		discard_private_pages(m->mem, low, high - low);
+	reset_devices(m);
+
 	for(i=0; i<8; i++)
-		regfile[i] = 0;
+		m->regfile[i] = 0;
+	m->cc = 0;
+	m->pc = m->image->entry;
+	m->running = 1;
+	m->halted = 0;
+	m->executions = 0;
+	if (m->console)
+		clear_console(m->console);
+	m->watch_hit = 0;
+	for (i=0; i<m->nbreakpoints; i++)
+		m->breakpoints[i].hits = 0;
 
-	cc = 0;
+	fetch_instruction(m);
+	decode_instruction(&m->next_inst, m->ir);
+	clear_profile(m);
+	clear_recording(m);
+#ifdef LC3_STATS
+	clear_stats(m);
+#endif
+	clear_coverage(m);
 }
 
-void run_program()
+/**
+ * @name 	Run Engine
+ * @brief Runs until HALT or a breakpoint using the selected execution engine
+ * @param [lc3_machine_t*] m The machine to run
+ * @param [unsigned long long] limit Instruction count to stop at
+ *
+ * Watchpoints and the recorder are only served by execute_instruction(), so while either is in use the switch
+ * engine is used. Coverage, the profile and statistics are kept by the block engine as well, which takes over from
+ * the predecode and JIT engines while any of them is on.
+ */
+static void run_engine(lc3_machine_t* m, unsigned long long limit)
 {
-	running = 1;
-	while (running && !halted)
+	unsigned short address;
+	engine_t engine = m->engine;
+
+	if (m->nwatchpoints || m->recording)
+		engine = ENGINE_SWITCH;
+	else if ((m->coverage || m->profile || stats_on(m)) && engine != ENGINE_SWITCH)
+		engine = ENGINE_BLOCK;
+	switch (engine) {
+	case ENGINE_PREDECODE:
+		run_predecoded(m);
+		return;
+	case ENGINE_BLOCK:
+		run_blocks(m);
+		return;
+	case ENGINE_JIT:
+		run_jit(m);
+		return;
+	default:
+		break;
+	}
+
+	address = m->pc-1;
+	if (breakpoint_at(m, address) == 2)
 	{
-		if (brk[pc-1] == 1)
+		step_forward(m);
+		set_breakpoint_state(m, address, 1);
+	}
+	while (m->running && !m->halted && m->executions < limit)
+	{
+		address = m->pc-1;
+		if (breakpoint_at(m, address))
 		{
-			running = 0;
-			brk[pc-1] = 2;
+			m->running = 0;
+			set_breakpoint_state(m, address, 2);
 			break;
 		}
-		step_forward();
-		if (brk[pc-1] == 2)
-			brk[pc-1] = 1;
+		step_forward(m);
 	}
 }
 
-void step_forward()
+/**
+ * @name 	Serve Events
+ * @brief Runs the events an engine stopped for
+ * @param [lc3_machine_t*] m The machine
+ * @retval 1	the run should go on
+ * @retval 0	it stopped for something else, or nothing is due
+ *
+ * The switch engine runs events as soon as they are due, before looking at the next breakpoint, so an interrupt
+ * taken in front of a breakpoint the run stopped on sets it back to 1 and carries on; it is stopped on again once
+ * the service routine returns to it.
+ */
+static int serve_events(lc3_machine_t* m)
 {
-	if (halted)
+	unsigned short address = m->pc-1;
+	unsigned char state;
+
+	if (m->halted || m->watch_hit || m->executions < m->next_event)
+		return 0;
+	state = breakpoint_at(m, address);
+	run_events(m);
+	if (m->pc-1 == address)
+		return state != 2;
+	if (state == 2)
+		set_breakpoint_state(m, address, 1);
+	return 1;
+}
+
+// run_program() itself, which times it while statistics are on
+static void run(lc3_machine_t* m)
+{
+	unsigned long long limit = m->execution_limit ? m->execution_limit : ~0ULL;
+
+	m->watch_hit = 0;
+	do {
+		if (m->executions >= limit)
+		{
+			m->running = 0;
+			return;
+		}
+		m->running = 1;
+		run_engine(m, limit);
+	} while (pass_breakpoint(m) || serve_events(m));
+}
+
+/**
+ * @name 	Run Program
+ * @brief Runs until HALT, a breakpoint or a watchpoint
+ * @param [lc3_machine_t*] m The machine to run
+ *
+ * A breakpoint that stopped the previous run is marked 2 so the instruction under it can be stepped past once.
+ * A conditional breakpoint whose condition is false, or whose hit count hasn't come up, is stepped past right
+ * away (see pass_breakpoint()). A watchpoint stops the run after the instruction that touched it, with watch_hit
+ * and watch_address set.
+ * If execution_limit is set, also stops (with running cleared but not halted) when executions reaches it, on
+ * every engine: the block-based ones step through a block that would take them past it.
+ * Scheduled events stop the engines the same way, and are run before carrying on (see lc3event.c).
+ */
+void run_program(lc3_machine_t* m)
+{
+#ifdef LC3_STATS
+	if (m->stats)
+	{
+		stats_run_started(m);
+		run(m);
+		stats_run_stopped(m);
+		return;
+	}
+#endif
+	run(m);
+}
+
+/**
+ * @name 	Step Forward
+ * @brief Executes the next instruction, then whatever events that made due
+ * @param [lc3_machine_t*] m The machine
+ */
+void step_forward(lc3_machine_t* m)
+{
+	if (m->halted)
 		return;
 	
-	execute_instruction(&next_inst);
-	if (halted) return;
-	next = fetch_instruction();
-	decode_instruction(&next_inst, next);
+	if (execute_instruction(m, &m->next_inst))
+	{
+		// Waiting for input; leave the instruction as the next one to run
+		m->running = 0;
+		return;
+	}
+	if (m->halted) return;
+	fetch_instruction(m);
+	decode_instruction(&m->next_inst, m->ir);
+	if (m->executions >= m->next_event)
+		run_events(m);
+}
+
+void set_breakpoint(lc3_machine_t* m, unsigned short address)
+{
+	unsigned char* state = find_breakpoint(m, address);
 
+	if (state)
+		*state = 1;
+	else
+	{
+		if (!(m->breakpoints = realloc(m->breakpoints, (m->nbreakpoints+1)*sizeof(lc3_breakpoint_t))))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+		m->breakpoints[m->nbreakpoints].address = address;
+		m->breakpoints[m->nbreakpoints].state = 1;
+		memset(&m->breakpoints[m->nbreakpoints].condition, 0, sizeof(lc3_condition_t));
+		m->breakpoints[m->nbreakpoints].hits = 0;
+		m->breakpoints[m->nbreakpoints].ignore = 0;
+		m->nbreakpoints++;
+		m->brk_filter |= 1ULL << (address & 63);
+	}
+	// Breakpoints are only checked at block entry, so no block may run over one
+	if (m->blocks && m->blocks->coverage[address])
+		flush_blocks(m, address);
+	if (m->jit && m->jit->coverage[address])
+		jit_flush(m, address);
 }
 
-void set_breakpoint(unsigned short address)
+void unset_breakpoint(lc3_machine_t* m, unsigned short address)
 {
-	brk[address] = 1;
+	int i;
+
+	for (i=0; i<m->nbreakpoints; i++)
+		if (m->breakpoints[i].address == address)
+		{
+			m->breakpoints[i] = m->breakpoints[--m->nbreakpoints];
+			break;
+		}
+	m->brk_filter = 0;
+	for (i=0; i<m->nbreakpoints; i++)
+		m->brk_filter |= 1ULL << (m->breakpoints[i].address & 63);
 }
 
-void unset_breakpoint(unsigned short address)
+/**
+ * @name 	Format Target
+ * @brief Writes the operand of a PC-relative instruction: the label it refers to, or the raw offset
+ * @param [const lc3_symtab_t*] symbols Labels to use (may be NULL)
+ * @param [unsigned short] address Address of the instruction
+ * @param [short] offset Its PC offset
+ * @param [char*] buffer Where to write the operand, DISASM_TARGET_MAX bytes
+ */
+static void format_target(const lc3_symtab_t* symbols, unsigned short address, short offset, char* buffer)
 {
-	brk[address] = 0;
+	if (!format_address(symbols, address+1+offset, buffer, DISASM_TARGET_MAX))
+		sprintf(buffer, "#%d", offset);
 }
 
-void disassemble_to_str(short instruction, char* buffer)
+/**
+ * @name 	Disassemble to String
+ * @brief Writes an instruction in assembly syntax, with PC-relative operands shown as labels where there are any
+ * @param [const lc3_symtab_t*] symbols Labels to use (may be NULL)
+ * @param [unsigned short] address Address of the instruction
+ * @param [short] instruction The instruction
+ * @param [char*] buffer Where to write it, DISASM_MAX bytes
+ */
+void disassemble_to_str(const lc3_symtab_t* symbols, unsigned short address, short instruction, char* buffer)
 {
+	char target[DISASM_TARGET_MAX];
 	lc3inst_t inst;
 	decode_instruction(&inst, instruction);
 	char* nzpstrings[8] = { "", "p", "z", "zp", "n", "np", "nz", "nzp" };
@@ -365,7 +749,10 @@ void disassemble_to_str(short instruction, char* buffer)
 		if (!inst.nzpbits)
 			sprintf(buffer, "NOP");
 		else
-			sprintf(buffer, "BR%s #%d", nzpstrings[inst.nzpbits], inst.pcoffset9);
+		{
+			format_target(symbols, address, inst.pcoffset9, target);
+			sprintf(buffer, "BR%s %s", nzpstrings[inst.nzpbits], target);
+		}
 		break;
 	case ADD:
 		if (inst.imm5_flag)
@@ -374,13 +761,21 @@ void disassemble_to_str(short instruction, char* buffer)
 			sprintf(buffer, "ADD R%d, R%d, R%d", inst.destreg, inst.src1reg, inst.src2reg);
 		break;
 	case LD:
-		sprintf(buffer, "LD R%d, #%d", inst.destreg, inst.pcoffset9);
+		format_target(symbols, address, inst.pcoffset9, target);
+		sprintf(buffer, "LD R%d, %s", inst.destreg, target);
 		break;
 	case ST:
-		sprintf(buffer, "ST R%d, #%d", inst.destreg, inst.pcoffset9);
+		format_target(symbols, address, inst.pcoffset9, target);
+		sprintf(buffer, "ST R%d, %s", inst.destreg, target);
 		break;
 	case JSR:
-		sprintf(buffer, "JSR #%d", inst.pcoffset11);
+		if (inst.jsrr_flag)
+			sprintf(buffer, "JSRR R%d", inst.src1reg);
+		else
+		{
+			format_target(symbols, address, inst.pcoffset11, target);
+			sprintf(buffer, "JSR %s", target);
+		}
 		break;
 	case AND:
 		if (inst.imm5_flag)
@@ -395,21 +790,25 @@ void disassemble_to_str(short instruction, char* buffer)
 		sprintf(buffer, "STR R%d, R%d, #%d", inst.destreg, inst.src1reg, inst.offset6);
 		break;
 	case RTI:
+		sprintf(buffer, "RTI");
 		break;
 	case NOT:
 		sprintf(buffer, "NOT R%d, R%d", inst.destreg, inst.src1reg);
 		break;
 	case LDI:
-		sprintf(buffer, "LDI R%d, #%d", inst.destreg, inst.pcoffset9);
+		format_target(symbols, address, inst.pcoffset9, target);
+		sprintf(buffer, "LDI R%d, %s", inst.destreg, target);
 		break;
 	case STI:
-		sprintf(buffer, "STI R%d, #%d", inst.destreg, inst.pcoffset9);
+		format_target(symbols, address, inst.pcoffset9, target);
+		sprintf(buffer, "STI R%d, %s", inst.destreg, target);
 		break;
 	case JMP:
 		sprintf(buffer, "JMP R%d", inst.src1reg);
 		break;
 	case LEA:
-		sprintf(buffer, "LEA R%d, #%d", inst.destreg, inst.pcoffset9);
+		format_target(symbols, address, inst.pcoffset9, target);
+		sprintf(buffer, "LEA R%d, %s", inst.destreg, target);
 		break;
 	case TRAP:
 		sprintf(buffer, "TRAP x%.2hx", inst.trapvect);
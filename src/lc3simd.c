@@ -0,0 +1,462 @@
+/**
+ * @file		lc3simd.c
+ * @brief		SIMD lockstep execution of one program over many machines
+ *
+ * Runs up to SIMD_LANES machines loaded with the same program one instruction at a time, all lanes at once.
+ * Registers, PCs and condition codes are kept in a structure-of-arrays layout, one vector per register, so
+ * ADD/AND/NOT/LEA and branch resolution are single vector operations; loads gather from each lane's own memory.
+ * Stores and traps are done lane by lane, on each lane's machine. A lane about to touch a device register leaves
+ * lockstep in front of that instruction.
+ *
+ * Every step runs the instruction at the lowest PC among the live lanes, with the other lanes masked off, so
+ * lanes split by a branch reconverge where the paths join. A lane that stays masked off for SIMD_DIVERGE_LIMIT
+ * steps in a row, or whose copy of the next instruction differs from the others' (self-modifying code), leaves
+ * lockstep and is finished by the ordinary engines.
+ *
+ * The vectors are GCC vector extensions, built for AVX2 and plain SSE2 with the right one picked at load time.
+ * Other compilers get no lockstep: every lane is handed straight back to the scalar engines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3block.h"
+#include "../include/lc3simd.h"
+
+/**
+ * @name 	Init Lockstep
+ * @brief Sets up a lockstep group over machines that have just loaded the same program
+ * @param [lc3_lockstep_t*] group The group to fill
+ * @param [lc3_machine_t**] lanes The machines, at most SIMD_LANES
+ * @param [int] count Number of machines
+ *
+ * A machine whose memory differs from the first one's, or that has a breakpoint set, runs alone.
+ */
+void init_lockstep(lc3_lockstep_t* group, lc3_machine_t** lanes, int count)
+{
+	int l;
+
+	group->count = count;
+	group->code = calloc(65536, sizeof(lc3pre_t));
+	group->written = calloc(65536, 1);
+	if (!group->code || !group->written)
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+
+	for (l=0; l<count; l++)
+	{
+		group->lanes[l] = lanes[l];
+		group->stepping[l] = !lanes[l]->halted
+			&& lanes[l]->pc == lanes[0]->pc
+			&& !memcmp(lanes[l]->mem, lanes[0]->mem, IMAGE_BYTES)
+			&& !lanes[l]->nbreakpoints && !lanes[l]->nwatchpoints && !lanes[l]->profile
+			&& !lanes[l]->recording;
+	}
+}
+
+/**
+ * @name 	Free Lockstep
+ * @brief Frees a group's shared tables; the machines are left alone
+ * @param [lc3_lockstep_t*] group The group
+ */
+void free_lockstep(lc3_lockstep_t* group)
+{
+	free(group->code);
+	free(group->written);
+	group->code = NULL;
+	group->written = NULL;
+}
+
+#ifdef __GNUC__
+
+typedef unsigned short lanes_t __attribute__((vector_size(2*SIMD_LANES)));
+typedef short slanes_t __attribute__((vector_size(2*SIMD_LANES)));
+
+// Lanes of a where mask is set, lanes of b elsewhere
+#define BLEND(mask, a, b)	(((mask) & (a)) | (~(mask) & (b)))
+
+#define CCVAL(v) ((short)(v) < 0 ? -1 : ((v) != 0))
+
+#if defined(__x86_64__) && defined(__linux__)
+#define SIMD_CLONES	__attribute__((target_clones("avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+/**
+ * @name 	Converged
+ * @brief Checks whether every live lane is at the same PC
+ * @param [lanes_t*] pcv The PC vector
+ * @param [lanes_t*] live The live lane mask
+ * @param [unsigned int] livebits The live lanes as a bit mask
+ */
+static inline int converged_at(const lanes_t* pcv, const lanes_t* live, unsigned int livebits)
+{
+	union {
+		lanes_t v;
+		unsigned long long q[sizeof(lanes_t)/8];
+	} diff;
+	unsigned long long any = 0;
+	int i;
+
+	if (!livebits)
+		return 1;
+	diff.v = (*pcv ^ ((lanes_t){0} + (*pcv)[__builtin_ctz(livebits)])) & *live;
+	for (i=0; i<sizeof(lanes_t)/8; i++)
+		any |= diff.q[i];
+	return !any;
+}
+
+/**
+ * @name 	Sync Lane
+ * @brief Copies a lane's registers back to its machine, stopped in front of the instruction at pc
+ * @param [lc3_machine_t*] m The lane's machine
+ * @param [lanes_t*] r The register vectors
+ * @param [int] l The lane
+ * @param [unsigned short] pc Address of the lane's next instruction
+ * @param [short] result The lane's last register write, for the condition code
+ * @param [unsigned long long] executions The lane's instruction count
+ */
+static void sync_lane(lc3_machine_t* m, lanes_t* r, int l, unsigned short pc, short result,
+	unsigned long long executions)
+{
+	int i;
+	for (i=0; i<8; i++)
+		m->regfile[i] = r[i][l];
+	m->cc = CCVAL(result);
+	m->executions = executions;
+	m->pc = pc+1;
+	m->ir = m->mem[pc];
+	decode_instruction(&m->next_inst, m->ir);
+}
+
+/**
+ * @name 	Run Lockstep
+ * @brief Runs a group's stepping lanes in lockstep until they have all left it or one reaches its execution_limit
+ * @param [lc3_lockstep_t*] group The group to run
+ * @retval The number of lanes still stepping; their machines are up to date and can be run again later
+ *
+ * Lanes that leave lockstep are left exactly as the same number of step_forward() calls would leave them, so
+ * run_program() carries on where lockstep stopped.
+ */
+SIMD_CLONES
+int run_lockstep(lc3_lockstep_t* group)
+{
+	lc3_machine_t** lanes = group->lanes;
+	lanes_t r[8];
+	lanes_t pcv = {0};
+	lanes_t result = {0};
+	lanes_t live = {0};
+	lanes_t exec;
+	lanes_t v = {0};
+	lanes_t taken;
+	slanes_t neg, zero;
+	unsigned long long base[SIMD_LANES];
+	unsigned long long skipped[SIMD_LANES];
+	unsigned short idle[SIMD_LANES];
+	unsigned long long steps = 0;
+	unsigned long long budget = ~0ULL;
+	unsigned long long limit;
+	unsigned int livebits = 0;
+	unsigned int execbits;
+	unsigned int bits;
+	unsigned short leader;
+	unsigned short target;
+	unsigned short word;
+	int converged;
+	int control;
+	int first;
+	int i, l;
+	lc3pre_t op;
+	lc3pre_t* entry;
+	lc3_machine_t* m;
+
+	memset(r, 0, sizeof(r));
+	for (l=0; l<group->count; l++)
+	{
+		if (!group->stepping[l])
+			continue;
+		m = lanes[l];
+		// Scheduled events are run by run_program(), so a machine with any runs on its own
+		if (m->nevents)
+		{
+			group->stepping[l] = 0;
+			continue;
+		}
+		for (i=0; i<8; i++)
+			r[i][l] = m->regfile[i];
+		pcv[l] = m->pc-1;
+		result[l] = m->cc;
+		live[l] = 0xFFFF;
+		livebits |= 1u << l;
+		base[l] = m->executions;
+		skipped[l] = 0;
+		limit = m->execution_limit ? m->execution_limit : ~0ULL;
+		if (limit - m->executions < budget)
+			budget = m->executions < limit ? limit - m->executions : 0;
+		m->running = 1;
+	}
+
+// Take lane l out of lockstep, stopped in front of the instruction at pc
+#define LEAVE(l, pc) \
+	do { \
+		sync_lane(lanes[l], r, l, pc, result[l], base[l] + steps - skipped[l]); \
+		group->stepping[l] = 0; \
+		live[l] = 0; \
+		livebits &= ~(1u << (l)); \
+		execbits &= ~(1u << (l)); \
+	} while (0)
+
+// Take lane l out of lockstep in front of this instruction if it touches a device register at address
+#define LEAVE_AT_DEVICE(l, address) \
+	if ((address) >= DEVICE_BASE) \
+	{ \
+		LEAVE(l, leader); \
+		exec[l] = 0; \
+		continue; \
+	}
+
+	// The lanes may have been split when the last call stopped
+	converged = converged_at(&pcv, &live, livebits);
+
+	memset(idle, 0, sizeof(idle));
+	while ((livebits & (livebits-1)) && steps < budget)
+	{
+		first = __builtin_ctz(livebits);
+		if (converged)
+		{
+			leader = pcv[first];
+			exec = live;
+			execbits = livebits;
+		}
+		else
+		{
+			// Run the lowest PC; the other paths wait for it to catch up
+			leader = pcv[first];
+			for (bits=livebits; bits; bits &= bits-1)
+				if (pcv[__builtin_ctz(bits)] < leader)
+					leader = pcv[__builtin_ctz(bits)];
+			exec = live & (lanes_t)(pcv == leader);
+			execbits = 0;
+			for (bits=livebits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				if (pcv[l] == leader)
+				{
+					execbits |= 1u << l;
+					idle[l] = 0;
+				}
+				else
+				{
+					if (++idle[l] > SIMD_DIVERGE_LIMIT)
+						LEAVE(l, pcv[l]);
+					else
+						skipped[l]++;
+				}
+			}
+			exec &= live;
+			first = __builtin_ctz(execbits);
+		}
+
+		// Fetch once for every lane, unless some lane has written over this address
+		if (group->written[leader])
+		{
+			word = lanes[first]->mem[leader];
+			for (bits=execbits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				if (lanes[l]->mem[leader] != word)
+				{
+					LEAVE(l, leader);
+					exec[l] = 0;
+				}
+			}
+			predecode(&op, leader, word);
+			entry = &op;
+		}
+		else
+		{
+			entry = &group->code[leader];
+			if (entry->handler == H_DECODE)
+				predecode(entry, leader, lanes[first]->mem[leader]);
+		}
+
+		control = 0;
+		switch (entry->handler) {
+		case H_ADDR:
+			v = r[entry->b] + r[entry->c];
+			goto write;
+		case H_ADDI:
+			v = r[entry->b] + entry->imm;
+			goto write;
+		case H_ANDR:
+			v = r[entry->b] & r[entry->c];
+			goto write;
+		case H_ANDI:
+			v = r[entry->b] & entry->imm;
+			goto write;
+		case H_NOT:
+			v = ~r[entry->b];
+			goto write;
+		case H_LEA:
+			v = (lanes_t){0} + entry->imm;
+			goto write;
+		case H_LD:
+			for (bits=execbits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				LEAVE_AT_DEVICE(l, entry->imm);
+				v[l] = lanes[l]->mem[entry->imm];
+			}
+			goto write;
+		case H_LDR:
+			for (bits=execbits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				target = r[entry->b][l] + entry->imm;
+				LEAVE_AT_DEVICE(l, target);
+				v[l] = lanes[l]->mem[target];
+			}
+			goto write;
+		case H_LDI:
+			for (bits=execbits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				target = lanes[l]->mem[entry->imm];
+				LEAVE_AT_DEVICE(l, entry->imm);
+				LEAVE_AT_DEVICE(l, target);
+				v[l] = lanes[l]->mem[target];
+			}
+		write:
+			r[entry->a] = BLEND(exec, v, r[entry->a]);
+			result = BLEND(exec, v, result);
+			pcv = BLEND(exec, pcv+1, pcv);
+			break;
+		case H_ST:
+		case H_STR:
+		case H_STI:
+			for (bits=execbits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				m = lanes[l];
+				if (entry->handler == H_ST)
+					target = entry->imm;
+				else if (entry->handler == H_STR)
+					target = r[entry->b][l] + entry->imm;
+				else
+				{
+					LEAVE_AT_DEVICE(l, entry->imm);
+					target = m->mem[entry->imm];
+				}
+				LEAVE_AT_DEVICE(l, target);
+				m->mem[target] = r[entry->a][l];
+				invalidate_code(m, target);
+				mark_dirty(m, target);
+				group->written[target] = 1;
+			}
+			pcv = BLEND(exec, pcv+1, pcv);
+			break;
+		case H_BR:
+			// NZP bits of each lane's condition code, tested against the branch's
+			neg = (slanes_t)result < 0;
+			zero = (slanes_t)result == 0;
+			v = (lanes_t)((neg & 4) | (zero & 2) | (~neg & ~zero & 1));
+			taken = (lanes_t)((v & entry->a) != 0);
+			pcv = BLEND(exec, BLEND(taken, (lanes_t){0} + entry->imm, pcv+1), pcv);
+			control = 1;
+			break;
+		case H_BRA:
+			pcv = BLEND(exec, (lanes_t){0} + entry->imm, pcv);
+			break;
+		case H_JSR:
+			r[7] = BLEND(exec, pcv+1, r[7]);
+			pcv = BLEND(exec, (lanes_t){0} + entry->imm, pcv);
+			break;
+		case H_JSRR:
+		case H_JMP:
+			v = r[entry->b];
+			r[7] = BLEND(exec, pcv+1, r[7]);
+			pcv = BLEND(exec, v, pcv);
+			control = 1;
+			break;
+		case H_TRAP:
+			// Service routines work on each lane's machine in turn
+			for (bits=execbits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				m = lanes[l];
+				sync_lane(m, r, l, leader, result[l], base[l] + steps - skipped[l]);
+				if (execute_trap(m, entry->imm))
+				{
+					// Waiting for input; this lane carries on alone once it has some
+					m->running = 0;
+					LEAVE(l, leader);
+					continue;
+				}
+				if (m->halted)
+				{
+					m->executions++;
+					group->stepping[l] = 0;
+					live[l] = 0;
+					livebits &= ~(1u << l);
+					continue;
+				}
+				for (i=0; i<8; i++)
+					r[i][l] = m->regfile[i];
+				result[l] = m->cc;
+				pcv[l] = m->pc;
+			}
+			control = 1;
+			break;
+		case H_RTI:
+			// Left to execute_instruction(), out of lockstep
+			for (bits=execbits; bits; bits &= bits-1)
+			{
+				l = __builtin_ctz(bits);
+				LEAVE(l, leader);
+			}
+			control = 1;
+			break;
+		default:	// NOP
+			pcv = BLEND(exec, pcv+1, pcv);
+			break;
+		}
+		steps++;
+
+		if (control || !converged)
+		{
+			i = converged;
+			converged = converged_at(&pcv, &live, livebits);
+			if (converged && !i)
+				memset(idle, 0, sizeof(idle));
+		}
+	}
+
+	// Hand back every lane; they stay in the group only if they stopped on the budget together
+	i = steps >= budget && __builtin_popcount(livebits) > 1 ? __builtin_popcount(livebits) : 0;
+	for (bits=livebits; bits; bits &= bits-1)
+	{
+		l = __builtin_ctz(bits);
+		sync_lane(lanes[l], r, l, pcv[l], result[l], base[l] + steps - skipped[l]);
+		if (i)
+			lanes[l]->running = 0;
+		else
+			group->stepping[l] = 0;
+	}
+	return i;
+}
+
+#else
+
+// No vector extensions with this compiler; every lane runs on the scalar engines
+int run_lockstep(lc3_lockstep_t* group)
+{
+	memset(group->stepping, 0, sizeof(group->stepping));
+	return 0;
+}
+
+#endif
@@ -0,0 +1,239 @@
+/**
+ * @file		lc3stats.c
+ * @brief		Run statistics
+ *
+ * Counts what a machine does: instructions by opcode, branches taken and not taken, loads and stores, TRAPs by
+ * vector and characters printed, along with the wall time spent running and the MIPS that makes. They are
+ * written as text or as one JSON object, at exit and whenever the process gets STATS_SIGNAL.
+ *
+ * Statistics are compiled in with LC3_STATS (make STATS=0 leaves them out, and every hook with them). Compiled in,
+ * a machine only pays for them while they are on. Like the profiler, they are kept by execute_instruction() and by
+ * the block engine, which adds a block's instructions by opcode each time it leaves it and takes over from the
+ * predecode and JIT engines while they are on; those two don't test for them at all.
+ *
+ * A pool writes the total over its jobs followed by each job's instructions, run time and MIPS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3stats.h"
+
+#ifdef LC3_STATS
+
+static const char* opcode_names[] = { "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR", "RTI", "NOT", "LDI",
+	"STI", "JMP", "RESERVED", "LEA", "TRAP" };
+
+// Set by the signal handler; a signal goes to the whole process, so this is the one thing kept outside a machine
+static volatile sig_atomic_t signalled;
+
+/**
+ * @name 	Start Stats
+ * @brief Starts counting; runs that would use the predecode or JIT engine use the block engine from now on
+ * @param [lc3_machine_t*] m The machine
+ */
+void start_stats(lc3_machine_t* m)
+{
+	if (m->stats)
+		return;
+	if (!(m->stats = malloc(sizeof(lc3_stats_t))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	clear_stats(m);
+}
+
+void stop_stats(lc3_machine_t* m)
+{
+	free(m->stats);
+	m->stats = NULL;
+}
+
+void clear_stats(lc3_machine_t* m)
+{
+	if (m->stats)
+		memset(m->stats, 0, sizeof(lc3_stats_t));
+}
+
+/**
+ * @name 	Add Stats
+ * @brief Adds one machine's statistics into a running total, e.g. over the jobs of a pool
+ * @param [lc3_stats_t*] total The total
+ * @param [const lc3_stats_t*] stats What to add
+ */
+void add_stats(lc3_stats_t* total, const lc3_stats_t* stats)
+{
+	int i;
+
+	for (i=0; i<16; i++)
+		total->opcodes[i] += stats->opcodes[i];
+	total->taken += stats->taken;
+	total->not_taken += stats->not_taken;
+	for (i=0; i<TRAP_VECTORS; i++)
+		total->traps[i] += stats->traps[i];
+	total->output += stats->output;
+	total->seconds += stats->seconds;
+}
+
+// Instructions counted, of every opcode
+unsigned long long stats_instructions(const lc3_stats_t* stats)
+{
+	unsigned long long instructions = 0;
+	int i;
+
+	for (i=0; i<16; i++)
+		instructions += stats->opcodes[i];
+	return instructions;
+}
+
+void stats_run_started(lc3_machine_t* m)
+{
+	clock_gettime(CLOCK_MONOTONIC, &m->stats->started);
+}
+
+void stats_run_stopped(lc3_machine_t* m)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	m->stats->seconds += (now.tv_sec - m->stats->started.tv_sec) + (now.tv_nsec - m->stats->started.tv_nsec) / 1e9;
+}
+
+/**
+ * @name 	Write Stats
+ * @brief Writes statistics as text, or as a single line of JSON
+ * @param [const lc3_stats_t*] stats The statistics
+ * @param [const lc3_stats_run_t*] runs The runs they add up, each given its own line; NULL for a single run
+ * @param [int] nruns Number of runs
+ * @param [FILE*] out Where to write them
+ * @param [int] json 1 for JSON
+ *
+ * Loads and stores count memory accesses: LDI reads memory twice, and STI reads the pointer it stores through.
+ */
+void write_stats(const lc3_stats_t* stats, const lc3_stats_run_t* runs, int nruns, FILE* out, int json)
+{
+	unsigned long long instructions = stats_instructions(stats);
+	unsigned long long loads;
+	unsigned long long stores;
+	double mips;
+	int first = 1;
+	int i;
+
+	loads = stats->opcodes[LD] + stats->opcodes[LDR] + 2*stats->opcodes[LDI] + stats->opcodes[STI];
+	stores = stats->opcodes[ST] + stats->opcodes[STR] + stats->opcodes[STI];
+	mips = stats->seconds > 0 ? instructions / stats->seconds / 1e6 : 0;
+
+	if (json)
+	{
+		fprintf(out, "{\"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.2f, \"opcodes\": {", instructions,
+			stats->seconds, mips);
+		for (i=0; i<16; i++)
+			fprintf(out, "%s\"%s\": %llu", i ? ", " : "", opcode_names[i], stats->opcodes[i]);
+		fprintf(out, "}, \"branches\": {\"taken\": %llu, \"not_taken\": %llu}, \"loads\": %llu, \"stores\": %llu, "
+			"\"traps\": {", stats->taken, stats->not_taken, loads, stores);
+		for (i=0; i<TRAP_VECTORS; i++)
+			if (stats->traps[i])
+			{
+				fprintf(out, "%s\"x%.2X\": %llu", first ? "" : ", ", i, stats->traps[i]);
+				first = 0;
+			}
+		fprintf(out, "}, \"output_bytes\": %llu", stats->output);
+		if (runs)
+		{
+			fprintf(out, ", \"runs\": [");
+			for (i=0; i<nruns; i++)
+			{
+				mips = runs[i].seconds > 0 ? runs[i].instructions / runs[i].seconds / 1e6 : 0;
+				fprintf(out, "%s{\"program\": \"%s\", \"input\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f, "
+					"\"mips\": %.2f}", i ? ", " : "", runs[i].program, runs[i].input, runs[i].instructions,
+					runs[i].seconds, mips);
+			}
+			fprintf(out, "]");
+		}
+		fprintf(out, "}\n");
+	}
+	else
+	{
+		fprintf(out, "instructions %llu in %.3fs, %.2f MIPS\n", instructions, stats->seconds, mips);
+		for (i=0; i<16; i++)
+			if (stats->opcodes[i])
+				fprintf(out, "  %-8s %14llu %6.2f%%\n", opcode_names[i], stats->opcodes[i],
+					100.0 * stats->opcodes[i] / instructions);
+		fprintf(out, "branches %llu taken, %llu not taken\n", stats->taken, stats->not_taken);
+		fprintf(out, "loads %llu, stores %llu\n", loads, stores);
+		for (i=0; i<TRAP_VECTORS; i++)
+			if (stats->traps[i])
+				fprintf(out, "trap x%.2X %llu\n", i, stats->traps[i]);
+		fprintf(out, "output %llu bytes\n", stats->output);
+		for (i=0; i<nruns; i++)
+		{
+			mips = runs[i].seconds > 0 ? runs[i].instructions / runs[i].seconds / 1e6 : 0;
+			fprintf(out, "run %s %s: %llu instructions in %.3fs, %.2f MIPS\n", runs[i].program, runs[i].input,
+				runs[i].instructions, runs[i].seconds, mips);
+		}
+	}
+}
+
+/**
+ * @name 	Save Stats
+ * @brief Writes statistics to a file, replacing what it held, or to stderr
+ * @param [const lc3_stats_t*] stats The statistics
+ * @param [const lc3_stats_run_t*] runs The runs they add up, as for write_stats()
+ * @param [int] nruns Number of runs
+ * @param [const char*] path The file, or "-" for stderr
+ * @param [int] json 1 for JSON
+ * @retval 0 on success, -EIO if the file couldn't be written
+ */
+int save_stats(const lc3_stats_t* stats, const lc3_stats_run_t* runs, int nruns, const char* path, int json)
+{
+	FILE* out;
+
+	if (!strcmp(path, "-"))
+	{
+		write_stats(stats, runs, nruns, stderr, json);
+		return 0;
+	}
+	if (!(out = fopen(path, "w")))
+		return -EIO;
+	write_stats(stats, runs, nruns, out, json);
+	return fclose(out) ? -EIO : 0;
+}
+
+static void stats_signal_handler(int signal)
+{
+	signalled = 1;
+}
+
+/**
+ * @name 	Catch Stats Signal
+ * @brief Has STATS_SIGNAL ask for the statistics instead of ending the process
+ *
+ * The handler only notes the signal; whoever runs the machine checks stats_signalled() between slices of the run
+ * and writes the statistics from there.
+ */
+void catch_stats_signal()
+{
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stats_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(STATS_SIGNAL, &action, NULL);
+}
+
+// Whether STATS_SIGNAL has come since the last call
+int stats_signalled()
+{
+	if (!signalled)
+		return 0;
+	signalled = 0;
+	return 1;
+}
+
+#endif
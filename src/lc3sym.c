@@ -0,0 +1,305 @@
+/**
+ * @file		lc3sym.c
+ * @brief		Symbol tables
+ *
+ * Reads the labels an assembler wrote next to a program, or takes them from ours (lc3asm.c), and answers "what is
+ * at this address", "what label precedes this address" and "where is this label". Symbol files are read in one go
+ * and parsed in place; both the "3003 LOOP" lines of our own assembler and the "//	LOOP  3003" lines of lc3as are
+ * understood, and anything else (headers, comments) is skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/lc3sym.h"
+
+static unsigned int hash_name(const char* name)
+{
+	unsigned int hash = 2166136261u;	// FNV-1a
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	return hash;
+}
+
+static int compare_symbols(const void* a, const void* b)
+{
+	return ((const lc3_symbol_t*)a)->address - ((const lc3_symbol_t*)b)->address;
+}
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * @name 	Parse Hex Address
+ * @brief Parses 1 to 4 hex digits, optionally after an x
+ * @param [const char*] text The token
+ * @param [unsigned short*] address Set to the value
+ * @retval 1 if the whole token is an address, 0 if not
+ */
+static int parse_hex_address(const char* text, unsigned short* address)
+{
+	unsigned int value = 0;
+	int digits = 0;
+
+	if (*text == 'x' || *text == 'X')
+		text++;
+	for (; *text; text++, digits++)
+	{
+		if (*text >= '0' && *text <= '9')
+			value = value*16 + *text - '0';
+		else if ((*text | 0x20) >= 'a' && (*text | 0x20) <= 'f')
+			value = value*16 + (*text | 0x20) - 'a' + 10;
+		else
+			return 0;
+	}
+	*address = value;
+	return digits >= 1 && digits <= 4;
+}
+
+/**
+ * @name 	Add Symbol
+ * @brief Appends a symbol, copying its name into the arena; index_symbols() must be called once all are added
+ * @param [lc3_symtab_t*] table The table
+ * @param [unsigned short] address Its address
+ * @param [const char*] name Its name, which needn't be terminated
+ * @param [int] length Length of the name
+ */
+void add_symbol(lc3_symtab_t* table, unsigned short address, const char* name, int length)
+{
+	if (table->count == table->capacity)
+	{
+		table->capacity = table->capacity ? 2*table->capacity : 256;
+		if (!(table->symbols = realloc(table->symbols, table->capacity*sizeof(lc3_symbol_t))))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+	}
+	if (table->arena_used + length + 1 > table->arena_size)
+	{
+		while (table->arena_used + length + 1 > table->arena_size)
+			table->arena_size = table->arena_size ? 2*table->arena_size : 4096;
+		if (!(table->arena = realloc(table->arena, table->arena_size)))
+		{
+			printf("Malloc returned NULL! That's no good!\n");
+			exit(-ENOMEM);
+		}
+	}
+	memcpy(table->arena + table->arena_used, name, length);
+	table->arena[table->arena_used + length] = '\0';
+	table->symbols[table->count].address = address;
+	table->symbols[table->count].name = table->arena_used;
+	table->arena_used += length + 1;
+	table->count++;
+}
+
+/**
+ * @name 	Index Symbols
+ * @brief Sorts the symbols by address and rehashes them by name
+ * @param [lc3_symtab_t*] table The table
+ */
+void index_symbols(lc3_symtab_t* table)
+{
+	unsigned int slots = 16;
+	unsigned int slot;
+	int i;
+
+	qsort(table->symbols, table->count, sizeof(lc3_symbol_t), compare_symbols);
+
+	while (slots < 2*(unsigned int)table->count)
+		slots *= 2;
+	free(table->index);
+	if (!(table->index = calloc(slots, sizeof(int))))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	table->index_mask = slots - 1;
+	for (i=0; i<table->count; i++)
+	{
+		slot = hash_name(table->arena + table->symbols[i].name) & table->index_mask;
+		while (table->index[slot])
+			slot = (slot + 1) & table->index_mask;
+		table->index[slot] = i + 1;
+	}
+}
+
+/**
+ * @name 	Load Symbols
+ * @brief Adds the labels in a symbol file to a table
+ * @param [lc3_symtab_t*] table The table
+ * @param [const char*] filename The symbol file
+ * @retval 0 on success, -ENOENT if the file couldn't be opened
+ */
+int load_symbols(lc3_symtab_t* table, const char* filename)
+{
+	FILE* file;
+	char* text;
+	char* line;
+	char* next;
+	char* first;
+	char* second;
+	long size;
+	int lc3as;
+	unsigned short address;
+
+	if (!(file = fopen(filename, "r")))
+		return -ENOENT;
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+	if (!(text = malloc(size + 1)))
+	{
+		printf("Malloc returned NULL! That's no good!\n");
+		exit(-ENOMEM);
+	}
+	size = fread(text, 1, size, file);
+	text[size] = '\0';
+	fclose(file);
+
+	for (line = text; line && *line; line = next)
+	{
+		if ((next = strchr(line, '\n')))
+			*next++ = '\0';
+
+		// Two whitespace-separated tokens; lc3as puts its table in // comments, name first
+		while (is_space(*line))
+			line++;
+		if ((lc3as = line[0] == '/' && line[1] == '/'))
+			line += 2;
+		while (is_space(*line))
+			line++;
+		first = line;
+		while (*line && !is_space(*line))
+			line++;
+		if (*line)
+			*line++ = '\0';
+		while (is_space(*line))
+			line++;
+		second = line;
+		while (*line && !is_space(*line))
+			line++;
+		*line = '\0';
+		if (!*first || !*second)
+			continue;
+
+		if (lc3as && parse_hex_address(second, &address))
+			add_symbol(table, address, first, strlen(first));
+		else if (!lc3as && parse_hex_address(first, &address))
+			add_symbol(table, address, second, strlen(second));
+	}
+	free(text);
+
+	index_symbols(table);
+	return 0;
+}
+
+void free_symbols(lc3_symtab_t* table)
+{
+	free(table->symbols);
+	free(table->arena);
+	free(table->index);
+	memset(table, 0, sizeof(lc3_symtab_t));
+}
+
+/**
+ * @name 	Symbol Before
+ * @brief Finds the closest symbol at or before an address
+ * @param [const lc3_symtab_t*] table The table (may be NULL)
+ * @param [unsigned short] address The address
+ * @param [unsigned short*] offset Set to how far past the symbol the address is
+ * @retval The symbol's name, or NULL if no symbol comes at or before the address
+ */
+const char* symbol_before(const lc3_symtab_t* table, unsigned short address, unsigned short* offset)
+{
+	int low = 0;
+	int high;
+	int mid;
+
+	if (!table || !table->count)
+		return NULL;
+	high = table->count - 1;
+	// Find the last symbol whose address is <= address
+	while (low < high)
+	{
+		mid = (low + high + 1) / 2;
+		if (table->symbols[mid].address <= address)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	if (table->symbols[low].address > address)
+		return NULL;
+	*offset = address - table->symbols[low].address;
+	return table->arena + table->symbols[low].name;
+}
+
+/**
+ * @name 	Symbol At
+ * @brief Looks up the symbol at an address
+ * @param [const lc3_symtab_t*] table The table (may be NULL)
+ * @param [unsigned short] address The address
+ * @retval The symbol's name, or NULL if there is none there
+ */
+const char* symbol_at(const lc3_symtab_t* table, unsigned short address)
+{
+	unsigned short offset;
+	const char* name = symbol_before(table, address, &offset);
+	return name && !offset ? name : NULL;
+}
+
+/**
+ * @name 	Symbol Address
+ * @brief Looks up a label by name
+ * @param [const lc3_symtab_t*] table The table (may be NULL)
+ * @param [const char*] name The label
+ * @param [unsigned short*] address Set to its address
+ * @retval 0 if found, -ENOENT if not
+ */
+int symbol_address(const lc3_symtab_t* table, const char* name, unsigned short* address)
+{
+	unsigned int slot;
+	const lc3_symbol_t* symbol;
+
+	if (!table || !table->index)
+		return -ENOENT;
+	for (slot = hash_name(name) & table->index_mask; table->index[slot]; slot = (slot + 1) & table->index_mask)
+	{
+		symbol = &table->symbols[table->index[slot] - 1];
+		if (!strcmp(table->arena + symbol->name, name))
+		{
+			*address = symbol->address;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+/**
+ * @name 	Format Address
+ * @brief Writes an address as LABEL or LABEL+offset, from the closest symbol at or before it
+ * @param [const lc3_symtab_t*] table The table (may be NULL)
+ * @param [unsigned short] address The address
+ * @param [char*] buffer Where to write it
+ * @param [int] size Size of the buffer
+ * @retval 1 if there was a symbol to use, 0 if not (buffer is then empty)
+ */
+int format_address(const lc3_symtab_t* table, unsigned short address, char* buffer, int size)
+{
+	unsigned short offset;
+	const char* name = symbol_before(table, address, &offset);
+
+	if (!name)
+	{
+		*buffer = '\0';
+		return 0;
+	}
+	if (offset)
+		snprintf(buffer, size, "%s+%d", name, offset);
+	else
+		snprintf(buffer, size, "%s", name);
+	return 1;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file		lc3trap.c
+ * @brief		Trap table and the native service routines
+ *
+ * Each machine has a table of the 256 TRAP vectors. A vector with a native routine runs it on the host in place of
+ * a service routine, all within the one TRAP instruction; any other vector jumps to the guest's routine at
+ * mem[vector], as on the LC-3. A new machine has the console traps (GETC, OUT, PUTS, IN, PUTSP, HALT) and UDIV
+ * native, so programs run without an OS image. Loading an OS that brings its own routines is a matter of giving
+ * those vectors back to it with unregister_trap() (--trap=x22:os).
+ *
+ * Beyond those, routines for multiplying, taking a remainder and copying memory can be put on any vector a program
+ * would otherwise spend a loop on. A routine tells the recorder what it changes (see lc3sim.h); one that changes
+ * memory or registers other than R0 and R1 puts up a barrier the recorder rewinds past through a snapshot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/lc3sim.h"
+#include "../include/lc3device.h"
+#include "../include/lc3trap.h"
+#include "../include/lc3stats.h"
+
+static const lc3_native_trap_t natives[] = {
+	{ "getc", { trap_getc, TRAP_WRITES_R0 | TRAP_READS_KEY } },
+	{ "out", { trap_out, 0 } },
+	{ "puts", { trap_puts, 0 } },
+	{ "in", { trap_in, TRAP_WRITES_R0 | TRAP_READS_KEY } },
+	{ "putsp", { trap_putsp, 0 } },
+	{ "halt", { trap_halt, 0 } },
+	{ "udiv", { trap_udiv, TRAP_WRITES_R0 | TRAP_WRITES_R1 } },
+	{ "mul", { trap_mul, TRAP_WRITES_R0 } },
+	{ "mod", { trap_mod, TRAP_WRITES_R0 } },
+	{ "memcpy", { trap_memcpy, TRAP_WRITES_OTHER } },
+	{ "os", { NULL, 0 } }
+};
+
+#define NUM_NATIVES ((int)(sizeof(natives)/sizeof(natives[0])))
+
+/**
+ * @name 	Default Traps
+ * @brief Gives a machine the native console traps and UDIV, and leaves every other vector to the guest
+ * @param [lc3_machine_t*] m The machine
+ */
+void default_traps(lc3_machine_t* m)
+{
+	memset(m->traps, 0, sizeof(m->traps));
+	m->traps[TRAP_GETC] = natives[0].trap;
+	m->traps[TRAP_OUT] = natives[1].trap;
+	m->traps[TRAP_PUTS] = natives[2].trap;
+	m->traps[TRAP_IN] = natives[3].trap;
+	m->traps[TRAP_PUTSP] = natives[4].trap;
+	m->traps[TRAP_HALT] = natives[5].trap;
+	m->traps[TRAP_UDIV] = natives[6].trap;
+}
+
+/**
+ * @name 	Register Trap
+ * @brief Has a TRAP vector run a native routine
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned char] vector The vector
+ * @param [int (*)(lc3_machine_t*)] routine The routine: returns 1 if it must wait for input (having changed
+ * nothing, so it can run again), 0 once done. It runs with the PC already past the TRAP.
+ * @param [int] effects TRAP_WRITES_R0 and so on, for whatever the routine may change besides console output
+ */
+void register_trap(lc3_machine_t* m, unsigned char vector, int (*routine)(lc3_machine_t* m), int effects)
+{
+	m->traps[vector].routine = routine;
+	m->traps[vector].effects = effects;
+}
+
+/**
+ * @name 	Unregister Trap
+ * @brief Gives a TRAP vector back to the guest's service routine at mem[vector]
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned char] vector The vector
+ */
+void unregister_trap(lc3_machine_t* m, unsigned char vector)
+{
+	register_trap(m, vector, NULL, 0);
+}
+
+/**
+ * @name 	Parse Trap Setting
+ * @brief Reads a VECTOR:ROUTINE setting such as x81:mul, or x22:os to leave PUTS to the guest
+ * @param [const char*] text The setting
+ * @param [lc3_trap_setting_t*] setting Filled in from it
+ * @retval 0 on success, -EINVAL if the vector or routine is unknown
+ */
+int parse_trap_setting(const char* text, lc3_trap_setting_t* setting)
+{
+	const char* colon = strchr(text, ':');
+	char* end;
+	long vector;
+	int i;
+
+	vector = strtol(text + (text[0] == 'x' || text[0] == 'X'), &end, 16);
+	if (!colon || end != colon || end == text || vector < 0 || vector >= TRAP_VECTORS)
+		return -EINVAL;
+	for (i=0; i<NUM_NATIVES; i++)
+		if (!strcmp(colon+1, natives[i].name))
+		{
+			setting->vector = vector;
+			setting->trap = natives[i].trap;
+			return 0;
+		}
+	return -EINVAL;
+}
+
+/**
+ * @name 	Apply Trap Settings
+ * @brief Registers each setting's routine on its vector, in order, so a later setting for a vector wins
+ * @param [lc3_machine_t*] m The machine
+ * @param [const lc3_trap_setting_t*] settings The settings, from parse_trap_setting()
+ * @param [int] count How many there are
+ */
+void apply_trap_settings(lc3_machine_t* m, const lc3_trap_setting_t* settings, int count)
+{
+	int i;
+	for (i=0; i<count; i++)
+		register_trap(m, settings[i].vector, settings[i].trap.routine, settings[i].trap.effects);
+}
+
+int trap_getc(lc3_machine_t* m)
+{
+	return !m->read_key(m, 0);
+}
+
+int trap_out(lc3_machine_t* m)
+{
+	m->write_char(m, (char)m->regfile[0]);
+	stats_output(m, 1);
+	return 0;
+}
+
+/**
+ * @name 	Write Words
+ * @brief Prints a zero-terminated string out of memory, handing it to write_string in chunks
+ * @param [lc3_machine_t*] m The machine
+ * @param [unsigned short] address Where the string starts
+ * @param [int] packed Two characters a word, low byte first, as PUTSP has them; otherwise one, as PUTS has
+ */
+static void write_words(lc3_machine_t* m, unsigned short address, int packed)
+{
+	const unsigned short* mem = m->mem;
+	char chunk[TRAP_CHUNK];
+	unsigned short word;
+	int n = 0;
+
+	while ((word = mem[address++]))
+	{
+		chunk[n++] = (char)word;
+		if (packed)
+		{
+			// An odd-length string ends with a zero high byte
+			if (!(word >> 8))
+				break;
+			chunk[n++] = (char)(word >> 8);
+		}
+		if (n >= TRAP_CHUNK - 1)
+		{
+			m->write_string(m, chunk, n);
+			stats_output(m, n);
+			n = 0;
+		}
+	}
+	if (n)
+	{
+		m->write_string(m, chunk, n);
+		stats_output(m, n);
+	}
+}
+
+int trap_puts(lc3_machine_t* m)
+{
+	write_words(m, m->regfile[0], 0);
+	return 0;
+}
+
+int trap_in(lc3_machine_t* m)
+{
+	return !m->read_key(m, 1);
+}
+
+int trap_putsp(lc3_machine_t* m)
+{
+	write_words(m, m->regfile[0], 1);
+	return 0;
+}
+
+int trap_halt(lc3_machine_t* m)
+{
+	m->halted = 1;
+	m->running = 0;
+	return 0;
+}
+
+// R0 / R1 into R0 and R0 % R1 into R1, unsigned; nothing for a zero divisor
+int trap_udiv(lc3_machine_t* m)
+{
+	unsigned short quotient;
+
+	if (!m->regfile[1])
+		return 0;
+	quotient = m->regfile[0] / m->regfile[1];
+	m->regfile[1] = m->regfile[0] % m->regfile[1];
+	m->regfile[0] = quotient;
+	return 0;
+}
+
+// R0 * R1 into R0, the low 16 bits, which are the same signed or unsigned
+int trap_mul(lc3_machine_t* m)
+{
+	m->regfile[0] = (unsigned short)(m->regfile[0] * m->regfile[1]);
+	return 0;
+}
+
+// R0 % R1 into R0, signed, taking the sign of R0 as in C; nothing for a zero divisor
+int trap_mod(lc3_machine_t* m)
+{
+	short divisor = m->regfile[1];
+
+	if (divisor)
+		m->regfile[0] = divisor == -1 ? 0 : (short)m->regfile[0] % divisor;
+	return 0;
+}
+
+/**
+ * @name 	Trap Memcpy
+ * @brief Copies R2 words from R1 on to R0 on, a word at a time upwards, as the loop it replaces would
+ * @param [lc3_machine_t*] m The machine
+ * @retval 0
+ *
+ * Words landing on the device registers are written as a store would write them.
+ */
+int trap_memcpy(lc3_machine_t* m)
+{
+	unsigned short to = m->regfile[0];
+	unsigned short from = m->regfile[1];
+	unsigned short count = m->regfile[2];
+
+	for (; count; count--, to++, from++)
+	{
+		if (to >= DEVICE_BASE)
+			device_write(m, to, m->mem[from]);
+		else if (m->mem[to] != m->mem[from])
+			write_word(m, to, m->mem[from]);
+	}
+	return 0;
+}